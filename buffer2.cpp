@@ -3,14 +3,15 @@
 #include <array>
 
 #include "buffer2.hpp"
+#include "dispatch.hpp"
 #include "commandbuffer.hpp"
 
 namespace buffer2
 {
 
 uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    // queried once, see memory::getMemoryProperties
+    const VkPhysicalDeviceMemoryProperties& memProperties = memory::getMemoryProperties(physicalDevice);
 
     /**
      * The VkPhysicalDeviceMemoryProperties structure has two arrays 
@@ -47,14 +48,24 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Vk
     throw std::runtime_error("failed to find suitable memory type!");
 }
 
-void bindBuffer(
-    VkPhysicalDevice physicalDevice,
+VkBufferUsageFlags getUsage(Type bufferType) {
+    switch (bufferType) {
+        case Type::Vertex:
+            return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        case Type::Index:
+            return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        case Type::Indirect:
+            return VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        default:
+            return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+}
+
+static void createBufferHandle(
     VkDevice logicalDevice,
     VkDeviceSize size,
     VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties,
-    VkBuffer& buffer,
-    VkDeviceMemory& bufferMemory
+    VkBuffer& buffer
 ) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -71,26 +82,93 @@ void bindBuffer(
     if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to create vertex buffer!");
     }
+}
+
+void bindBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    memory::Usage memoryUsage,
+    VkBuffer& buffer,
+    VkDeviceMemory& bufferMemory
+) {
+    createBufferHandle(logicalDevice, size, usage, buffer);
 
     // buffer has been created but no memory is assigned to it yet
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
     
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
+    // the memory type is picked from the intent, the heaps and their budget
+    memory::allocateMemory(physicalDevice, logicalDevice, memRequirements, memoryUsage, bufferMemory);
+
+    // memory allocation successful, so bind it to the buffer
+    vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+}
+
+bool bindDeviceBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    bool allowDirectUpload,
+    VkBuffer& buffer,
+    VkDeviceMemory& bufferMemory
+) {
+    // TRANSFER_DST in any case: the memory type is only known once the requirements are
+    createBufferHandle(logicalDevice, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer);
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
+
+    bool direct = allowDirectUpload
+        && memory::tryAllocateMemory(physicalDevice, logicalDevice, memRequirements, memory::DirectUpload, bufferMemory);
+    if (!direct) {
+        memory::allocateMemory(physicalDevice, logicalDevice, memRequirements, memory::GpuOnly, bufferMemory);
+    }
+
+    vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+    return direct;
+}
+
+void reserveStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkDeviceSize size,
+    StagingBuffer& stagingBuffer
+) {
+    PROFILE_SCOPE("buffer2::reserveStagingBuffer");
+    if (stagingBuffer.size >= size) {
+        return;
+    }
+
+    destroyStagingBuffer(logicalDevice, stagingBuffer);
+
+    bindBuffer(
         physicalDevice,
-        memRequirements.memoryTypeBits, 
-        properties
+        logicalDevice,
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        memory::Upload,
+        stagingBuffer.buffer,
+        stagingBuffer.memory
     );
 
-    if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate vertex buffer memory!");
+    // "persistent mapping", like the uniform buffers
+    // the whole allocation, so that the flushes can be aligned to nonCoherentAtomSize
+    vkMapMemory(logicalDevice, stagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &stagingBuffer.mapped);
+    stagingBuffer.size = size;
+}
+
+void destroyStagingBuffer(VkDevice logicalDevice, StagingBuffer& stagingBuffer) {
+    if (stagingBuffer.buffer == VK_NULL_HANDLE) {
+        return;
     }
 
-    // memory allocation successful, so bind it to the buffer
-    vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+    vkUnmapMemory(logicalDevice, stagingBuffer.memory);
+    vkDestroyBuffer(logicalDevice, stagingBuffer.buffer, nullptr);
+    memory::freeMemory(logicalDevice, stagingBuffer.memory);
+    stagingBuffer = StagingBuffer{};
 }
 
 void copyBuffer(
@@ -101,6 +179,8 @@ void copyBuffer(
     VkBuffer dstBuffer,
     VkDeviceSize size
 ) {
+    PROFILE_SCOPE("buffer2::copyBuffer");
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
     VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(
       logicalDevice,
       commandPool  
@@ -112,7 +192,7 @@ void copyBuffer(
     copyRegion.srcOffset = 0; // Optional
     copyRegion.dstOffset = 0; // Optional
     copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    table.vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
     commandbuffer::endAndExecuteSingleTimeCommands(
         logicalDevice,
@@ -130,6 +210,7 @@ void createUniformBuffers(
     std::vector<VkDeviceMemory>& uniformBuffersMemory,
     std::vector<void*>& uniformBuffersMapped
 ) {
+    PROFILE_SCOPE("buffer2::createUniformBuffers");
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
     uniformBuffers.resize(maxFramesInFlight);
@@ -142,14 +223,16 @@ void createUniformBuffers(
             logicalDevice,
             bufferSize,
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            // written every frame, read in place by the GPU
+            memory::Dynamic,
             uniformBuffers[i],
             uniformBuffersMemory[i]);
 
         // The buffer stays mapped the whole application time
         // as mapping has a cost, it is best to avoid doing it every time
         // this is called "persistent mapping"
-        vkMapMemory(logicalDevice, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+        // The memory may not be coherent, the writes are flushed every frame (mapped::FlushBatcher)
+        vkMapMemory(logicalDevice, uniformBuffersMemory[i], 0, VK_WHOLE_SIZE, 0, &uniformBuffersMapped[i]);
     }
 }
 
@@ -1,21 +1,35 @@
 #pragma once
 
 #include <vector>
+#include <cstring>
 
 // Let GLFW include by itslef vulkan headers
 #define GLFW_INCLUDE_VULKAN
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
 
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "profiler.hpp"
+
 namespace buffer2
 {
 
 enum Type {
     Vertex,
-    Index
+    Index,
+    /** VkDrawIndexedIndirectCommand... read by vkCmdDrawIndexedIndirect */
+    Indirect,
+    Storage
 };
 
-/** returns the memoryType index */
+/** the VkBufferUsageFlags of a Type, TRANSFER_DST aside */
+VkBufferUsageFlags getUsage(Type bufferType);
+
+/**
+ * returns the first memoryType index with all the properties
+ * see memory::findMemoryType to pick one from the usage instead
+ */
 uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 /**
@@ -38,11 +52,50 @@ void bindBuffer(
     VkDevice logicalDevice,
     VkDeviceSize size,
     VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties,
+    memory::Usage memoryUsage,
+    VkBuffer& buffer,
+    VkDeviceMemory& bufferMemory
+);
+
+/**
+ * A buffer for data the GPU reads (vertices, indices), TRANSFER_DST is added to usage.
+ * With allowDirectUpload, DEVICE_LOCAL | HOST_VISIBLE memory is used if the device has some
+ * with enough budget left (UMA, lavapipe, resizable BAR): the memory can then be mapped and written
+ * in place. Returns true in that case, false if the buffer is only reachable through a staging copy
+ */
+bool bindDeviceBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    bool allowDirectUpload,
     VkBuffer& buffer,
     VkDeviceMemory& bufferMemory
 );
 
+/**
+ * A staging buffer kept mapped for its whole life and reused by the uploads,
+ * instead of create/map/unmap/destroy for each of them. It only grows.
+ * Reusing it is safe as long as the previous copy has completed,
+ * which endAndExecuteSingleTimeCommands guarantees for now
+ */
+struct StagingBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+    VkDeviceSize size = 0;
+};
+
+/** make sure stagingBuffer holds at least size bytes, the previous content is lost if it grows */
+void reserveStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkDeviceSize size,
+    StagingBuffer& stagingBuffer
+);
+
+void destroyStagingBuffer(VkDevice logicalDevice, StagingBuffer& stagingBuffer);
+
 void copyBuffer(
     VkDevice logicalDevice,
     VkCommandPool commandPool,
@@ -53,7 +106,7 @@ void copyBuffer(
 );
 
 template <class T>
-void createBuffer(
+bool createBuffer(
     Type bufferType,
     VkPhysicalDevice physicalDevice,
     VkDevice logicalDevice,
@@ -61,10 +114,36 @@ void createBuffer(
     VkQueue graphicsQueue,
     const std::vector<T>& itemList,
     VkBuffer& buffer,
-    VkDeviceMemory& bufferMemory
+    VkDeviceMemory& bufferMemory,
+    bool allowDirectUpload = true
 ) {
+    PROFILE_SCOPE("buffer2::createBuffer");
     VkDeviceSize bufferSize = sizeof(itemList[0]) * itemList.size();
 
+    auto buffer_bit = getUsage(bufferType);
+
+    // The most optimal memory on the GPU, but usually not accessible from the CPU
+    // hence the use of a staging buffer, unless the device local memory is mappable
+    bool direct = bindDeviceBuffer(
+        physicalDevice,
+        logicalDevice,
+        bufferSize,
+        buffer_bit,
+        allowDirectUpload,
+        buffer,
+        bufferMemory
+    );
+
+    if (direct) {
+        // no staging buffer, no copy command, no wait for the queue
+        void* data;
+        vkMapMemory(logicalDevice, bufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        memcpy(data, itemList.data(), static_cast<size_t>(bufferSize));
+        mapped::flush(logicalDevice, bufferMemory, 0, bufferSize);
+        vkUnmapMemory(logicalDevice, bufferMemory);
+        return true;
+    }
+
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
 
@@ -76,14 +155,14 @@ void createBuffer(
         // creating a staging buffer
         // Buffer can be used as source in a memory transfer operation.
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        memory::Upload,
         stagingBuffer,
         stagingBufferMemory
     );
 
     // fill the staging buffer
     void* data;
-    vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
 
     /**
      * Unfortunately the driver may not immediately copy the data 
@@ -94,36 +173,20 @@ void createBuffer(
      * * Call vkFlushMappedMemoryRanges after writing to the mapped memory, 
      * and call vkInvalidateMappedMemoryRanges before reading from the mapped memory
      * 
-     * We went for the first approach, which ensures that the mapped memory always matches
-     * the contents of the allocated memory. Do keep in mind that this may lead to slightly 
-     * worse performance than explicit flushing.bufferSize
-     * 
-     * But now we are dealing with a staging buffer, TODO: does it matter with a staging buffer ?
+     * We first went for the first approach. Now any host visible type is accepted
+     * and the range is flushed: mapped::flush does nothing if the type ended up coherent.
+     * The flush is needed even for a staging buffer, the copy command reads the memory
      */
     memcpy(data, itemList.data(), static_cast<size_t>(bufferSize));
+    mapped::flush(logicalDevice, stagingBufferMemory, 0, bufferSize);
     vkUnmapMemory(logicalDevice, stagingBufferMemory);
 
-    auto buffer_bit = (bufferType == Type::Vertex) ? VK_BUFFER_USAGE_VERTEX_BUFFER_BIT : VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-
-    bindBuffer(
-        physicalDevice,
-        logicalDevice,
-        bufferSize,
-        // vkMap usualy not possible as device local
-        // hence we specify it can be used as a transfer destination
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | buffer_bit,
-        // The most optimal memory on the GPU, but usually not accessible from the CPU
-        // hence the use of a staging buffer
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        buffer,
-        bufferMemory
-    );
-
     copyBuffer(logicalDevice, commandPool, graphicsQueue, stagingBuffer, buffer, bufferSize);
 
     // we can now clean the staging buffer
     vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    memory::freeMemory(logicalDevice, stagingBufferMemory);
+    return false;
 }
 
 /**
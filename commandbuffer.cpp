@@ -1,4 +1,6 @@
 #include "commandbuffer.hpp"
+#include "dispatch.hpp"
+#include "hitch.hpp"
 
 namespace commandbuffer {
 
@@ -6,6 +8,7 @@ VkCommandBuffer beginSingleTimeCommands(
     VkDevice logicalDevice,
     VkCommandPool commandPool
 ) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -24,7 +27,7 @@ VkCommandBuffer beginSingleTimeCommands(
     allocInfo.commandBufferCount = 1;
 
     VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer);
+    table.vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer);
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -34,7 +37,7 @@ VkCommandBuffer beginSingleTimeCommands(
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     // start recording
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    table.vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
     return commandBuffer;
 }
@@ -45,8 +48,11 @@ void endAndExecuteSingleTimeCommands(
     VkQueue graphicsQueue,
     VkCommandBuffer commandBuffer
 ) {
+    // synchronous: the frame waits for the whole transfer
+    hitch::ScopedEvent hitchEvent(hitch::UPLOAD);
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
     // end recording
-    vkEndCommandBuffer(commandBuffer);
+    table.vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -54,14 +60,14 @@ void endAndExecuteSingleTimeCommands(
     submitInfo.pCommandBuffers = &commandBuffer;
 
     // execute the command buffer
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    table.vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
     // there is no event to wait, unlike the draw command
     // we juste want to execute immediately
     // two way to wait for the transfer to complete:
     // * vkWaitForFence (would allow us to schedule multiple transfer simultaneously)
     // * vkQueueWaitIdle
-    vkQueueWaitIdle(graphicsQueue);
+    table.vkQueueWaitIdle(graphicsQueue);
 
-    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    table.vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
 }
 }
\ No newline at end of file
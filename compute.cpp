@@ -0,0 +1,430 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "compute.hpp"
+#include "pipeline5.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
+#include "hitch.hpp"
+
+namespace compute {
+
+static VkDescriptorType getDescriptorType(BindingType type) {
+    switch (type) {
+        case StorageBuffer:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        case StorageImage:
+            return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        case UniformBuffer:
+            return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case SampledImage:
+            return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    }
+    throw std::invalid_argument("unknown compute binding type!");
+}
+
+Limits getLimits(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    Limits limits;
+    limits.maxGroupSize = std::min(properties.limits.maxComputeWorkGroupInvocations,
+        properties.limits.maxComputeWorkGroupSize[0]);
+    for (int i = 0; i < 3; i++) {
+        limits.maxGroupCount[i] = properties.limits.maxComputeWorkGroupCount[i];
+    }
+    limits.maxSharedMemorySize = properties.limits.maxComputeSharedMemorySize;
+    limits.minStorageBufferOffsetAlignment = properties.limits.minStorageBufferOffsetAlignment;
+    return limits;
+}
+
+uint32_t chooseGroupSize(const Limits& limits, uint32_t preferred) {
+    // the spec guarantees 128 invocations
+    uint32_t groupSize = 1;
+    while (groupSize * 2 <= std::min(preferred, limits.maxGroupSize)) {
+        groupSize *= 2;
+    }
+    return groupSize;
+}
+
+GroupCount getGroupCount(const Limits& limits, uint32_t count, uint32_t groupSize) {
+    uint32_t groups = (count + groupSize - 1) / groupSize;
+    GroupCount groupCount;
+    if (groups <= limits.maxGroupCount[0]) {
+        groupCount.x = std::max(groups, 1u);
+        return groupCount;
+    }
+    // at least 65535 in x and y: 2^32 invocations always fit with groups of 1 or more
+    groupCount.y = (groups + limits.maxGroupCount[0] - 1) / limits.maxGroupCount[0];
+    groupCount.x = (groups + groupCount.y - 1) / groupCount.y;
+    if (groupCount.y > limits.maxGroupCount[1]) {
+        throw std::invalid_argument("too many invocations for one dispatch!");
+    }
+    return groupCount;
+}
+
+GroupCount getGroupCount2D(uint32_t width, uint32_t height, uint32_t groupWidth, uint32_t groupHeight) {
+    GroupCount groupCount;
+    groupCount.x = std::max((width + groupWidth - 1) / groupWidth, 1u);
+    groupCount.y = std::max((height + groupHeight - 1) / groupHeight, 1u);
+    return groupCount;
+}
+
+void createDescriptorSetLayout(
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    VkDescriptorSetLayout& descriptorSetLayout,
+    VkShaderStageFlags stages
+) {
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = getDescriptorType(bindings[i]);
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = stages;
+        layoutBindings[i].pImmutableSamplers = nullptr;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    layoutInfo.pBindings = layoutBindings.data();
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute descriptor set layout!");
+    }
+}
+
+void createDescriptorPool(
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t setCount,
+    VkDescriptorPool& descriptorPool,
+    VkDescriptorPoolCreateFlags flags
+) {
+    // one pool size per binding: the duplicate types add up
+    std::vector<VkDescriptorPoolSize> poolSizes(bindings.size());
+    for (size_t i = 0; i < bindings.size(); i++) {
+        poolSizes[i].type = getDescriptorType(bindings[i]);
+        poolSizes[i].descriptorCount = setCount;
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = setCount;
+    poolInfo.flags = flags;
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute descriptor pool!");
+    }
+}
+
+VkDescriptorSet allocateDescriptorSet(
+    VkDevice logicalDevice,
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout
+) {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate compute descriptor set!");
+    }
+    return descriptorSet;
+}
+
+void writeBuffer(
+    VkDevice logicalDevice,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    BindingType type,
+    VkBuffer buffer,
+    VkDeviceSize offset,
+    VkDeviceSize range
+) {
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = offset;
+    bufferInfo.range = range;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = binding;
+    write.dstArrayElement = 0;
+    write.descriptorType = getDescriptorType(type);
+    write.descriptorCount = 1;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void writeImage(
+    VkDevice logicalDevice,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    BindingType type,
+    VkImageView imageView,
+    VkImageLayout imageLayout,
+    VkSampler sampler
+) {
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = imageLayout;
+    imageInfo.imageView = imageView;
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = binding;
+    write.dstArrayElement = 0;
+    write.descriptorType = getDescriptorType(type);
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void createKernel(
+    const char* compFile,
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t pushConstantSize,
+    uint32_t groupSize,
+    Kernel& kernel
+) {
+    createKernel(pipeline5::readFile(compFile), logicalDevice, bindings, pushConstantSize, groupSize, kernel);
+}
+
+void createKernel(
+    const std::vector<char>& compShaderCode,
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t pushConstantSize,
+    uint32_t groupSize,
+    Kernel& kernel
+) {
+    PROFILE_SCOPE("compute::createKernel");
+    hitch::ScopedEvent hitchEvent(hitch::COMPILE);
+    kernel.groupSize = groupSize;
+    kernel.pushConstantSize = pushConstantSize;
+
+    createDescriptorSetLayout(logicalDevice, bindings, kernel.descriptorSetLayout);
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &kernel.descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &kernel.pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline layout!");
+    }
+
+    // local_size_x_id = 0 and GROUP_SIZE
+    VkSpecializationMapEntry groupSizeEntry{};
+    groupSizeEntry.constantID = 0;
+    groupSizeEntry.offset = 0;
+    groupSizeEntry.size = sizeof(uint32_t);
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &groupSizeEntry;
+    specializationInfo.dataSize = sizeof(uint32_t);
+    specializationInfo.pData = &kernel.groupSize;
+
+    VkShaderModule compShaderModule = pipeline5::createShaderModule(compShaderCode, logicalDevice);
+
+    VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+    compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compShaderStageInfo.module = compShaderModule;
+    compShaderStageInfo.pName = "main";
+    compShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = compShaderStageInfo;
+    pipelineInfo.layout = kernel.pipelineLayout;
+
+    VkResult result = vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &kernel.pipeline);
+    vkDestroyShaderModule(logicalDevice, compShaderModule, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+}
+
+void destroyKernel(VkDevice logicalDevice, Kernel& kernel) {
+    vkDestroyPipeline(logicalDevice, kernel.pipeline, nullptr);
+    vkDestroyPipelineLayout(logicalDevice, kernel.pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logicalDevice, kernel.descriptorSetLayout, nullptr);
+    kernel = Kernel{};
+}
+
+void recordDispatch(
+    VkCommandBuffer commandBuffer,
+    const Kernel& kernel,
+    VkDescriptorSet descriptorSet,
+    const void* pushConstants,
+    GroupCount groupCount
+) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    table.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+    table.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipelineLayout,
+        0, 1, &descriptorSet, 0, nullptr);
+    if (kernel.pushConstantSize > 0) {
+        table.vkCmdPushConstants(commandBuffer, kernel.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+            0, kernel.pushConstantSize, pushConstants);
+    }
+    table.vkCmdDispatch(commandBuffer, groupCount.x, groupCount.y, groupCount.z);
+}
+
+void recordBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags srcStageMask,
+    VkAccessFlags srcAccessMask,
+    VkPipelineStageFlags dstStageMask,
+    VkAccessFlags dstAccessMask
+) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    dispatch::getDeviceTable().vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0,
+        1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void BufferOps::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    uint32_t maxCount,
+    uint32_t maxBuffers,
+    const char* fillFile,
+    const char* reduceFile
+) {
+    logicalDevice_ = logicalDevice;
+    limits_ = getLimits(physicalDevice);
+    maxCount_ = maxCount;
+    maxBuffers_ = std::max(maxBuffers, 1u);
+    uint32_t groupSize = chooseGroupSize(limits_);
+
+    const std::vector<BindingType> fillBindings = {StorageBuffer};
+    const std::vector<BindingType> reduceBindings = {StorageBuffer, StorageBuffer};
+    createKernel(fillFile, logicalDevice_, fillBindings, sizeof(PushConstants), groupSize, fill_);
+    createKernel(reduceFile, logicalDevice_, reduceBindings, sizeof(PushConstants), groupSize, reduce_);
+
+    // maxBuffers fill and sum sets, freed by forget, and the 2 scratch sets, sized as reduce sets
+    createDescriptorPool(logicalDevice_, reduceBindings, 2 * maxBuffers_ + 2, descriptorPool_,
+        VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+    for (auto& set : reduceSets_) {
+        set = allocateDescriptorSet(logicalDevice_, descriptorPool_, reduce_.descriptorSetLayout);
+    }
+
+    // the partial sums of the first pass, then of the second one
+    uint32_t firstCount = std::max((maxCount + groupSize - 1) / groupSize, 1u);
+    uint32_t secondCount = std::max((firstCount + groupSize - 1) / groupSize, 1u);
+    uint32_t counts[2] = {firstCount, secondCount};
+    for (int i = 0; i < 2; i++) {
+        buffer2::bindBuffer(physicalDevice, logicalDevice_, counts[i] * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            memory::GpuOnly, scratchBuffers_[i], scratchMemory_[i]);
+    }
+    writeBuffer(logicalDevice_, reduceSets_[0], 0, StorageBuffer, scratchBuffers_[0]);
+    writeBuffer(logicalDevice_, reduceSets_[0], 1, StorageBuffer, scratchBuffers_[1]);
+    writeBuffer(logicalDevice_, reduceSets_[1], 0, StorageBuffer, scratchBuffers_[1]);
+    writeBuffer(logicalDevice_, reduceSets_[1], 1, StorageBuffer, scratchBuffers_[0]);
+}
+
+VkDescriptorSet BufferOps::getSet(
+    std::unordered_map<VkBuffer, VkDescriptorSet>& sets,
+    const Kernel& kernel,
+    VkBuffer buffer,
+    VkBuffer output
+) {
+    auto found = sets.find(buffer);
+    if (found != sets.end()) {
+        return found->second;
+    }
+    if (sets.size() >= maxBuffers_) {
+        throw std::invalid_argument("compute::BufferOps: more buffers than the maxBuffers of init, forget some!");
+    }
+
+    VkDescriptorSet set = allocateDescriptorSet(logicalDevice_, descriptorPool_, kernel.descriptorSetLayout);
+    writeBuffer(logicalDevice_, set, 0, StorageBuffer, buffer);
+    if (output != VK_NULL_HANDLE) {
+        writeBuffer(logicalDevice_, set, 1, StorageBuffer, output);
+    }
+    sets[buffer] = set;
+    return set;
+}
+
+void BufferOps::recordFill(VkCommandBuffer commandBuffer, VkBuffer buffer, uint32_t count, uint32_t value) {
+    VkDescriptorSet set = getSet(fillSets_, fill_, buffer);
+    PushConstants pushConstants{count, value};
+    recordDispatch(commandBuffer, fill_, set, &pushConstants, getGroupCount(limits_, count, fill_.groupSize));
+}
+
+VkBuffer BufferOps::recordSum(VkCommandBuffer commandBuffer, VkBuffer input, uint32_t count) {
+    if (count > maxCount_) {
+        throw std::invalid_argument("compute::BufferOps::recordSum past the maxCount of init!");
+    }
+    VkDescriptorSet inputSet = getSet(sumSets_, reduce_, input, scratchBuffers_[0]);
+
+    // the input may have just been written by an other kernel
+    recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    uint32_t pass = 0;
+    VkBuffer output = scratchBuffers_[0];
+    do {
+        VkDescriptorSet set = pass == 0 ? inputSet : reduceSets_[(pass - 1) % 2];
+        output = pass % 2 == 0 ? scratchBuffers_[0] : scratchBuffers_[1];
+        if (pass > 0) {
+            recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+        }
+        PushConstants pushConstants{count, 0};
+        recordDispatch(commandBuffer, reduce_, set, &pushConstants, getGroupCount(limits_, count, reduce_.groupSize));
+        count = (count + reduce_.groupSize - 1) / reduce_.groupSize;
+        pass++;
+    } while (count > 1);
+    return output;
+}
+
+void BufferOps::forget(VkBuffer buffer) {
+    for (auto* sets : {&fillSets_, &sumSets_}) {
+        auto found = sets->find(buffer);
+        if (found != sets->end()) {
+            vkFreeDescriptorSets(logicalDevice_, descriptorPool_, 1, &found->second);
+            sets->erase(found);
+        }
+    }
+}
+
+uint32_t BufferOps::getGroupSize() const {
+    return reduce_.groupSize;
+}
+
+void BufferOps::destroy() {
+    for (int i = 0; i < 2; i++) {
+        vkDestroyBuffer(logicalDevice_, scratchBuffers_[i], nullptr);
+        memory::freeMemory(logicalDevice_, scratchMemory_[i]);
+    }
+    // the sets go with the pool
+    vkDestroyDescriptorPool(logicalDevice_, descriptorPool_, nullptr);
+    fillSets_.clear();
+    sumSets_.clear();
+    destroyKernel(logicalDevice_, fill_);
+    destroyKernel(logicalDevice_, reduce_);
+}
+
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace compute {
+
+/**
+ * Compute pipelines next to the graphics one of pipeline5: the kernels run on the
+ * graphics queue (headless::Device picks a family with both), recorded in the same
+ * command buffers as the passes, with barriers in between.
+ *
+ * A kernel has one descriptor set (bindings 0..n-1 in the order of its BindingTypes,
+ * visible to the compute stage only), push constants, and a 1D workgroup whose size is
+ * the specialization constant 0, chosen at creation from the device limits:
+ *
+ *     layout(local_size_x_id = 0) in;
+ *     layout(constant_id = 0) const uint GROUP_SIZE = 64;
+ *
+ * Big 1D dispatches spill into y (see getGroupCount), the shaders compute their index with
+ * (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * GROUP_SIZE + gl_LocalInvocationID.x
+ * and skip the ones past the count
+ */
+enum BindingType {
+    StorageBuffer,
+    StorageImage,
+    UniformBuffer,
+    /** combined image sampler */
+    SampledImage
+};
+
+struct Limits {
+    /** maxComputeWorkGroupInvocations and maxComputeWorkGroupSize[0] */
+    uint32_t maxGroupSize;
+    uint32_t maxGroupCount[3];
+    uint32_t maxSharedMemorySize;
+    VkDeviceSize minStorageBufferOffsetAlignment;
+};
+
+struct GroupCount {
+    uint32_t x = 1;
+    uint32_t y = 1;
+    uint32_t z = 1;
+};
+
+Limits getLimits(VkPhysicalDevice physicalDevice);
+
+/**
+ * the largest power of two up to preferred the device allows. 64 to 256 suits every
+ * vendor (a multiple of the 32 or 64 wide subgroups), the kernels ask for 256
+ */
+uint32_t chooseGroupSize(const Limits& limits, uint32_t preferred = 256);
+
+/** enough groups of groupSize for count invocations, in x then y past maxGroupCount[0] */
+GroupCount getGroupCount(const Limits& limits, uint32_t count, uint32_t groupSize);
+
+/** groups of groupWidth x groupHeight covering width x height (images) */
+GroupCount getGroupCount2D(uint32_t width, uint32_t height, uint32_t groupWidth, uint32_t groupHeight);
+
+/** stages: COMPUTE for the kernels, the graphics stages for a pipeline5 pipeline */
+void createDescriptorSetLayout(
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    VkDescriptorSetLayout& descriptorSetLayout,
+    VkShaderStageFlags stages = VK_SHADER_STAGE_COMPUTE_BIT
+);
+
+/** room for setCount sets of these bindings. flags: FREE_DESCRIPTOR_SET to free them one by one */
+void createDescriptorPool(
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t setCount,
+    VkDescriptorPool& descriptorPool,
+    VkDescriptorPoolCreateFlags flags = 0
+);
+
+VkDescriptorSet allocateDescriptorSet(
+    VkDevice logicalDevice,
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout
+);
+
+/** StorageBuffer or UniformBuffer. offset: a multiple of the min*OffsetAlignment limit */
+void writeBuffer(
+    VkDevice logicalDevice,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    BindingType type,
+    VkBuffer buffer,
+    VkDeviceSize offset = 0,
+    VkDeviceSize range = VK_WHOLE_SIZE
+);
+
+/** StorageImage (layout GENERAL) or SampledImage (sampler needed) */
+void writeImage(
+    VkDevice logicalDevice,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    BindingType type,
+    VkImageView imageView,
+    VkImageLayout imageLayout,
+    VkSampler sampler = VK_NULL_HANDLE
+);
+
+struct Kernel {
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    uint32_t groupSize = 0;
+    uint32_t pushConstantSize = 0;
+};
+
+/**
+ * The pipeline, its layout and its descriptor set layout.
+ * pushConstantSize: bytes of push constants, 0 for none (128 are always available)
+ */
+void createKernel(
+    const char* compFile,
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t pushConstantSize,
+    uint32_t groupSize,
+    Kernel& kernel
+);
+
+/** same, with the SPIR-V code already read */
+void createKernel(
+    const std::vector<char>& compShaderCode,
+    VkDevice logicalDevice,
+    const std::vector<BindingType>& bindings,
+    uint32_t pushConstantSize,
+    uint32_t groupSize,
+    Kernel& kernel
+);
+
+void destroyKernel(VkDevice logicalDevice, Kernel& kernel);
+
+/** binds the pipeline and the set, pushes the constants (kernel.pushConstantSize bytes) and dispatches */
+void recordDispatch(
+    VkCommandBuffer commandBuffer,
+    const Kernel& kernel,
+    VkDescriptorSet descriptorSet,
+    const void* pushConstants,
+    GroupCount groupCount
+);
+
+/** a global memory barrier, e.g. the writes of a dispatch before the reads of the next one */
+void recordBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags srcStageMask,
+    VkAccessFlags srcAccessMask,
+    VkPipelineStageFlags dstStageMask,
+    VkAccessFlags dstAccessMask
+);
+
+const auto DEFAULT_FILL_FILE = "./shaders/spirv/fill.comp.spirv";
+const auto DEFAULT_REDUCE_FILE = "./shaders/spirv/reduce.comp.spirv";
+
+/**
+ * The first built-in kernels, on uint32 buffers:
+ * * fill: like vkCmdFillBuffer, but as a kernel (what the others look like)
+ * * sum: a tree reduction in shared memory, one partial sum per group, pass after pass
+ *   until one value is left. The sum wraps around like uint32_t does on the CPU
+ *
+ * Writing a descriptor set bound in a command buffer being recorded invalidates it
+ * (no UPDATE_AFTER_BIND on Vulkan 1.0): a record may write a set only once per command
+ * buffer. So each buffer gets its own sets, written the first time the buffer is given and
+ * only rebound after: any number of records of the same buffers in one command buffer.
+ * forget a buffer before destroying it, once no pending command buffer uses it
+ */
+class BufferOps {
+public:
+    /**
+     * maxCount: the longest buffer recordSum will be given, sizes the scratch buffers.
+     * maxBuffers: the buffers recordFill, and recordSum, may know at a time (see forget)
+     */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        uint32_t maxCount,
+        uint32_t maxBuffers = 16,
+        const char* fillFile = DEFAULT_FILL_FILE,
+        const char* reduceFile = DEFAULT_REDUCE_FILE
+    );
+
+    /** buffer: count uint32 from offset 0, STORAGE_BUFFER usage */
+    void recordFill(VkCommandBuffer commandBuffer, VkBuffer buffer, uint32_t count, uint32_t value);
+
+    /**
+     * The sum of the count uint32 of input, written after the previous writes of the
+     * compute stage. Returns the buffer holding it in its first uint32, valid until the next
+     * recordSum, readable by a transfer after a compute to transfer barrier
+     */
+    VkBuffer recordSum(VkCommandBuffer commandBuffer, VkBuffer input, uint32_t count);
+
+    /** frees the sets of buffer, a new buffer may get the same handle */
+    void forget(VkBuffer buffer);
+
+    uint32_t getGroupSize() const;
+
+    void destroy();
+
+private:
+    struct PushConstants {
+        uint32_t count;
+        uint32_t value;
+    };
+
+    /** the set of buffer (binding 0) in sets, allocated and written the first time only. output: binding 1, if any */
+    VkDescriptorSet getSet(
+        std::unordered_map<VkBuffer, VkDescriptorSet>& sets,
+        const Kernel& kernel,
+        VkBuffer buffer,
+        VkBuffer output = VK_NULL_HANDLE
+    );
+
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    Limits limits_{};
+    uint32_t maxCount_ = 0;
+    uint32_t maxBuffers_ = 0;
+    Kernel fill_;
+    Kernel reduce_;
+    VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
+    /** the buffer filled */
+    std::unordered_map<VkBuffer, VkDescriptorSet> fillSets_;
+    /** the input summed to scratch 0 */
+    std::unordered_map<VkBuffer, VkDescriptorSet> sumSets_;
+    /** the next passes: scratch 0 to 1 and 1 to 0 in turn */
+    VkDescriptorSet reduceSets_[2] = {};
+    VkBuffer scratchBuffers_[2] = {};
+    VkDeviceMemory scratchMemory_[2] = {};
+};
+
+}
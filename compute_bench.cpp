@@ -0,0 +1,250 @@
+/**
+ * Validation and timing of the first compute kernels (compute::BufferOps) on a headless
+ * device, lavapipe included:
+ * * fill: every value read back must be the filled one, timed against vkCmdFillBuffer
+ * * sum: random values, checked against the CPU sum for counts around the group size
+ *   (partial groups, one and several passes), a count whose groups spill into y with
+ *   more groups than needed (maxGroupCount[0] + 1 groups, if that fits in 256 MB), and
+ *   the whole buffer, then timed
+ *
+ * The timings submit repeats dispatches in one command buffer and wait once: GPU time
+ * plus one submission, without timestamp queries. The descriptor sets of the buffer are
+ * written by the first record, the repeats only rebind them (see compute::BufferOps).
+ * The bench fails if a result is wrong.
+ * Needs the compiled shaders (shaders/compile1.sh).
+ *
+ * usage: compute_bench [--count N] [--repeats R] [--seed S]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "headless.hpp"
+#include "compute.hpp"
+#include "buffer2.hpp"
+#include "commandbuffer.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+
+struct BenchOptions {
+    uint32_t count = 16 * 1024 * 1024;
+    uint32_t repeatCount = 10;
+    uint32_t seed = 1;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--count") {
+            options.count = value;
+        } else if (name == "--repeats") {
+            options.repeatCount = value;
+        } else if (name == "--seed") {
+            options.seed = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    if (options.count == 0 || options.repeatCount == 0) {
+        throw std::invalid_argument("--count and --repeats must be positive");
+    }
+    return options;
+}
+
+struct Context {
+    headless::Device headless;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+
+    /** records, submits and waits: returns the milliseconds from submission to completion */
+    double execute(const std::function<void(VkCommandBuffer)>& record) {
+        VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(headless.device_, commandPool);
+        record(commandBuffer);
+        auto start = std::chrono::steady_clock::now();
+        commandbuffer::endAndExecuteSingleTimeCommands(headless.device_, commandPool, headless.queue_, commandBuffer);
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+static void copyToReadback(VkCommandBuffer commandBuffer, VkBuffer source, VkBuffer readback, VkDeviceSize size) {
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    VkBufferCopy region{};
+    region.size = size;
+    vkCmdCopyBuffer(commandBuffer, source, readback, 1, &region);
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+}
+
+static void run(const BenchOptions& options) {
+    Context context;
+    context.headless.init("Compute bench");
+    VkPhysicalDevice physicalDevice = context.headless.physicalDevice_;
+    VkDevice device = context.headless.device_;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = context.headless.queueFamilyIndex_;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &context.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    compute::Limits limits = compute::getLimits(physicalDevice);
+
+    // one group more than maxGroupCount[0]: the dispatch spills into y with x * y > groups
+    uint32_t groupSize = compute::chooseGroupSize(limits);
+    const uint64_t MAX_SPILL_COUNT = 64 * 1024 * 1024;
+    uint64_t spillCount = (static_cast<uint64_t>(limits.maxGroupCount[0]) + 1) * groupSize;
+    bool checkSpill = spillCount <= std::max<uint64_t>(options.count, MAX_SPILL_COUNT);
+    uint32_t bufferCount = checkSpill ? std::max(options.count, static_cast<uint32_t>(spillCount)) : options.count;
+
+    compute::BufferOps ops;
+    ops.init(physicalDevice, device, bufferCount);
+    std::cout << "device: " << properties.deviceName << ", group size " << ops.getGroupSize()
+        << " (max " << limits.maxGroupSize << "), " << options.count << " values\n";
+
+    VkDeviceSize size = static_cast<VkDeviceSize>(bufferCount) * sizeof(uint32_t);
+    VkBuffer data, readback;
+    VkDeviceMemory dataMemory, readbackMemory;
+    buffer2::bindBuffer(physicalDevice, device, size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly, data, dataMemory);
+    buffer2::bindBuffer(physicalDevice, device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::Readback, readback, readbackMemory);
+    void* mappedReadback;
+    vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &mappedReadback);
+    const uint32_t* readValues = static_cast<const uint32_t*>(mappedReadback);
+
+    std::string failures;
+    double gigabytes = options.count * sizeof(uint32_t) / 1e9;
+    VkDeviceSize countSize = static_cast<VkDeviceSize>(options.count) * sizeof(uint32_t);
+
+    // fill
+    const uint32_t FILL_VALUE = 0xdeadbeef;
+    context.execute([&](VkCommandBuffer commandBuffer) {
+        ops.recordFill(commandBuffer, data, options.count, FILL_VALUE);
+        copyToReadback(commandBuffer, data, readback, countSize);
+    });
+    mapped::invalidate(device, readbackMemory, 0, countSize);
+    uint32_t wrongCount = 0;
+    for (uint32_t i = 0; i < options.count; i++) {
+        wrongCount += readValues[i] != FILL_VALUE;
+    }
+    if (wrongCount > 0) {
+        failures += "\n  fill: " + std::to_string(wrongCount) + " wrong values";
+    }
+
+    // the same buffer each time: the fill set is only rebound
+    double fillMs = context.execute([&](VkCommandBuffer commandBuffer) {
+        for (uint32_t r = 0; r < options.repeatCount; r++) {
+            ops.recordFill(commandBuffer, data, options.count, r);
+            compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+        }
+    }) / options.repeatCount;
+    double fillBufferMs = context.execute([&](VkCommandBuffer commandBuffer) {
+        for (uint32_t r = 0; r < options.repeatCount; r++) {
+            vkCmdFillBuffer(commandBuffer, data, 0, countSize, r);
+            compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        }
+    }) / options.repeatCount;
+    std::cout << "fill:            " << fillMs << " ms, " << gigabytes / (fillMs / 1000.0) << " GB/s"
+        << (wrongCount == 0 ? "" : " WRONG") << '\n'
+        << "vkCmdFillBuffer: " << fillBufferMs << " ms, " << gigabytes / (fillBufferMs / 1000.0) << " GB/s\n";
+
+    // sum, of random values through a staging buffer
+    std::vector<uint32_t> values(bufferCount);
+    uint32_t state = options.seed;
+    for (auto& value : values) {
+        state = state * 1664525u + 1013904223u;
+        value = state >> 8;
+    }
+    buffer2::StagingBuffer staging;
+    buffer2::reserveStagingBuffer(physicalDevice, device, size, staging);
+    memcpy(staging.mapped, values.data(), size);
+    mapped::flush(device, staging.memory, 0, size);
+    buffer2::copyBuffer(device, context.commandPool, context.headless.queue_, staging.buffer, data, size);
+    buffer2::destroyStagingBuffer(device, staging);
+
+    std::vector<uint32_t> counts = {1, groupSize - 1, groupSize, groupSize + 1, groupSize * groupSize + 3, options.count};
+    if (checkSpill) {
+        counts.push_back(static_cast<uint32_t>(spillCount));
+    } else {
+        std::cout << "maxGroupCount[0] " << limits.maxGroupCount[0] << ": the dispatches spilling into y are not checked\n";
+    }
+    for (uint32_t count : counts) {
+        if (count == 0 || count > bufferCount) {
+            continue;
+        }
+        // the sum wraps around, like the shader's
+        uint32_t expected = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            expected += values[i];
+        }
+
+        context.execute([&](VkCommandBuffer commandBuffer) {
+            VkBuffer result = ops.recordSum(commandBuffer, data, count);
+            copyToReadback(commandBuffer, result, readback, sizeof(uint32_t));
+        });
+        mapped::invalidate(device, readbackMemory, 0, sizeof(uint32_t));
+        if (readValues[0] != expected) {
+            failures += "\n  sum of " + std::to_string(count) + " values: " + std::to_string(readValues[0])
+                + " instead of " + std::to_string(expected);
+        }
+    }
+
+    // the sum set of data is only rebound, the scratch sets never change
+    double sumMs = context.execute([&](VkCommandBuffer commandBuffer) {
+        for (uint32_t r = 0; r < options.repeatCount; r++) {
+            ops.recordSum(commandBuffer, data, options.count);
+        }
+    }) / options.repeatCount;
+    auto cpuStart = std::chrono::steady_clock::now();
+    uint32_t cpuSum = 0;
+    for (uint32_t i = 0; i < options.count; i++) {
+        cpuSum += values[i];
+    }
+    double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+    std::cout << "sum:             " << sumMs << " ms, " << gigabytes / (sumMs / 1000.0) << " GB/s ("
+        << counts.size() << " counts checked)\n"
+        << "CPU sum:         " << cpuMs << " ms, " << gigabytes / (cpuMs / 1000.0) << " GB/s (" << cpuSum << ")\n";
+
+    vkUnmapMemory(device, readbackMemory);
+    vkDestroyBuffer(device, readback, nullptr);
+    memory::freeMemory(device, readbackMemory);
+    ops.forget(data);
+    vkDestroyBuffer(device, data, nullptr);
+    memory::freeMemory(device, dataMemory);
+    ops.destroy();
+    vkDestroyCommandPool(device, context.commandPool, nullptr);
+    context.headless.cleanup();
+
+    if (!failures.empty()) {
+        throw std::runtime_error("wrong compute results:" + failures);
+    }
+    std::cout << "all the compute results match\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
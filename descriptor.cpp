@@ -0,0 +1,267 @@
+#include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <array>
+
+#include "descriptor.hpp"
+#include "dispatch.hpp"
+
+namespace descriptor {
+
+static bool hasExtension(const std::vector<VkExtensionProperties>& availableExtensions, const char* extension) {
+    for (const auto& available : availableExtensions) {
+        if (strcmp(available.extensionName, extension) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static std::array<VkDescriptorUpdateTemplateEntryKHR, 2> getTemplateEntries() {
+    std::array<VkDescriptorUpdateTemplateEntryKHR, 2> entries{};
+
+    entries[0].dstBinding = 0;
+    entries[0].dstArrayElement = 0;
+    entries[0].descriptorCount = 1;
+    entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    // where the VkDescriptorBufferInfo lives in the packed struct
+    entries[0].offset = offsetof(PerDrawBindings, uniformBuffer);
+    // only relevant for arrays of descriptors
+    entries[0].stride = sizeof(PerDrawBindings);
+
+    entries[1].dstBinding = 1;
+    entries[1].dstArrayElement = 0;
+    entries[1].descriptorCount = 1;
+    entries[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    entries[1].offset = offsetof(PerDrawBindings, texture);
+    entries[1].stride = sizeof(PerDrawBindings);
+
+    return entries;
+}
+
+bool checkInstanceExtensionSupport(const char* extension) {
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+    return hasExtension(extensions, extension);
+}
+
+Mode chooseMode(VkPhysicalDevice physicalDevice, bool pushDescriptorAllowed) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+    bool hasTemplate = hasExtension(availableExtensions, VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+    bool hasPush = hasExtension(availableExtensions, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+
+    // we push through a template, so push descriptors also need the template extension
+    if (pushDescriptorAllowed && hasPush && hasTemplate) {
+        return PushDescriptor;
+    }
+
+    if (hasTemplate) {
+        return UpdateTemplate;
+    }
+
+    return WriteDescriptorSet;
+}
+
+std::vector<const char*> getDeviceExtensions(Mode mode) {
+    switch (mode) {
+    case PushDescriptor:
+        return {VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME};
+    case UpdateTemplate:
+        return {VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME};
+    default:
+        return {};
+    }
+}
+
+void createDescriptorSetLayout(
+    VkDevice logicalDevice,
+    Mode mode,
+    VkDescriptorSetLayout& descriptorSetLayout
+) {
+    VkDescriptorSetLayoutBinding uboLayoutBinding{};
+    uboLayoutBinding.binding = 0;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+    samplerLayoutBinding.binding = 1;
+    samplerLayoutBinding.descriptorCount = 1;
+    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    // a push descriptor layout can't be used to allocate sets
+    layoutInfo.flags = (mode == PushDescriptor) ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+}
+
+void createBinder(
+    VkDevice logicalDevice,
+    Mode mode,
+    VkDescriptorSetLayout descriptorSetLayout,
+    VkPipelineLayout pipelineLayout,
+    Binder& binder
+) {
+    binder = Binder{};
+    binder.mode = mode;
+
+    if (mode == WriteDescriptorSet) {
+        return;
+    }
+
+    auto createTemplate = (PFN_vkCreateDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(logicalDevice, "vkCreateDescriptorUpdateTemplateKHR");
+    binder.destroyDescriptorUpdateTemplate = (PFN_vkDestroyDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(logicalDevice, "vkDestroyDescriptorUpdateTemplateKHR");
+    binder.updateDescriptorSetWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR) vkGetDeviceProcAddr(logicalDevice, "vkUpdateDescriptorSetWithTemplateKHR");
+    if (mode == PushDescriptor) {
+        binder.cmdPushDescriptorSetWithTemplate = (PFN_vkCmdPushDescriptorSetWithTemplateKHR) vkGetDeviceProcAddr(logicalDevice, "vkCmdPushDescriptorSetWithTemplateKHR");
+    }
+
+    // the extensions returned by getDeviceExtensions were not enabled on the device
+    if (createTemplate == nullptr || binder.destroyDescriptorUpdateTemplate == nullptr ||
+        (mode == UpdateTemplate && binder.updateDescriptorSetWithTemplate == nullptr) ||
+        (mode == PushDescriptor && binder.cmdPushDescriptorSetWithTemplate == nullptr)) {
+        throw std::runtime_error("descriptor update template functions not loaded!");
+    }
+
+    auto entries = getTemplateEntries();
+
+    VkDescriptorUpdateTemplateCreateInfoKHR createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+    createInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+    createInfo.pDescriptorUpdateEntries = entries.data();
+    if (mode == PushDescriptor) {
+        // push templates are tied to a pipeline layout and a set number
+        // descriptorSetLayout is ignored
+        createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+        createInfo.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        createInfo.pipelineLayout = pipelineLayout;
+        createInfo.set = 0;
+    } else {
+        createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+        createInfo.descriptorSetLayout = descriptorSetLayout;
+    }
+
+    if (createTemplate(logicalDevice, &createInfo, nullptr, &binder.updateTemplate) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor update template!");
+    }
+}
+
+void destroyBinder(VkDevice logicalDevice, Binder& binder) {
+    if (binder.updateTemplate != VK_NULL_HANDLE) {
+        binder.destroyDescriptorUpdateTemplate(logicalDevice, binder.updateTemplate, nullptr);
+    }
+
+    binder = Binder{};
+}
+
+void allocateDescriptorSets(
+    VkDevice logicalDevice,
+    const Binder& binder,
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout,
+    int maxFramesInFlight,
+    std::vector<VkDescriptorSet>& descriptorSets
+) {
+    descriptorSets.clear();
+
+    if (binder.mode == PushDescriptor) {
+        return;
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(maxFramesInFlight, descriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(maxFramesInFlight);
+    allocInfo.pSetLayouts = layouts.data();
+
+    descriptorSets.resize(maxFramesInFlight);
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+}
+
+void updateDescriptorSet(
+    VkDevice logicalDevice,
+    const Binder& binder,
+    VkDescriptorSet descriptorSet,
+    const PerDrawBindings& bindings
+) {
+    if (binder.mode == PushDescriptor) {
+        throw std::logic_error("descriptor sets are not used with push descriptors!");
+    }
+
+    if (binder.mode == UpdateTemplate) {
+        // one call, the driver reads the descriptors straight from the packed struct
+        binder.updateDescriptorSetWithTemplate(logicalDevice, descriptorSet, binder.updateTemplate, &bindings);
+        return;
+    }
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = descriptorSet;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pBufferInfo = &bindings.uniformBuffer;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = descriptorSet;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &bindings.texture;
+
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void bindDescriptors(
+    VkCommandBuffer commandBuffer,
+    const Binder& binder,
+    VkPipelineLayout pipelineLayout,
+    VkDescriptorSet descriptorSet,
+    const PerDrawBindings& bindings
+) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    if (binder.mode == PushDescriptor) {
+        // the descriptors are copied into the command buffer at record time
+        // so bindings can be a stack variable reused for the next draw
+        binder.cmdPushDescriptorSetWithTemplate(commandBuffer, binder.updateTemplate, pipelineLayout, 0, &bindings);
+        return;
+    }
+
+    table.vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipelineLayout,
+        0,
+        1,
+        &descriptorSet,
+        0,
+        nullptr
+    );
+}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace descriptor {
+
+/**
+ * How the per draw resources reach the shaders, from the cheapest to the most expensive:
+ * * PushDescriptor: VK_KHR_push_descriptor, descriptors are recorded straight into the
+ *   command buffer, no pool, no set allocation at all
+ * * UpdateTemplate: VK_KHR_descriptor_update_template, sets are still allocated but updated
+ *   from a packed struct in one call, the driver does not have to walk VkWriteDescriptorSet arrays
+ * * WriteDescriptorSet: the plain vkUpdateDescriptorSets path, always available
+ */
+enum Mode {
+    PushDescriptor,
+    UpdateTemplate,
+    WriteDescriptorSet
+};
+
+/**
+ * Packed layout of the resources of one draw.
+ * The update template entries point into this struct with offsetof
+ * so the order of the members does not have to match the bindings
+ */
+struct PerDrawBindings {
+    // binding 0
+    VkDescriptorBufferInfo uniformBuffer;
+    // binding 1
+    VkDescriptorImageInfo texture;
+};
+
+/**
+ * Everything needed to bind the descriptors of a draw whatever the Mode is.
+ * Extension functions are not exported by the loader, so they are looked up
+ * once with vkGetDeviceProcAddr when the binder is created
+ */
+struct Binder {
+    Mode mode = WriteDescriptorSet;
+    VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR updateDescriptorSetWithTemplate = nullptr;
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR cmdPushDescriptorSetWithTemplate = nullptr;
+    PFN_vkDestroyDescriptorUpdateTemplateKHR destroyDescriptorUpdateTemplate = nullptr;
+};
+
+/**
+ * VK_KHR_push_descriptor depends on VK_KHR_get_physical_device_properties2
+ * which is an instance extension, so this has to be known before vkCreateInstance
+ */
+bool checkInstanceExtensionSupport(const char* extension);
+
+/**
+ * pick the best Mode supported by the physical device
+ * pushDescriptorAllowed is false if the instance was created without
+ * VK_KHR_get_physical_device_properties2
+ */
+Mode chooseMode(VkPhysicalDevice physicalDevice, bool pushDescriptorAllowed);
+
+/** device extensions to enable for the given Mode, to append to the required ones */
+std::vector<const char*> getDeviceExtensions(Mode mode);
+
+/**
+ * Same bindings as buffer2::createDescriptorSetLayout, but the layout
+ * has to be flagged when used with push descriptors
+ */
+void createDescriptorSetLayout(
+    VkDevice logicalDevice,
+    Mode mode,
+    VkDescriptorSetLayout& descriptorSetLayout
+);
+
+/**
+ * The template for push descriptors references the pipeline layout,
+ * so it has to be called after the graphics pipeline creation
+ */
+void createBinder(
+    VkDevice logicalDevice,
+    Mode mode,
+    VkDescriptorSetLayout descriptorSetLayout,
+    VkPipelineLayout pipelineLayout,
+    Binder& binder
+);
+
+void destroyBinder(VkDevice logicalDevice, Binder& binder);
+
+/**
+ * one descriptor set for each frame in flight, all with the same layout
+ * nothing is allocated with PushDescriptor
+ */
+void allocateDescriptorSets(
+    VkDevice logicalDevice,
+    const Binder& binder,
+    VkDescriptorPool descriptorPool,
+    VkDescriptorSetLayout descriptorSetLayout,
+    int maxFramesInFlight,
+    std::vector<VkDescriptorSet>& descriptorSets
+);
+
+/**
+ * Write the bindings into an allocated set
+ * not needed (and not allowed) with PushDescriptor
+ */
+void updateDescriptorSet(
+    VkDevice logicalDevice,
+    const Binder& binder,
+    VkDescriptorSet descriptorSet,
+    const PerDrawBindings& bindings
+);
+
+/**
+ * To call while recording, before the draw.
+ * With PushDescriptor the bindings are pushed and descriptorSet is ignored,
+ * otherwise descriptorSet must have been updated with the same bindings
+ */
+void bindDescriptors(
+    VkCommandBuffer commandBuffer,
+    const Binder& binder,
+    VkPipelineLayout pipelineLayout,
+    VkDescriptorSet descriptorSet,
+    const PerDrawBindings& bindings
+);
+
+}
@@ -0,0 +1,298 @@
+/**
+ * Headless bench of the descriptor modes of descriptor.hpp
+ *
+ * Each draw of the model loop gets its uniform buffer and its texture, this times
+ * the CPU side of --draws of them in each Mode the device supports:
+ * * WriteDescriptorSet: vkUpdateDescriptorSets of the draw's set, then vkCmdBindDescriptorSets
+ * * UpdateTemplate: vkUpdateDescriptorSetWithTemplateKHR of the set, then vkCmdBindDescriptorSets
+ * * PushDescriptor: vkCmdPushDescriptorSetWithTemplateKHR, no set at all
+ * The updates and the binds (recorded in a command buffer, never submitted) are timed apart,
+ * the best of --runs is kept.
+ * PushDescriptor also needs VK_KHR_get_physical_device_properties2 and a maxPushDescriptors of
+ * at least 2, the modes the device can't run are listed as skipped.
+ *
+ * usage: descriptor_bench [--draws N] [--runs R]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "headless.hpp"
+#include "descriptor.hpp"
+#include "buffer2.hpp"
+#include "texture3.hpp"
+#include "sampler.hpp"
+#include "memory.hpp"
+
+struct BenchOptions {
+    uint32_t drawCount = 10000;
+    uint32_t runCount = 5;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--draws") {
+            options.drawCount = std::max(value, 1u);
+        } else if (name == "--runs") {
+            options.runCount = std::max(value, 1u);
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+static const char* getModeName(descriptor::Mode mode) {
+    switch (mode) {
+    case descriptor::PushDescriptor:
+        return "PushDescriptor";
+    case descriptor::UpdateTemplate:
+        return "UpdateTemplate";
+    default:
+        return "WriteDescriptorSet";
+    }
+}
+
+// the uniform buffer and the combined image sampler of a draw
+const uint32_t PUSHED_DESCRIPTOR_COUNT = 2;
+
+/** 0 if vkGetPhysicalDeviceProperties2KHR can't be found */
+static uint32_t getMaxPushDescriptors(const headless::Device& headless) {
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+        headless.instance_, "vkGetPhysicalDeviceProperties2KHR");
+    if (getProperties2 == nullptr) {
+        return 0;
+    }
+
+    VkPhysicalDevicePushDescriptorPropertiesKHR pushProperties{};
+    pushProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR;
+
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &pushProperties;
+    getProperties2(headless.physicalDevice_, &properties);
+
+    return pushProperties.maxPushDescriptors;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** the resources the draws point to, shared by all the modes */
+struct Resources {
+    VkBuffer uniformBuffer;
+    VkDeviceMemory uniformBufferMemory;
+    /** the draws cycle through this many slots of the uniform buffer */
+    uint32_t slotCount;
+    VkDeviceSize slotSize;
+    VkImage image;
+    VkDeviceMemory imageMemory;
+    VkImageView imageView;
+    VkSampler sampler;
+};
+
+static descriptor::PerDrawBindings getBindings(const Resources& resources, uint32_t draw) {
+    descriptor::PerDrawBindings bindings{};
+    bindings.uniformBuffer.buffer = resources.uniformBuffer;
+    bindings.uniformBuffer.offset = (draw % resources.slotCount) * resources.slotSize;
+    bindings.uniformBuffer.range = sizeof(buffer2::UniformBufferObject);
+    bindings.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    bindings.texture.imageView = resources.imageView;
+    bindings.texture.sampler = resources.sampler;
+    return bindings;
+}
+
+static void measureMode(
+    headless::Device& headless,
+    descriptor::Mode mode,
+    const Resources& resources,
+    VkCommandBuffer commandBuffer,
+    const BenchOptions& options
+) {
+    VkDevice device = headless.device_;
+
+    VkDescriptorSetLayout setLayout;
+    descriptor::createDescriptorSetLayout(device, mode, setLayout);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    VkPipelineLayout pipelineLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    descriptor::Binder binder;
+    descriptor::createBinder(device, mode, setLayout, pipelineLayout, binder);
+
+    // one set per draw, none with push descriptors
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> sets;
+    if (mode != descriptor::PushDescriptor) {
+        buffer2::createDescriptorPool(device, static_cast<int>(options.drawCount), descriptorPool);
+        descriptor::allocateDescriptorSets(device, binder, descriptorPool, setLayout,
+            static_cast<int>(options.drawCount), sets);
+    }
+
+    double bestUpdateMs = 0.0;
+    double bestBindMs = 0.0;
+    for (uint32_t run = 0; run < options.runCount; run++) {
+        auto start = std::chrono::steady_clock::now();
+        if (mode != descriptor::PushDescriptor) {
+            for (uint32_t draw = 0; draw < options.drawCount; draw++) {
+                descriptor::updateDescriptorSet(device, binder, sets[draw], getBindings(resources, draw));
+            }
+        }
+        double updateMs = elapsedMs(start);
+
+        vkResetCommandBuffer(commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+        start = std::chrono::steady_clock::now();
+        for (uint32_t draw = 0; draw < options.drawCount; draw++) {
+            VkDescriptorSet set = sets.empty() ? VK_NULL_HANDLE : sets[draw];
+            descriptor::bindDescriptors(commandBuffer, binder, pipelineLayout, set, getBindings(resources, draw));
+        }
+        double bindMs = elapsedMs(start);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+
+        if (run == 0 || updateMs + bindMs < bestUpdateMs + bestBindMs) {
+            bestUpdateMs = updateMs;
+            bestBindMs = bindMs;
+        }
+    }
+
+    double totalMs = bestUpdateMs + bestBindMs;
+    std::cout << "  " << getModeName(mode) << ": " << totalMs << " ms (update " << bestUpdateMs
+        << " ms, bind " << bestBindMs << " ms), " << totalMs * 1000.0 / options.drawCount << " us/draw\n";
+
+    if (descriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    }
+    descriptor::destroyBinder(device, binder);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    // push descriptors also need VK_KHR_get_physical_device_properties2, enabled when available
+    headless.init("Descriptor bench", descriptor::getDeviceExtensions(descriptor::PushDescriptor));
+    VkDevice device = headless.device_;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName << '\n';
+
+    std::vector<descriptor::Mode> modes = {descriptor::WriteDescriptorSet};
+    // why the others are not measured, printed with the results
+    std::vector<std::string> skipped;
+    bool hasTemplate = headless.isExtensionEnabled(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+    if (hasTemplate) {
+        modes.push_back(descriptor::UpdateTemplate);
+    } else {
+        skipped.push_back("UpdateTemplate and PushDescriptor: no " VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+    }
+    if (hasTemplate && !headless.isExtensionEnabled(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+        skipped.push_back("PushDescriptor: no " VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    } else if (hasTemplate && !headless.properties2_) {
+        skipped.push_back("PushDescriptor: no " VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    } else if (hasTemplate) {
+        uint32_t maxPushDescriptors = getMaxPushDescriptors(headless);
+        if (maxPushDescriptors < PUSHED_DESCRIPTOR_COUNT) {
+            skipped.push_back("PushDescriptor: maxPushDescriptors is " + std::to_string(maxPushDescriptors)
+                + ", a draw pushes " + std::to_string(PUSHED_DESCRIPTOR_COUNT));
+        } else {
+            modes.push_back(descriptor::PushDescriptor);
+        }
+    }
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers!");
+    }
+
+    Resources resources;
+    VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+    resources.slotSize = (sizeof(buffer2::UniformBufferObject) + alignment - 1) / alignment * alignment;
+    resources.slotCount = 64;
+    buffer2::bindBuffer(headless.physicalDevice_, device, resources.slotSize * resources.slotCount,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, memory::GpuOnly, resources.uniformBuffer, resources.uniformBufferMemory);
+
+    const int TEXTURE_SIZE = 4;
+    std::vector<unsigned char> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 4, 128);
+    uint32_t mipLevels = texture3::createTextureImageFromPixels(headless.physicalDevice_, device,
+        commandPool, headless.queue_, pixels.data(), TEXTURE_SIZE, TEXTURE_SIZE, VK_SAMPLE_COUNT_1_BIT,
+        resources.image, resources.imageMemory);
+    texture3::createTextureImageView(device, resources.image, resources.imageView, mipLevels);
+
+    sampler::SamplerCache samplerCache;
+    samplerCache.init(headless.physicalDevice_, device);
+    // samplerAnisotropy is not enabled on the headless device
+    sampler::SamplerKey key = sampler::getTextureSamplerKey(1.0f);
+    key.anisotropyEnable = VK_FALSE;
+    resources.sampler = samplerCache.acquire(key);
+
+    std::cout << options.drawCount << " draws, a uniform buffer and a combined image sampler each, best of "
+        << options.runCount << " runs:\n";
+    for (descriptor::Mode mode : modes) {
+        measureMode(headless, mode, resources, commandBuffer, options);
+    }
+    for (const std::string& reason : skipped) {
+        std::cout << "  skipped " << reason << '\n';
+    }
+
+    samplerCache.release(resources.sampler);
+    samplerCache.destroy();
+    vkDestroyImageView(device, resources.imageView, nullptr);
+    vkDestroyImage(device, resources.image, nullptr);
+    memory::freeMemory(device, resources.imageMemory);
+    vkDestroyBuffer(device, resources.uniformBuffer, nullptr);
+    memory::freeMemory(device, resources.uniformBufferMemory);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -3,6 +3,8 @@
 #include <set>
 
 #include "device.hpp"
+#include "profiler.hpp"
+#include "hostalloc.hpp"
 #include "swapchain3.hpp"
 
 namespace device {
@@ -80,6 +82,7 @@ namespace device {
 
 
 void printExtensions() {
+    PROFILE_SCOPE("device::printExtensions");
     // retrieve a list of supported extensions
     // could be compared to glfwGetRequiredInstanceExtensions
 
@@ -137,6 +140,7 @@ VkResult createDebugUtilsMessengerEXT(
 }
 
 void setupDebugMessenger(VkInstance instance, bool enable_validation_layers, VkDebugUtilsMessengerEXT* pDebugMessenger) {
+    PROFILE_SCOPE("device::setupDebugMessenger");
     if (!enable_validation_layers) return;
 
     VkDebugUtilsMessengerCreateInfoEXT createInfo{};
@@ -236,6 +240,7 @@ bool isPhysicalDeviceSuitable(VkPhysicalDevice physicalDevice, VkSurfaceKHR surf
 }
 
 bool checkValidationLayerSupport(const std::vector<const char*>& validation_layers) {
+    PROFILE_SCOPE("device::checkValidationLayerSupport");
     uint32_t layerCount;
     vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
 
@@ -272,6 +277,7 @@ void pickPhysicalDevice(
     // TODO: better returning the handle
     VkPhysicalDevice* pPhysicalDevice
 ) {
+    PROFILE_SCOPE("device::pickPhysicalDevice");
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 
@@ -321,6 +327,7 @@ void createLogicalDevice(
     VkQueue* pGraphicsQueue,
     VkQueue* pPresentQueue
     ) {
+    PROFILE_SCOPE("device::createLogicalDevice");
     // Specify the queues to be created
     // TODO: dedicated function ?
     device::QueueFamilyIndices indices = device::findQueueFamilies(physicalDevice, surface);
@@ -359,6 +366,10 @@ void createLogicalDevice(
     VkPhysicalDeviceFeatures deviceFeatures{};
     // anisotropic filtering is an optional feature
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    // for gpustats::Recorder, it falls back to timestamps only without it
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -386,7 +397,7 @@ void createLogicalDevice(
         createInfo.enabledLayerCount = 0;
     }
 
-    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, pLogicalDevice) != VK_SUCCESS) {
+    if (vkCreateDevice(physicalDevice, &createInfo, hostalloc::getCallbacks(), pLogicalDevice) != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
 
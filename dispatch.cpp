@@ -0,0 +1,41 @@
+#include "dispatch.hpp"
+
+namespace dispatch {
+
+static InstanceTable instanceTable;
+static DeviceTable deviceTable;
+
+// a function the driver doesn't expose (extension not enabled...) keeps the exported one
+#define DISPATCH_LOAD_INSTANCE(name) \
+    if (auto function = (PFN_##name) vkGetInstanceProcAddr(instance, #name)) { \
+        instanceTable.name = function; \
+    }
+
+#define DISPATCH_LOAD_DEVICE(name) \
+    if (auto function = (PFN_##name) instanceTable.vkGetDeviceProcAddr(logicalDevice, #name)) { \
+        deviceTable.name = function; \
+    }
+
+void loadInstance(VkInstance instance) {
+    instanceTable = InstanceTable{};
+    DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_LOAD_INSTANCE)
+}
+
+void loadDevice(VkDevice logicalDevice) {
+    deviceTable = DeviceTable{};
+    DISPATCH_DEVICE_FUNCTIONS(DISPATCH_LOAD_DEVICE)
+}
+
+void resetDevice() {
+    deviceTable = DeviceTable{};
+}
+
+const InstanceTable& getInstanceTable() {
+    return instanceTable;
+}
+
+const DeviceTable& getDeviceTable() {
+    return deviceTable;
+}
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace dispatch {
+
+/**
+ * Function pointers straight to the driver, like volk does.
+ *
+ * The vk* functions exported by libvulkan are trampolines: they find the dispatch
+ * table of the object (instance, device, command buffer...) then jump through it,
+ * and the layers add their own hop. Fetched with vkGetDeviceProcAddr, a device function
+ * pointer goes straight to the driver (or the first enabled layer).
+ * It only matters for the functions called thousands of times per frame (vkCmd*),
+ * so the tables only hold the per frame and command recording functions.
+ *
+ * The members start as the exported functions: the tables work before load*
+ * (and in code which never calls it), just through the loader.
+ * Only one instance and one device at a time, like memory.hpp
+ */
+
+#define DISPATCH_INSTANCE_FUNCTIONS(X) \
+    X(vkGetDeviceProcAddr) \
+    X(vkGetPhysicalDeviceFormatProperties) \
+    X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR) \
+    X(vkGetPhysicalDeviceSurfaceFormatsKHR) \
+    X(vkGetPhysicalDeviceSurfacePresentModesKHR)
+
+#define DISPATCH_DEVICE_FUNCTIONS(X) \
+    X(vkAcquireNextImageKHR) \
+    X(vkQueuePresentKHR) \
+    X(vkQueueSubmit) \
+    X(vkQueueWaitIdle) \
+    X(vkWaitForFences) \
+    X(vkGetFenceStatus) \
+    X(vkResetFences) \
+    X(vkAllocateCommandBuffers) \
+    X(vkFreeCommandBuffers) \
+    X(vkResetCommandBuffer) \
+    X(vkBeginCommandBuffer) \
+    X(vkEndCommandBuffer) \
+    X(vkMapMemory) \
+    X(vkUnmapMemory) \
+    X(vkFlushMappedMemoryRanges) \
+    X(vkInvalidateMappedMemoryRanges) \
+    X(vkUpdateDescriptorSets) \
+    X(vkCmdBeginRenderPass) \
+    X(vkCmdEndRenderPass) \
+    X(vkCmdBindPipeline) \
+    X(vkCmdBindVertexBuffers) \
+    X(vkCmdBindIndexBuffer) \
+    X(vkCmdBindDescriptorSets) \
+    X(vkCmdSetViewport) \
+    X(vkCmdSetScissor) \
+    X(vkCmdDraw) \
+    X(vkCmdDrawIndexed) \
+    X(vkCmdDrawIndexedIndirect) \
+    X(vkCmdDispatch) \
+    X(vkCmdPushConstants) \
+    X(vkCmdPipelineBarrier) \
+    X(vkCmdCopyBuffer) \
+    X(vkCmdFillBuffer) \
+    X(vkCmdCopyBufferToImage) \
+    X(vkCmdCopyImageToBuffer) \
+    X(vkCmdBlitImage) \
+    X(vkCmdResetQueryPool) \
+    X(vkCmdWriteTimestamp) \
+    X(vkCmdBeginQuery) \
+    X(vkCmdEndQuery) \
+    X(vkGetQueryPoolResults)
+
+#define DISPATCH_DECLARE_MEMBER(name) PFN_##name name = ::name;
+
+struct InstanceTable {
+    DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_DECLARE_MEMBER)
+};
+
+struct DeviceTable {
+    DISPATCH_DEVICE_FUNCTIONS(DISPATCH_DECLARE_MEMBER)
+};
+
+#undef DISPATCH_DECLARE_MEMBER
+
+/** right after vkCreateInstance */
+void loadInstance(VkInstance instance);
+
+/**
+ * right after vkCreateDevice, before any other thread records commands.
+ * Goes through the vkGetDeviceProcAddr of the instance table
+ */
+void loadDevice(VkDevice logicalDevice);
+
+/** back to the exported functions, before vkDestroyDevice */
+void resetDevice();
+
+const InstanceTable& getInstanceTable();
+const DeviceTable& getDeviceTable();
+
+}
@@ -0,0 +1,329 @@
+/**
+ * Headless benchmark of the dispatch tables (dispatch.hpp)
+ *
+ * Records the per draw calls of the frame loop (bind descriptor set, bind vertex
+ * and index buffers, set viewport, vkCmdDrawIndexed) into a command buffer, inside a
+ * render pass with the pipeline of the app bound (pipeline5, like offscreen::Renderer),
+ * first through the functions exported by libvulkan (loader trampolines), then through
+ * the device table filled by dispatch::loadDevice, and prints the ns per call.
+ * Nothing is submitted: only the CPU cost of recording is measured, so lavapipe
+ * is fine, but the compiled shaders are needed.
+ * The command buffer is reset every few thousand draws to keep its memory bounded.
+ *
+ * usage: dispatch_bench [--calls C] [--batch B] [--rounds R]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <array>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "memory.hpp"
+#include "buffer2.hpp"
+#include "headless.hpp"
+#include "dispatch.hpp"
+#include "device.hpp"
+#include "descriptor.hpp"
+#include "pipeline5.hpp"
+#include "swapchain3.hpp"
+#include "texture3.hpp"
+#include "image2.hpp"
+#include "sampler.hpp"
+#include "offscreen.hpp"
+
+struct BenchOptions {
+    uint32_t callCount = 1000000;
+    uint32_t batchSize = 4096;
+    uint32_t roundCount = 5;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--calls") {
+            options.callCount = value;
+        } else if (name == "--batch") {
+            options.batchSize = std::max(value, 1u);
+        } else if (name == "--rounds") {
+            options.roundCount = std::max(value, 1u);
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** a small target: the draws are recorded, never rasterized */
+const VkExtent2D TARGET_EXTENT = {64, 64};
+
+struct Attachment {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+};
+
+struct Objects {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // the target of offscreen::Renderer: multisampled color and depth, resolved
+    Attachment color;
+    Attachment depth;
+    Attachment resolve;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+    Attachment texture;
+    sampler::SamplerCache samplerCache;
+    VkSampler sampler = VK_NULL_HANDLE;
+};
+
+static void createAttachment(
+    const headless::Device& headless,
+    VkSampleCountFlagBits sampleCount,
+    VkFormat format,
+    VkImageUsageFlags usage,
+    VkImageAspectFlags aspect,
+    Attachment& attachment
+) {
+    texture3::bindImageMemory(headless.physicalDevice_, headless.device_, TARGET_EXTENT.width, TARGET_EXTENT.height,
+        1, sampleCount, format, VK_IMAGE_TILING_OPTIMAL, usage, memory::GpuOnly, attachment.image, attachment.memory);
+    attachment.view = image2::createImageView(headless.device_, attachment.image, format, aspect, 1);
+}
+
+static void destroyAttachment(VkDevice device, Attachment& attachment) {
+    vkDestroyImageView(device, attachment.view, nullptr);
+    vkDestroyImage(device, attachment.image, nullptr);
+    memory::freeMemory(device, attachment.memory);
+}
+
+static void createObjects(const headless::Device& headless, Objects& objects) {
+    VkDevice device = headless.device_;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &objects.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = objects.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &objects.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers!");
+    }
+
+    // the render pass and the pipeline of the app
+    VkSampleCountFlagBits sampleCount = std::min(VK_SAMPLE_COUNT_4_BIT, device::getMaxUsableSampleCount(headless.physicalDevice_));
+    VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    VkFormat depthFormat = device::findSupportedDepthImageFormat(
+        headless.physicalDevice_,
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+    );
+    createAttachment(headless, sampleCount, colorFormat,
+        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+        objects.color);
+    createAttachment(headless, sampleCount, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        VK_IMAGE_ASPECT_DEPTH_BIT, objects.depth);
+    createAttachment(headless, VK_SAMPLE_COUNT_1_BIT, colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        VK_IMAGE_ASPECT_COLOR_BIT, objects.resolve);
+
+    pipeline5::createRenderPass(device, colorFormat, sampleCount, depthFormat, objects.renderPass,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    swapchain3::createFramebuffers(device, {objects.resolve.view}, TARGET_EXTENT, objects.depth.view,
+        objects.color.view, objects.renderPass, objects.framebuffers);
+
+    descriptor::createDescriptorSetLayout(device, descriptor::WriteDescriptorSet, objects.descriptorSetLayout);
+    pipeline5::createGraphicsPipeline(offscreen::DEFAULT_VERT_FILE, offscreen::DEFAULT_FRAG_FILE, device,
+        TARGET_EXTENT, sampleCount, objects.renderPass, objects.descriptorSetLayout, objects.pipelineLayout,
+        objects.pipeline);
+
+    descriptor::Binder binder;
+    descriptor::createBinder(device, descriptor::WriteDescriptorSet, objects.descriptorSetLayout,
+        objects.pipelineLayout, binder);
+    buffer2::createDescriptorPool(device, 1, objects.descriptorPool);
+    std::vector<VkDescriptorSet> sets;
+    descriptor::allocateDescriptorSets(device, binder, objects.descriptorPool, objects.descriptorSetLayout, 1, sets);
+    objects.descriptorSet = sets[0];
+
+    // one buffer for the uniform, the vertices and the indices: only bound, never read
+    const VkDeviceSize BUFFER_SIZE = 4096;
+    buffer2::bindBuffer(headless.physicalDevice_, device, BUFFER_SIZE,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        memory::GpuOnly, objects.buffer, objects.bufferMemory);
+
+    // the draws would sample it: the set has to be complete
+    const int TEXTURE_SIZE = 4;
+    std::vector<unsigned char> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 4, 128);
+    uint32_t mipLevels = texture3::createTextureImageFromPixels(headless.physicalDevice_, device,
+        objects.commandPool, headless.queue_, pixels.data(), TEXTURE_SIZE, TEXTURE_SIZE, VK_SAMPLE_COUNT_1_BIT,
+        objects.texture.image, objects.texture.memory);
+    texture3::createTextureImageView(device, objects.texture.image, objects.texture.view, mipLevels);
+    objects.samplerCache.init(headless.physicalDevice_, device);
+    // samplerAnisotropy is not enabled on the headless device
+    sampler::SamplerKey key = sampler::getTextureSamplerKey(1.0f);
+    key.anisotropyEnable = VK_FALSE;
+    objects.sampler = objects.samplerCache.acquire(key);
+
+    descriptor::PerDrawBindings bindings{};
+    bindings.uniformBuffer.buffer = objects.buffer;
+    bindings.uniformBuffer.offset = 0;
+    bindings.uniformBuffer.range = sizeof(buffer2::UniformBufferObject);
+    bindings.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    bindings.texture.imageView = objects.texture.view;
+    bindings.texture.sampler = objects.sampler;
+    descriptor::updateDescriptorSet(device, binder, objects.descriptorSet, bindings);
+    descriptor::destroyBinder(device, binder);
+}
+
+static void destroyObjects(VkDevice device, Objects& objects) {
+    objects.samplerCache.release(objects.sampler);
+    objects.samplerCache.destroy();
+    destroyAttachment(device, objects.texture);
+    vkDestroyBuffer(device, objects.buffer, nullptr);
+    memory::freeMemory(device, objects.bufferMemory);
+    vkDestroyDescriptorPool(device, objects.descriptorPool, nullptr);
+    vkDestroyPipeline(device, objects.pipeline, nullptr);
+    vkDestroyPipelineLayout(device, objects.pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, objects.descriptorSetLayout, nullptr);
+    for (VkFramebuffer framebuffer : objects.framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    vkDestroyRenderPass(device, objects.renderPass, nullptr);
+    destroyAttachment(device, objects.resolve);
+    destroyAttachment(device, objects.depth);
+    destroyAttachment(device, objects.color);
+    vkDestroyCommandPool(device, objects.commandPool, nullptr);
+}
+
+/**
+ * Table is either the exported functions or the loaded ones, same code for both.
+ * Returns the ns per call, 5 calls per draw
+ */
+static double record(const dispatch::DeviceTable& table, const Objects& objects, const BenchOptions& options) {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = objects.renderPass;
+    renderPassInfo.framebuffer = objects.framebuffers[0];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = TARGET_EXTENT;
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
+
+    VkDeviceSize offset = 0;
+    VkViewport viewport{0.0f, 0.0f, static_cast<float>(TARGET_EXTENT.width), static_cast<float>(TARGET_EXTENT.height), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, TARGET_EXTENT};
+
+    const uint32_t CALLS_PER_DRAW = 5;
+    uint32_t drawCount = options.callCount / CALLS_PER_DRAW;
+
+    // the resets, begins, pipeline binds... of each batch are in the timing too, the same for both tables
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < drawCount; i++) {
+        if (i % options.batchSize == 0) {
+            if (i > 0) {
+                table.vkCmdEndRenderPass(objects.commandBuffer);
+                table.vkEndCommandBuffer(objects.commandBuffer);
+            }
+            table.vkResetCommandBuffer(objects.commandBuffer, 0);
+            table.vkBeginCommandBuffer(objects.commandBuffer, &beginInfo);
+            table.vkCmdBeginRenderPass(objects.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            table.vkCmdBindPipeline(objects.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, objects.pipeline);
+            table.vkCmdSetScissor(objects.commandBuffer, 0, 1, &scissor);
+        }
+        table.vkCmdBindDescriptorSets(objects.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+            objects.pipelineLayout, 0, 1, &objects.descriptorSet, 0, nullptr);
+        table.vkCmdBindVertexBuffers(objects.commandBuffer, 0, 1, &objects.buffer, &offset);
+        table.vkCmdBindIndexBuffer(objects.commandBuffer, objects.buffer, 0, VK_INDEX_TYPE_UINT32);
+        table.vkCmdSetViewport(objects.commandBuffer, 0, 1, &viewport);
+        // the 3 first indices of the buffer, never read: nothing is submitted
+        table.vkCmdDrawIndexed(objects.commandBuffer, 3, 1, 0, 0, 0);
+    }
+    if (drawCount > 0) {
+        table.vkCmdEndRenderPass(objects.commandBuffer);
+    }
+    table.vkEndCommandBuffer(objects.commandBuffer);
+    double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    return elapsedNs / (static_cast<double>(drawCount) * CALLS_PER_DRAW);
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    // loads the dispatch tables too
+    headless.init("Dispatch bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName << '\n';
+
+    Objects objects;
+    createObjects(headless, objects);
+
+    // default constructed: the members are the exported functions
+    const dispatch::DeviceTable loaderTable;
+    const dispatch::DeviceTable& deviceTable = dispatch::getDeviceTable();
+    if (deviceTable.vkCmdBindDescriptorSets == loaderTable.vkCmdBindDescriptorSets) {
+        std::cout << "warning: vkGetDeviceProcAddr returned the exported functions, both columns are the same path\n";
+    }
+
+    // rounds alternate so that a frequency change doesn't favor one side, best of each is kept
+    double bestLoaderNs = 0.0;
+    double bestTableNs = 0.0;
+    for (uint32_t round = 0; round < options.roundCount; round++) {
+        double loaderNs = record(loaderTable, objects, options);
+        double tableNs = record(deviceTable, objects, options);
+        bestLoaderNs = round == 0 ? loaderNs : std::min(bestLoaderNs, loaderNs);
+        bestTableNs = round == 0 ? tableNs : std::min(bestTableNs, tableNs);
+        std::cout << "round " << round << ": loader " << loaderNs << " ns/call, table " << tableNs << " ns/call\n";
+    }
+
+    std::cout << "best of " << options.roundCount << " (" << options.callCount << " calls each):\n"
+        << "  loader trampolines: " << bestLoaderNs << " ns/call\n"
+        << "  device table:       " << bestTableNs << " ns/call\n"
+        << "  saved:              " << bestLoaderNs - bestTableNs << " ns/call ("
+        << (bestLoaderNs > 0.0 ? 100.0 * (bestLoaderNs - bestTableNs) / bestLoaderNs : 0.0) << "%)\n";
+
+    vkDeviceWaitIdle(headless.device_);
+    destroyObjects(headless.device_, objects);
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/**
+ * Headless benchmark of the mapped memory flushes (mapped.hpp)
+ *
+ * First checks the range math (alignment to nonCoherentAtomSize, merging),
+ * then for each mapped memory usage, "frames" of scattered writes are done in
+ * a persistently mapped buffer, like per object uniforms slots:
+ * * per write: one vkFlushMappedMemoryRanges after each write
+ * * batched: the writes are recorded in a mapped::FlushBatcher, one flush per frame
+ * For Readback the mapped memory is also read back after an invalidate.
+ * On coherent memory the flushes are skipped, both columns are then the raw write speed.
+ *
+ * usage: flush_bench [--frames F] [--writes W] [--slot-size S] [--buffer-mb M]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "buffer2.hpp"
+#include "headless.hpp"
+
+struct BenchOptions {
+    uint32_t frameCount = 1000;
+    uint32_t writeCount = 512;
+    uint32_t slotSize = 256;
+    uint32_t bufferMB = 8;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--frames") {
+            options.frameCount = value;
+        } else if (name == "--writes") {
+            options.writeCount = value;
+        } else if (name == "--slot-size") {
+            options.slotSize = value;
+        } else if (name == "--buffer-mb") {
+            options.bufferMB = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+static void expectRange(const mapped::Range& range, VkDeviceSize offset, VkDeviceSize size, const char* what) {
+    if (range.offset != offset || range.size != size) {
+        throw std::runtime_error(std::string("range check failed: ") + what
+            + " gives " + std::to_string(range.offset) + "+" + std::to_string(range.size)
+            + ", expected " + std::to_string(offset) + "+" + std::to_string(size));
+    }
+}
+
+/** the cases the flushes rely on, fails loudly rather than corrupting uniforms on some GPU */
+static void checkRanges() {
+    expectRange(mapped::alignRange(0, 64, 64, 1024), 0, 64, "aligned");
+    expectRange(mapped::alignRange(10, 4, 64, 1024), 0, 64, "inside one atom");
+    expectRange(mapped::alignRange(60, 8, 64, 1024), 0, 128, "across two atoms");
+    expectRange(mapped::alignRange(1000, 20, 64, 1024), 960, 64, "clamped to the allocation end");
+    expectRange(mapped::alignRange(1000, 50, 256, 1060), 768, 292, "clamped, not a multiple of the atom");
+    expectRange(mapped::alignRange(5, 3, 1, 1024), 5, 3, "atom of 1 byte");
+
+    std::vector<mapped::Range> ranges = {{256, 64}, {0, 64}, {64, 64}, {512, 64}, {300, 100}, {576, 0}};
+    mapped::mergeRanges(ranges);
+    if (ranges.size() != 3) {
+        throw std::runtime_error("range check failed: merge gives " + std::to_string(ranges.size()) + " ranges, expected 3");
+    }
+    expectRange(ranges[0], 0, 128, "merge of touching ranges");
+    expectRange(ranges[1], 256, 144, "merge of overlapping ranges");
+    expectRange(ranges[2], 512, 64, "merge of an empty range at the end");
+
+    std::vector<mapped::Range> empty;
+    mapped::mergeRanges(empty);
+    if (!empty.empty()) {
+        throw std::runtime_error("range check failed: merge of nothing");
+    }
+
+    std::cout << "range checks passed\n";
+}
+
+static const char* getUsageName(memory::Usage usage) {
+    switch (usage) {
+    case memory::Upload: return "Upload";
+    case memory::Readback: return "Readback";
+    case memory::Dynamic: return "Dynamic";
+    case memory::DirectUpload: return "DirectUpload";
+    default: return "GpuOnly";
+    }
+}
+
+static std::string getFlagsName(VkMemoryPropertyFlags flags) {
+    std::string name;
+    if (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) name += "DEVICE_LOCAL ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) name += "HOST_VISIBLE ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) name += "HOST_COHERENT ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) name += "HOST_CACHED ";
+    return name;
+}
+
+/** same slots for both modes, some consecutive (merged by the batcher), from a fixed seed */
+static std::vector<uint32_t> makeSlots(const BenchOptions& options, uint32_t slotCount, uint32_t frame) {
+    std::vector<uint32_t> slots(options.writeCount);
+    uint32_t state = 12345u + frame * 7919u;
+    uint32_t slot = 0;
+    for (auto& s : slots) {
+        state = state * 1664525u + 1013904223u;
+        // a run of objects, then a jump
+        slot = (state >> 28) < 12 ? slot + 1 : (state >> 8);
+        s = slot % slotCount;
+    }
+    return slots;
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Flush bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName
+        << ", nonCoherentAtomSize " << memory::getNonCoherentAtomSize() << '\n';
+
+    checkRanges();
+
+    VkDeviceSize bufferSize = static_cast<VkDeviceSize>(options.bufferMB) * 1024 * 1024;
+    uint32_t slotCount = static_cast<uint32_t>(bufferSize / options.slotSize);
+    std::vector<unsigned char> source(options.slotSize, 0x5a);
+    double frameMB = static_cast<double>(options.writeCount) * options.slotSize / (1024.0 * 1024.0);
+
+    // generated before the timings, the frames cycle through them
+    const uint32_t PATTERN_COUNT = 64;
+    std::vector<std::vector<uint32_t>> patterns;
+    for (uint32_t p = 0; p < PATTERN_COUNT; p++) {
+        patterns.push_back(makeSlots(options, slotCount, p));
+    }
+
+    for (memory::Usage usage : {memory::Dynamic, memory::Upload, memory::Readback, memory::DirectUpload}) {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+
+        if (usage == memory::DirectUpload) {
+            // only on UMA or ReBAR
+            if (!buffer2::bindDeviceBuffer(headless.physicalDevice_, headless.device_, bufferSize,
+                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, true, buffer, bufferMemory)) {
+                vkDestroyBuffer(headless.device_, buffer, nullptr);
+                memory::freeMemory(headless.device_, bufferMemory);
+                std::cout << getUsageName(usage) << ": no mappable device local memory\n";
+                continue;
+            }
+        } else {
+            buffer2::bindBuffer(headless.physicalDevice_, headless.device_, bufferSize,
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                usage, buffer, bufferMemory);
+        }
+
+        void* data;
+        vkMapMemory(headless.device_, bufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        auto mappedBytes = static_cast<unsigned char*>(data);
+
+        // per write
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < options.frameCount; frame++) {
+            for (uint32_t slot : patterns[frame % PATTERN_COUNT]) {
+                VkDeviceSize offset = static_cast<VkDeviceSize>(slot) * options.slotSize;
+                memcpy(mappedBytes + offset, source.data(), options.slotSize);
+                mapped::flush(headless.device_, bufferMemory, offset, options.slotSize);
+            }
+        }
+        double perWriteMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // batched
+        mapped::FlushBatcher batcher;
+        batcher.init(headless.device_);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < options.frameCount; frame++) {
+            for (uint32_t slot : patterns[frame % PATTERN_COUNT]) {
+                VkDeviceSize offset = static_cast<VkDeviceSize>(slot) * options.slotSize;
+                memcpy(mappedBytes + offset, source.data(), options.slotSize);
+                batcher.add(bufferMemory, offset, options.slotSize);
+            }
+            batcher.flush();
+        }
+        double batchedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        double totalMB = frameMB * options.frameCount;
+        std::cout << getUsageName(usage) << " [" << getFlagsName(memory::getAllocationInfo(bufferMemory).flags) << "]\n"
+            << "  per write: " << perWriteMs / options.frameCount << " ms/frame, " << totalMB / (perWriteMs / 1000.0) << " MB/s\n"
+            << "  batched:   " << batchedMs / options.frameCount << " ms/frame, " << totalMB / (batchedMs / 1000.0) << " MB/s, "
+            << batcher.getFlushCount() << " flushes, "
+            << (batcher.getFlushCount() ? batcher.getRangeCount() / batcher.getFlushCount() : 0)
+            << " ranges/flush for " << options.writeCount << " writes\n";
+
+        if (usage == memory::Readback) {
+            start = std::chrono::steady_clock::now();
+            uint64_t sum = 0;
+            for (uint32_t frame = 0; frame < options.frameCount; frame++) {
+                mapped::invalidate(headless.device_, bufferMemory, 0, bufferSize);
+                for (uint32_t slot : patterns[frame % PATTERN_COUNT]) {
+                    sum += mappedBytes[static_cast<VkDeviceSize>(slot) * options.slotSize];
+                }
+            }
+            double readMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            // sum printed so that the reads are not optimized out
+            std::cout << "  invalidate + read: " << readMs / options.frameCount << " ms/frame (checksum " << sum << ")\n";
+        }
+
+        vkUnmapMemory(headless.device_, bufferMemory);
+        vkDestroyBuffer(headless.device_, buffer, nullptr);
+        memory::freeMemory(headless.device_, bufferMemory);
+    }
+
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/**
+ * Headless benchmark of the frame loop (offscreen::Renderer, the hello_model_1 frame
+ * without window) and check that it doesn't allocate in steady state.
+ *
+ * After the warmup frames, the frame path scopes (drawFrame, recordCommandBuffer,
+ * updateUniformBuffer) must do no operator new at all: the bench fails otherwise.
+ * This covers offscreen::Renderer, hello_model_1 checks its own windowed loop the same way at exit.
+ * malloc is reported but only checked with --no-malloc 1, it includes the driver
+ * (lavapipe allocates its command lists while recording).
+ * The driver allocations also go through hostalloc, whose report gives them per scope.
+ *
+ * The hitches (frames way longer than the recent ones) are dumped with their causes.
+ * The GPU time and pipeline statistics of the pass and its draws (gpustats) are printed
+ * too, and written as JSON with --gpu-stats-json 1 (gpu_stats.json).
+ *
+ * --dump-every N copies one frame out of N to frames/frame_<index>.png through a
+ * readback::Ring: the copies are submitted after the frame and the PNG files written
+ * by a background thread, so the frames/s should barely move. The frames the ring
+ * had no room for are reported as dropped.
+ *
+ * Needs the .vscode "with heap counters" build (-DHEAPCOUNT_ENABLED) to check anything, and the compiled shaders.
+ *
+ * usage: frame_bench [--frames F] [--warmup W] [--width X] [--height Y] [--grid N] [--no-malloc 0|1]
+ *                    [--gpu-stats-json 0|1] [--dump-every N]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "headless.hpp"
+#include "offscreen.hpp"
+#include "hostalloc.hpp"
+#include "heapcount.hpp"
+#include "hitch.hpp"
+#include "readback.hpp"
+
+struct BenchOptions {
+    uint32_t frameCount = 1000;
+    uint32_t warmupFrameCount = 100;
+    uint32_t width = 800;
+    uint32_t height = 600;
+    uint32_t gridSize = 64;
+    bool noMalloc = false;
+    bool gpuStatsJson = false;
+    /** 0: no frame dump */
+    uint32_t dumpEvery = 0;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--frames") {
+            options.frameCount = value;
+        } else if (name == "--warmup") {
+            options.warmupFrameCount = value;
+        } else if (name == "--width") {
+            options.width = value;
+        } else if (name == "--height") {
+            options.height = value;
+        } else if (name == "--grid") {
+            options.gridSize = value;
+        } else if (name == "--no-malloc") {
+            options.noMalloc = value != 0;
+        } else if (name == "--gpu-stats-json") {
+            options.gpuStatsJson = value != 0;
+        } else if (name == "--dump-every") {
+            options.dumpEvery = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** a flat grid of gridSize x gridSize quads in the xy plane, centered on 0 */
+static void makeGrid(uint32_t gridSize, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    for (uint32_t y = 0; y <= gridSize; y++) {
+        for (uint32_t x = 0; x <= gridSize; x++) {
+            vertex3::Vertex vertex{};
+            float u = static_cast<float>(x) / gridSize;
+            float v = static_cast<float>(y) / gridSize;
+            vertex.pos = {u - 0.5f, v - 0.5f, 0.0f};
+            vertex.color = {1.0f, 1.0f, 1.0f};
+            vertex.texCoord = {u * 4.0f, v * 4.0f};
+            vertices.push_back(vertex);
+        }
+    }
+    uint32_t rowSize = gridSize + 1;
+    for (uint32_t y = 0; y < gridSize; y++) {
+        for (uint32_t x = 0; x < gridSize; x++) {
+            uint32_t corner = y * rowSize + x;
+            // counter clockwise, the pipeline culls the back faces
+            indices.insert(indices.end(), {corner, corner + 1, corner + rowSize + 1});
+            indices.insert(indices.end(), {corner, corner + rowSize + 1, corner + rowSize});
+        }
+    }
+}
+
+static buffer2::UniformBufferObject makeUniforms(uint32_t frame, VkExtent2D extent) {
+    buffer2::UniformBufferObject ubo{};
+    ubo.model = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.view = glm::lookAt(glm::vec3(0.0f, -1.0f, 1.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), extent.width / static_cast<float>(extent.height), 0.1f, 10.0f);
+    ubo.proj[1][1] *= -1;
+    return ubo;
+}
+
+static void run(const BenchOptions& options) {
+    // the driver allocations go through the callbacks, command scope ones in the arena
+    hostalloc::init(true, options.warmupFrameCount);
+    heapcount::init(options.warmupFrameCount);
+    hitch::init();
+
+    headless::Device headless;
+    headless.init("Frame bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+
+    offscreen::Renderer renderer;
+    renderer.init(headless, {options.width, options.height});
+
+    std::vector<vertex3::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    makeGrid(options.gridSize, vertices, indices);
+    renderer.uploadMesh(vertices, indices);
+
+    std::cout << "device: " << properties.deviceName << ", " << options.width << "x" << options.height
+        << " " << renderer.getSampleCount() << "x MSAA, " << indices.size() / 3 << " triangles\n";
+
+    readback::Ring ring;
+    if (options.dumpEvery > 0) {
+        std::filesystem::create_directories("frames");
+        ring.init(headless.physicalDevice_, headless.device_, headless.queue_, headless.queueFamilyIndex_,
+            renderer.getExtent(), renderer.getColorFormat(), "frames");
+    }
+
+    uint32_t totalFrameCount = options.warmupFrameCount + options.frameCount;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < totalFrameCount; frame++) {
+        if (frame == options.warmupFrameCount) {
+            renderer.waitIdle();
+            start = std::chrono::steady_clock::now();
+        }
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent()));
+        if (options.dumpEvery > 0) {
+            ring.poll();
+            if (frame % options.dumpEvery == 0) {
+                ring.capture(renderer.getResolveImage(), frame);
+            }
+        }
+        heapcount::endFrame();
+        hostalloc::endFrame();
+        hitch::endFrame();
+    }
+    renderer.waitIdle();
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << options.frameCount << " frames in " << elapsedMs << " ms: "
+        << options.frameCount / (elapsedMs / 1000.0) << " frames/s, "
+        << elapsedMs / options.frameCount << " ms/frame\n";
+
+    if (options.dumpEvery > 0) {
+        ring.flush();
+        readback::Stats stats = ring.getStats();
+        std::cout << "frame dumps: " << stats.written << " written to frames/, " << stats.dropped << " dropped, "
+            << stats.failed << " failed\n";
+        ring.destroy();
+    }
+
+    heapcount::printReport();
+    hostalloc::printReport();
+    renderer.getGpuStats().printReport();
+    hitch::dump();
+    if (options.gpuStatsJson) {
+        std::ofstream("gpu_stats.json") << renderer.getGpuStats().toJson() << '\n';
+        std::cout << "gpu stats written to gpu_stats.json\n";
+    }
+
+    renderer.cleanup();
+    headless.cleanup();
+
+    if (!heapcount::isEnabled()) {
+        std::cout << "built without HEAPCOUNT_ENABLED, the allocations were not checked\n";
+        return;
+    }
+
+    std::string failures;
+    for (const char* scope : {"offscreen::drawFrame", "offscreen::recordCommandBuffer", "offscreen::updateUniformBuffer"}) {
+        heapcount::ScopeStats stats = heapcount::getScopeStats(scope);
+        if (stats.steady.newCount > 0) {
+            failures += std::string("\n  ") + scope + ": " + std::to_string(stats.steady.newCount) + " new";
+        }
+        if (options.noMalloc && stats.steady.mallocCount > 0) {
+            failures += std::string("\n  ") + scope + ": " + std::to_string(stats.steady.mallocCount) + " malloc";
+        }
+    }
+    if (!failures.empty()) {
+        throw std::runtime_error("heap allocations in the steady state frame loop:" + failures);
+    }
+    std::cout << "no heap allocation in the frame loop after " << options.warmupFrameCount << " warmup frames\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,361 @@
+/**
+ * Headless bench of the geometry pool of offscreen::Renderer (geometrypool::Pool): a generated
+ * scene of N distinct meshes, one instance each, rendered three ways:
+ * - dedicated: a vertex and an index buffer per mesh, a bind of both and a draw per instance
+ *   (the way uploadMesh used to create them)
+ * - pooled: the meshes in one block of the pool, bound once, still a draw per instance
+ * - mdi: pooled, a vkCmdDrawIndexedIndirect per texture (one with --textures 1), the models
+ *   in a storage buffer
+ * Per mode: the upload time, the frame time and the CPU time of the command recording,
+ * what the submission costs the CPU at 10k meshes.
+ *
+ * Correctness:
+ * - frame --check-frame is read back in every mode and compared with the dedicated one:
+ *   the bench fails if more than 0.1% of the pixels differ (by more than a rounding of
+ *   the MSAA resolve)
+ * - --churn random loads and unloads of the meshes in a pool of their own, then everything
+ *   unloaded: the pool must be back to one free range per buffer of each block, nothing used
+ *
+ * usage: geometry_bench [--meshes N] [--triangles T] [--textures K] [--seed S] [--frames F]
+ *                       [--warmup W] [--check-frame C] [--churn L] [--width X] [--height Y]
+ */
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iomanip>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "headless.hpp"
+#include "offscreen.hpp"
+#include "geometrypool.hpp"
+#include "scene.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "commandbuffer.hpp"
+
+// a channel difference the MSAA resolve can make on its own
+const int PIXEL_TOLERANCE = 2;
+const double MAX_DIFFERENT_PIXELS = 0.001;
+
+struct BenchOptions {
+    uint32_t meshCount = 10000;
+    uint32_t triangleCount = 100;
+    uint32_t textureCount = 1;
+    uint64_t seed = 1;
+    uint32_t frameCount = 200;
+    uint32_t warmupFrameCount = 20;
+    uint32_t checkFrame = 10;
+    uint32_t churnCount = 100000;
+    uint32_t width = 800;
+    uint32_t height = 600;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        if (name == "--meshes") {
+            options.meshCount = number;
+        } else if (name == "--triangles") {
+            options.triangleCount = number;
+        } else if (name == "--textures") {
+            options.textureCount = number;
+        } else if (name == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "--frames") {
+            options.frameCount = number;
+        } else if (name == "--warmup") {
+            options.warmupFrameCount = number;
+        } else if (name == "--check-frame") {
+            options.checkFrame = number;
+        } else if (name == "--churn") {
+            options.churnCount = number;
+        } else if (name == "--width") {
+            options.width = number;
+        } else if (name == "--height") {
+            options.height = number;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** the whole cube in view, turning slowly around z */
+static buffer2::UniformBufferObject makeUniforms(uint32_t frame, VkExtent2D extent, float sceneExtent) {
+    buffer2::UniformBufferObject ubo{};
+    ubo.model = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.view = glm::lookAt(glm::vec3(0.0f, -2.5f * sceneExtent, 0.5f * sceneExtent), glm::vec3(0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(60.0f), extent.width / static_cast<float>(extent.height),
+        0.1f, 6.0f * sceneExtent);
+    ubo.proj[1][1] *= -1;
+    return ubo;
+}
+
+struct Mode {
+    bool pooling;
+    offscreen::Submission submission;
+    const char* name;
+};
+
+struct Result {
+    double uploadMs;
+    double frameMs;
+    double recordUs;
+    uint32_t blockCount;
+};
+
+/** the scene uploaded again in this mode, then the frames */
+static Result measure(offscreen::Renderer& renderer, const scene::Scene& generated, const BenchOptions& options,
+    const Mode& mode, float sceneExtent) {
+    renderer.setSubmission(offscreen::DrawPerInstance);
+    renderer.setGeometryPooling(mode.pooling);
+    renderer.setSubmission(mode.submission);
+
+    Result result;
+    auto uploadStart = std::chrono::steady_clock::now();
+    renderer.uploadScene(generated);
+    result.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+    result.blockCount = renderer.getGeometryStats().blockCount;
+
+    double recordMs = 0.0;
+    uint32_t totalFrameCount = options.warmupFrameCount + options.frameCount;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < totalFrameCount; frame++) {
+        if (frame == options.warmupFrameCount) {
+            renderer.waitIdle();
+            start = std::chrono::steady_clock::now();
+        }
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent(), sceneExtent));
+        if (frame >= options.warmupFrameCount) {
+            recordMs += renderer.getLastRecordMs();
+        }
+    }
+    renderer.waitIdle();
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    result.frameMs = elapsedMs / options.frameCount;
+    result.recordUs = recordMs * 1000.0 / options.frameCount;
+    return result;
+}
+
+/** frame checkFrame of the scene as measure left it, read back as RGBA8 */
+static std::vector<unsigned char> renderCheckFrame(
+    offscreen::Renderer& renderer,
+    const headless::Device& headless,
+    const BenchOptions& options,
+    float sceneExtent
+) {
+    renderer.drawFrame(makeUniforms(options.checkFrame, renderer.getExtent(), sceneExtent));
+    renderer.waitIdle();
+
+    VkExtent2D extent = renderer.getExtent();
+    VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+    VkBuffer buffer;
+    VkDeviceMemory bufferMemory;
+    buffer2::bindBuffer(headless.physicalDevice_, headless.device_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::Readback, buffer, bufferMemory);
+
+    VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(headless.device_, renderer.getCommandPool());
+    // the resolve of the last frame, already in TRANSFER_SRC_OPTIMAL
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, renderer.getResolveImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        buffer, 1, &region);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    commandbuffer::endAndExecuteSingleTimeCommands(headless.device_, renderer.getCommandPool(), headless.queue_,
+        commandBuffer);
+
+    std::vector<unsigned char> pixels(size);
+    void* mappedPixels;
+    vkMapMemory(headless.device_, bufferMemory, 0, VK_WHOLE_SIZE, 0, &mappedPixels);
+    mapped::invalidate(headless.device_, bufferMemory, 0, size);
+    memcpy(pixels.data(), mappedPixels, size);
+    vkUnmapMemory(headless.device_, bufferMemory);
+    vkDestroyBuffer(headless.device_, buffer, nullptr);
+    memory::freeMemory(headless.device_, bufferMemory);
+    return pixels;
+}
+
+/** the share of the pixels with a channel further than PIXEL_TOLERANCE */
+static double getDifferentPixels(const std::vector<unsigned char>& expected, const std::vector<unsigned char>& actual) {
+    size_t differentCount = 0;
+    for (size_t pixel = 0; pixel < expected.size(); pixel += 4) {
+        for (size_t channel = 0; channel < 4; channel++) {
+            if (std::abs(expected[pixel + channel] - actual[pixel + channel]) > PIXEL_TOLERANCE) {
+                differentCount++;
+                break;
+            }
+        }
+    }
+    return static_cast<double>(differentCount) / (expected.size() / 4);
+}
+
+/**
+ * churnCount loads or unloads of random meshes of the scene (one load per call, the way
+ * streaming would), in blocks of a tenth of the scene: holes, several blocks. Then
+ * everything unloaded: every range must be back and merged
+ */
+static bool testChurn(const headless::Device& headless, VkCommandPool commandPool, const scene::Scene& generated,
+    const BenchOptions& options) {
+    std::vector<std::vector<uint32_t>> indices(generated.meshes.size());
+    std::vector<geometrypool::MeshData> meshData(generated.meshes.size());
+    for (size_t i = 0; i < generated.meshes.size(); i++) {
+        const scene::Mesh& mesh = generated.meshes[i];
+        for (uint32_t j = 0; j < mesh.indexCount; j++) {
+            indices[i].push_back(generated.indices[mesh.firstIndex + j] - mesh.firstVertex);
+        }
+        meshData[i].vertices = generated.vertices.data() + mesh.firstVertex;
+        meshData[i].vertexCount = mesh.vertexCount;
+        meshData[i].indices = indices[i].data();
+        meshData[i].indexCount = mesh.indexCount;
+    }
+
+    geometrypool::Pool pool;
+    pool.init(headless.physicalDevice_, headless.device_, commandPool, headless.queue_,
+        std::max(static_cast<uint32_t>(generated.vertices.size() / 10), 1u),
+        std::max(static_cast<uint32_t>(generated.indices.size() / 10), 1u));
+
+    scene::Random random(options.seed);
+    std::vector<geometrypool::Mesh> loaded;
+    uint32_t loadCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.churnCount; i++) {
+        // unloads more likely as the pool fills: about half the scene in, once warm
+        uint32_t meshCount = static_cast<uint32_t>(meshData.size());
+        bool unload = random.nextIndex(meshCount) < loaded.size();
+        if (unload) {
+            uint32_t index = random.nextIndex(static_cast<uint32_t>(loaded.size()));
+            pool.unload(loaded[index]);
+            loaded[index] = loaded.back();
+            loaded.pop_back();
+            continue;
+        }
+        uint32_t mesh = random.nextIndex(meshCount);
+        loaded.push_back(pool.load(std::vector<geometrypool::MeshData>{meshData[mesh]})[0]);
+        loadCount++;
+    }
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    geometrypool::Stats busy = pool.getStats();
+
+    for (const auto& mesh : loaded) {
+        pool.unload(mesh);
+    }
+    geometrypool::Stats stats = pool.getStats();
+    pool.destroy();
+
+    bool passed = stats.meshCount == 0 && stats.usedVertexCount == 0 && stats.usedIndexCount == 0
+        && stats.freeRangeCount == 2 * stats.blockCount;
+    std::cout << "churn: " << options.churnCount << " loads and unloads, " << std::setprecision(1)
+        << loadCount / std::max(elapsedMs, 1e-6) << " loads/ms, " << busy.blockCount << " blocks, "
+        << busy.meshCount << " meshes and " << busy.freeRangeCount << " free ranges at the end, "
+        << "then all unloaded: " << stats.freeRangeCount << " free ranges "
+        << (passed ? "OK" : "FAILED") << '\n';
+    return passed;
+}
+
+static bool run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Geometry bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+
+    offscreen::Renderer renderer;
+    renderer.init(headless, {options.width, options.height});
+
+    // a mesh per instance: the draws can't be instanced, every one is a mesh of its own
+    scene::Config config;
+    config.seed = options.seed;
+    config.instanceCount = options.meshCount;
+    config.meshCount = options.meshCount;
+    config.triangleCount = options.triangleCount;
+    config.textureCount = options.textureCount;
+    config.textureSize = 64;
+    scene::Scene generated = scene::generate(config);
+
+    std::cout << "device: " << properties.deviceName << ", " << options.width << "x" << options.height
+        << " " << renderer.getSampleCount() << "x MSAA, seed " << options.seed << ", "
+        << options.meshCount << " meshes, " << generated.getTriangleCount() << " triangles, "
+        << options.textureCount << " textures, multiDrawIndirect "
+        << (headless.features_.multiDrawIndirect ? "yes" : "no") << "\n\n";
+
+    std::vector<Mode> modes = {
+        {false, offscreen::DrawPerInstance, "dedicated"},
+        {true, offscreen::DrawPerInstance, "pooled"}
+    };
+    if (headless.features_.drawIndirectFirstInstance) {
+        modes.push_back({true, offscreen::MultiDrawIndirect, "mdi"});
+    } else {
+        std::cout << "no drawIndirectFirstInstance: mdi skipped\n";
+    }
+
+    std::cout << std::setw(10) << "geometry" << std::setw(8) << "blocks" << std::setw(12) << "upload ms"
+        << std::setw(12) << "ms/frame" << std::setw(12) << "record us" << '\n';
+    bool passed = true;
+    std::vector<unsigned char> expected;
+    for (const Mode& mode : modes) {
+        Result result = measure(renderer, generated, options, mode, config.extent);
+        std::cout << std::fixed << std::setprecision(2)
+            << std::setw(10) << mode.name << std::setw(8) << result.blockCount
+            << std::setw(12) << result.uploadMs << std::setw(12) << result.frameMs
+            << std::setw(12) << std::setprecision(1) << result.recordUs << '\n';
+
+        std::vector<unsigned char> pixels = renderCheckFrame(renderer, headless, options, config.extent);
+        if (expected.empty()) {
+            expected = std::move(pixels);
+            continue;
+        }
+        double different = getDifferentPixels(expected, pixels);
+        bool modePassed = different <= MAX_DIFFERENT_PIXELS;
+        passed = passed && modePassed;
+        std::cout << "    frame " << options.checkFrame << ": " << std::setprecision(3) << different * 100.0
+            << "% of the pixels differ from dedicated " << (modePassed ? "OK" : "FAILED") << '\n';
+    }
+    std::cout << '\n';
+
+    passed = testChurn(headless, renderer.getCommandPool(), generated, options) && passed;
+
+    renderer.cleanup();
+    headless.cleanup();
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (!run(parseOptions(argc, argv))) {
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
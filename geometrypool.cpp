@@ -0,0 +1,362 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "geometrypool.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "commandbuffer.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
+
+namespace geometrypool {
+
+void RangeAllocator::init(uint32_t capacity) {
+    capacity_ = capacity;
+    freeCount_ = capacity;
+    freeRanges_.clear();
+    if (capacity > 0) {
+        freeRanges_[0] = capacity;
+    }
+}
+
+bool RangeAllocator::allocate(uint32_t count, uint32_t& offset) {
+    if (count == 0) {
+        offset = 0;
+        return true;
+    }
+    for (auto it = freeRanges_.begin(); it != freeRanges_.end(); ++it) {
+        if (it->second < count) {
+            continue;
+        }
+        offset = it->first;
+        uint32_t left = it->second - count;
+        freeRanges_.erase(it);
+        if (left > 0) {
+            freeRanges_[offset + count] = left;
+        }
+        freeCount_ -= count;
+        return true;
+    }
+    return false;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (offset + count > capacity_) {
+        throw std::invalid_argument("range freed out of the allocator!");
+    }
+    freeCount_ += count;
+
+    auto next = freeRanges_.lower_bound(offset);
+    if (next != freeRanges_.end() && next->first == offset + count) {
+        count += next->second;
+        next = freeRanges_.erase(next);
+    }
+    if (next != freeRanges_.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += count;
+            return;
+        }
+    }
+    freeRanges_[offset] = count;
+}
+
+uint32_t RangeAllocator::getCapacity() const {
+    return capacity_;
+}
+
+uint32_t RangeAllocator::getFreeCount() const {
+    return freeCount_;
+}
+
+uint32_t RangeAllocator::getLargestFreeRange() const {
+    uint32_t largest = 0;
+    for (const auto& range : freeRanges_) {
+        largest = std::max(largest, range.second);
+    }
+    return largest;
+}
+
+uint32_t RangeAllocator::getFreeRangeCount() const {
+    return static_cast<uint32_t>(freeRanges_.size());
+}
+
+void Pool::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue queue,
+    uint32_t blockVertexCount,
+    uint32_t blockIndexCount
+) {
+    physicalDevice_ = physicalDevice;
+    device_ = logicalDevice;
+    commandPool_ = commandPool;
+    queue_ = queue;
+    // both or none: a block per mesh
+    if ((blockVertexCount == 0) != (blockIndexCount == 0)) {
+        throw std::invalid_argument("geometry pool with a block size of 0 for the vertices or the indices only!");
+    }
+    blockVertexCount_ = blockVertexCount;
+    blockIndexCount_ = blockIndexCount;
+}
+
+uint32_t Pool::addBlock(uint32_t vertexCount, uint32_t indexCount) {
+    PROFILE_SCOPE("geometrypool::Pool::addBlock");
+    uint32_t index;
+    if (!freeBlocks_.empty()) {
+        index = freeBlocks_.back();
+        freeBlocks_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(blocks_.size());
+        blocks_.emplace_back();
+    }
+    Block& block = blocks_[index];
+
+    // never empty buffers: a mesh without indices still gets a block
+    vertexCount = std::max(vertexCount, 1u);
+    indexCount = std::max(indexCount, 1u);
+    bool directVertices = buffer2::bindDeviceBuffer(physicalDevice_, device_, vertexCount * sizeof(vertex3::Vertex),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, true, block.vertexBuffer, block.vertexMemory);
+    if (directVertices) {
+        vkMapMemory(device_, block.vertexMemory, 0, VK_WHOLE_SIZE, 0, &block.mappedVertices);
+    }
+    bool directIndices = buffer2::bindDeviceBuffer(physicalDevice_, device_, indexCount * sizeof(uint32_t),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT, true, block.indexBuffer, block.indexMemory);
+    if (directIndices) {
+        vkMapMemory(device_, block.indexMemory, 0, VK_WHOLE_SIZE, 0, &block.mappedIndices);
+    }
+    block.vertices.init(vertexCount);
+    block.indices.init(indexCount);
+    block.meshCount = 0;
+    return index;
+}
+
+void Pool::destroyBlock(Block& block) {
+    if (block.mappedVertices != nullptr) {
+        vkUnmapMemory(device_, block.vertexMemory);
+    }
+    if (block.mappedIndices != nullptr) {
+        vkUnmapMemory(device_, block.indexMemory);
+    }
+    vkDestroyBuffer(device_, block.vertexBuffer, nullptr);
+    memory::freeMemory(device_, block.vertexMemory);
+    vkDestroyBuffer(device_, block.indexBuffer, nullptr);
+    memory::freeMemory(device_, block.indexMemory);
+    block = Block{};
+}
+
+uint32_t Pool::findBlock(uint32_t vertexCount, uint32_t indexCount) const {
+    for (uint32_t i = 0; i < blocks_.size(); i++) {
+        const Block& block = blocks_[i];
+        if (block.vertices.getLargestFreeRange() >= vertexCount && block.indices.getLargestFreeRange() >= indexCount) {
+            return i;
+        }
+    }
+    return getBlockCount();
+}
+
+void Pool::reserve(uint32_t vertexCount, uint32_t indexCount) {
+    if (isPooled() && findBlock(vertexCount, indexCount) == getBlockCount()) {
+        addBlock(std::max(vertexCount, blockVertexCount_), std::max(indexCount, blockIndexCount_));
+    }
+}
+
+Mesh Pool::allocate(uint32_t vertexCount, uint32_t indexCount, uint32_t block) {
+    Mesh mesh;
+    mesh.vertexCount = vertexCount;
+    mesh.indexCount = indexCount;
+    if (isPooled()) {
+        const Block* preferred = block < blocks_.size() ? &blocks_[block] : nullptr;
+        if (preferred == nullptr || preferred->vertices.getLargestFreeRange() < vertexCount
+            || preferred->indices.getLargestFreeRange() < indexCount) {
+            block = findBlock(vertexCount, indexCount);
+        }
+        if (block < blocks_.size()) {
+            Block& found = blocks_[block];
+            found.vertices.allocate(vertexCount, mesh.firstVertex);
+            found.indices.allocate(indexCount, mesh.firstIndex);
+            found.meshCount++;
+            mesh.block = block;
+            return mesh;
+        }
+    }
+
+    uint32_t blockVertexCount = isPooled() ? std::max(vertexCount, blockVertexCount_) : vertexCount;
+    uint32_t blockIndexCount = isPooled() ? std::max(indexCount, blockIndexCount_) : indexCount;
+    mesh.block = addBlock(blockVertexCount, blockIndexCount);
+    Block& block = blocks_[mesh.block];
+    block.vertices.allocate(vertexCount, mesh.firstVertex);
+    block.indices.allocate(indexCount, mesh.firstIndex);
+    block.meshCount++;
+    return mesh;
+}
+
+Mesh Pool::load(const std::vector<vertex3::Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    MeshData data;
+    data.vertices = vertices.data();
+    data.vertexCount = static_cast<uint32_t>(vertices.size());
+    data.indices = indices.data();
+    data.indexCount = static_cast<uint32_t>(indices.size());
+    return load(std::vector<MeshData>{data})[0];
+}
+
+std::vector<Mesh> Pool::load(const std::vector<MeshData>& meshes) {
+    PROFILE_SCOPE("geometrypool::Pool::load");
+    // a block with a free range of the size of the whole batch: the ranges of the meshes fit in it whatever
+    // the smaller ranges before it they take
+    uint32_t block = getBlockCount();
+    if (isPooled()) {
+        uint64_t vertexCount = 0;
+        uint64_t indexCount = 0;
+        for (const MeshData& data : meshes) {
+            vertexCount += data.vertexCount;
+            indexCount += data.indexCount;
+        }
+        if (vertexCount > UINT32_MAX || indexCount > UINT32_MAX) {
+            throw std::invalid_argument("geometry pool load bigger than a block can be!");
+        }
+        reserve(static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(indexCount));
+        block = findBlock(static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(indexCount));
+    }
+
+    std::vector<Mesh> loaded;
+    loaded.reserve(meshes.size());
+    for (const MeshData& data : meshes) {
+        loaded.push_back(allocate(data.vertexCount, data.indexCount, block));
+    }
+
+    // written in place when the block is mapped, staged otherwise
+    VkDeviceSize stagingSize = 0;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Block& block = blocks_[loaded[i].block];
+        if (block.mappedVertices == nullptr) {
+            stagingSize += meshes[i].vertexCount * sizeof(vertex3::Vertex);
+        }
+        if (block.mappedIndices == nullptr) {
+            stagingSize += meshes[i].indexCount * sizeof(uint32_t);
+        }
+    }
+    if (stagingSize > 0) {
+        buffer2::reserveStagingBuffer(physicalDevice_, device_, stagingSize, staging_);
+    }
+
+    // the copies per destination buffer, all in one submission
+    std::map<VkBuffer, std::vector<VkBufferCopy>> copies;
+    VkDeviceSize stagingOffset = 0;
+    auto write = [&](void* mapped, VkDeviceMemory memory, VkBuffer buffer, VkDeviceSize offset, const void* data,
+        VkDeviceSize size) {
+        if (size == 0) {
+            return;
+        }
+        if (mapped != nullptr) {
+            memcpy(static_cast<char*>(mapped) + offset, data, static_cast<size_t>(size));
+            mapped::flush(device_, memory, offset, size);
+            return;
+        }
+        memcpy(static_cast<char*>(staging_.mapped) + stagingOffset, data, static_cast<size_t>(size));
+        copies[buffer].push_back(VkBufferCopy{stagingOffset, offset, size});
+        stagingOffset += size;
+    };
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Block& block = blocks_[loaded[i].block];
+        write(block.mappedVertices, block.vertexMemory, block.vertexBuffer,
+            loaded[i].firstVertex * sizeof(vertex3::Vertex), meshes[i].vertices,
+            meshes[i].vertexCount * sizeof(vertex3::Vertex));
+        write(block.mappedIndices, block.indexMemory, block.indexBuffer,
+            loaded[i].firstIndex * sizeof(uint32_t), meshes[i].indices, meshes[i].indexCount * sizeof(uint32_t));
+    }
+
+    if (!copies.empty()) {
+        mapped::flush(device_, staging_.memory, 0, stagingOffset);
+        const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+        VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(device_, commandPool_);
+        for (const auto& copy : copies) {
+            table.vkCmdCopyBuffer(commandBuffer, staging_.buffer, copy.first,
+                static_cast<uint32_t>(copy.second.size()), copy.second.data());
+        }
+        commandbuffer::endAndExecuteSingleTimeCommands(device_, commandPool_, queue_, commandBuffer);
+    }
+    return loaded;
+}
+
+void Pool::unload(const Mesh& mesh) {
+    if (mesh.block >= blocks_.size() || blocks_[mesh.block].meshCount == 0) {
+        throw std::invalid_argument("mesh unloaded from a block without meshes!");
+    }
+    Block& block = blocks_[mesh.block];
+    block.vertices.free(mesh.firstVertex, mesh.vertexCount);
+    block.indices.free(mesh.firstIndex, mesh.indexCount);
+    block.meshCount--;
+    if (!isPooled()) {
+        destroyBlock(block);
+        freeBlocks_.push_back(mesh.block);
+    }
+}
+
+void Pool::bind(VkCommandBuffer commandBuffer, uint32_t block) const {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    VkDeviceSize offset = 0;
+    table.vkCmdBindVertexBuffers(commandBuffer, 0, 1, &blocks_[block].vertexBuffer, &offset);
+    table.vkCmdBindIndexBuffer(commandBuffer, blocks_[block].indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+VkDrawIndexedIndirectCommand Pool::getDrawCommand(const Mesh& mesh, uint32_t firstInstance) const {
+    VkDrawIndexedIndirectCommand command{};
+    command.indexCount = mesh.indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = mesh.firstIndex;
+    command.vertexOffset = static_cast<int32_t>(mesh.firstVertex);
+    command.firstInstance = firstInstance;
+    return command;
+}
+
+bool Pool::isPooled() const {
+    return blockVertexCount_ > 0;
+}
+
+uint32_t Pool::getBlockCount() const {
+    return static_cast<uint32_t>(blocks_.size());
+}
+
+VkBuffer Pool::getVertexBuffer(uint32_t block) const {
+    return blocks_[block].vertexBuffer;
+}
+
+VkBuffer Pool::getIndexBuffer(uint32_t block) const {
+    return blocks_[block].indexBuffer;
+}
+
+Stats Pool::getStats() const {
+    Stats stats;
+    for (const Block& block : blocks_) {
+        if (block.vertexBuffer == VK_NULL_HANDLE) {
+            continue;
+        }
+        stats.blockCount++;
+        stats.meshCount += block.meshCount;
+        stats.vertexCapacity += block.vertices.getCapacity();
+        stats.usedVertexCount += block.vertices.getCapacity() - block.vertices.getFreeCount();
+        stats.indexCapacity += block.indices.getCapacity();
+        stats.usedIndexCount += block.indices.getCapacity() - block.indices.getFreeCount();
+        stats.freeRangeCount += block.vertices.getFreeRangeCount() + block.indices.getFreeRangeCount();
+    }
+    return stats;
+}
+
+void Pool::destroy() {
+    for (Block& block : blocks_) {
+        if (block.vertexBuffer != VK_NULL_HANDLE) {
+            destroyBlock(block);
+        }
+    }
+    blocks_.clear();
+    freeBlocks_.clear();
+    buffer2::destroyStagingBuffer(device_, staging_);
+}
+
+}
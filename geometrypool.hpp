@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "buffer2.hpp"
+#include "vertex3.hpp"
+
+namespace geometrypool {
+
+/**
+ * The meshes in a few big device local buffers instead of a vertex and an index buffer
+ * each (buffer2::createBuffer per mesh): a mesh is a range of vertices and a range of
+ * indices of a block, drawn with its firstIndex and its vertexOffset. The draws of all
+ * the meshes of a block need one bind of its buffers, and can be one
+ * vkCmdDrawIndexedIndirect.
+ *
+ * A block is a vertex buffer and an index buffer, each with a first fit allocator of its
+ * elements. A load takes ranges from the first block with room, adding a block when none
+ * has (at least the default size, more for a bigger mesh); an unload gives them back,
+ * merged with the free neighbours. The blocks stay until destroy, empty or not.
+ *
+ * The indices of a mesh are relative to its first vertex (the vertexOffset of the draw
+ * adds it). Like buffer2::createBuffer the memory is device local, written in place when
+ * it is also host visible (lavapipe, UMA), through one staging copy per load otherwise.
+ *
+ * With a block size of 0 every mesh gets a block of its own, sized to it and destroyed by
+ * its unload: the buffers of one mesh each, for the benchmarks to compare against.
+ * Loading never touches the ranges of the other meshes, unloading a mesh must wait for the
+ * frames drawing it to be done
+ */
+const uint32_t DEFAULT_BLOCK_VERTEX_COUNT = 1 << 20;
+const uint32_t DEFAULT_BLOCK_INDEX_COUNT = 1 << 22;
+
+/** first fit over the free ranges of [0, capacity) */
+class RangeAllocator {
+public:
+    void init(uint32_t capacity);
+    /** false if no free range holds count elements */
+    bool allocate(uint32_t count, uint32_t& offset);
+    /** an allocated range, merged with the free ranges around it */
+    void free(uint32_t offset, uint32_t count);
+
+    uint32_t getCapacity() const;
+    uint32_t getFreeCount() const;
+    uint32_t getLargestFreeRange() const;
+    uint32_t getFreeRangeCount() const;
+
+private:
+    uint32_t capacity_ = 0;
+    uint32_t freeCount_ = 0;
+    /** offset -> count, never two adjacent ones */
+    std::map<uint32_t, uint32_t> freeRanges_;
+};
+
+struct Mesh {
+    uint32_t block = 0;
+    uint32_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+};
+
+/** what a load reads, the indices relative to the first vertex */
+struct MeshData {
+    const vertex3::Vertex* vertices = nullptr;
+    uint32_t vertexCount = 0;
+    const uint32_t* indices = nullptr;
+    uint32_t indexCount = 0;
+};
+
+struct Stats {
+    uint32_t blockCount = 0;
+    uint32_t meshCount = 0;
+    uint64_t vertexCapacity = 0;
+    uint64_t usedVertexCount = 0;
+    uint64_t indexCapacity = 0;
+    uint64_t usedIndexCount = 0;
+    /** vertex and index ranges: how fragmented the blocks are */
+    uint32_t freeRangeCount = 0;
+};
+
+class Pool {
+public:
+    /** blockVertexCount, blockIndexCount: 0 for a block per mesh */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        VkCommandPool commandPool,
+        VkQueue queue,
+        uint32_t blockVertexCount = DEFAULT_BLOCK_VERTEX_COUNT,
+        uint32_t blockIndexCount = DEFAULT_BLOCK_INDEX_COUNT
+    );
+
+    /**
+     * makes sure one block has a free range of vertexCount vertices and one of indexCount
+     * indices, adding a block otherwise: loads of that much in total then share a block.
+     * Nothing to do with a block per mesh
+     */
+    void reserve(uint32_t vertexCount, uint32_t indexCount);
+
+    Mesh load(const std::vector<vertex3::Vertex>& vertices, const std::vector<uint32_t>& indices);
+    /**
+     * all of them with one staging copy, in the order given. Pooled, they all go in the first
+     * block with room for the whole batch (a new one if none has): a scene is one bind and
+     * can be one multi draw
+     */
+    std::vector<Mesh> load(const std::vector<MeshData>& meshes);
+
+    /** its ranges go back to its block */
+    void unload(const Mesh& mesh);
+
+    /** the vertex and index buffers of the block, for the draws of its meshes */
+    void bind(VkCommandBuffer commandBuffer, uint32_t block) const;
+
+    /** instanceCount 1 */
+    VkDrawIndexedIndirectCommand getDrawCommand(const Mesh& mesh, uint32_t firstInstance = 0) const;
+
+    bool isPooled() const;
+    /** the block indices are below it, the destroyed blocks of a block per mesh included */
+    uint32_t getBlockCount() const;
+    VkBuffer getVertexBuffer(uint32_t block) const;
+    VkBuffer getIndexBuffer(uint32_t block) const;
+    Stats getStats() const;
+
+    /** the device must be done with the meshes */
+    void destroy();
+
+private:
+    struct Block {
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory vertexMemory = VK_NULL_HANDLE;
+        /** written in place when not null */
+        void* mappedVertices = nullptr;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+        void* mappedIndices = nullptr;
+        RangeAllocator vertices;
+        RangeAllocator indices;
+        uint32_t meshCount = 0;
+    };
+
+    uint32_t addBlock(uint32_t vertexCount, uint32_t indexCount);
+    void destroyBlock(Block& block);
+    /** the first block with a free range of each, getBlockCount() if none */
+    uint32_t findBlock(uint32_t vertexCount, uint32_t indexCount) const;
+    /** the ranges of a mesh, in block if it has room, else the first block with room, else a new one */
+    Mesh allocate(uint32_t vertexCount, uint32_t indexCount, uint32_t block);
+
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkCommandPool commandPool_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    uint32_t blockVertexCount_ = 0;
+    uint32_t blockIndexCount_ = 0;
+
+    std::vector<Block> blocks_;
+    /** with a block per mesh: the blocks of the unloaded meshes, destroyed, to reuse */
+    std::vector<uint32_t> freeBlocks_;
+    buffer2::StagingBuffer staging_;
+};
+
+}
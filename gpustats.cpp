@@ -0,0 +1,364 @@
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+#include "gpustats.hpp"
+#include "dispatch.hpp"
+
+namespace gpustats {
+
+const VkQueryPipelineStatisticFlags STATISTICS_FLAGS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+// the 6 counters then the availability
+const uint32_t STATISTICS_VALUE_COUNT = 6 + 1;
+// the timestamp then the availability
+const uint32_t TIMESTAMP_VALUE_COUNT = 2;
+
+static void add(PipelineStatistics& total, const PipelineStatistics& value) {
+    total.inputAssemblyVertices += value.inputAssemblyVertices;
+    total.inputAssemblyPrimitives += value.inputAssemblyPrimitives;
+    total.vertexShaderInvocations += value.vertexShaderInvocations;
+    total.clippingInvocations += value.clippingInvocations;
+    total.clippingPrimitives += value.clippingPrimitives;
+    total.fragmentShaderInvocations += value.fragmentShaderInvocations;
+}
+
+void Recorder::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    uint32_t queueFamilyIndex,
+    uint32_t frameSlotCount,
+    uint32_t maxRangesPerFrame
+) {
+    device_ = logicalDevice;
+    maxRanges_ = maxRangesPerFrame;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriodNs_ = properties.limits.timestampPeriod;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    timestampMask_ = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+    if (validBits > 0) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        // begin and end of each range
+        poolInfo.queryCount = frameSlotCount * maxRanges_ * 2;
+        if (vkCreateQueryPool(device_, &poolInfo, nullptr, &timestampPool_) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+    }
+
+    // enabled at device creation whenever supported
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+    if (features.pipelineStatisticsQuery) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        // same index as the range, the passes leave theirs unused
+        poolInfo.queryCount = frameSlotCount * maxRanges_;
+        poolInfo.pipelineStatistics = STATISTICS_FLAGS;
+        if (vkCreateQueryPool(device_, &poolInfo, nullptr, &statisticsPool_) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline statistics query pool!");
+        }
+    }
+
+    slots_.assign(frameSlotCount, Slot{});
+    for (auto& slot : slots_) {
+        slot.ranges.reserve(maxRanges_);
+    }
+    timestampResults_.resize(maxRanges_ * 2 * TIMESTAMP_VALUE_COUNT);
+    statisticsResults_.resize(maxRanges_ * STATISTICS_VALUE_COUNT);
+    lastFrame_.reserve(maxRanges_);
+    summaries_.reserve(maxRanges_ * 2);
+}
+
+void Recorder::destroy() {
+    if (timestampPool_ != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device_, timestampPool_, nullptr);
+        timestampPool_ = VK_NULL_HANDLE;
+    }
+    if (statisticsPool_ != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device_, statisticsPool_, nullptr);
+        statisticsPool_ = VK_NULL_HANDLE;
+    }
+}
+
+bool Recorder::hasTimestamps() const {
+    return timestampPool_ != VK_NULL_HANDLE;
+}
+
+bool Recorder::hasStatistics() const {
+    return statisticsPool_ != VK_NULL_HANDLE;
+}
+
+void Recorder::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+
+    if (slots_[frameSlot].recorded) {
+        readBack(frameSlot);
+    }
+
+    Slot& slot = slots_[frameSlot];
+    slot.ranges.clear();
+    slot.recorded = true;
+    currentSlot_ = frameSlot;
+    openPass_ = -1;
+    openDraws_ = -1;
+
+    // a query must be reset before being written again, outside of a render pass
+    if (hasTimestamps()) {
+        table.vkCmdResetQueryPool(commandBuffer, timestampPool_, frameSlot * maxRanges_ * 2, maxRanges_ * 2);
+    }
+    if (hasStatistics()) {
+        table.vkCmdResetQueryPool(commandBuffer, statisticsPool_, frameSlot * maxRanges_, maxRanges_);
+    }
+}
+
+uint32_t Recorder::beginRange(VkCommandBuffer commandBuffer, const char* name, bool pass) {
+    Slot& slot = slots_[currentSlot_];
+    if (slot.ranges.size() == maxRanges_) {
+        throw std::runtime_error("more than " + std::to_string(maxRanges_) + " gpu stats ranges in a frame!");
+    }
+
+    uint32_t index = static_cast<uint32_t>(slot.ranges.size());
+    slot.ranges.push_back(Range{name, pass, false, pass ? -1 : openPass_, false});
+
+    if (hasTimestamps()) {
+        dispatch::getDeviceTable().vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            timestampPool_, (currentSlot_ * maxRanges_ + index) * 2);
+    }
+    return index;
+}
+
+void Recorder::beginPass(VkCommandBuffer commandBuffer, const char* name) {
+    if (openPass_ != -1) {
+        throw std::runtime_error("gpu stats passes can't nest!");
+    }
+    openPass_ = static_cast<int32_t>(beginRange(commandBuffer, name, true));
+}
+
+void Recorder::endPass(VkCommandBuffer commandBuffer) {
+    if (openPass_ == -1) {
+        throw std::runtime_error("no gpu stats pass to end!");
+    }
+    if (hasTimestamps()) {
+        dispatch::getDeviceTable().vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            timestampPool_, (currentSlot_ * maxRanges_ + openPass_) * 2 + 1);
+    }
+    slots_[currentSlot_].ranges[openPass_].ended = true;
+    openPass_ = -1;
+}
+
+void Recorder::beginDraws(VkCommandBuffer commandBuffer, const char* name) {
+    if (openDraws_ != -1) {
+        throw std::runtime_error("gpu stats draw ranges can't nest!");
+    }
+    uint32_t index = beginRange(commandBuffer, name, false);
+    openDraws_ = static_cast<int32_t>(index);
+
+    if (hasStatistics()) {
+        dispatch::getDeviceTable().vkCmdBeginQuery(commandBuffer, statisticsPool_, currentSlot_ * maxRanges_ + index, 0);
+        slots_[currentSlot_].ranges[index].hasStatistics = true;
+    }
+}
+
+void Recorder::endDraws(VkCommandBuffer commandBuffer) {
+    if (openDraws_ == -1) {
+        throw std::runtime_error("no gpu stats draw range to end!");
+    }
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    uint32_t query = currentSlot_ * maxRanges_ + openDraws_;
+    if (hasStatistics()) {
+        table.vkCmdEndQuery(commandBuffer, statisticsPool_, query);
+    }
+    if (hasTimestamps()) {
+        table.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool_, query * 2 + 1);
+    }
+    slots_[currentSlot_].ranges[openDraws_].ended = true;
+    openDraws_ = -1;
+}
+
+void Recorder::readBack(uint32_t frameSlot) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    const Slot& slot = slots_[frameSlot];
+    uint32_t rangeCount = static_cast<uint32_t>(slot.ranges.size());
+    if (rangeCount == 0) {
+        return;
+    }
+
+    // no VK_QUERY_RESULT_WAIT_BIT: the fence of the slot was waited, and an unavailable
+    // query is skipped rather than stalling the frame. VK_NOT_READY is expected for
+    // the statistics queries the passes leave unused
+    const VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+    if (hasTimestamps()) {
+        table.vkGetQueryPoolResults(device_, timestampPool_, frameSlot * maxRanges_ * 2, rangeCount * 2,
+            rangeCount * 2 * TIMESTAMP_VALUE_COUNT * sizeof(uint64_t), timestampResults_.data(),
+            TIMESTAMP_VALUE_COUNT * sizeof(uint64_t), flags);
+    }
+    if (hasStatistics()) {
+        table.vkGetQueryPoolResults(device_, statisticsPool_, frameSlot * maxRanges_, rangeCount,
+            rangeCount * STATISTICS_VALUE_COUNT * sizeof(uint64_t), statisticsResults_.data(),
+            STATISTICS_VALUE_COUNT * sizeof(uint64_t), flags);
+    }
+
+    lastFrame_.clear();
+    bool missed = false;
+    for (uint32_t i = 0; i < rangeCount; i++) {
+        const Range& range = slot.ranges[i];
+        RangeStats stats;
+        stats.name = range.name;
+        stats.pass = range.pass;
+
+        if (hasTimestamps() && range.ended) {
+            const uint64_t* begin = &timestampResults_[i * 2 * TIMESTAMP_VALUE_COUNT];
+            const uint64_t* end = begin + TIMESTAMP_VALUE_COUNT;
+            if (begin[1] && end[1]) {
+                uint64_t ticks = (end[0] - begin[0]) & timestampMask_;
+                stats.gpuMs = ticks * timestampPeriodNs_ / 1e6;
+            } else {
+                missed = true;
+            }
+        }
+
+        if (range.hasStatistics && range.ended) {
+            const uint64_t* values = &statisticsResults_[i * STATISTICS_VALUE_COUNT];
+            if (values[6]) {
+                stats.hasStatistics = true;
+                stats.statistics.inputAssemblyVertices = values[0];
+                stats.statistics.inputAssemblyPrimitives = values[1];
+                stats.statistics.vertexShaderInvocations = values[2];
+                stats.statistics.clippingInvocations = values[3];
+                stats.statistics.clippingPrimitives = values[4];
+                stats.statistics.fragmentShaderInvocations = values[5];
+            } else {
+                missed = true;
+            }
+        }
+        lastFrame_.push_back(stats);
+    }
+
+    // the statistics of a pass: the sum of its draw ranges
+    for (uint32_t i = 0; i < rangeCount; i++) {
+        int32_t parent = slot.ranges[i].parent;
+        if (parent >= 0 && lastFrame_[i].hasStatistics) {
+            lastFrame_[parent].hasStatistics = true;
+            add(lastFrame_[parent].statistics, lastFrame_[i].statistics);
+        }
+    }
+
+    if (missed) {
+        missedFrameCount_++;
+        return;
+    }
+    for (const auto& stats : lastFrame_) {
+        accumulate(stats);
+    }
+}
+
+void Recorder::accumulate(const RangeStats& stats) {
+    auto summary = std::find_if(summaries_.begin(), summaries_.end(), [&stats](const RangeSummary& s) {
+        return s.pass == stats.pass && (s.name == stats.name || strcmp(s.name, stats.name) == 0);
+    });
+    if (summary == summaries_.end()) {
+        RangeSummary created;
+        created.name = stats.name;
+        created.pass = stats.pass;
+        summaries_.push_back(created);
+        summary = summaries_.end() - 1;
+    }
+
+    summary->frameCount++;
+    summary->totalGpuMs += stats.gpuMs;
+    summary->maxGpuMs = std::max(summary->maxGpuMs, stats.gpuMs);
+    if (stats.hasStatistics) {
+        summary->hasStatistics = true;
+        add(summary->statistics, stats.statistics);
+    }
+}
+
+const std::vector<RangeStats>& Recorder::getLastFrame() const {
+    return lastFrame_;
+}
+
+const std::vector<RangeSummary>& Recorder::getSummaries() const {
+    return summaries_;
+}
+
+uint64_t Recorder::getMissedFrameCount() const {
+    return missedFrameCount_;
+}
+
+void Recorder::printReport() const {
+    std::cout << std::fixed << std::setprecision(3)
+        << "gpu stats (" << (hasTimestamps() ? "timestamps" : "no timestamps") << ", "
+        << (hasStatistics() ? "pipeline statistics" : "no pipeline statistics") << ", "
+        << missedFrameCount_ << " frames missed), averages per frame\n"
+        << "      gpu ms    max ms   ia verts   ia prims   vs invoc  clip prim   fs invoc  fs/vs  range\n";
+    for (const auto& summary : summaries_) {
+        double frames = static_cast<double>(std::max<uint64_t>(summary.frameCount, 1));
+        const PipelineStatistics& s = summary.statistics;
+        std::cout << std::setw(12) << summary.totalGpuMs / frames
+            << std::setw(10) << summary.maxGpuMs;
+        if (summary.hasStatistics) {
+            std::cout << std::setprecision(0)
+                << std::setw(11) << s.inputAssemblyVertices / frames
+                << std::setw(11) << s.inputAssemblyPrimitives / frames
+                << std::setw(11) << s.vertexShaderInvocations / frames
+                << std::setw(11) << s.clippingPrimitives / frames
+                << std::setw(11) << s.fragmentShaderInvocations / frames
+                << std::setprecision(2)
+                // far above 1: fragment bound (MSAA shades per pixel, not per sample, without sample shading)
+                << std::setw(7) << (s.vertexShaderInvocations ? static_cast<double>(s.fragmentShaderInvocations) / s.vertexShaderInvocations : 0.0)
+                << std::setprecision(3);
+        } else {
+            std::cout << std::setw(62) << "";
+        }
+        std::cout << "  " << (summary.pass ? "pass " : "draws ") << summary.name << '\n';
+    }
+    std::cout << std::defaultfloat;
+}
+
+std::string Recorder::toJson() const {
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < summaries_.size(); i++) {
+        const RangeSummary& summary = summaries_[i];
+        double frames = static_cast<double>(std::max<uint64_t>(summary.frameCount, 1));
+        const PipelineStatistics& s = summary.statistics;
+        json << (i ? ", " : "") << "{\"name\": \"" << summary.name << "\""
+            << ", \"pass\": " << (summary.pass ? "true" : "false")
+            << ", \"frames\": " << summary.frameCount
+            << ", \"gpuMs\": " << summary.totalGpuMs / frames
+            << ", \"maxGpuMs\": " << summary.maxGpuMs;
+        if (summary.hasStatistics) {
+            json << ", \"inputAssemblyVertices\": " << s.inputAssemblyVertices / frames
+                << ", \"inputAssemblyPrimitives\": " << s.inputAssemblyPrimitives / frames
+                << ", \"vertexShaderInvocations\": " << s.vertexShaderInvocations / frames
+                << ", \"clippingInvocations\": " << s.clippingInvocations / frames
+                << ", \"clippingPrimitives\": " << s.clippingPrimitives / frames
+                << ", \"fragmentShaderInvocations\": " << s.fragmentShaderInvocations / frames;
+        }
+        json << "}";
+    }
+    json << "]";
+    return json.str();
+}
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace gpustats {
+
+/** the VK_QUERY_TYPE_PIPELINE_STATISTICS counters we ask for, in the order the driver writes them */
+struct PipelineStatistics {
+    uint64_t inputAssemblyVertices = 0;
+    uint64_t inputAssemblyPrimitives = 0;
+    uint64_t vertexShaderInvocations = 0;
+    uint64_t clippingInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentShaderInvocations = 0;
+};
+
+/** one pass or draw range of one frame */
+struct RangeStats {
+    const char* name = nullptr;
+    bool pass = false;
+    /** 0 if the queue has no timestamps */
+    double gpuMs = 0.0;
+    bool hasStatistics = false;
+    PipelineStatistics statistics;
+};
+
+/** the same range over all the frames read back */
+struct RangeSummary {
+    const char* name = nullptr;
+    bool pass = false;
+    uint64_t frameCount = 0;
+    double totalGpuMs = 0.0;
+    double maxGpuMs = 0.0;
+    bool hasStatistics = false;
+    /** summed over the frames, divide by frameCount */
+    PipelineStatistics statistics;
+};
+
+/**
+ * GPU time and pipeline statistics per pass and per tagged draw range, through query pools.
+ *
+ * Each frame slot (frame in flight) has its own queries. The results of a slot are read
+ * when the slot is recorded again, in beginFrame: its fence has been waited by then, so
+ * vkGetQueryPoolResults never waits, the numbers are just MAX_FRAMES_IN_FLIGHT frames late.
+ *
+ * * a pass: timestamps around it, its statistics are the sum of the draw ranges inside
+ * * a draw range: timestamps and a pipeline statistics query. Two pipeline statistics
+ *   queries can't be active at once in a command buffer: draw ranges can't nest
+ *
+ * Pipeline statistics need the pipelineStatisticsQuery feature: device::createLogicalDevice
+ * and headless::Device enable it when supported, without it only the times are there.
+ * Nothing allocates per frame once the names have been seen once.
+ */
+class Recorder {
+public:
+    /** maxRangesPerFrame: passes and draw ranges together */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        uint32_t queueFamilyIndex,
+        uint32_t frameSlotCount,
+        uint32_t maxRangesPerFrame = 32
+    );
+    void destroy();
+
+    /**
+     * First thing recorded in the command buffer of frameSlot, outside of any render pass,
+     * once the fence of the slot has been waited: reads back the previous frame of the slot
+     */
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+
+    void beginPass(VkCommandBuffer commandBuffer, const char* name);
+    void endPass(VkCommandBuffer commandBuffer);
+
+    /** inside a render pass, begun and ended in the same subpass */
+    void beginDraws(VkCommandBuffer commandBuffer, const char* name);
+    void endDraws(VkCommandBuffer commandBuffer);
+
+    bool hasTimestamps() const;
+    bool hasStatistics() const;
+
+    /** ranges of the last frame read back, in recording order */
+    const std::vector<RangeStats>& getLastFrame() const;
+    /** per name, over all the frames read back */
+    const std::vector<RangeSummary>& getSummaries() const;
+    /** frames whose queries were not available when read (should be 0) */
+    uint64_t getMissedFrameCount() const;
+
+    /** averages per frame, with the fragment / vertex shader invocations ratio */
+    void printReport() const;
+    /** the summaries as a JSON array */
+    std::string toJson() const;
+
+private:
+    struct Range {
+        const char* name;
+        bool pass;
+        bool hasStatistics;
+        // draw range: index of its pass, -1 if outside of one
+        int32_t parent;
+        bool ended;
+    };
+
+    struct Slot {
+        std::vector<Range> ranges;
+        bool recorded = false;
+    };
+
+    uint32_t beginRange(VkCommandBuffer commandBuffer, const char* name, bool pass);
+    void readBack(uint32_t frameSlot);
+    void accumulate(const RangeStats& stats);
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueryPool timestampPool_ = VK_NULL_HANDLE;
+    VkQueryPool statisticsPool_ = VK_NULL_HANDLE;
+    uint32_t maxRanges_ = 0;
+    uint64_t timestampMask_ = 0;
+    double timestampPeriodNs_ = 0.0;
+
+    std::vector<Slot> slots_;
+    uint32_t currentSlot_ = 0;
+    int32_t openPass_ = -1;
+    int32_t openDraws_ = -1;
+
+    // per frame readback scratch, sized in init
+    std::vector<uint64_t> timestampResults_;
+    std::vector<uint64_t> statisticsResults_;
+
+    std::vector<RangeStats> lastFrame_;
+    std::vector<RangeSummary> summaries_;
+    uint64_t missedFrameCount_ = 0;
+};
+
+}
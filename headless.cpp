@@ -0,0 +1,158 @@
+#include <stdexcept>
+#include <cstring>
+
+#include "headless.hpp"
+#include "memory.hpp"
+#include "dispatch.hpp"
+#include "hostalloc.hpp"
+
+namespace headless {
+
+bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* name) {
+    for (const auto& extension : extensions) {
+        if (strcmp(extension.extensionName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Device::init(
+    const char* applicationName,
+    const std::vector<const char*>& optionalDeviceExtensions,
+    const std::vector<const char*>& optionalInstanceExtensions
+) {
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = applicationName;
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> instanceExtensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, instanceExtensions.data());
+
+    // no surface, only what the memory budget query needs
+    enabledInstanceExtensions_.clear();
+    properties2_ = hasExtension(instanceExtensions, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (properties2_) {
+        enabledInstanceExtensions_.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+    for (const char* name : optionalInstanceExtensions) {
+        if (hasExtension(instanceExtensions, name) && !isExtensionEnabled(name)) {
+            enabledInstanceExtensions_.push_back(name);
+        }
+    }
+
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledInstanceExtensions_.size());
+    createInfo.ppEnabledExtensionNames = enabledInstanceExtensions_.data();
+
+    if (vkCreateInstance(&createInfo, hostalloc::getCallbacks(), &instance_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance!");
+    }
+    dispatch::loadInstance(instance_);
+
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance_, &deviceCount, nullptr);
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(instance_, &deviceCount, devices.data());
+
+    // the first one with a graphics and compute queue, like device::pickPhysicalDevice without the presentation
+    // (a device with graphics has such a family, the compute kernels run on the same queue)
+    for (auto candidate : devices) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(candidate, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(candidate, &queueFamilyCount, queueFamilies.data());
+
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            VkQueueFlags required = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+            if ((queueFamilies[i].queueFlags & required) == required) {
+                physicalDevice_ = candidate;
+                queueFamilyIndex_ = i;
+                break;
+            }
+        }
+        if (physicalDevice_ != VK_NULL_HANDLE) {
+            break;
+        }
+    }
+
+    if (physicalDevice_ == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to find a suitable GPU!");
+    }
+
+    vkEnumerateDeviceExtensionProperties(physicalDevice_, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> deviceExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice_, nullptr, &extensionCount, deviceExtensions.data());
+
+    enabledDeviceExtensions_.clear();
+    memoryBudget_ = properties2_ && hasExtension(deviceExtensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudget_) {
+        enabledDeviceExtensions_.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    for (const char* name : optionalDeviceExtensions) {
+        if (hasExtension(deviceExtensions, name)) {
+            enabledDeviceExtensions_.push_back(name);
+        }
+    }
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueCreateInfo{};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamilyIndex_;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice_, &supportedFeatures);
+    VkPhysicalDeviceFeatures deviceFeatures{};
+    // for gpustats::Recorder, when supported (lavapipe does)
+    deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    // for the draws of a whole scene in one vkCmdDrawIndexedIndirect, see offscreen::MultiDrawIndirect
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+    VkDeviceCreateInfo deviceCreateInfo{};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions_.size());
+    deviceCreateInfo.ppEnabledExtensionNames = enabledDeviceExtensions_.data();
+
+    if (vkCreateDevice(physicalDevice_, &deviceCreateInfo, hostalloc::getCallbacks(), &device_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create logical device!");
+    }
+
+    features_ = deviceFeatures;
+    dispatch::loadDevice(device_);
+    vkGetDeviceQueue(device_, queueFamilyIndex_, 0, &queue_);
+
+    memory::init(instance_, physicalDevice_, properties2_);
+}
+
+bool Device::isExtensionEnabled(const char* name) const {
+    for (const auto* list : {&enabledInstanceExtensions_, &enabledDeviceExtensions_}) {
+        for (const char* enabled : *list) {
+            if (strcmp(enabled, name) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Device::cleanup() {
+    dispatch::resetDevice();
+    vkDestroyDevice(device_, hostalloc::getCallbacks());
+    vkDestroyInstance(instance_, hostalloc::getCallbacks());
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace headless {
+
+/**
+ * A Vulkan device without window, surface or swapchain, for the benchmarks:
+ * they run anywhere there is a Vulkan implementation (lavapipe in a CI container...)
+ *
+ * The first physical device with a graphics and compute queue is picked, one queue is created.
+ * VK_KHR_get_physical_device_properties2 and VK_EXT_memory_budget are enabled when
+ * available, then memory::init is called.
+ */
+class Device {
+public:
+    VkInstance instance_ = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex_ = 0;
+    bool properties2_ = false;
+    bool memoryBudget_ = false;
+    /** the ones enabled: pipelineStatisticsQuery, multiDrawIndirect, drawIndirectFirstInstance if supported */
+    VkPhysicalDeviceFeatures features_{};
+
+    /**
+     * The optional extensions are enabled if supported, see isExtensionEnabled.
+     * A device extension depending on an instance extension must be checked for both
+     */
+    void init(
+        const char* applicationName,
+        const std::vector<const char*>& optionalDeviceExtensions = {},
+        const std::vector<const char*>& optionalInstanceExtensions = {}
+    );
+    /** instance or device extension */
+    bool isExtensionEnabled(const char* name) const;
+    void cleanup();
+
+private:
+    std::vector<const char*> enabledInstanceExtensions_;
+    std::vector<const char*> enabledDeviceExtensions_;
+};
+
+bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* name);
+
+}
@@ -0,0 +1,330 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "heapcount.hpp"
+
+namespace heapcount {
+
+// constant initialized (no dynamic TLS init), safe to touch from inside malloc
+static thread_local Counters threadCounters;
+// the frame thread only
+static thread_local Counters frameStart;
+static thread_local Counters lastFrame;
+
+struct ScopeEntry {
+    const char* name;
+    uint64_t callCount;
+    Counters total;
+    Counters steady;
+};
+
+// a fixed table: the scopes must not allocate themselves
+const uint32_t MAX_SCOPE_COUNT = 64;
+
+static std::mutex mutex;
+static ScopeEntry scopes[MAX_SCOPE_COUNT];
+static uint32_t scopeCount = 0;
+static uint32_t warmupFrames = 100;
+static uint64_t frameIndex = 0;
+static uint64_t steadyFrameCount = 0;
+static uint64_t steadyFramesWithNew = 0;
+static Counters steadyFrameTotal;
+
+static Counters subtract(const Counters& a, const Counters& b) {
+    Counters result;
+    result.newCount = a.newCount - b.newCount;
+    result.newBytes = a.newBytes - b.newBytes;
+    result.mallocCount = a.mallocCount - b.mallocCount;
+    result.mallocBytes = a.mallocBytes - b.mallocBytes;
+    return result;
+}
+
+static void add(Counters& total, const Counters& delta) {
+    total.newCount += delta.newCount;
+    total.newBytes += delta.newBytes;
+    total.mallocCount += delta.mallocCount;
+    total.mallocBytes += delta.mallocBytes;
+}
+
+/** with the mutex locked, nullptr if the table is full */
+static ScopeEntry* findScope(const char* name, bool create) {
+    for (uint32_t i = 0; i < scopeCount; i++) {
+        if (scopes[i].name == name || strcmp(scopes[i].name, name) == 0) {
+            return &scopes[i];
+        }
+    }
+    if (!create || scopeCount == MAX_SCOPE_COUNT) {
+        return nullptr;
+    }
+    scopes[scopeCount] = ScopeEntry{name, 0, Counters{}, Counters{}};
+    return &scopes[scopeCount++];
+}
+
+bool isEnabled() {
+#ifdef HEAPCOUNT_ENABLED
+    return true;
+#else
+    return false;
+#endif
+}
+
+void init(uint32_t warmupFrameCount) {
+    std::lock_guard<std::mutex> lock(mutex);
+    scopeCount = 0;
+    warmupFrames = warmupFrameCount;
+    frameIndex = 0;
+    steadyFrameCount = 0;
+    steadyFramesWithNew = 0;
+    steadyFrameTotal = Counters{};
+    frameStart = threadCounters;
+}
+
+Counters getThreadCounters() {
+    return threadCounters;
+}
+
+void endFrame() {
+    Counters now = threadCounters;
+    lastFrame = subtract(now, frameStart);
+    frameStart = now;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frameIndex >= warmupFrames) {
+        steadyFrameCount++;
+        add(steadyFrameTotal, lastFrame);
+        if (lastFrame.newCount > 0) {
+            steadyFramesWithNew++;
+        }
+    }
+    frameIndex++;
+}
+
+Counters getLastFrameCounters() {
+    return lastFrame;
+}
+
+ScopeStats getScopeStats(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ScopeStats stats;
+    stats.name = name;
+    if (const ScopeEntry* entry = findScope(name, false)) {
+        stats.callCount = entry->callCount;
+        stats.total = entry->total;
+        stats.steady = entry->steady;
+    }
+    return stats;
+}
+
+void printReport() {
+    if (!isEnabled()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "heap allocations (" << frameIndex << " frames, " << steadyFrameCount
+        << " after the " << warmupFrames << " warmup ones, " << steadyFramesWithNew << " of them with a new)\n"
+        << "     calls         new      new KB      malloc   malloc KB  steady new  steady malloc  scope\n";
+    for (uint32_t i = 0; i < scopeCount; i++) {
+        const ScopeEntry& entry = scopes[i];
+        std::cout << std::setw(10) << entry.callCount
+            << std::setw(12) << entry.total.newCount
+            << std::setw(12) << entry.total.newBytes / 1024.0
+            << std::setw(12) << entry.total.mallocCount
+            << std::setw(12) << entry.total.mallocBytes / 1024.0
+            << std::setw(12) << entry.steady.newCount
+            << std::setw(15) << entry.steady.mallocCount
+            << "  " << entry.name << '\n';
+    }
+    if (steadyFrameCount > 0) {
+        std::cout << "per steady frame (whole frame thread): "
+            << static_cast<double>(steadyFrameTotal.newCount) / steadyFrameCount << " new, "
+            << static_cast<double>(steadyFrameTotal.mallocCount) / steadyFrameCount << " malloc\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+ScopedCounter::ScopedCounter(const char* name) : name_(name), start_(threadCounters) {}
+
+ScopedCounter::~ScopedCounter() {
+    Counters delta = subtract(threadCounters, start_);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ScopeEntry* entry = findScope(name_, true);
+    if (!entry) {
+        return;
+    }
+    entry->callCount++;
+    add(entry->total, delta);
+    if (frameIndex >= warmupFrames) {
+        add(entry->steady, delta);
+    }
+}
+
+}
+
+#ifdef HEAPCOUNT_ENABLED
+
+#if defined(__GLIBC__)
+// the real allocator behind our malloc, exported by glibc
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+}
+
+static void* rawMalloc(size_t size) {
+    return __libc_malloc(size);
+}
+
+static void rawFree(void* pointer) {
+    __libc_free(pointer);
+}
+
+/**
+ * Replaces the malloc of the whole process, the driver included.
+ * Aligned allocations (posix_memalign, aligned_alloc) are not counted:
+ * they go straight to glibc and come back through free, which is fine
+ */
+extern "C" {
+
+void* malloc(size_t size) {
+    heapcount::threadCounters.mallocCount++;
+    heapcount::threadCounters.mallocBytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    heapcount::threadCounters.mallocCount++;
+    heapcount::threadCounters.mallocBytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    if (size > 0) {
+        heapcount::threadCounters.mallocCount++;
+        heapcount::threadCounters.mallocBytes += size;
+    }
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+
+}
+
+#else
+// only operator new is counted
+static void* rawMalloc(size_t size) {
+    return std::malloc(size);
+}
+
+static void rawFree(void* pointer) {
+    std::free(pointer);
+}
+#endif
+
+static void* countedNew(size_t size) {
+    heapcount::threadCounters.newCount++;
+    heapcount::threadCounters.newBytes += size;
+    return rawMalloc(size ? size : 1);
+}
+
+static void* countedAlignedNew(size_t size, std::align_val_t alignment) {
+    heapcount::threadCounters.newCount++;
+    heapcount::threadCounters.newBytes += size;
+    void* pointer = nullptr;
+    size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+    if (posix_memalign(&pointer, align, size ? size : 1) != 0) {
+        return nullptr;
+    }
+    return pointer;
+}
+
+void* operator new(size_t size) {
+    if (void* pointer = countedNew(size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedNew(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedNew(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* pointer = countedAlignedNew(size, alignment)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlignedNew(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlignedNew(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    rawFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    rawFree(pointer);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+namespace heapcount {
+
+/**
+ * Counts the heap allocations of each thread, to keep the frame loop allocation free:
+ * * new: the global operator new (and new[], aligned, nothrow): our code and the std containers
+ * * malloc: malloc, calloc and realloc, which includes the driver (lavapipe allocates
+ *   while recording and submitting) and C libraries like stb_image
+ *
+ * Compiled in only with -DHEAPCOUNT_ENABLED (the .vscode "with heap counters" build task): the global
+ * operator new is then replaced, and malloc too on glibc (forwarded to __libc_malloc).
+ * Without it nothing is replaced, the counters stay at 0 and the macros expand to nothing.
+ *
+ * HEAP_SCOPE attributes what the current thread allocates in a scope to its name,
+ * nested scopes are counted in their parents too. endFrame closes a frame of the calling
+ * thread: after the warmup frames, the scopes also count their "steady" allocations,
+ * the ones a frame loop in steady state should not have.
+ */
+struct Counters {
+    uint64_t newCount = 0;
+    uint64_t newBytes = 0;
+    uint64_t mallocCount = 0;
+    uint64_t mallocBytes = 0;
+};
+
+struct ScopeStats {
+    const char* name = nullptr;
+    uint64_t callCount = 0;
+    /** since init */
+    Counters total;
+    /** after the warmup frames only */
+    Counters steady;
+};
+
+/** true if compiled with HEAPCOUNT_ENABLED */
+bool isEnabled();
+
+/** forgets the scopes and the frames, the per thread counters keep going */
+void init(uint32_t warmupFrameCount = 100);
+
+/** everything the calling thread allocated since it started */
+Counters getThreadCounters();
+
+/** closes a frame of the calling thread (the one calling drawFrame) */
+void endFrame();
+
+/** what the calling thread allocated during the last frame */
+Counters getLastFrameCounters();
+
+/** all zeros if the scope never ran */
+ScopeStats getScopeStats(const char* name);
+
+/** per scope totals, steady state allocations and per frame average after the warmup */
+void printReport();
+
+class ScopedCounter {
+public:
+    /** name must outlive the program, a string literal */
+    explicit ScopedCounter(const char* name);
+    ~ScopedCounter();
+
+    ScopedCounter(const ScopedCounter&) = delete;
+    ScopedCounter& operator=(const ScopedCounter&) = delete;
+
+private:
+    const char* name_;
+    Counters start_;
+};
+
+}
+
+#ifdef HEAPCOUNT_ENABLED
+    #define HEAP_CONCAT_INNER(a, b) a##b
+    #define HEAP_CONCAT(a, b) HEAP_CONCAT_INNER(a, b)
+    #define HEAP_SCOPE(name) heapcount::ScopedCounter HEAP_CONCAT(heapScope, __LINE__)(name)
+#else
+    #define HEAP_SCOPE(name) ((void) 0)
+#endif
@@ -2,6 +2,7 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <vector>
+#include <string>
 #include <cstring>
 #include <map>
 #include <optional>
@@ -10,6 +11,7 @@
 #include <fstream>
 #include <chrono>
 #include <memory>
+#include <sys/resource.h>
 
 // Let GLFW include by itslef vulkan headers
 #define GLFW_INCLUDE_VULKAN
@@ -22,19 +24,29 @@
 #include "glm/gtc/matrix_transform.hpp"
 // to easily print glm vec
 #include "glm/gtx/string_cast.hpp"
-// could be only in one file in the project
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
 
 #include "device.hpp"
 #include "swapchain3.hpp"
 #include "pipeline5.hpp"
 #include "vertex3.hpp"
+#include "model.hpp"
 #include "camera.hpp"
 #include "buffer2.hpp"
 #include "texture3.hpp"
 #include "image2.hpp"
 #include "commandbuffer.hpp"
+#include "descriptor.hpp"
+#include "sampler.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "taskgraph.hpp"
+#include "profiler.hpp"
+#include "dispatch.hpp"
+#include "hostalloc.hpp"
+#include "heapcount.hpp"
+#include "gpustats.hpp"
+#include "hitch.hpp"
+#include "imageloader.hpp"
 
 #ifdef NDEBUG
     const bool ENABLE_VALIDATION_LAYERS = false;
@@ -50,6 +62,25 @@ const uint32_t HEIGHT = 600;
  */
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+/**
+ * write the vertices/indices straight in device local memory when it is host visible
+ * (integrated GPUs, lavapipe, resizable BAR), false to always go through a staging buffer
+ * e.g. to compare both paths
+ */
+const bool ALLOW_DIRECT_UPLOAD = true;
+
+/**
+ * threads running the initVulkan task graph, 0 for std::thread::hardware_concurrency,
+ * 1 to run the steps one after the other like before (on the main thread)
+ */
+const uint32_t STARTUP_THREAD_COUNT = 0;
+
+/**
+ * give the driver our VkAllocationCallbacks to count its host allocations per scope
+ * (report printed at exit), false to let it use its own allocator
+ */
+const bool TRACK_HOST_ALLOCATIONS = true;
+
 const std::vector<const char*> VALIDATION_LAYERS = {
     "VK_LAYER_KHRONOS_validation"
 };
@@ -105,7 +136,17 @@ public:
         initWindow();
         initVulkan();
         mainLoop();
+        // before cleanup: the destructions would show up in the last frame
+        hostalloc::printReport();
+        heapcount::printReport();
+        gpuStats_.printReport();
+        hitch::dump();
         cleanup();
+
+        // open it in chrome://tracing or ui.perfetto.dev, nothing without PROFILER_ENABLED
+        profiler::dump("startup_trace.json");
+
+        checkSteadyAllocations();
     }
 
 private:
@@ -135,6 +176,8 @@ private:
     std::vector<VkImage> swapChainImages_;
     VkFormat swapChainImageFormat_;
     VkExtent2D swapChainExtent_;
+    /** glfwGetFramebufferSize of the window, read on the main thread for createSwapChain */
+    VkExtent2D framebufferExtent_{};
     std::vector<VkImageView> swapChainImageViews_;
     VkRenderPass renderPass_;
     VkDescriptorSetLayout descriptorSetLayout_;
@@ -163,14 +206,37 @@ private:
     std::vector<VkBuffer> uniformBuffers_;
     std::vector<VkDeviceMemory> uniformBuffersMemory_;
     std::vector<void*> uniformBuffersMapped_;
-    VkDescriptorPool descriptorPool_;
+    /** the uniform writes of the frame, flushed at once before the submit */
+    mapped::FlushBatcher uniformFlush_;
+    /** GPU time and pipeline statistics of the main pass and its draws */
+    gpustats::Recorder gpuStats_;
+    VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
     std::vector<VkDescriptorSet> descriptorSets_;
+    /** VK_KHR_get_physical_device_properties2 enabled on the instance, needed by push descriptors */
+    bool pushDescriptorAllowed_ = false;
+    descriptor::Mode descriptorMode_ = descriptor::WriteDescriptorSet;
+    descriptor::Binder descriptorBinder_;
+    /** DEVICE_EXTENSIONS plus the optional ones supported by the picked physical device */
+    std::vector<const char*> deviceExtensions_;
     Camera camera_;
     VkImage textureImage_;
     uint32_t mipLevels_;
     VkDeviceMemory textureImageMemory_;
     VkImageView textureImageView_;
     VkSampler textureSampler_;
+    sampler::SamplerCache samplerCache_;
+
+    // reused by the texture uploads, grows to the biggest one
+    buffer2::StagingBuffer stagingBuffer_;
+    // read during the startup before the device exists, freed once used
+    std::vector<unsigned char> textureFileContent_;
+    int textureWidth_ = 0;
+    int textureHeight_ = 0;
+    // decode start: the time printed by createTextureImage is the wall time of the decode and
+    // the upload, which run in different tasks of the startup graph
+    std::chrono::steady_clock::time_point textureLoadStart_;
+    std::vector<char> vertShaderCode_;
+    std::vector<char> fragShaderCode_;
     VkImage depthImage_;
     VkFormat depthFormat_;
     VkDeviceMemory depthImageMemory_;
@@ -197,7 +263,7 @@ private:
 
     void createSwapChain() {
         swapchain3::createSwapChain(
-            window_.get(),
+            framebufferExtent_,
             physicalDevice_,
             surface_,
             device_,
@@ -224,6 +290,13 @@ private:
         app->camera_.updateOrientation(x_pos, y_pos);
     }
 
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+        // on demand, the log is dumped at exit anyway
+        if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+            hitch::dump();
+        }
+    }
+
 
     void initWindow() {
         glfwSetErrorCallback(errorCallback);
@@ -239,6 +312,9 @@ private:
     }
 
     void createInstance() {
+        // the instance and the device are created with the callbacks, or without
+        hostalloc::init(TRACK_HOST_ALLOCATIONS);
+
         if (ENABLE_VALIDATION_LAYERS && !device::checkValidationLayerSupport(VALIDATION_LAYERS)) {
             throw std::runtime_error("validation layers requested, but not available!");
         }
@@ -283,14 +359,23 @@ private:
         }
 
         auto extensions = device::getRequiredExtensions(ENABLE_VALIDATION_LAYERS);
+        // optional, only to unlock push descriptors later on the device
+        pushDescriptorAllowed_ = descriptor::checkInstanceExtensionSupport(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        if (pushDescriptorAllowed_) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
         createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
         createInfo.ppEnabledExtensionNames = extensions.data();
 
         // Note: there is a RAII way to do instead of this: find this an migrate
         // to it when the tutorial is finished
-        if (vkCreateInstance(&createInfo, nullptr, &instance_) != VK_SUCCESS) {
+        // slow with the validation layers, they are loaded here
+        PROFILE_SCOPE("vkCreateInstance");
+        if (vkCreateInstance(&createInfo, hostalloc::getCallbacks(), &instance_) != VK_SUCCESS) {
             throw std::runtime_error("failed to create instance!");
         }
+
+        dispatch::loadInstance(instance_);
     }
 
     void pickPhysicalDeviceAndSetMSAASampleCount() {
@@ -302,69 +387,43 @@ private:
         );
 
         msaaSampleCount_ = device::getMaxUsableSampleCount(physicalDevice_);
+
+        descriptorMode_ = descriptor::chooseMode(physicalDevice_, pushDescriptorAllowed_);
+        deviceExtensions_ = DEVICE_EXTENSIONS;
+        for (auto extension : descriptor::getDeviceExtensions(descriptorMode_)) {
+            deviceExtensions_.push_back(extension);
+        }
+
+        // the budget is queried through VK_KHR_get_physical_device_properties2 too
+        memory::init(instance_, physicalDevice_, pushDescriptorAllowed_);
+        if (memory::isBudgetAvailable()) {
+            deviceExtensions_.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
     }
 
     void createLogicalDevice() {
         device::createLogicalDevice(
             physicalDevice_,
             surface_,
-            DEVICE_EXTENSIONS,
+            deviceExtensions_,
             ENABLE_VALIDATION_LAYERS,
             VALIDATION_LAYERS,
             &device_,
             &graphicsQueue_,
             &presentationQueue_
         );
-    }
 
-    void loadModel() {
-        /**
-         * The attrib container holds all of the positions, normals and texture coordinates 
-         * in its attrib.vertices, attrib.normals and attrib.texcoords vectors. 
-         * The shapes container contains all of the separate objects and their faces. 
-         * Each face consists of an array of vertices, and each vertex contains 
-         * the indices of the position, normal and texture coordinate attributes.
-         * OBJ models can also define a material and texture per face, but we will be ignoring those.
-         */
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string warn, err;
+        // the frame loop calls the driver without going through the loader trampolines
+        dispatch::loadDevice(device_);
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH)) {
-            throw std::runtime_error(warn + err);
-        }
+        samplerCache_.init(physicalDevice_, device_);
+        uniformFlush_.init(device_);
+    }
 
-        // We're going to combine all of the faces in the file into a single model, so just iterate over all of the shapes:
-        for (const auto& shape : shapes) {
-            // The triangulation feature has already made sure that there are three vertices per face,
-            // so we can now directly iterate over the vertices and dump them straight into our vertices vector:
-            for (const auto& index : shape.mesh.indices) {
-                vertex3::Vertex vertex{};
-
-                // attrib.vertices array is an array of float values instead of something like glm::vec3
-                vertex.pos = {
-                    attrib.vertices[3 * index.vertex_index + 0], // x
-                    attrib.vertices[3 * index.vertex_index + 1], // y
-                    attrib.vertices[3 * index.vertex_index + 2] // z
-                };
-
-                // Similarly, there are two texture coordinate components per entry.
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0], // u
-                    // for OBJ format 0 means the bottom of the image
-                    // but we've uploaded the image to Vulkan in a top-bottom orientation
-                    // so we flip the vertical axis
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1] // v
-                };
-
-                vertex.color = {1.0f, 1.0f, 1.0f};
-
-                vertices_.push_back(vertex);
-                // For simplicity, we will assume that every vertex is unique for now, hence the simple auto-increment indices.
-                indices_.push_back(indices_.size());
-            }
-        }
+    void loadModel() {
+        model::loadObj(MODEL_PATH, vertices_, indices_);
+        // one vertex per face corner so far: the shared ones are transformed only once after this
+        model::deduplicateVertices(vertices_, indices_);
     }
 
     void createImageViews() {
@@ -388,16 +447,22 @@ private:
     }
 
     void createDescriptorSetLayout() {
-        buffer2::createDescriptorSetLayout(
+        descriptor::createDescriptorSetLayout(
             device_,
+            descriptorMode_,
             descriptorSetLayout_
         );
     }
 
+    void readShaderFiles() {
+        vertShaderCode_ = pipeline5::readFile(VERT_FILE);
+        fragShaderCode_ = pipeline5::readFile(FRAG_FILE);
+    }
+
     void createGraphicsPipeline() {
         pipeline5::createGraphicsPipeline(
-            VERT_FILE,
-            FRAG_FILE,
+            vertShaderCode_,
+            fragShaderCode_,
             device_,
             swapChainExtent_,
             msaaSampleCount_,
@@ -406,6 +471,9 @@ private:
             pipelineLayout_,
             graphicsPipeline_
         );
+
+        std::vector<char>().swap(vertShaderCode_);
+        std::vector<char>().swap(fragShaderCode_);
     }
 
     void createFramebuffers() {
@@ -433,11 +501,11 @@ private:
 
         vkDestroyImageView(device_, colorImageView_, nullptr);
         vkDestroyImage(device_, colorImage_, nullptr);
-        vkFreeMemory(device_, colorImageMemory_, nullptr);
+        memory::freeMemory(device_, colorImageMemory_);
 
         vkDestroyImageView(device_, depthImageView_, nullptr);
         vkDestroyImage(device_, depthImage_, nullptr);
-        vkFreeMemory(device_, depthImageMemory_, nullptr);
+        memory::freeMemory(device_, depthImageMemory_);
 
         // Validation Layer error if we do this before destroying the surface
         vkDestroySwapchainKHR(device_, swapChain_, nullptr);
@@ -454,12 +522,15 @@ private:
      * from an standard range to an high dynamic range monitor. This may require the application to recreate
      * the renderpass to make sure the change between dynamic ranges is properly reflected
      * 
-     * Also, note that in chooseSwapExtent we already query the new window resolution to make sure that the
-     * swap chain images have the (new) right size, so there's no need to modify chooseSwapExtent 
+     * Also, note that chooseSwapExtent gets the new window resolution (framebufferExtent_, queried below)
+     * to make sure that the swap chain images have the (new) right size
      * (remember that we already had to use glfwGetFramebufferSize get the resolution of the surface in 
      * pixels when creating the swap chain).
      */
     void recreateSwapChain() {
+        // allocates by design, taken out of drawFrame by checkSteadyAllocations
+        HEAP_SCOPE("recreateSwapChain");
+        hitch::ScopedEvent hitchEvent(hitch::RESIZE);
         // custom handling of minimization:
         // we wait until it is over
         int width = 0, height = 0;
@@ -469,6 +540,7 @@ private:
             glfwGetFramebufferSize(window_.get(), &width, &height);
             glfwWaitEvents();
         }
+        framebufferExtent_ = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
 
         // don't touch resources while they may be in use
         vkDeviceWaitIdle(device_);
@@ -497,10 +569,14 @@ private:
         if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
             throw std::runtime_error("failed to create command pool!");
         }
+
+        // queries on the queue the command buffers are submitted to, one set per frame in flight
+        gpuStats_.init(physicalDevice_, device_, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
     }
 
     void createVertexBuffer() {
-        buffer2::createBuffer(
+        auto start = std::chrono::steady_clock::now();
+        bool direct = buffer2::createBuffer(
             buffer2::Type::Vertex,
             physicalDevice_,
             device_,
@@ -508,12 +584,15 @@ private:
             graphicsQueue_,
             vertices_,
             vertexBuffer_,
-            vertexBufferMemory_
+            vertexBufferMemory_,
+            ALLOW_DIRECT_UPLOAD
         );
+        printUploadTime("vertex", sizeof(vertices_[0]) * vertices_.size(), direct, start);
     }
 
     void createIndexBuffer() {
-        buffer2::createBuffer(
+        auto start = std::chrono::steady_clock::now();
+        bool direct = buffer2::createBuffer(
             buffer2::Type::Index,
             physicalDevice_,
             device_,
@@ -521,8 +600,16 @@ private:
             graphicsQueue_,
             indices_,
             indexBuffer_,
-            indexBufferMemory_
+            indexBufferMemory_,
+            ALLOW_DIRECT_UPLOAD
         );
+        printUploadTime("index", sizeof(indices_[0]) * indices_.size(), direct, start);
+    }
+
+    void printUploadTime(const char* name, size_t size, bool direct, std::chrono::steady_clock::time_point start) {
+        std::cout << name << " buffer " << size / 1024 << " KB uploaded in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms"
+            << (direct ? " (direct, no staging)\n" : " (staging copy)\n");
     }
 
     void createUniformBuffers() {
@@ -556,6 +643,8 @@ private:
 
     /** writes the commands we want to execute into a command buffer. */
     void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        HEAP_SCOPE("recordCommandBuffer");
+        const dispatch::DeviceTable& table = dispatch::getDeviceTable();
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         // none of the flags applicable for us right now
@@ -565,9 +654,11 @@ private:
 
         // If the command buffer was already recorded once, then a call to vkBeginCommandBuffer 
         // will implicitly reset it. It's not possible to append commands to a buffer at a later time.
-        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        if (table.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
             throw std::runtime_error("failed to begin recording command buffer!");
         }
+        // the fence of currentFrame_ was waited: reads back its queries, resets them
+        gpuStats_.beginFrame(commandBuffer, currentFrame_);
 
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -595,19 +686,20 @@ private:
         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassInfo.pClearValues = clearValues.data();
 
+        gpuStats_.beginPass(commandBuffer, "main pass");
         // no secondary command buffer so no VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        table.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
+        table.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
 
         VkBuffer vertexBuffers[] = {vertexBuffer_};
         VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        table.vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
         // we can have only one index buffer
         // we used a 32 bit for storage for the indices
         // so 32 bit storage for the index buffer
-        vkCmdBindIndexBuffer(commandBuffer, indexBuffer_, 0, VK_INDEX_TYPE_UINT32);
+        table.vkCmdBindIndexBuffer(commandBuffer, indexBuffer_, 0, VK_INDEX_TYPE_UINT32);
 
         // as we defined viewport and scissor state to be dynamic
         // we need to set them in the command buffer before the draw command
@@ -618,25 +710,24 @@ private:
         viewport.height = static_cast<float>(swapChainExtent_.height);
         viewport.minDepth = 0.0f;
         viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        table.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
         VkRect2D scissor{};
         scissor.offset = {0, 0};
         scissor.extent = swapChainExtent_;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        table.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        vkCmdBindDescriptorSets(
+        // push descriptors need no set, the other modes bind the set of the current frame
+        descriptor::bindDescriptors(
             commandBuffer,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            descriptorBinder_,
             pipelineLayout_,
-            0,
-            1,
-            &descriptorSets_[currentFrame_],
-            0,
-            nullptr
+            descriptorSets_.empty() ? VK_NULL_HANDLE : descriptorSets_[currentFrame_],
+            getPerDrawBindings(currentFrame_)
         );
 
-        vkCmdDrawIndexed(
+        gpuStats_.beginDraws(commandBuffer, "viking room");
+        table.vkCmdDrawIndexed(
             commandBuffer,
             // now index count instead of vertex count as we draw indexed
             static_cast<uint32_t>(indices_.size()),
@@ -649,11 +740,13 @@ private:
             // firstInstance, we don't use instance.
             0 
         );
+        gpuStats_.endDraws(commandBuffer);
 
-        vkCmdEndRenderPass(commandBuffer);
+        table.vkCmdEndRenderPass(commandBuffer);
+        gpuStats_.endPass(commandBuffer);
 
         // we've finish recording the command buffer
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        if (table.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
         }
     }
@@ -691,6 +784,7 @@ private:
     }
 
     void updateUniformBuffer(uint32_t currentImage) {
+        HEAP_SCOPE("updateUniformBuffer");
         buffer2::UniformBufferObject ubo{};
 
         // Model matrix
@@ -724,15 +818,48 @@ private:
         // no staging buffer, and memory already mapped
         // it is not the most optimal way of doing (see push constants)
         memcpy(uniformBuffersMapped_[currentImage], &ubo, sizeof(ubo));
+        uniformFlush_.add(uniformBuffersMemory_[currentImage], 0, sizeof(ubo));
+    }
+
+    /**
+     * The frame_bench check on the windowed loop, with the "with heap counters" build only:
+     * after the warmup frames drawFrame, recordCommandBuffer and updateUniformBuffer must
+     * do no operator new. The swapchain recreations of the resizes are not counted
+     */
+    void checkSteadyAllocations() {
+        if (!heapcount::isEnabled()) {
+            return;
+        }
+
+        uint64_t resizeNewCount = heapcount::getScopeStats("recreateSwapChain").steady.newCount;
+        std::string failures;
+        for (const char* scope : {"drawFrame", "recordCommandBuffer", "updateUniformBuffer"}) {
+            uint64_t newCount = heapcount::getScopeStats(scope).steady.newCount;
+            if (strcmp(scope, "drawFrame") == 0) {
+                newCount -= resizeNewCount;
+            }
+            if (newCount > 0) {
+                failures += std::string("\n  ") + scope + ": " + std::to_string(newCount) + " new";
+            }
+        }
+        if (!failures.empty()) {
+            throw std::runtime_error("heap allocations in the steady state frame loop:" + failures);
+        }
+        std::cout << "no heap allocation in the frame loop after the warmup frames\n";
     }
 
     void drawFrame() {
-        vkWaitForFences(device_, 1, &inFlightFences_[currentFrame_], VK_TRUE, UINT64_MAX);
-        
+        HEAP_SCOPE("drawFrame");
+        const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+        {
+            hitch::ScopedEvent hitchEvent(hitch::FENCE_WAIT);
+            table.vkWaitForFences(device_, 1, &inFlightFences_[currentFrame_], VK_TRUE, UINT64_MAX);
+        }
+
 
         uint32_t imageIndex;
         // extension so vk...KHR naming
-        VkResult result = vkAcquireNextImageKHR(
+        VkResult result = table.vkAcquireNextImageKHR(
             device_,
             swapChain_,
             // No timeout 
@@ -758,11 +885,11 @@ private:
         // Only reset the fence if we are submitting work
         // has we used early return pattern in the lines before
         // vkQueue needs VK_NULL_HANDLE or unsignaled fence
-        vkResetFences(device_, 1, &inFlightFences_[currentFrame_]);
+        table.vkResetFences(device_, 1, &inFlightFences_[currentFrame_]);
 
         // record the command buffer
         // make sure the command buffer can be recorded
-        vkResetCommandBuffer(commandBuffers_[currentFrame_], 0);
+        table.vkResetCommandBuffer(commandBuffers_[currentFrame_], 0);
         recordCommandBuffer(commandBuffers_[currentFrame_], imageIndex);
 
         updateUniformBuffer(currentFrame_);
@@ -781,7 +908,10 @@ private:
         submitInfo.signalSemaphoreCount = 1;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        if (vkQueueSubmit(graphicsQueue_, 1, &submitInfo, inFlightFences_[currentFrame_]) != VK_SUCCESS) {
+        // one vkFlushMappedMemoryRanges for all the host writes of the frame
+        uniformFlush_.flush();
+
+        if (table.vkQueueSubmit(graphicsQueue_, 1, &submitInfo, inFlightFences_[currentFrame_]) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
 
@@ -800,7 +930,7 @@ private:
         presentInfo.pResults = nullptr; // Optional
 
         // submit a request to present an image on the swapchain
-        result = vkQueuePresentKHR(presentationQueue_, &presentInfo);
+        result = table.vkQueuePresentKHR(presentationQueue_, &presentInfo);
 
 
         /**
@@ -814,10 +944,19 @@ private:
             throw std::runtime_error("failed to present swap chain image!");
         }
 
+        hostalloc::endFrame();
+        heapcount::endFrame();
+        hitch::endFrame();
+
         currentFrame_ = (currentFrame_ + 1) % MAX_FRAMES_IN_FLIGHT;
     }
 
     void createDescriptorPool() {
+        // nothing to allocate from with push descriptors
+        if (descriptorMode_ == descriptor::PushDescriptor) {
+            return;
+        }
+
         buffer2::createDescriptorPool(
             device_,
             MAX_FRAMES_IN_FLIGHT,
@@ -825,30 +964,85 @@ private:
         );
     }
 
+    descriptor::PerDrawBindings getPerDrawBindings(uint32_t frame) {
+        descriptor::PerDrawBindings bindings{};
+        bindings.uniformBuffer.buffer = uniformBuffers_[frame];
+        bindings.uniformBuffer.offset = 0;
+        bindings.uniformBuffer.range = sizeof(buffer2::UniformBufferObject);
+        bindings.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        bindings.texture.imageView = textureImageView_;
+        bindings.texture.sampler = textureSampler_;
+        return bindings;
+    }
+
     void createDescriptorSets() {
-        buffer2::createDescriptorSets(
+        // the push template references the pipeline layout
+        // so this has to happen after createGraphicsPipeline
+        descriptor::createBinder(
             device_,
-            MAX_FRAMES_IN_FLIGHT,
-            uniformBuffers_,
+            descriptorMode_,
+            descriptorSetLayout_,
+            pipelineLayout_,
+            descriptorBinder_
+        );
+
+        descriptor::allocateDescriptorSets(
+            device_,
+            descriptorBinder_,
             descriptorPool_,
             descriptorSetLayout_,
-            textureImageView_,
-            textureSampler_,
+            MAX_FRAMES_IN_FLIGHT,
             descriptorSets_
         );
+
+        for (size_t i = 0; i < descriptorSets_.size(); i++) {
+            descriptor::updateDescriptorSet(device_, descriptorBinder_, descriptorSets_[i], getPerDrawBindings(i));
+        }
+    }
+
+    void readTextureFile() {
+        if (!imageloader::readFileContent(TEXTURE_PATH, textureFileContent_)) {
+            throw std::runtime_error("failed to load texture image!");
+        }
+    }
+
+    void decodeTexture() {
+        // decoded straight into the persistently mapped staging buffer, which is kept for the next uploads.
+        // Not through imageloader::loadImages: for a single texture its worker threads have nothing
+        // to share, and it would decode into the heap then copy to the staging buffer.
+        // It is the way to go for a batch of textures (see image_loader_bench).
+        // no command recorded: runs while the command pool uploads the vertices
+        textureLoadStart_ = std::chrono::steady_clock::now();
+        texture3::decodeToStagingBuffer(
+            physicalDevice_,
+            device_,
+            textureFileContent_,
+            stagingBuffer_,
+            textureWidth_,
+            textureHeight_
+        );
     }
 
     void createTextureImage() {
-        mipLevels_ = texture3::createTextureImage(
+        mipLevels_ = texture3::createTextureImageFromStagingBuffer(
             physicalDevice_,
             device_,
             commandPool_,
             graphicsQueue_,
-            TEXTURE_PATH,
+            stagingBuffer_,
+            textureWidth_,
+            textureHeight_,
             VK_SAMPLE_COUNT_1_BIT,
             textureImage_,
             textureImageMemory_
         );
+
+        // ru_maxrss is in kilobytes on linux
+        struct rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        std::cout << "texture " << TEXTURE_PATH << " " << textureWidth_ << "x" << textureHeight_ << " decoded and uploaded in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - textureLoadStart_).count() << " ms, "
+            << "peak RSS " << usage.ru_maxrss / 1024.0 << " MB\n";
     }
 
     void createTextureImageView() {
@@ -862,8 +1056,7 @@ private:
 
     void createTextureSampler() {
         texture3::createTextureSampler(
-            physicalDevice_,
-            device_,
+            samplerCache_,
             textureSampler_
         );
     }
@@ -881,7 +1074,7 @@ private:
             colorFormat,
             VK_IMAGE_TILING_OPTIMAL,
             VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            memory::GpuOnly,
             colorImage_,
             colorImageMemory_
         );
@@ -908,7 +1101,7 @@ private:
             depthFormat_,
             VK_IMAGE_TILING_OPTIMAL,
             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            memory::GpuOnly,
             depthImage_,
             depthImageMemory_
         );
@@ -920,36 +1113,72 @@ private:
     }
 
     
+    /**
+     * The steps as a task graph: each one waits only for the steps whose members it reads.
+     * The CPU only work (obj parsing, texture file, SPIR-V files) overlaps the instance
+     * and device creation, the pipeline is compiled while the buffers are uploaded.
+     *
+     * Everything recording into commandPool_ and submitting to graphicsQueue_
+     * (externally synchronized) is chained: vertex buffer, index buffer, texture, command buffers.
+     * The trace printed at the end gives the critical path: what to shorten to start faster
+     */
     void initVulkan() {
-        device::printExtensions();
-        createInstance();
-        setupDebugMessenger();
+        PROFILE_SCOPE("initVulkan");
+        using Task = taskgraph::TaskId;
+        taskgraph::TaskGraph graph;
+        // GLFW is main thread only, the tasks may run on the workers
+        framebufferExtent_ = swapchain3::getFramebufferExtent(window_.get());
+
+        // added first: the longest chain, they get the threads first
+        Task instance = graph.add("createInstance", [this]() {
+            device::printExtensions();
+            createInstance();
+            setupDebugMessenger();
+        });
         // TODO: something is wrong here and on functions call nested:
         // createSurface must be called before pickPhysicalDevice and LogicalDevice
         // or add a docstring ? Really the kind of hidden state I dislike with OOP
-        createSurface();
-        pickPhysicalDeviceAndSetMSAASampleCount();
-        createLogicalDevice();
-        loadModel();
-        createSwapChain();
-        createImageViews();
-        createColorResources();
-        createDepthResources();
-        createRenderPass();
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createCommandPool();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffers();
-        createDescriptorPool();
-        createCommandBuffers();
-        createSyncObjects();
-        createTextureImage();
-        createTextureImageView();
-        createTextureSampler();
-        createDescriptorSets();
+        Task surface = graph.add("createSurface", [this]() { createSurface(); }, {instance});
+        Task physicalDevice = graph.add("pickPhysicalDevice", [this]() { pickPhysicalDeviceAndSetMSAASampleCount(); }, {surface});
+        Task logicalDevice = graph.add("createLogicalDevice", [this]() { createLogicalDevice(); }, {physicalDevice});
+
+        // CPU only, no Vulkan object needed
+        Task model = graph.add("loadModel", [this]() { loadModel(); });
+        Task textureFile = graph.add("readTextureFile", [this]() { readTextureFile(); });
+        Task shaderFiles = graph.add("readShaderFiles", [this]() { readShaderFiles(); });
+
+        Task swapChain = graph.add("createSwapChain", [this]() {
+            createSwapChain();
+            createImageViews();
+        }, {logicalDevice});
+        Task colorResources = graph.add("createColorResources", [this]() { createColorResources(); }, {swapChain});
+        // also picks depthFormat_, needed by the render pass
+        Task depthResources = graph.add("createDepthResources", [this]() { createDepthResources(); }, {swapChain});
+        Task renderPass = graph.add("createRenderPass", [this]() { createRenderPass(); }, {depthResources});
+        Task setLayout = graph.add("createDescriptorSetLayout", [this]() { createDescriptorSetLayout(); }, {logicalDevice});
+        Task pipeline = graph.add("createGraphicsPipeline", [this]() { createGraphicsPipeline(); }, {renderPass, setLayout, shaderFiles});
+        graph.add("createFramebuffers", [this]() { createFramebuffers(); }, {renderPass, colorResources});
+
+        Task commandPool = graph.add("createCommandPool", [this]() { createCommandPool(); }, {logicalDevice});
+        Task vertexBuffer = graph.add("createVertexBuffer", [this]() { createVertexBuffer(); }, {commandPool, model});
+        Task indexBuffer = graph.add("createIndexBuffer", [this]() { createIndexBuffer(); }, {vertexBuffer});
+        Task textureDecode = graph.add("decodeTexture", [this]() { decodeTexture(); }, {logicalDevice, textureFile});
+        Task textureImage = graph.add("createTextureImage", [this]() { createTextureImage(); }, {indexBuffer, textureDecode});
+        graph.add("createCommandBuffers", [this]() { createCommandBuffers(); }, {textureImage});
+        Task textureView = graph.add("createTextureImageView", [this]() { createTextureImageView(); }, {textureImage});
+        Task sampler = graph.add("createTextureSampler", [this]() { createTextureSampler(); }, {logicalDevice});
+
+        Task uniformBuffers = graph.add("createUniformBuffers", [this]() { createUniformBuffers(); }, {logicalDevice});
+        Task descriptorPool = graph.add("createDescriptorPool", [this]() { createDescriptorPool(); }, {logicalDevice});
+        graph.add("createSyncObjects", [this]() { createSyncObjects(); }, {logicalDevice});
+        // the push descriptor template references the pipeline layout
+        graph.add("createDescriptorSets", [this]() { createDescriptorSets(); },
+            {pipeline, descriptorPool, uniformBuffers, textureView, sampler});
+
+        graph.run(STARTUP_THREAD_COUNT);
+        graph.printTrace();
+
+        memory::printHeapStats();
     }
 
     void mainLoop() {
@@ -960,6 +1189,13 @@ private:
         // without escape button
         // glfwSetInputMode(window_, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         glfwSetCursorPosCallback(window_.get(), mouseCallback);
+        // H dumps the hitch log
+        glfwSetKeyCallback(window_.get(), keyCallback);
+
+        // the frame path must not allocate once warm, see the report at exit
+        heapcount::init();
+        // the hitches are the frames way longer than the recent ones
+        hitch::init();
 
         while (!glfwWindowShouldClose(window_.get())) {
             glfwPollEvents();
@@ -986,18 +1222,21 @@ private:
     void cleanup() {
         cleanupSwapChain();
 
-        vkDestroySampler(device_, textureSampler_, nullptr);
+        samplerCache_.release(textureSampler_);
+        samplerCache_.destroy();
+
+        buffer2::destroyStagingBuffer(device_, stagingBuffer_);
 
         vkDestroyImageView(device_, textureImageView_, nullptr);
 
         vkDestroyImage(device_, textureImage_, nullptr);
-        vkFreeMemory(device_, textureImageMemory_, nullptr);
+        memory::freeMemory(device_, textureImageMemory_);
 
         vkDestroyBuffer(device_, vertexBuffer_, nullptr);
-        vkFreeMemory(device_, vertexBufferMemory_, nullptr);
+        memory::freeMemory(device_, vertexBufferMemory_);
 
         vkDestroyBuffer(device_, indexBuffer_, nullptr);
-        vkFreeMemory(device_, indexBufferMemory_, nullptr);
+        memory::freeMemory(device_, indexBufferMemory_);
 
         // glfw doesn't provide method for this, so us vk call instead
         vkDestroySurfaceKHR(instance_, surface_, nullptr);
@@ -1008,18 +1247,22 @@ private:
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             vkDestroyBuffer(device_, uniformBuffers_[i], nullptr);
-            vkFreeMemory(device_, uniformBuffersMemory_[i], nullptr);
+            memory::freeMemory(device_, uniformBuffersMemory_[i]);
         }
 
         // this will destroy the pool and its descriptor sets
         vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
 
+        descriptor::destroyBinder(device_, descriptorBinder_);
+
         vkDestroyDescriptorSetLayout(device_, descriptorSetLayout_, nullptr);
 
         vkDestroyPipelineLayout(device_, pipelineLayout_, nullptr);
 
         vkDestroyCommandPool(device_, commandPool_, nullptr);
 
+        gpuStats_.destroy();
+
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             vkDestroySemaphore(device_, renderFinishedSemaphores_[i], nullptr);
             vkDestroySemaphore(device_, imageAvailableSemaphores_[i], nullptr);
@@ -1027,7 +1270,8 @@ private:
         }
 
         // This is caught by validation layer message if forgotten
-        vkDestroyDevice(device_, nullptr);
+        dispatch::resetDevice();
+        vkDestroyDevice(device_, hostalloc::getCallbacks());
 
         // TODO: why moving this on top of function scope
         // or here doesn't change ?
@@ -1041,7 +1285,7 @@ private:
         }
 
         // As we do not use RAII for now, destroy is needed
-        vkDestroyInstance(instance_, nullptr);
+        vkDestroyInstance(instance_, hostalloc::getCallbacks());
 
         glfwTerminate();
     }
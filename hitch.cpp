@@ -0,0 +1,199 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "hitch.hpp"
+
+namespace hitch {
+
+using Clock = std::chrono::steady_clock;
+
+// the events of the current frame, from any thread
+static std::atomic<uint32_t> eventCounts[CAUSE_COUNT];
+static std::atomic<uint64_t> eventNs[CAUSE_COUNT];
+
+// the frame loop thread only
+static double frameFactor = 2.0;
+static double frameMinExcessMs = 2.0;
+static bool frameStarted = false;
+static Clock::time_point frameStart;
+static double frameTimes[BASELINE_FRAME_COUNT];
+// nth_element scratch, the window stays in frame order
+static double sortedFrameTimes[BASELINE_FRAME_COUNT];
+static double baselineMs = 0.0;
+static bool lastFrameHitch = false;
+
+// the log, read by dump from any thread
+static std::mutex mutex;
+static std::vector<Hitch> ring;
+static uint32_t ringNext = 0;
+static uint64_t frameCount = 0;
+static uint64_t hitchCount = 0;
+static uint64_t hitchCountPerCause[CAUSE_COUNT];
+
+const char* getCauseName(Cause cause) {
+    switch (cause) {
+        case RESIZE: return "resize";
+        case UPLOAD: return "upload";
+        case COMPILE: return "compile";
+        case ALLOCATION: return "allocation";
+        case FENCE_WAIT: return "fence wait";
+        default: return "unknown";
+    }
+}
+
+void init(double factor, double minExcessMs, uint32_t logCapacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    frameFactor = factor;
+    frameMinExcessMs = minExcessMs;
+    frameStarted = false;
+    baselineMs = 0.0;
+    lastFrameHitch = false;
+    ring.assign(std::max(logCapacity, 1u), Hitch{});
+    ringNext = 0;
+    frameCount = 0;
+    hitchCount = 0;
+    for (uint32_t i = 0; i < CAUSE_COUNT; i++) {
+        hitchCountPerCause[i] = 0;
+        eventCounts[i] = 0;
+        eventNs[i] = 0;
+    }
+}
+
+/** median of the window, with the mutex locked */
+static double computeBaseline() {
+    uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(frameCount, BASELINE_FRAME_COUNT));
+    std::copy(frameTimes, frameTimes + count, sortedFrameTimes);
+    double* middle = sortedFrameTimes + count / 2;
+    std::nth_element(sortedFrameTimes, middle, sortedFrameTimes + count);
+    return *middle;
+}
+
+void endFrame() {
+    Clock::time_point now = Clock::now();
+    // always taken: an event of this frame must not leak into the next one
+    Events events[CAUSE_COUNT];
+    for (uint32_t i = 0; i < CAUSE_COUNT; i++) {
+        events[i].count = eventCounts[i].exchange(0);
+        events[i].ms = eventNs[i].exchange(0) / 1e6;
+    }
+    if (!frameStarted) {
+        frameStarted = true;
+        frameStart = now;
+        return;
+    }
+    double frameMs = std::chrono::duration<double, std::milli>(now - frameStart).count();
+    frameStart = now;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // against the baseline of the previous frames, a hitch can't hide itself
+    lastFrameHitch = frameCount >= MIN_BASELINE_FRAME_COUNT
+        && frameMs > baselineMs * frameFactor
+        && frameMs - baselineMs >= frameMinExcessMs;
+
+    if (lastFrameHitch) {
+        Hitch& hitch = ring[ringNext];
+        ringNext = (ringNext + 1) % ring.size();
+        hitch.frameIndex = frameCount;
+        hitch.frameMs = frameMs;
+        hitch.baselineMs = baselineMs;
+        for (uint32_t i = 0; i < CAUSE_COUNT; i++) {
+            hitch.events[i] = events[i];
+            if (events[i].count > 0) {
+                hitchCountPerCause[i]++;
+            }
+        }
+        hitchCount++;
+    }
+
+    frameTimes[frameCount % BASELINE_FRAME_COUNT] = frameMs;
+    frameCount++;
+    baselineMs = computeBaseline();
+}
+
+bool wasLastFrameHitch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastFrameHitch;
+}
+
+double getBaselineMs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return baselineMs;
+}
+
+uint64_t getFrameCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return frameCount;
+}
+
+uint64_t getHitchCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hitchCount;
+}
+
+/** with the mutex locked */
+static std::vector<Hitch> getHitchesLocked() {
+    std::vector<Hitch> hitches;
+    uint64_t count = std::min<uint64_t>(hitchCount, ring.size());
+    hitches.reserve(count);
+    // the oldest is the next to be overwritten once the ring is full
+    uint32_t first = static_cast<uint32_t>((ringNext + ring.size() - count) % ring.size());
+    for (uint64_t i = 0; i < count; i++) {
+        hitches.push_back(ring[(first + i) % ring.size()]);
+    }
+    return hitches;
+}
+
+std::vector<Hitch> getHitches() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return getHitchesLocked();
+}
+
+void dump() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Hitch> hitches = getHitchesLocked();
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "hitches: " << hitchCount << " in " << frameCount << " frames (longer than "
+        << frameFactor << "x the median of the last " << BASELINE_FRAME_COUNT << " frames and by "
+        << frameMinExcessMs << " ms), current baseline " << baselineMs << " ms\n";
+    if (hitchCount == 0) {
+        std::cout << std::defaultfloat;
+        return;
+    }
+    std::cout << "hitches with:";
+    for (uint32_t i = 0; i < CAUSE_COUNT; i++) {
+        std::cout << " " << getCauseName(static_cast<Cause>(i)) << " " << hitchCountPerCause[i];
+    }
+    std::cout << "\nlast " << hitches.size() << ":\n"
+        << "     frame    frame ms baseline ms  events\n";
+    for (const Hitch& hitch : hitches) {
+        std::cout << std::setw(10) << hitch.frameIndex
+            << std::setw(12) << hitch.frameMs
+            << std::setw(12) << hitch.baselineMs << " ";
+        double attributedMs = 0.0;
+        for (uint32_t i = 0; i < CAUSE_COUNT; i++) {
+            const Events& events = hitch.events[i];
+            if (events.count > 0) {
+                std::cout << " " << getCauseName(static_cast<Cause>(i)) << " x" << events.count
+                    << " " << events.ms << " ms,";
+                attributedMs += events.ms;
+            }
+        }
+        // nested events and other threads can make the events longer than the frame
+        std::cout << " other " << std::max(0.0, hitch.frameMs - attributedMs) << " ms\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+ScopedEvent::ScopedEvent(Cause cause) : cause_(cause), start_(Clock::now()) {}
+
+ScopedEvent::~ScopedEvent() {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    eventCounts[cause_]++;
+    eventNs[cause_] += ns;
+}
+
+}
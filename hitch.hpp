@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+namespace hitch {
+
+/**
+ * Frame hitch detector: endFrame measures the time since the previous endFrame and
+ * compares it to a baseline, the median of the last BASELINE_FRAME_COUNT frames.
+ * A frame longer than factor * baseline, and by at least minExcessMs, is a hitch.
+ *
+ * The usual suspects are instrumented with a ScopedEvent: each hitch is logged with
+ * the count and the time of the events of each cause during its frame, the time left
+ * is "other" (scheduling, compositor, a cause not instrumented yet).
+ * The events of all the threads count for the current frame (a texture upload on a
+ * loader thread still competes for the queue), nested events count for each cause.
+ *
+ * The log is a ring buffer of the last logCapacity hitches: dump prints it, on demand
+ * (H in hello_model_1) and at exit. Nothing allocates after init.
+ */
+enum Cause {
+    RESIZE,
+    UPLOAD,
+    COMPILE,
+    ALLOCATION,
+    FENCE_WAIT,
+    CAUSE_COUNT
+};
+
+const uint32_t BASELINE_FRAME_COUNT = 120;
+/** no hitch before this many frames: the baseline of the first frames means nothing */
+const uint32_t MIN_BASELINE_FRAME_COUNT = 30;
+
+struct Events {
+    uint32_t count = 0;
+    double ms = 0.0;
+};
+
+struct Hitch {
+    uint64_t frameIndex = 0;
+    double frameMs = 0.0;
+    double baselineMs = 0.0;
+    Events events[CAUSE_COUNT];
+};
+
+/** "resize", "upload", ... */
+const char* getCauseName(Cause cause);
+
+/** forgets the frames and the log, the next endFrame only starts the first frame */
+void init(double factor = 2.0, double minExcessMs = 2.0, uint32_t logCapacity = 64);
+
+/** closes the current frame, once per frame on the thread running the frame loop */
+void endFrame();
+
+/** the frame is a hitch if it returns true, its entry is the last of getHitches */
+bool wasLastFrameHitch();
+
+/** median of the last frames, 0 before the first frame */
+double getBaselineMs();
+
+uint64_t getFrameCount();
+/** all the hitches since init, including the ones dropped from the log */
+uint64_t getHitchCount();
+
+/** the log, oldest first */
+std::vector<Hitch> getHitches();
+
+/** the hitch count per cause, then the log: one line per hitch with its events */
+void dump();
+
+class ScopedEvent {
+public:
+    explicit ScopedEvent(Cause cause);
+    ~ScopedEvent();
+
+    ScopedEvent(const ScopedEvent&) = delete;
+    ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+private:
+    Cause cause_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}
@@ -0,0 +1,188 @@
+/**
+ * Headless benchmark of hostimport::createBufferFromFile
+ *
+ * Writes an asset sized file, then uploads it to a device local buffer through
+ * the import of the mmap'd pages (VK_EXT_external_memory_host) and through the
+ * staging fallback. Each result is read back and compared to the file.
+ * The file stays in the page cache: this measures the copies, not the disk.
+ *
+ * usage: host_import_bench [--mb M] [--runs R] [--path P]
+ */
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "hostimport.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "imageloader.hpp"
+#include "headless.hpp"
+
+struct BenchOptions {
+    uint32_t sizeMB = 64;
+    uint32_t runCount = 10;
+    std::string path = "/tmp/host_import_bench.bin";
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        if (name == "--mb") {
+            options.sizeMB = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (name == "--runs") {
+            options.runCount = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (name == "--path") {
+            options.path = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** not a multiple of the page size on purpose: the end of the mapping is padded */
+static std::vector<unsigned char> writeFile(const std::string& path, size_t size) {
+    std::vector<unsigned char> content(size);
+    uint32_t state = 2166136261u;
+    for (auto& byte : content) {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<unsigned char>(state >> 24);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(content.data()), static_cast<std::streamsize>(content.size()));
+    if (!file) {
+        throw std::runtime_error("failed to write " + path + "!");
+    }
+    return content;
+}
+
+/** copy back to a Readback buffer and hash it */
+static uint64_t hashBuffer(
+    const headless::Device& headless,
+    VkCommandPool commandPool,
+    VkBuffer buffer,
+    VkDeviceSize size
+) {
+    VkBuffer readbackBuffer;
+    VkDeviceMemory readbackMemory;
+    buffer2::bindBuffer(headless.physicalDevice_, headless.device_, size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT, memory::Readback, readbackBuffer, readbackMemory);
+
+    buffer2::copyBuffer(headless.device_, commandPool, headless.queue_, buffer, readbackBuffer, size);
+
+    void* data;
+    vkMapMemory(headless.device_, readbackMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    mapped::invalidate(headless.device_, readbackMemory, 0, size);
+    uint64_t hash = imageloader::hashContent(static_cast<const unsigned char*>(data), static_cast<size_t>(size));
+    vkUnmapMemory(headless.device_, readbackMemory);
+
+    vkDestroyBuffer(headless.device_, readbackBuffer, nullptr);
+    memory::freeMemory(headless.device_, readbackMemory);
+    return hash;
+}
+
+static void run(const BenchOptions& options) {
+    auto optionalDeviceExtensions = hostimport::getDeviceExtensions();
+    headless::Device headless;
+    headless.init("Host import bench", optionalDeviceExtensions, hostimport::getInstanceExtensions());
+
+    bool extensionsEnabled = headless.properties2_;
+    for (const char* name : hostimport::getInstanceExtensions()) {
+        extensionsEnabled = extensionsEnabled && headless.isExtensionEnabled(name);
+    }
+    for (const char* name : optionalDeviceExtensions) {
+        extensionsEnabled = extensionsEnabled && headless.isExtensionEnabled(name);
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+
+    hostimport::Importer importer;
+    hostimport::createImporter(headless.instance_, headless.physicalDevice_, headless.device_, extensionsEnabled, importer);
+    std::cout << "device: " << properties.deviceName << ", VK_EXT_external_memory_host "
+        << (hostimport::isAvailable(importer)
+            ? "available (alignment " + std::to_string(importer.alignment) + ")"
+            : std::string("not available, fallback only")) << '\n';
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(headless.device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    size_t fileSize = static_cast<size_t>(options.sizeMB) * 1024 * 1024 + 123;
+    auto content = writeFile(options.path, fileSize);
+    uint64_t expectedHash = imageloader::hashContent(content.data(), content.size());
+    std::vector<unsigned char>().swap(content);
+
+    for (bool allowImport : {true, false}) {
+        if (allowImport && !hostimport::isAvailable(importer)) {
+            continue;
+        }
+
+        double totalMs = 0.0;
+        bool imported = false;
+        bool valid = true;
+        for (uint32_t i = 0; i < options.runCount; i++) {
+            VkBuffer buffer;
+            VkDeviceMemory bufferMemory;
+            VkDeviceSize size;
+
+            auto start = std::chrono::steady_clock::now();
+            imported = hostimport::createBufferFromFile(importer, commandPool, headless.queue_, options.path,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT, allowImport, buffer, bufferMemory, size);
+            totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            // first and last runs only, hashing is slower than the upload
+            if (i == 0 || i + 1 == options.runCount) {
+                valid = valid && size == fileSize && hashBuffer(headless, commandPool, buffer, size) == expectedHash;
+            }
+
+            vkDestroyBuffer(headless.device_, buffer, nullptr);
+            memory::freeMemory(headless.device_, bufferMemory);
+        }
+
+        double averageMs = totalMs / std::max(options.runCount, 1u);
+        std::cout << (allowImport ? "import:  " : "staging: ")
+            << averageMs << " ms, " << (fileSize / (1024.0 * 1024.0)) / (averageMs / 1000.0) << " MB/s"
+            << (allowImport && !imported ? " (the driver refused the pointer, fell back to staging)" : "")
+            << (valid ? "" : " CONTENT MISMATCH") << '\n';
+
+        if (!valid) {
+            throw std::runtime_error("uploaded buffer differs from the file!");
+        }
+    }
+
+    std::remove(options.path.c_str());
+    vkDestroyCommandPool(headless.device_, commandPool, nullptr);
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "hostalloc.hpp"
+
+namespace hostalloc {
+
+struct AtomicStats {
+    std::atomic<uint64_t> allocationCount{0};
+    std::atomic<uint64_t> reallocationCount{0};
+    std::atomic<uint64_t> freeCount{0};
+    std::atomic<uint64_t> arenaCount{0};
+    std::atomic<uint64_t> liveBytes{0};
+    std::atomic<uint64_t> peakBytes{0};
+    std::atomic<uint64_t> internalAllocationCount{0};
+    std::atomic<uint64_t> internalLiveBytes{0};
+};
+
+/** the command scope temporaries of one thread */
+struct Arena {
+    // a vkCreateGraphicsPipelines needs a few KB on lavapipe, more goes to the heap
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    char* chunk = nullptr;
+    size_t offset = 0;
+    // freed from another thread is allowed, so atomic, but only the owner rewinds
+    std::atomic<uint32_t> outstandingCount{0};
+
+    ~Arena() {
+        // a command scope allocation still alive at thread exit would be a driver bug,
+        // leak the chunk rather than have it point to freed memory
+        if (outstandingCount == 0) {
+            free(chunk);
+        }
+    }
+};
+
+/** right before the pointer returned to the driver */
+struct Header {
+    void* base;
+    size_t size;
+    Arena* arena;
+    uint32_t scope;
+};
+
+static bool enabled = false;
+static uint32_t warmupFrames = 0;
+static VkAllocationCallbacks callbacks{};
+static AtomicStats stats[SCOPE_COUNT];
+
+// per frame, only touched by the thread calling endFrame
+static uint64_t frameIndex = 0;
+static uint64_t frameStartCounts[SCOPE_COUNT] = {};
+static uint64_t lastFrameCounts[SCOPE_COUNT] = {};
+static uint64_t steadyCounts[SCOPE_COUNT] = {};
+static uint64_t steadyFrameCount = 0;
+
+static thread_local Arena arena;
+
+static uint32_t toIndex(VkSystemAllocationScope scope) {
+    return std::min(static_cast<uint32_t>(scope), SCOPE_COUNT - 1);
+}
+
+static void addLiveBytes(AtomicStats& scopeStats, size_t size) {
+    uint64_t live = scopeStats.liveBytes.fetch_add(size) + size;
+    uint64_t peak = scopeStats.peakBytes.load();
+    while (live > peak && !scopeStats.peakBytes.compare_exchange_weak(peak, live)) {}
+}
+
+static void* allocateInArena(size_t size, size_t alignment) {
+    if (arena.outstandingCount == 0) {
+        arena.offset = 0;
+    }
+    if (!arena.chunk) {
+        arena.chunk = static_cast<char*>(malloc(Arena::CHUNK_SIZE));
+        if (!arena.chunk) {
+            return nullptr;
+        }
+    }
+
+    alignment = std::max(alignment, alignof(Header));
+    uintptr_t start = reinterpret_cast<uintptr_t>(arena.chunk) + arena.offset;
+    uintptr_t user = (start + sizeof(Header) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    size_t end = user + size - reinterpret_cast<uintptr_t>(arena.chunk);
+    if (end > Arena::CHUNK_SIZE) {
+        return nullptr;
+    }
+    arena.offset = end;
+    arena.outstandingCount++;
+
+    auto header = reinterpret_cast<Header*>(user) - 1;
+    header->base = nullptr;
+    header->arena = &arena;
+    return reinterpret_cast<void*>(user);
+}
+
+static void* allocateInHeap(size_t size, size_t alignment) {
+    alignment = std::max(alignment, alignof(Header));
+    void* base = malloc(size + sizeof(Header) + alignment - 1);
+    if (!base) {
+        return nullptr;
+    }
+    uintptr_t user = (reinterpret_cast<uintptr_t>(base) + sizeof(Header) + alignment - 1)
+        & ~(static_cast<uintptr_t>(alignment) - 1);
+
+    auto header = reinterpret_cast<Header*>(user) - 1;
+    header->base = base;
+    header->arena = nullptr;
+    return reinterpret_cast<void*>(user);
+}
+
+static void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    uint32_t index = toIndex(scope);
+
+    void* memory = nullptr;
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+        memory = allocateInArena(size, alignment);
+        if (memory) {
+            stats[index].arenaCount++;
+        }
+    }
+    if (!memory) {
+        memory = allocateInHeap(size, alignment);
+    }
+    if (!memory) {
+        return nullptr;
+    }
+
+    auto header = static_cast<Header*>(memory) - 1;
+    header->size = size;
+    header->scope = index;
+    addLiveBytes(stats[index], size);
+    return memory;
+}
+
+static void release(void* memory) {
+    auto header = static_cast<Header*>(memory) - 1;
+    stats[header->scope].freeCount++;
+    stats[header->scope].liveBytes -= header->size;
+
+    if (header->arena) {
+        // rewound at the next allocation of the owner thread
+        header->arena->outstandingCount--;
+    } else {
+        free(header->base);
+    }
+}
+
+static VKAPI_ATTR void* VKAPI_CALL allocationCallback(
+    void* pUserData,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope allocationScope
+) {
+    if (size == 0) {
+        return nullptr;
+    }
+    stats[toIndex(allocationScope)].allocationCount++;
+    return allocate(size, alignment, allocationScope);
+}
+
+static VKAPI_ATTR void* VKAPI_CALL reallocationCallback(
+    void* pUserData,
+    void* pOriginal,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope allocationScope
+) {
+    // the spec makes these two an allocation and a free
+    if (!pOriginal) {
+        return allocationCallback(pUserData, size, alignment, allocationScope);
+    }
+    if (size == 0) {
+        release(pOriginal);
+        return nullptr;
+    }
+
+    stats[toIndex(allocationScope)].reallocationCount++;
+    void* memory = allocate(size, alignment, allocationScope);
+    if (!memory) {
+        // the original stays valid
+        return nullptr;
+    }
+    auto original = static_cast<Header*>(pOriginal) - 1;
+    memcpy(memory, pOriginal, std::min(size, original->size));
+    release(pOriginal);
+    return memory;
+}
+
+static VKAPI_ATTR void VKAPI_CALL freeCallback(void* pUserData, void* pMemory) {
+    if (pMemory) {
+        release(pMemory);
+    }
+}
+
+static VKAPI_ATTR void VKAPI_CALL internalAllocationCallback(
+    void* pUserData,
+    size_t size,
+    VkInternalAllocationType allocationType,
+    VkSystemAllocationScope allocationScope
+) {
+    auto& scopeStats = stats[toIndex(allocationScope)];
+    scopeStats.internalAllocationCount++;
+    scopeStats.internalLiveBytes += size;
+}
+
+static VKAPI_ATTR void VKAPI_CALL internalFreeCallback(
+    void* pUserData,
+    size_t size,
+    VkInternalAllocationType allocationType,
+    VkSystemAllocationScope allocationScope
+) {
+    stats[toIndex(allocationScope)].internalLiveBytes -= size;
+}
+
+void init(bool enable, uint32_t warmupFrameCount) {
+    enabled = enable;
+    warmupFrames = warmupFrameCount;
+
+    callbacks = VkAllocationCallbacks{};
+    callbacks.pfnAllocation = allocationCallback;
+    callbacks.pfnReallocation = reallocationCallback;
+    callbacks.pfnFree = freeCallback;
+    callbacks.pfnInternalAllocation = internalAllocationCallback;
+    callbacks.pfnInternalFree = internalFreeCallback;
+}
+
+bool isEnabled() {
+    return enabled;
+}
+
+const VkAllocationCallbacks* getCallbacks() {
+    return enabled ? &callbacks : nullptr;
+}
+
+ScopeStats getStats(VkSystemAllocationScope scope) {
+    const auto& scopeStats = stats[toIndex(scope)];
+
+    ScopeStats result;
+    result.allocationCount = scopeStats.allocationCount;
+    result.reallocationCount = scopeStats.reallocationCount;
+    result.freeCount = scopeStats.freeCount;
+    result.arenaCount = scopeStats.arenaCount;
+    result.liveBytes = scopeStats.liveBytes;
+    result.peakBytes = scopeStats.peakBytes;
+    result.internalAllocationCount = scopeStats.internalAllocationCount;
+    result.internalLiveBytes = scopeStats.internalLiveBytes;
+    return result;
+}
+
+void endFrame() {
+    if (!enabled) {
+        return;
+    }
+
+    bool steady = frameIndex >= warmupFrames;
+    for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+        uint64_t count = stats[i].allocationCount + stats[i].reallocationCount;
+        lastFrameCounts[i] = count - frameStartCounts[i];
+        frameStartCounts[i] = count;
+        if (steady) {
+            steadyCounts[i] += lastFrameCounts[i];
+        }
+    }
+    if (steady) {
+        steadyFrameCount++;
+    }
+    frameIndex++;
+}
+
+uint64_t getLastFrameAllocationCount(VkSystemAllocationScope scope) {
+    return lastFrameCounts[toIndex(scope)];
+}
+
+const char* getScopeName(VkSystemAllocationScope scope) {
+    switch (scope) {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+    case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+    case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+    default: return "instance";
+    }
+}
+
+void printReport() {
+    if (!enabled) {
+        return;
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "driver host allocations (" << frameIndex << " frames, "
+        << steadyFrameCount << " after the " << warmupFrames << " warmup ones)\n"
+        << "     scope      allocs    reallocs       frees   arena   live KB   peak KB  last frame  per frame\n";
+    for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+        auto scope = static_cast<VkSystemAllocationScope>(i);
+        ScopeStats scopeStats = getStats(scope);
+        std::cout << std::setw(10) << getScopeName(scope)
+            << std::setw(12) << scopeStats.allocationCount
+            << std::setw(12) << scopeStats.reallocationCount
+            << std::setw(12) << scopeStats.freeCount
+            << std::setw(8) << scopeStats.arenaCount
+            << std::setw(10) << scopeStats.liveBytes / 1024.0
+            << std::setw(10) << scopeStats.peakBytes / 1024.0
+            << std::setw(12) << lastFrameCounts[i]
+            << std::setw(11) << (steadyFrameCount ? static_cast<double>(steadyCounts[i]) / steadyFrameCount : 0.0)
+            << '\n';
+        if (scopeStats.internalAllocationCount > 0) {
+            std::cout << "            + " << scopeStats.internalAllocationCount << " internal allocations, "
+                << scopeStats.internalLiveBytes / 1024.0 << " KB live\n";
+        }
+    }
+    std::cout << std::defaultfloat;
+}
+
+}
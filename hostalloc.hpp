@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace hostalloc {
+
+/**
+ * VkAllocationCallbacks counting the host memory the driver allocates, per
+ * VkSystemAllocationScope:
+ * * COMMAND: only lives during the vk* call (temporaries of vkQueueSubmit, vkCreate*...)
+ * * OBJECT: lives as long as the Vulkan object (command buffers, pipelines...)
+ * * CACHE: pipeline cache
+ * * DEVICE / INSTANCE: lives as long as the device / instance
+ *
+ * The COMMAND scope allocations come from a thread local arena: a bump pointer
+ * in one chunk per thread, rewound once everything allocated from it is freed.
+ * They are freed before the vk* call returns so the arena is almost always empty
+ * at the next call. Too big for the chunk, they go to the heap like the others.
+ *
+ * Switched at startup: with init(false) getCallbacks returns nullptr, the driver
+ * allocates with its own allocator and nothing is counted.
+ * The callbacks are passed to vkCreateInstance and vkCreateDevice: the child
+ * objects created with a nullptr pAllocator use the device allocator (Mesa drivers
+ * do, the spec lets the driver choose), which covers the per frame calls.
+ * The allocator given at creation must be given at destruction too.
+ */
+
+const uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+struct ScopeStats {
+    /** allocations and reallocations, the host allocator calls the driver makes */
+    uint64_t allocationCount = 0;
+    uint64_t reallocationCount = 0;
+    uint64_t freeCount = 0;
+    /** served by the thread local arena (COMMAND scope only) */
+    uint64_t arenaCount = 0;
+    uint64_t liveBytes = 0;
+    uint64_t peakBytes = 0;
+    /** vkInternalAllocationNotification: executable memory... the driver allocates itself */
+    uint64_t internalAllocationCount = 0;
+    uint64_t internalLiveBytes = 0;
+};
+
+/**
+ * before vkCreateInstance. warmupFrameCount: frames ignored by the steady state
+ * averages (the first frames create caches, grow the command pools...)
+ */
+void init(bool enabled, uint32_t warmupFrameCount = 100);
+
+bool isEnabled();
+
+/** nullptr if disabled, to pass as pAllocator */
+const VkAllocationCallbacks* getCallbacks();
+
+/** totals since init */
+ScopeStats getStats(VkSystemAllocationScope scope);
+
+/** once per frame, after the submit and the present */
+void endFrame();
+
+/** allocations + reallocations during the last frame */
+uint64_t getLastFrameAllocationCount(VkSystemAllocationScope scope);
+
+/** totals, last frame and average per frame after the warmup, per scope */
+void printReport();
+
+const char* getScopeName(VkSystemAllocationScope scope);
+
+}
@@ -0,0 +1,335 @@
+#include <stdexcept>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hostimport.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+
+namespace hostimport {
+
+/** calls its function when leaving the scope, unwinding included, unless dismissed */
+template <typename Function>
+class ScopeGuard {
+public:
+    explicit ScopeGuard(Function function) : function_(function) {}
+    ~ScopeGuard() {
+        if (active_) {
+            function_();
+        }
+    }
+    ScopeGuard(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(const ScopeGuard&) = delete;
+
+    void dismiss() {
+        active_ = false;
+    }
+
+private:
+    Function function_;
+    bool active_ = true;
+};
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::vector<const char*> getInstanceExtensions() {
+    return {VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME};
+}
+
+std::vector<const char*> getDeviceExtensions() {
+    return {VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME};
+}
+
+void mapFile(const std::string& path, VkDeviceSize alignment, MappedFile& file) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open file " + path + "!");
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("failed to map empty file " + path + "!");
+    }
+
+    VkDeviceSize pageSize = static_cast<VkDeviceSize>(sysconf(_SC_PAGESIZE));
+    alignment = std::max(alignment, pageSize);
+
+    file = MappedFile{};
+    file.size = static_cast<VkDeviceSize>(status.st_size);
+    file.mappedSize = alignUp(file.size, alignment);
+
+    // mmap only guarantees the page alignment: reserve enough to align the start
+    // then map the file over the beginning of the reservation, the rest stays zero pages
+    file.reservationSize = static_cast<size_t>(file.mappedSize + alignment - pageSize);
+    file.reservation = mmap(nullptr, file.reservationSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (file.reservation == MAP_FAILED) {
+        close(fd);
+        file = MappedFile{};
+        throw std::runtime_error("failed to map file " + path + "!");
+    }
+
+    auto start = reinterpret_cast<uintptr_t>(file.reservation);
+    void* data = reinterpret_cast<void*>(alignUp(start, alignment));
+    if (mmap(data, static_cast<size_t>(file.size), PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(file.reservation, file.reservationSize);
+        close(fd);
+        file = MappedFile{};
+        throw std::runtime_error("failed to map file " + path + "!");
+    }
+
+    // the mapping keeps its own reference on the file
+    close(fd);
+
+    // the whole file is about to be read by the copy, start the reads now
+    madvise(data, static_cast<size_t>(file.size), MADV_WILLNEED);
+    file.data = data;
+}
+
+void unmapFile(MappedFile& file) {
+    if (file.reservation == nullptr) {
+        return;
+    }
+
+    // also unmaps the file mapped over the reservation
+    munmap(file.reservation, file.reservationSize);
+    file = MappedFile{};
+}
+
+void createImporter(
+    VkInstance instance,
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    bool extensionsEnabled,
+    Importer& importer
+) {
+    importer = Importer{};
+    importer.physicalDevice = physicalDevice;
+    importer.logicalDevice = logicalDevice;
+
+    if (!extensionsEnabled) {
+        return;
+    }
+
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+    auto getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT) vkGetDeviceProcAddr(logicalDevice, "vkGetMemoryHostPointerPropertiesEXT");
+    if (getProperties2 == nullptr || getHostPointerProperties == nullptr) {
+        return;
+    }
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties{};
+    hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &hostProperties;
+    getProperties2(physicalDevice, &properties);
+
+    importer.alignment = hostProperties.minImportedHostPointerAlignment;
+    importer.getMemoryHostPointerProperties = getHostPointerProperties;
+}
+
+bool isAvailable(const Importer& importer) {
+    return importer.alignment != 0;
+}
+
+/**
+ * TRANSFER_SRC buffer bound to the pages of file.
+ * false, with nothing left to destroy, if the driver doesn't accept them
+ */
+static bool importFile(const Importer& importer, const MappedFile& file, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    const auto handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    // the import itself doesn't write, the pointer is only non const in the structs
+    void* hostPointer = const_cast<void*>(file.data);
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties{};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (importer.getMemoryHostPointerProperties(importer.logicalDevice, handleType, hostPointer, &pointerProperties) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkExternalMemoryBufferCreateInfoKHR externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+    externalInfo.handleTypes = handleType;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = &externalInfo;
+    bufferInfo.size = file.size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    // the driver may refuse external memory buffers of this size: the staging path still works
+    if (vkCreateBuffer(importer.logicalDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(importer.logicalDevice, buffer, &memRequirements);
+
+    uint32_t typeBits = memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+    if (typeBits == 0 || memRequirements.size > file.mappedSize) {
+        vkDestroyBuffer(importer.logicalDevice, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = handleType;
+    importInfo.pHostPointer = hostPointer;
+
+    // not through memory::allocateMemory: these are the pages of the file, not a heap allocation
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = file.mappedSize;
+    allocInfo.memoryTypeIndex = static_cast<uint32_t>(__builtin_ctz(typeBits));
+
+    if (vkAllocateMemory(importer.logicalDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(importer.logicalDevice, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
+        bufferMemory = VK_NULL_HANDLE;
+        return false;
+    }
+
+    if (vkBindBufferMemory(importer.logicalDevice, buffer, bufferMemory, 0) != VK_SUCCESS) {
+        vkDestroyBuffer(importer.logicalDevice, buffer, nullptr);
+        vkFreeMemory(importer.logicalDevice, bufferMemory, nullptr);
+        buffer = VK_NULL_HANDLE;
+        bufferMemory = VK_NULL_HANDLE;
+        return false;
+    }
+    return true;
+}
+
+bool createBufferFromFile(
+    const Importer& importer,
+    VkCommandPool commandPool,
+    VkQueue queue,
+    const std::string& path,
+    VkBufferUsageFlags usage,
+    bool allowImport,
+    VkBuffer& buffer,
+    VkDeviceMemory& bufferMemory,
+    VkDeviceSize& size
+) {
+    VkDevice logicalDevice = importer.logicalDevice;
+    VkBuffer srcBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory srcMemory = VK_NULL_HANDLE;
+    // imported memory is not a memory::allocateMemory allocation
+    bool imported = false;
+    MappedFile file;
+    buffer = VK_NULL_HANDLE;
+    bufferMemory = VK_NULL_HANDLE;
+
+    // whatever throws below (bindBuffer, copyBuffer, the read...): the source and the
+    // mapping always go, the destination unless it is returned
+    ScopeGuard releaseSource([&]() {
+        if (srcBuffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, srcBuffer, nullptr);
+        }
+        if (srcMemory != VK_NULL_HANDLE) {
+            if (imported) {
+                vkFreeMemory(logicalDevice, srcMemory, nullptr);
+            } else {
+                memory::freeMemory(logicalDevice, srcMemory);
+            }
+        }
+        unmapFile(file);
+    });
+    ScopeGuard releaseDestination([&]() {
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+        }
+        if (bufferMemory != VK_NULL_HANDLE) {
+            memory::freeMemory(logicalDevice, bufferMemory);
+            bufferMemory = VK_NULL_HANDLE;
+        }
+    });
+
+    if (allowImport && isAvailable(importer)) {
+        mapFile(path, importer.alignment, file);
+        imported = importFile(importer, file, srcBuffer, srcMemory);
+
+        if (imported) {
+            size = file.size;
+            buffer2::bindBuffer(
+                importer.physicalDevice,
+                logicalDevice,
+                size,
+                usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                memory::GpuOnly,
+                buffer,
+                bufferMemory
+            );
+
+            // waits for the queue: the pages can be unmapped right after, by releaseSource
+            buffer2::copyBuffer(logicalDevice, commandPool, queue, srcBuffer, buffer, size);
+
+            releaseDestination.dismiss();
+            return true;
+        }
+
+        unmapFile(file);
+    }
+
+    std::ifstream stream(path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open()) {
+        throw std::runtime_error("failed to open file " + path + "!");
+    }
+    size = static_cast<VkDeviceSize>(stream.tellg());
+    if (size == 0) {
+        throw std::runtime_error("failed to read empty file " + path + "!");
+    }
+    stream.seekg(0);
+
+    buffer2::bindBuffer(
+        importer.physicalDevice,
+        logicalDevice,
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        memory::Upload,
+        srcBuffer,
+        srcMemory
+    );
+
+    // read by the kernel straight into the staging memory
+    void* data;
+    vkMapMemory(logicalDevice, srcMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    stream.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+    mapped::flush(logicalDevice, srcMemory, 0, size);
+    vkUnmapMemory(logicalDevice, srcMemory);
+
+    if (!stream) {
+        throw std::runtime_error("failed to read file " + path + "!");
+    }
+
+    buffer2::bindBuffer(
+        importer.physicalDevice,
+        logicalDevice,
+        size,
+        usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly,
+        buffer,
+        bufferMemory
+    );
+
+    buffer2::copyBuffer(logicalDevice, commandPool, queue, srcBuffer, buffer, size);
+
+    releaseDestination.dismiss();
+    return false;
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace hostimport {
+
+/**
+ * Zero copy uploads of raw asset files (vertices, indices, already encoded GPU data...)
+ *
+ * The usual path reads the file into RAM then copies it into a staging buffer,
+ * the bytes go through the CPU twice. With VK_EXT_external_memory_host the pages
+ * of the mmap'd file are imported as VkDeviceMemory and bound to a TRANSFER_SRC buffer:
+ * the GPU copies from the page cache to device local memory, no memcpy at all.
+ *
+ * The import needs a host pointer and a size aligned to minImportedHostPointerAlignment
+ * (usually the page size, can be bigger), see mapFile.
+ * Without the extensions, or if the driver refuses the pointer (some only accept
+ * anonymous memory), the file is read straight into mapped staging memory instead:
+ * one copy by the kernel, still no intermediate vector.
+ * lavapipe supports the extension, so the import path runs without a GPU too.
+ */
+
+/** VK_KHR_external_memory_capabilities, VK_KHR_external_memory depends on it (Vulkan 1.0 instance) */
+std::vector<const char*> getInstanceExtensions();
+
+/** VK_KHR_external_memory and VK_EXT_external_memory_host */
+std::vector<const char*> getDeviceExtensions();
+
+/**
+ * A read only mapping of a whole file at an address aligned to alignment.
+ * The mapping goes up to mappedSize (size rounded up to alignment), the pages past
+ * the end of the file are anonymous zero pages: reading them never raises SIGBUS
+ */
+struct MappedFile {
+    const void* data = nullptr;
+    VkDeviceSize size = 0;
+    VkDeviceSize mappedSize = 0;
+    // what munmap needs, data is somewhere inside
+    void* reservation = nullptr;
+    size_t reservationSize = 0;
+};
+
+/** throws if the file can't be opened or is empty */
+void mapFile(const std::string& path, VkDeviceSize alignment, MappedFile& file);
+void unmapFile(MappedFile& file);
+
+/**
+ * What the import needs, looked up once like descriptor::Binder.
+ * alignment is 0 when the import path can't be used
+ */
+struct Importer {
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice logicalDevice = VK_NULL_HANDLE;
+    VkDeviceSize alignment = 0;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = nullptr;
+};
+
+/**
+ * extensionsEnabled: getInstanceExtensions and getDeviceExtensions were all enabled
+ * (VK_KHR_get_physical_device_properties2 too), else every upload takes the fallback
+ */
+void createImporter(
+    VkInstance instance,
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    bool extensionsEnabled,
+    Importer& importer
+);
+
+bool isAvailable(const Importer& importer);
+
+/**
+ * Create a device local buffer (usage | TRANSFER_DST) holding the whole file.
+ * Waits for the copy, like buffer2::copyBuffer.
+ * Returns true if the file pages were imported, false if the staging fallback was used
+ * (always with allowImport false, e.g. to compare both paths)
+ */
+bool createBufferFromFile(
+    const Importer& importer,
+    VkCommandPool commandPool,
+    VkQueue queue,
+    const std::string& path,
+    VkBufferUsageFlags usage,
+    bool allowImport,
+    VkBuffer& buffer,
+    VkDeviceMemory& bufferMemory,
+    VkDeviceSize& size
+);
+
+}
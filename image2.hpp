@@ -6,6 +6,7 @@
 
 namespace image2 {
 
-VkImageView createImageView(VkDevice logicalDevice, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
+/** the levels [baseMipLevel, baseMipLevel + mipLevels), format may differ from the image's if it was created MUTABLE_FORMAT */
+VkImageView createImageView(VkDevice logicalDevice, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0);
 
 }
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <cstring>
+#include <cctype>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// the implementation is compiled in texture3.cpp
+#include "stb_image.h"
+
+#include "imageloader.hpp"
+#include "profiler.hpp"
+
+namespace imageloader {
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t hashContent(const unsigned char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool readFileContent(const std::string& path, std::vector<unsigned char>& content) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    content.resize(fileSize);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(content.data()), fileSize);
+
+    return static_cast<bool>(file);
+}
+
+bool probeImage(const std::vector<unsigned char>& content, int& width, int& height, int& channels) {
+    return stbi_info_from_memory(content.data(), static_cast<int>(content.size()), &width, &height, &channels) != 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * 4 texels by iteration: 12 bytes are spread on 16 with a shuffle, the alpha is or'ed in.
+ * It reads 16 bytes to use 12, so the caller keeps the last texels for the scalar loop
+ */
+__attribute__((target("ssse3")))
+static size_t expandRGBToRGBASSSE3(const unsigned char* src, size_t texelCount, unsigned char* dst) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+    size_t i = 0;
+    // 6 texels left is 18 bytes, the 16 bytes load stays in bounds
+    for (; i + 6 <= texelCount; i += 4) {
+        __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), rgba);
+    }
+
+    return i;
+}
+#endif
+
+void expandToRGBA(const unsigned char* src, int channels, size_t texelCount, unsigned char* dst) {
+    if (channels == 4) {
+        memcpy(dst, src, texelCount * 4);
+        return;
+    }
+
+    size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (channels == 3 && __builtin_cpu_supports("ssse3")) {
+        i = expandRGBToRGBASSSE3(src, texelCount, dst);
+    }
+#endif
+
+    for (; i < texelCount; i++) {
+        const unsigned char* texel = src + i * channels;
+        unsigned char* out = dst + i * 4;
+        if (channels >= 3) {
+            out[0] = texel[0];
+            out[1] = texel[1];
+            out[2] = texel[2];
+            out[3] = 255;
+        } else {
+            // grey (+ alpha)
+            out[0] = texel[0];
+            out[1] = texel[0];
+            out[2] = texel[0];
+            out[3] = (channels == 2) ? texel[1] : 255;
+        }
+    }
+}
+
+bool decodeToRGBA(const std::vector<unsigned char>& content, unsigned char* dst, size_t dstSize) {
+    PROFILE_SCOPE("imageloader::decodeToRGBA");
+    int width;
+    int height;
+    int channels;
+    stbi_uc* pixels = stbi_load_from_memory(
+        content.data(),
+        static_cast<int>(content.size()),
+        &width,
+        &height,
+        &channels,
+        // 0: keep the channels of the file
+        0
+    );
+
+    if (!pixels) {
+        return false;
+    }
+
+    size_t texelCount = static_cast<size_t>(width) * height;
+    if (texelCount * 4 > dstSize) {
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    expandToRGBA(pixels, channels, texelCount, dst);
+    stbi_image_free(pixels);
+
+    return true;
+}
+
+/** a hash match is only a hint: same size and same bytes as the file at path */
+static bool isSameContent(const std::string& path, const std::vector<unsigned char>& content, std::vector<unsigned char>& scratch) {
+    return readFileContent(path, scratch) && scratch.size() == content.size()
+        && memcmp(scratch.data(), content.data(), content.size()) == 0;
+}
+
+std::vector<DecodedImage> loadImages(const std::vector<std::string>& paths, unsigned int threadCount) {
+    std::vector<DecodedImage> images(paths.size());
+    // indices of the images in charge of decoding a given hash, more than one on a collision
+    std::unordered_map<uint64_t, std::vector<size_t>> owners;
+    // the one a deduplicated image takes its pixels from
+    std::vector<size_t> ownerOf(paths.size());
+    std::mutex ownersMutex;
+    std::atomic<size_t> next{0};
+
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min<unsigned int>(threadCount, std::max<size_t>(paths.size(), 1));
+
+    auto worker = [&]() {
+        std::vector<unsigned char> content;
+        std::vector<unsigned char> ownerContent;
+        std::vector<size_t> unchecked;
+
+        // each worker picks the next path until there is none left
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            DecodedImage& image = images[i];
+            image.path = paths[i];
+
+            auto readStart = std::chrono::steady_clock::now();
+            if (!readFileContent(paths[i], content)) {
+                image.error = "failed to read file!";
+                continue;
+            }
+            image.fileSize = content.size();
+            image.contentHash = hashContent(content.data(), content.size());
+            image.readMs = elapsedMs(readStart);
+
+            // the first one to see a content decodes it, the others are filled after the join.
+            // On a hash match the candidate files are read again, outside of the lock: a duplicate
+            // costs a read instead of a decode, a collision is decoded on its own.
+            // Candidates are only appended, once the ones seen are compared the lock is taken
+            // again to check the ones added meanwhile, and to become a candidate if there is none
+            size_t checkedCount = 0;
+            while (!image.deduplicated) {
+                {
+                    std::lock_guard<std::mutex> lock(ownersMutex);
+                    std::vector<size_t>& candidates = owners[image.contentHash];
+                    if (checkedCount == candidates.size()) {
+                        candidates.push_back(i);
+                        break;
+                    }
+                    unchecked.assign(candidates.begin() + checkedCount, candidates.end());
+                    checkedCount = candidates.size();
+                }
+
+                for (size_t candidate : unchecked) {
+                    if (images[candidate].fileSize == image.fileSize
+                        && isSameContent(paths[candidate], content, ownerContent)) {
+                        image.deduplicated = true;
+                        ownerOf[i] = candidate;
+                        break;
+                    }
+                }
+            }
+            if (image.deduplicated) {
+                continue;
+            }
+
+            auto decodeStart = std::chrono::steady_clock::now();
+            // stb keeps its failure reason thread local, decoding from several threads is fine
+            stbi_uc* pixels = stbi_load_from_memory(
+                content.data(),
+                static_cast<int>(content.size()),
+                &image.width,
+                &image.height,
+                &image.channels,
+                STBI_rgb_alpha
+            );
+            image.decodeMs = elapsedMs(decodeStart);
+
+            if (!pixels) {
+                image.error = stbi_failure_reason();
+                continue;
+            }
+
+            image.pixels = std::shared_ptr<unsigned char>(pixels, stbi_image_free);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threadCount; t++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < images.size(); i++) {
+        DecodedImage& image = images[i];
+        if (!image.deduplicated) {
+            continue;
+        }
+
+        const DecodedImage& owner = images[ownerOf[i]];
+        image.width = owner.width;
+        image.height = owner.height;
+        image.channels = owner.channels;
+        image.pixels = owner.pixels;
+        image.error = owner.error;
+    }
+
+    return images;
+}
+
+std::vector<std::string> listImages(const std::string& directory) {
+    std::vector<std::string> paths;
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        if (extension == ".png" || extension == ".jpg" || extension == ".jpeg") {
+            paths.push_back(entry.path().string());
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+void printStats(const std::vector<DecodedImage>& images, double wallMs) {
+    double readMs = 0.0;
+    double decodeMs = 0.0;
+    size_t bytes = 0;
+    size_t decoded = 0;
+
+    std::cout << "image loading:\n";
+    for (const auto& image : images) {
+        std::cout << '\t' << image.path;
+        if (!image.error.empty()) {
+            std::cout << " error: " << image.error << '\n';
+            continue;
+        }
+
+        std::cout << ' ' << image.width << 'x' << image.height
+            << " read " << image.readMs << " ms";
+        if (image.deduplicated) {
+            std::cout << " (same content as an other image, not decoded)\n";
+        } else {
+            std::cout << " decode " << image.decodeMs << " ms\n";
+            decodeMs += image.decodeMs;
+            decoded++;
+        }
+
+        readMs += image.readMs;
+        bytes += image.fileSize;
+    }
+
+    std::cout << '\t' << images.size() << " images, " << decoded << " decoded, "
+        << "read " << readMs << " ms, decode " << decodeMs << " ms (summed over threads), "
+        << "wall " << wallMs << " ms\n";
+    if (wallMs > 0.0) {
+        std::cout << '\t' << (bytes / (1024.0 * 1024.0)) / (wallMs / 1000.0) << " MB/s, "
+            << images.size() / (wallMs / 1000.0) << " images/s\n";
+    }
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace imageloader {
+
+/**
+ * A decoded image, always 4 channels (STBI_rgb_alpha) like texture3 expects.
+ * pixels is shared: the same content referenced twice (even through two different paths)
+ * is decoded once and both entries point to the same buffer. Same content is the same
+ * bytes: the hash finds the candidates, the files are compared before sharing
+ */
+struct DecodedImage {
+    std::string path;
+    /** FNV-1a 64 bits of the file bytes */
+    uint64_t contentHash = 0;
+    int width = 0;
+    int height = 0;
+    /** channels in the file, pixels always have 4 */
+    int channels = 0;
+    std::shared_ptr<unsigned char> pixels;
+    size_t fileSize = 0;
+    double readMs = 0.0;
+    double decodeMs = 0.0;
+    /** true if the pixels come from another entry with the same content */
+    bool deduplicated = false;
+    /** empty on success */
+    std::string error;
+};
+
+uint64_t hashContent(const unsigned char* data, size_t size);
+
+bool readFileContent(const std::string& path, std::vector<unsigned char>& content);
+
+/**
+ * header only probe (stbi_info), nothing is decoded
+ * enough to size the staging memory before decoding
+ */
+bool probeImage(const std::vector<unsigned char>& content, int& width, int& height, int& channels);
+
+/**
+ * RGB, grey or grey+alpha texels to RGBA with an opaque alpha for the formats without one.
+ * The RGB case, the common one for JPEG, uses SSSE3 shuffles when the CPU has them
+ */
+void expandToRGBA(const unsigned char* src, int channels, size_t texelCount, unsigned char* dst);
+
+/**
+ * Decode content into dst, which must hold width * height * 4 bytes (see probeImage),
+ * typically mapped staging memory.
+ * stb always allocates its own output buffer, so the image is decoded with its native channel count
+ * (3 bytes per texel for most JPEG) and expanded while being written to dst:
+ * no 4 channels copy on the heap and the pixels are written only once to dst
+ */
+bool decodeToRGBA(const std::vector<unsigned char>& content, unsigned char* dst, size_t dstSize);
+
+/**
+ * Read and decode all the paths on threadCount worker threads
+ * (0: std::thread::hardware_concurrency).
+ * Results are in the same order as paths. A failure does not throw,
+ * it is reported in DecodedImage::error so that one bad file does not hide the others
+ */
+std::vector<DecodedImage> loadImages(const std::vector<std::string>& paths, unsigned int threadCount);
+
+/** the .png, .jpg and .jpeg files of a directory, sorted */
+std::vector<std::string> listImages(const std::string& directory);
+
+/** per image read/decode times, then totals and throughput for the whole batch */
+void printStats(const std::vector<DecodedImage>& images, double wallMs);
+
+}
@@ -0,0 +1,138 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "mapped.hpp"
+#include "memory.hpp"
+
+namespace mapped {
+
+Range alignRange(VkDeviceSize offset, VkDeviceSize size, VkDeviceSize atomSize, VkDeviceSize allocationSize) {
+    VkDeviceSize start = offset / atomSize * atomSize;
+    VkDeviceSize end = (offset + size + atomSize - 1) / atomSize * atomSize;
+    // allowed by the spec: a size which is not a multiple of the atom size if it goes to the end
+    end = std::min(end, allocationSize);
+    return Range{start, end - start};
+}
+
+void mergeRanges(std::vector<Range>& ranges) {
+    if (ranges.empty()) {
+        return;
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+        return a.offset < b.offset;
+    });
+
+    size_t last = 0;
+    for (size_t i = 1; i < ranges.size(); i++) {
+        VkDeviceSize lastEnd = ranges[last].offset + ranges[last].size;
+        if (ranges[i].offset <= lastEnd) {
+            ranges[last].size = std::max(lastEnd, ranges[i].offset + ranges[i].size) - ranges[last].offset;
+        } else {
+            ranges[++last] = ranges[i];
+        }
+    }
+    ranges.resize(last + 1);
+}
+
+static bool getRange(VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange& mappedRange) {
+    memory::AllocationInfo info = memory::getAllocationInfo(deviceMemory);
+    if (info.flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return false;
+    }
+
+    Range range = alignRange(offset, size, memory::getNonCoherentAtomSize(), info.size);
+
+    mappedRange = VkMappedMemoryRange{};
+    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    mappedRange.memory = deviceMemory;
+    mappedRange.offset = range.offset;
+    mappedRange.size = range.size;
+    return true;
+}
+
+void flush(VkDevice logicalDevice, VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size) {
+    VkMappedMemoryRange mappedRange;
+    if (!getRange(deviceMemory, offset, size, mappedRange)) {
+        return;
+    }
+
+    if (vkFlushMappedMemoryRanges(logicalDevice, 1, &mappedRange) != VK_SUCCESS) {
+        throw std::runtime_error("failed to flush mapped memory!");
+    }
+}
+
+void invalidate(VkDevice logicalDevice, VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size) {
+    VkMappedMemoryRange mappedRange;
+    if (!getRange(deviceMemory, offset, size, mappedRange)) {
+        return;
+    }
+
+    if (vkInvalidateMappedMemoryRanges(logicalDevice, 1, &mappedRange) != VK_SUCCESS) {
+        throw std::runtime_error("failed to invalidate mapped memory!");
+    }
+}
+
+void FlushBatcher::init(VkDevice logicalDevice) {
+    logicalDevice_ = logicalDevice;
+    atomSize_ = memory::getNonCoherentAtomSize();
+    // the vectors are cleared, never shrunk: with this the first frames don't allocate either
+    writes_.reserve(INITIAL_CAPACITY);
+    ranges_.reserve(INITIAL_CAPACITY);
+}
+
+void FlushBatcher::add(VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size) {
+    memory::AllocationInfo info = memory::getAllocationInfo(deviceMemory);
+    if (info.flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+
+    // aligned right away, so that the writes sharing an atom end up merged
+    writes_.push_back(Write{deviceMemory, alignRange(offset, size, atomSize_, info.size)});
+}
+
+void FlushBatcher::flush() {
+    if (writes_.empty()) {
+        return;
+    }
+
+    std::sort(writes_.begin(), writes_.end(), [](const Write& a, const Write& b) {
+        return a.memory != b.memory ? a.memory < b.memory : a.range.offset < b.range.offset;
+    });
+
+    // same as mergeRanges, but the ranges of different allocations never merge
+    ranges_.clear();
+    for (const auto& write : writes_) {
+        if (!ranges_.empty() && ranges_.back().memory == write.memory
+            && write.range.offset <= ranges_.back().offset + ranges_.back().size) {
+            VkMappedMemoryRange& last = ranges_.back();
+            last.size = std::max(last.offset + last.size, write.range.offset + write.range.size) - last.offset;
+            continue;
+        }
+
+        VkMappedMemoryRange mappedRange{};
+        mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        mappedRange.memory = write.memory;
+        mappedRange.offset = write.range.offset;
+        mappedRange.size = write.range.size;
+        ranges_.push_back(mappedRange);
+    }
+
+    if (vkFlushMappedMemoryRanges(logicalDevice_, static_cast<uint32_t>(ranges_.size()), ranges_.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to flush mapped memory!");
+    }
+
+    flushCount_++;
+    rangeCount_ += ranges_.size();
+    writes_.clear();
+}
+
+uint64_t FlushBatcher::getFlushCount() const {
+    return flushCount_;
+}
+
+uint64_t FlushBatcher::getRangeCount() const {
+    return rangeCount_;
+}
+
+}
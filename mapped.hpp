@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace mapped {
+
+/**
+ * Mapped memory without HOST_COHERENT: the CPU writes may stay in the CPU caches
+ * (or the write combining buffers) until vkFlushMappedMemoryRanges, and the GPU writes
+ * are not visible to the CPU before vkInvalidateMappedMemoryRanges.
+ * Both take ranges whose offset and size are multiples of nonCoherentAtomSize
+ * (the size may also end at the end of the allocation).
+ *
+ * The whole allocation must be mapped (vkMapMemory with VK_WHOLE_SIZE): the aligned range
+ * can go past the bytes actually written.
+ * Everything is a no-op on coherent memory, so the callers don't have to care
+ */
+
+struct Range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+/** offset rounded down and end rounded up to atomSize, the end clamped to allocationSize */
+Range alignRange(VkDeviceSize offset, VkDeviceSize size, VkDeviceSize atomSize, VkDeviceSize allocationSize);
+
+/** sort by offset and merge the ranges which overlap or touch, in place */
+void mergeRanges(std::vector<Range>& ranges);
+
+/** flush right away, for the one time writes (staging) */
+void flush(VkDevice logicalDevice, VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size);
+
+/** before reading what the GPU wrote (readbacks) */
+void invalidate(VkDevice logicalDevice, VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size);
+
+/**
+ * The writes of a frame (uniform buffers...) are only recorded, then flush()
+ * issues one vkFlushMappedMemoryRanges with the merged ranges, just before vkQueueSubmit.
+ * The vectors keep their capacity: no allocation once the first frames are done
+ */
+class FlushBatcher {
+public:
+    void init(VkDevice logicalDevice);
+    void add(VkDeviceMemory deviceMemory, VkDeviceSize offset, VkDeviceSize size);
+    void flush();
+
+    /** vkFlushMappedMemoryRanges calls and ranges since init */
+    uint64_t getFlushCount() const;
+    uint64_t getRangeCount() const;
+
+private:
+    static const size_t INITIAL_CAPACITY = 64;
+
+    struct Write {
+        VkDeviceMemory memory;
+        Range range;
+    };
+
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    VkDeviceSize atomSize_ = 1;
+    std::vector<Write> writes_;
+    std::vector<VkMappedMemoryRange> ranges_;
+    uint64_t flushCount_ = 0;
+    uint64_t rangeCount_ = 0;
+};
+
+}
@@ -0,0 +1,379 @@
+#include <stdexcept>
+#include <cstdint>
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <array>
+
+#include "memory.hpp"
+#include "hitch.hpp"
+
+namespace memory {
+
+struct Allocation {
+    uint32_t typeIndex;
+    VkDeviceSize size;
+};
+
+/**
+ * the cached properties and the counters. Allocations may come from the
+ * streaming or loading threads, hence the mutex
+ */
+struct State {
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties properties{};
+    VkDeviceSize nonCoherentAtomSize = 1;
+    // null when VK_EXT_memory_budget can't be used
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> allocatedBytes{};
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> peakAllocatedBytes{};
+    std::array<uint32_t, VK_MAX_MEMORY_HEAPS> allocationCount{};
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> budget{};
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> usage{};
+    std::unordered_map<VkDeviceMemory, Allocation> allocations;
+    std::mutex mutex;
+};
+
+static State state;
+
+struct UsageFlags {
+    VkMemoryPropertyFlags required;
+    VkMemoryPropertyFlags preferred;
+    VkMemoryPropertyFlags avoided;
+};
+
+/**
+ * HOST_COHERENT is not required: the mapped writes are flushed (see mapped.hpp)
+ *
+ * * Upload avoids DEVICE_LOCAL: the small host visible VRAM window (ReBAR off) is better kept for Dynamic
+ * * Upload and Dynamic avoid HOST_CACHED: write combined memory is faster for sequential CPU writes
+ * * Readback prefers HOST_CACHED: uncached reads are very slow
+ */
+static UsageFlags getUsageFlags(Usage usage) {
+    switch (usage) {
+    case GpuOnly:
+        return {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+    case Upload:
+        return {
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            0,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT
+        };
+    case Readback:
+        return {
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+            0
+        };
+    case Dynamic:
+        return {
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT
+        };
+    case DirectUpload:
+        return {
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            0,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT
+        };
+    }
+
+    throw std::invalid_argument("unknown memory usage!");
+}
+
+static int countBits(VkMemoryPropertyFlags flags) {
+    int count = 0;
+    for (; flags; flags &= flags - 1) {
+        count++;
+    }
+    return count;
+}
+
+// needs state.mutex
+static void refreshBudget() {
+    if (state.getMemoryProperties2) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2KHR memProperties2{};
+        memProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        memProperties2.pNext = &budgetProperties;
+        state.getMemoryProperties2(state.physicalDevice, &memProperties2);
+
+        for (uint32_t i = 0; i < state.properties.memoryHeapCount; i++) {
+            state.budget[i] = budgetProperties.heapBudget[i];
+            state.usage[i] = budgetProperties.heapUsage[i];
+        }
+        return;
+    }
+
+    // no way to know what the others use, keep some room for them and the driver
+    for (uint32_t i = 0; i < state.properties.memoryHeapCount; i++) {
+        state.budget[i] = state.properties.memoryHeaps[i].size / 10 * 8;
+        state.usage[i] = state.allocatedBytes[i];
+    }
+}
+
+// needs state.mutex
+static void setPhysicalDevice(VkPhysicalDevice physicalDevice) {
+    if (state.physicalDevice == physicalDevice) {
+        return;
+    }
+
+    state.physicalDevice = physicalDevice;
+    state.getMemoryProperties2 = nullptr;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &state.properties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    state.nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+    state.allocatedBytes.fill(0);
+    state.peakAllocatedBytes.fill(0);
+    state.allocationCount.fill(0);
+    state.allocations.clear();
+    refreshBudget();
+}
+
+void init(VkInstance instance, VkPhysicalDevice physicalDevice, bool properties2Enabled) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    setPhysicalDevice(physicalDevice);
+
+    if (properties2Enabled && isBudgetExtensionSupported(physicalDevice)) {
+        state.getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(
+            instance,
+            "vkGetPhysicalDeviceMemoryProperties2KHR"
+        );
+    }
+
+    refreshBudget();
+}
+
+bool isBudgetExtensionSupported(VkPhysicalDevice physicalDevice) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    for (const auto& extension : extensions) {
+        if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isBudgetAvailable() {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.getMemoryProperties2 != nullptr;
+}
+
+const VkPhysicalDeviceMemoryProperties& getMemoryProperties(VkPhysicalDevice physicalDevice) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    setPhysicalDevice(physicalDevice);
+    return state.properties;
+}
+
+const uint32_t NO_MEMORY_TYPE = UINT32_MAX;
+
+/**
+ * needs state.mutex
+ * strict: no fallback, NO_MEMORY_TYPE if no type with the required flags is under budget
+ */
+static uint32_t findMemoryTypeLocked(uint32_t typeFilter, Usage usage, VkDeviceSize size, bool strict) {
+    const UsageFlags flags = getUsageFlags(usage);
+    const auto& properties = state.properties;
+
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if (typeFilter & (1 << i)) {
+            candidates.push_back(i);
+        }
+    }
+
+    // the more preferred flags and the less avoided ones the better,
+    // the spec orders the types so that the first ones are the fastest: keep that order on ties
+    auto score = [&](uint32_t typeIndex) {
+        VkMemoryPropertyFlags typeFlags = properties.memoryTypes[typeIndex].propertyFlags;
+        return countBits(typeFlags & flags.preferred) - countBits(typeFlags & flags.avoided);
+    };
+    std::stable_sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+        return score(a) > score(b);
+    });
+
+    auto fits = [&](uint32_t typeIndex, VkMemoryPropertyFlags required) {
+        uint32_t heapIndex = properties.memoryTypes[typeIndex].heapIndex;
+        return (properties.memoryTypes[typeIndex].propertyFlags & required) == required
+            && state.usage[heapIndex] + size <= state.budget[heapIndex];
+    };
+
+    for (uint32_t typeIndex : candidates) {
+        if (fits(typeIndex, flags.required)) {
+            return typeIndex;
+        }
+    }
+
+    if (strict) {
+        return NO_MEMORY_TYPE;
+    }
+
+    // the device local heaps are full: system memory is slower, but still better than failing
+    if (usage == GpuOnly) {
+        for (uint32_t typeIndex : candidates) {
+            if (fits(typeIndex, 0)) {
+                return typeIndex;
+            }
+        }
+    }
+
+    // over budget everywhere, let the driver try (it may page out)
+    for (uint32_t typeIndex : candidates) {
+        if ((properties.memoryTypes[typeIndex].propertyFlags & flags.required) == flags.required) {
+            return typeIndex;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Usage usage, VkDeviceSize size) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    setPhysicalDevice(physicalDevice);
+    return findMemoryTypeLocked(typeFilter, usage, size, false);
+}
+
+// needs state.mutex
+static void allocateLocked(
+    VkDevice logicalDevice,
+    const VkMemoryRequirements& requirements,
+    uint32_t typeIndex,
+    VkDeviceMemory& deviceMemory
+) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = typeIndex;
+
+    {
+        hitch::ScopedEvent hitchEvent(hitch::ALLOCATION);
+        if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &deviceMemory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate memory!");
+        }
+    }
+
+    uint32_t heapIndex = state.properties.memoryTypes[typeIndex].heapIndex;
+    state.allocatedBytes[heapIndex] += requirements.size;
+    state.peakAllocatedBytes[heapIndex] = std::max(state.peakAllocatedBytes[heapIndex], state.allocatedBytes[heapIndex]);
+    state.allocationCount[heapIndex]++;
+    state.allocations[deviceMemory] = Allocation{typeIndex, requirements.size};
+}
+
+void allocateMemory(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    const VkMemoryRequirements& requirements,
+    Usage usage,
+    VkDeviceMemory& deviceMemory
+) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    setPhysicalDevice(physicalDevice);
+    // the other processes change the budget too, allocations are rare enough to ask every time
+    refreshBudget();
+
+    uint32_t typeIndex = findMemoryTypeLocked(requirements.memoryTypeBits, usage, requirements.size, false);
+    allocateLocked(logicalDevice, requirements, typeIndex, deviceMemory);
+}
+
+bool tryAllocateMemory(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    const VkMemoryRequirements& requirements,
+    Usage usage,
+    VkDeviceMemory& deviceMemory
+) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    setPhysicalDevice(physicalDevice);
+    refreshBudget();
+
+    uint32_t typeIndex = findMemoryTypeLocked(requirements.memoryTypeBits, usage, requirements.size, true);
+    if (typeIndex == NO_MEMORY_TYPE) {
+        return false;
+    }
+
+    allocateLocked(logicalDevice, requirements, typeIndex, deviceMemory);
+    return true;
+}
+
+void freeMemory(VkDevice logicalDevice, VkDeviceMemory deviceMemory) {
+    if (deviceMemory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        auto allocation = state.allocations.find(deviceMemory);
+        if (allocation != state.allocations.end()) {
+            uint32_t heapIndex = state.properties.memoryTypes[allocation->second.typeIndex].heapIndex;
+            state.allocatedBytes[heapIndex] -= allocation->second.size;
+            state.allocationCount[heapIndex]--;
+            state.allocations.erase(allocation);
+        }
+    }
+
+    vkFreeMemory(logicalDevice, deviceMemory, nullptr);
+}
+
+AllocationInfo getAllocationInfo(VkDeviceMemory deviceMemory) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto allocation = state.allocations.find(deviceMemory);
+    if (allocation == state.allocations.end()) {
+        throw std::invalid_argument("memory not allocated through memory::allocateMemory!");
+    }
+    return AllocationInfo{
+        state.properties.memoryTypes[allocation->second.typeIndex].propertyFlags,
+        allocation->second.size
+    };
+}
+
+VkDeviceSize getNonCoherentAtomSize() {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.nonCoherentAtomSize;
+}
+
+std::vector<HeapStats> getHeapStats() {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    refreshBudget();
+
+    std::vector<HeapStats> heaps(state.properties.memoryHeapCount);
+    for (uint32_t i = 0; i < state.properties.memoryHeapCount; i++) {
+        heaps[i].size = state.properties.memoryHeaps[i].size;
+        heaps[i].flags = state.properties.memoryHeaps[i].flags;
+        heaps[i].budget = state.budget[i];
+        heaps[i].usage = state.usage[i];
+        heaps[i].allocatedBytes = state.allocatedBytes[i];
+        heaps[i].peakAllocatedBytes = state.peakAllocatedBytes[i];
+        heaps[i].allocationCount = state.allocationCount[i];
+    }
+    return heaps;
+}
+
+void printHeapStats() {
+    auto heaps = getHeapStats();
+    const double MB = 1024.0 * 1024.0;
+
+    std::cout << "memory heaps" << (isBudgetAvailable() ? " (VK_EXT_memory_budget):\n" : " (estimated budget):\n");
+    for (size_t i = 0; i < heaps.size(); i++) {
+        const auto& heap = heaps[i];
+        std::cout << '\t' << i << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " device local" : " host")
+            << " size " << heap.size / MB << " MB"
+            << " budget " << heap.budget / MB << " MB"
+            << " usage " << heap.usage / MB << " MB"
+            << " ours " << heap.allocatedBytes / MB << " MB in " << heap.allocationCount << " allocations"
+            << " (peak " << heap.peakAllocatedBytes / MB << " MB)\n";
+    }
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace memory {
+
+/**
+ * What the memory is for, rather than the property flags:
+ * the best flags depend on the device (discrete, integrated, ReBAR...)
+ *
+ * * GpuOnly: written and read by the GPU only, or filled through a staging buffer (textures, vertices)
+ * * Upload: staging, written once sequentially by the CPU then copied by the GPU
+ * * Readback: written by the GPU, read by the CPU
+ * * Dynamic: written by the CPU every frame and read by the GPU in place (uniform buffers)
+ * * DirectUpload: GpuOnly data written once by the CPU in place, skipping the staging copy.
+ *   Only DEVICE_LOCAL | HOST_VISIBLE memory qualifies: integrated GPUs (UMA), CPU
+ *   implementations like lavapipe, or discrete GPUs with resizable BAR
+ */
+enum Usage {
+    GpuOnly,
+    Upload,
+    Readback,
+    Dynamic,
+    DirectUpload
+};
+
+struct HeapStats {
+    VkDeviceSize size;
+    VkMemoryHeapFlags flags;
+    /** VK_EXT_memory_budget heapBudget, else 80% of the heap size */
+    VkDeviceSize budget;
+    /** VK_EXT_memory_budget heapUsage (all the process), else allocatedBytes */
+    VkDeviceSize usage;
+    /** through allocateMemory only */
+    VkDeviceSize allocatedBytes;
+    /** highest allocatedBytes reached */
+    VkDeviceSize peakAllocatedBytes;
+    uint32_t allocationCount;
+};
+
+/**
+ * Query the memory properties once for the whole application.
+ * properties2Enabled: VK_KHR_get_physical_device_properties2 is enabled on instance,
+ * the budget is then read from VK_EXT_memory_budget if the device supports it
+ * (the extension must be enabled on the logical device, see isBudgetExtensionSupported)
+ *
+ * Only one physical device at a time, which is all this project ever uses.
+ * Calling the other functions without init works, without budget extension
+ */
+void init(VkInstance instance, VkPhysicalDevice physicalDevice, bool properties2Enabled);
+
+bool isBudgetExtensionSupported(VkPhysicalDevice physicalDevice);
+/** true once init found VK_EXT_memory_budget usable */
+bool isBudgetAvailable();
+
+/** cached, no vkGetPhysicalDeviceMemoryProperties call after the first one */
+const VkPhysicalDeviceMemoryProperties& getMemoryProperties(VkPhysicalDevice physicalDevice);
+
+/**
+ * Best memory type for usage amongst typeFilter (VkMemoryRequirements::memoryTypeBits).
+ * Candidates are ranked by the flags usage prefers/avoids. A type whose heap
+ * would go over budget with size more bytes is skipped for the next one,
+ * GpuOnly may then fall back to host memory. Throws if no type fits at all
+ */
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Usage usage, VkDeviceSize size);
+
+/** vkAllocateMemory with the type findMemoryType picks, the allocation is counted in its heap */
+void allocateMemory(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    const VkMemoryRequirements& requirements,
+    Usage usage,
+    VkDeviceMemory& deviceMemory
+);
+
+/**
+ * allocateMemory without the fallbacks: returns false (nothing allocated)
+ * if no type has the flags usage requires with enough budget left
+ */
+bool tryAllocateMemory(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    const VkMemoryRequirements& requirements,
+    Usage usage,
+    VkDeviceMemory& deviceMemory
+);
+
+/** vkFreeMemory, counterpart of allocateMemory. VK_NULL_HANDLE is ignored */
+void freeMemory(VkDevice logicalDevice, VkDeviceMemory deviceMemory);
+
+struct AllocationInfo {
+    /** of the memory type the allocation ended up in, e.g. to know if it is host coherent */
+    VkMemoryPropertyFlags flags;
+    VkDeviceSize size;
+};
+
+AllocationInfo getAllocationInfo(VkDeviceMemory deviceMemory);
+
+/** limits.nonCoherentAtomSize of the physical device, cached like the memory properties */
+VkDeviceSize getNonCoherentAtomSize();
+
+/** one entry per heap, the budget values are refreshed */
+std::vector<HeapStats> getHeapStats();
+
+void printHeapStats();
+
+}
@@ -0,0 +1,524 @@
+/**
+ * Mip generation, blit chain (texture3::recordGenerateMipmaps) against the single pass
+ * compute downsampler (mipgen::Downsampler), on a headless device:
+ * * GPU time of both on a random sRGB texture, 4096x4096 by default, through timestamps
+ *   (wall time of the submission if the queue has none)
+ * * the compute levels checked against a CPU reference (averages of linear values, 2x2
+ *   clamped to the level before): 2 units at most, the levels past 5 are reduced from the
+ *   8 bits of level 5. The difference with the blit chain is
+ *   printed, not checked: on NPOT sizes the blits stretch the odd row / column
+ * * the depth pyramid of random depths (max reduction) checked exactly against the CPU
+ *
+ * The bench fails if a result is wrong.
+ * Needs the compiled shaders (shaders/compile1.sh).
+ *
+ * usage: mip_bench [--width W] [--height H] [--repeats R] [--seed S]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "headless.hpp"
+#include "mipgen.hpp"
+#include "image2.hpp"
+#include "texture3.hpp"
+#include "buffer2.hpp"
+#include "commandbuffer.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+
+struct BenchOptions {
+    uint32_t width = 4096;
+    uint32_t height = 4096;
+    uint32_t repeatCount = 10;
+    uint32_t seed = 1;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--width") {
+            options.width = value;
+        } else if (name == "--height") {
+            options.height = value;
+        } else if (name == "--repeats") {
+            options.repeatCount = value;
+        } else if (name == "--seed") {
+            options.seed = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    if (options.width < 2 || options.height < 2 || options.width > 4096 || options.height > 4096) {
+        throw std::invalid_argument("--width and --height must be within 2..4096");
+    }
+    if (options.repeatCount == 0) {
+        throw std::invalid_argument("--repeats must be positive");
+    }
+    return options;
+}
+
+struct Context {
+    headless::Device headless;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    double timestampPeriodNs = 0.0;
+
+    /** records, submits and waits: returns the milliseconds from submission to completion */
+    double execute(const std::function<void(VkCommandBuffer)>& record) {
+        VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(headless.device_, commandPool);
+        record(commandBuffer);
+        auto start = std::chrono::steady_clock::now();
+        commandbuffer::endAndExecuteSingleTimeCommands(headless.device_, commandPool, headless.queue_, commandBuffer);
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /** GPU milliseconds of timed, prepare is recorded before and not counted */
+    double measure(const std::function<void(VkCommandBuffer)>& prepare, const std::function<void(VkCommandBuffer)>& timed) {
+        if (queryPool == VK_NULL_HANDLE) {
+            return execute([&](VkCommandBuffer commandBuffer) {
+                prepare(commandBuffer);
+                timed(commandBuffer);
+            });
+        }
+        execute([&](VkCommandBuffer commandBuffer) {
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+            prepare(commandBuffer);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 0);
+            timed(commandBuffer);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        });
+        uint64_t timestamps[2];
+        vkGetQueryPoolResults(headless.device_, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        return (timestamps[1] - timestamps[0]) * timestampPeriodNs / 1e6;
+    }
+};
+
+static void recordLayout(
+    VkCommandBuffer commandBuffer,
+    VkImage image,
+    VkImageAspectFlags aspect,
+    uint32_t baseLevel,
+    uint32_t levelCount,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess
+) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {aspect, baseLevel, levelCount, 0, 1};
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+static void recordHostRead(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier,
+        0, nullptr, 0, nullptr);
+}
+
+static uint32_t getLevelSize(uint32_t size, uint32_t level) {
+    return std::max(size >> level, 1u);
+}
+
+/** the bytes of the levels first..first+count-1, one after the other */
+static VkDeviceSize getLevelsSize(uint32_t width, uint32_t height, uint32_t first, uint32_t count, uint32_t texelSize) {
+    VkDeviceSize size = 0;
+    for (uint32_t level = first; level < first + count; level++) {
+        size += static_cast<VkDeviceSize>(getLevelSize(width, level)) * getLevelSize(height, level) * texelSize;
+    }
+    return size;
+}
+
+/** copies the levels first..first+count-1 (TRANSFER_SRC_OPTIMAL) one after the other from bufferOffset */
+static void copyLevels(
+    VkCommandBuffer commandBuffer,
+    VkImage image,
+    uint32_t width,
+    uint32_t height,
+    uint32_t first,
+    uint32_t count,
+    uint32_t texelSize,
+    VkBuffer buffer,
+    VkDeviceSize bufferOffset
+) {
+    std::vector<VkBufferImageCopy> regions;
+    for (uint32_t level = first; level < first + count; level++) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = bufferOffset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        region.imageExtent = {getLevelSize(width, level), getLevelSize(height, level), 1};
+        regions.push_back(region);
+        bufferOffset += static_cast<VkDeviceSize>(region.imageExtent.width) * region.imageExtent.height * texelSize;
+    }
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer,
+        static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+static float toLinear(uint8_t value) {
+    float color = value / 255.0f;
+    return color <= 0.04045f ? color / 12.92f : std::pow((color + 0.055f) / 1.055f, 2.4f);
+}
+
+static float toSrgb(float color) {
+    return color <= 0.0031308f ? color * 12.92f : 1.055f * std::pow(color, 1.0f / 2.4f) - 0.055f;
+}
+
+/**
+ * One level of the CPU reference from the level before (channels floats per texel):
+ * each texel reduces the 2x2 texels of the level before, clamped to it like the shader
+ */
+static std::vector<float> reduceLevel(
+    const std::vector<float>& texels,
+    uint32_t width,
+    uint32_t height,
+    uint32_t channels,
+    uint32_t outWidth,
+    uint32_t outHeight,
+    const std::function<float(float, float, float, float)>& reduce
+) {
+    std::vector<float> result(static_cast<size_t>(outWidth) * outHeight * channels);
+    for (uint32_t y = 0; y < outHeight; y++) {
+        uint32_t y0 = std::min(2 * y, height - 1);
+        uint32_t y1 = std::min(2 * y + 1, height - 1);
+        for (uint32_t x = 0; x < outWidth; x++) {
+            uint32_t x0 = std::min(2 * x, width - 1);
+            uint32_t x1 = std::min(2 * x + 1, width - 1);
+            for (uint32_t c = 0; c < channels; c++) {
+                auto at = [&](uint32_t tx, uint32_t ty) {
+                    return texels[(static_cast<size_t>(ty) * width + tx) * channels + c];
+                };
+                result[(static_cast<size_t>(y) * outWidth + x) * channels + c] =
+                    reduce(at(x0, y0), at(x1, y0), at(x0, y1), at(x1, y1));
+            }
+        }
+    }
+    return result;
+}
+
+static void run(const BenchOptions& options) {
+    Context context;
+    context.headless.init("Mip bench");
+    VkPhysicalDevice physicalDevice = context.headless.physicalDevice_;
+    VkDevice device = context.headless.device_;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = context.headless.queueFamilyIndex_;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &context.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    if (queueFamilies[context.headless.queueFamilyIndex_].timestampValidBits > 0) {
+        VkQueryPoolCreateInfo queryInfo{};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = 2;
+        if (vkCreateQueryPool(device, &queryInfo, nullptr, &context.queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create query pool!");
+        }
+        context.timestampPeriodNs = properties.limits.timestampPeriod;
+    }
+
+    uint32_t width = options.width;
+    uint32_t height = options.height;
+    uint32_t mipLevels = mipgen::getMipLevelCount(width, height);
+    std::cout << "device: " << properties.deviceName << ", " << width << "x" << height << ", " << mipLevels
+        << " levels, " << (context.queryPool != VK_NULL_HANDLE ? "GPU timestamps" : "wall time (no timestamps)") << '\n';
+
+    mipgen::Downsampler downsampler;
+    downsampler.init(physicalDevice, device);
+
+    // random sRGB texels, uploaded to the level 0 of both images before each run
+    VkDeviceSize levelZeroSize = static_cast<VkDeviceSize>(width) * height * 4;
+    std::vector<uint8_t> pixels(levelZeroSize);
+    uint32_t state = options.seed;
+    for (auto& pixel : pixels) {
+        state = state * 1664525u + 1013904223u;
+        pixel = static_cast<uint8_t>(state >> 24);
+    }
+    buffer2::StagingBuffer staging;
+    buffer2::reserveStagingBuffer(physicalDevice, device, levelZeroSize, staging);
+    memcpy(staging.mapped, pixels.data(), levelZeroSize);
+    mapped::flush(device, staging.memory, 0, levelZeroSize);
+    VkBufferImageCopy upload{};
+    upload.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    upload.imageExtent = {width, height, 1};
+
+    VkImage blitImage, computeImage;
+    VkDeviceMemory blitMemory, computeMemory;
+    texture3::bindImageMemory(physicalDevice, device, width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+        VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        memory::GpuOnly, blitImage, blitMemory);
+    texture3::bindImageMemory(physicalDevice, device, width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+        VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+            | VK_IMAGE_USAGE_STORAGE_BIT,
+        memory::GpuOnly, computeImage, computeMemory, VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT);
+    mipgen::Target mipTarget;
+    downsampler.createMipTarget(computeImage, VK_FORMAT_R8G8B8A8_SRGB, width, height, mipLevels, mipTarget);
+
+    auto prepareBlit = [&](VkCommandBuffer commandBuffer) {
+        recordLayout(commandBuffer, blitImage, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        vkCmdCopyBufferToImage(commandBuffer, staging.buffer, blitImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload);
+    };
+    auto blit = [&](VkCommandBuffer commandBuffer) {
+        texture3::recordGenerateMipmaps(commandBuffer, blitImage, width, height, mipLevels, 1);
+    };
+    auto prepareCompute = [&](VkCommandBuffer commandBuffer) {
+        recordLayout(commandBuffer, computeImage, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        recordLayout(commandBuffer, computeImage, VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+        vkCmdCopyBufferToImage(commandBuffer, staging.buffer, computeImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload);
+        recordLayout(commandBuffer, computeImage, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    };
+    auto downsample = [&](VkCommandBuffer commandBuffer) {
+        downsampler.record(commandBuffer, mipTarget);
+    };
+
+    // both chains once, read back for the checks
+    VkDeviceSize levelsSize = getLevelsSize(width, height, 1, mipLevels - 1, 4);
+    VkBuffer readback;
+    VkDeviceMemory readbackMemory;
+    buffer2::bindBuffer(physicalDevice, device, 2 * levelsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::Readback, readback, readbackMemory);
+    context.execute([&](VkCommandBuffer commandBuffer) {
+        prepareBlit(commandBuffer);
+        blit(commandBuffer);
+        prepareCompute(commandBuffer);
+        downsample(commandBuffer);
+        recordLayout(commandBuffer, blitImage, VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        recordLayout(commandBuffer, computeImage, VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        copyLevels(commandBuffer, blitImage, width, height, 1, mipLevels - 1, 4, readback, 0);
+        copyLevels(commandBuffer, computeImage, width, height, 1, mipLevels - 1, 4, readback, levelsSize);
+        recordHostRead(commandBuffer);
+    });
+    void* mappedReadback;
+    vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &mappedReadback);
+    mapped::invalidate(device, readbackMemory, 0, 2 * levelsSize);
+    const uint8_t* blitLevels = static_cast<const uint8_t*>(mappedReadback);
+    const uint8_t* computeLevels = blitLevels + levelsSize;
+
+    // the CPU reference, level after level on linear values
+    std::vector<float> texels(levelZeroSize);
+    for (size_t i = 0; i < texels.size(); i++) {
+        texels[i] = i % 4 == 3 ? pixels[i] / 255.0f : toLinear(pixels[i]);
+    }
+    auto average = [](float a, float b, float c, float d) { return (a + b + c + d) * 0.25f; };
+    std::string failures;
+    int maxComputeDifference = 0;
+    int maxBlitDifference = 0;
+    size_t offset = 0;
+    for (uint32_t level = 1; level < mipLevels; level++) {
+        texels = reduceLevel(texels, getLevelSize(width, level - 1), getLevelSize(height, level - 1), 4,
+            getLevelSize(width, level), getLevelSize(height, level), average);
+        int levelDifference = 0;
+        for (size_t i = 0; i < texels.size(); i++) {
+            float value = i % 4 == 3 ? texels[i] : toSrgb(texels[i]);
+            int expected = static_cast<int>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+            levelDifference = std::max(levelDifference, std::abs(computeLevels[offset + i] - expected));
+            maxBlitDifference = std::max(maxBlitDifference, std::abs(blitLevels[offset + i] - expected));
+        }
+        if (levelDifference > 2) {
+            failures += "\n  mip level " + std::to_string(level) + ": " + std::to_string(levelDifference)
+                + " units from the reference";
+        }
+        maxComputeDifference = std::max(maxComputeDifference, levelDifference);
+        offset += texels.size();
+    }
+    vkUnmapMemory(device, readbackMemory);
+    vkDestroyBuffer(device, readback, nullptr);
+    memory::freeMemory(device, readbackMemory);
+
+    double blitMs = 0.0;
+    double computeMs = 0.0;
+    for (uint32_t r = 0; r < options.repeatCount; r++) {
+        blitMs += context.measure(prepareBlit, blit);
+        computeMs += context.measure(prepareCompute, downsample);
+    }
+    blitMs /= options.repeatCount;
+    computeMs /= options.repeatCount;
+    std::cout << "blit chain:      " << blitMs << " ms, " << maxBlitDifference << " units from the reference at most\n"
+        << "compute (1 pass): " << computeMs << " ms, " << maxComputeDifference << " units from the reference at most, x"
+        << blitMs / computeMs << '\n';
+
+    downsampler.destroyTarget(mipTarget);
+    vkDestroyImage(device, computeImage, nullptr);
+    memory::freeMemory(device, computeMemory);
+    vkDestroyImage(device, blitImage, nullptr);
+    memory::freeMemory(device, blitMemory);
+    buffer2::destroyStagingBuffer(device, staging);
+
+    // the depth pyramid of random depths, max reduction
+    VkFormatProperties depthProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_D32_SFLOAT, &depthProperties);
+    if (!(depthProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        std::cout << "depth pyramid: skipped, D32_SFLOAT can't be sampled\n";
+    } else {
+        VkExtent2D pyramidExtent = mipgen::getPyramidExtent(width, height);
+        uint32_t pyramidLevels = std::min(mipgen::getMipLevelCount(pyramidExtent.width, pyramidExtent.height),
+            mipgen::MAX_LEVEL_COUNT);
+        std::vector<float> depths(static_cast<size_t>(width) * height);
+        for (auto& depth : depths) {
+            state = state * 1664525u + 1013904223u;
+            depth = (state >> 8) / 16777216.0f;
+        }
+        VkDeviceSize depthSize = depths.size() * sizeof(float);
+        buffer2::reserveStagingBuffer(physicalDevice, device, depthSize, staging);
+        memcpy(staging.mapped, depths.data(), depthSize);
+        mapped::flush(device, staging.memory, 0, depthSize);
+
+        VkImage depthImage, pyramid;
+        VkDeviceMemory depthMemory, pyramidMemory;
+        texture3::bindImageMemory(physicalDevice, device, width, height, 1, VK_SAMPLE_COUNT_1_BIT,
+            VK_FORMAT_D32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            memory::GpuOnly, depthImage, depthMemory);
+        texture3::bindImageMemory(physicalDevice, device, pyramidExtent.width, pyramidExtent.height, pyramidLevels,
+            VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+            memory::GpuOnly, pyramid, pyramidMemory);
+        VkImageView depthView = image2::createImageView(device, depthImage, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+        mipgen::Target pyramidTarget;
+        downsampler.createPyramidTarget(depthView, pyramid, width, height, VK_SAMPLE_COUNT_1_BIT, pyramidLevels,
+            mipgen::Max, pyramidTarget);
+
+        VkDeviceSize pyramidSize = getLevelsSize(pyramidExtent.width, pyramidExtent.height, 0, pyramidLevels, sizeof(float));
+        buffer2::bindBuffer(physicalDevice, device, pyramidSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            memory::Readback, readback, readbackMemory);
+        VkBufferImageCopy depthUpload{};
+        depthUpload.imageSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1};
+        depthUpload.imageExtent = {width, height, 1};
+        auto preparePyramid = [&](VkCommandBuffer commandBuffer) {
+            recordLayout(commandBuffer, depthImage, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1,
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+            recordLayout(commandBuffer, pyramid, VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels,
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+            vkCmdCopyBufferToImage(commandBuffer, staging.buffer, depthImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &depthUpload);
+            recordLayout(commandBuffer, depthImage, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        };
+        auto reducePyramid = [&](VkCommandBuffer commandBuffer) {
+            downsampler.record(commandBuffer, pyramidTarget);
+        };
+        double pyramidMs = context.measure(preparePyramid, reducePyramid);
+        context.execute([&](VkCommandBuffer commandBuffer) {
+            preparePyramid(commandBuffer);
+            reducePyramid(commandBuffer);
+            recordLayout(commandBuffer, pyramid, VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels,
+                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+            copyLevels(commandBuffer, pyramid, pyramidExtent.width, pyramidExtent.height, 0, pyramidLevels, sizeof(float), readback, 0);
+            recordHostRead(commandBuffer);
+        });
+        vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &mappedReadback);
+        mapped::invalidate(device, readbackMemory, 0, pyramidSize);
+        const float* pyramidTexels = static_cast<const float*>(mappedReadback);
+
+        // level 0 from the depths (clamped past the depth buffer), then level after level
+        auto farthest = [](float a, float b, float c, float d) { return std::max(std::max(a, b), std::max(c, d)); };
+        std::vector<float> reference = depths;
+        uint32_t referenceWidth = width;
+        uint32_t referenceHeight = height;
+        uint32_t wrongCount = 0;
+        offset = 0;
+        for (uint32_t level = 0; level < pyramidLevels; level++) {
+            uint32_t levelWidth = getLevelSize(pyramidExtent.width, level);
+            uint32_t levelHeight = getLevelSize(pyramidExtent.height, level);
+            reference = reduceLevel(reference, referenceWidth, referenceHeight, 1, levelWidth, levelHeight, farthest);
+            referenceWidth = levelWidth;
+            referenceHeight = levelHeight;
+            for (size_t i = 0; i < reference.size(); i++) {
+                wrongCount += pyramidTexels[offset + i] != reference[i];
+            }
+            offset += reference.size();
+        }
+        if (wrongCount > 0) {
+            failures += "\n  depth pyramid: " + std::to_string(wrongCount) + " wrong texels";
+        }
+        std::cout << "depth pyramid:   " << pyramidMs << " ms, " << pyramidExtent.width << "x" << pyramidExtent.height
+            << ", " << pyramidLevels << " levels" << (wrongCount == 0 ? "" : " WRONG") << '\n';
+
+        vkUnmapMemory(device, readbackMemory);
+        vkDestroyBuffer(device, readback, nullptr);
+        memory::freeMemory(device, readbackMemory);
+        downsampler.destroyTarget(pyramidTarget);
+        vkDestroyImageView(device, depthView, nullptr);
+        vkDestroyImage(device, pyramid, nullptr);
+        memory::freeMemory(device, pyramidMemory);
+        vkDestroyImage(device, depthImage, nullptr);
+        memory::freeMemory(device, depthMemory);
+        buffer2::destroyStagingBuffer(device, staging);
+    }
+
+    downsampler.destroy();
+    if (context.queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, context.queryPool, nullptr);
+    }
+    vkDestroyCommandPool(device, context.commandPool, nullptr);
+    context.headless.cleanup();
+
+    if (!failures.empty()) {
+        throw std::runtime_error("wrong mip levels:" + failures);
+    }
+    std::cout << "all the levels match\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
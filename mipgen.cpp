@@ -0,0 +1,211 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "mipgen.hpp"
+#include "image2.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
+
+namespace mipgen {
+
+// the sampled source, the 12 destination levels and the counter
+static const std::vector<compute::BindingType> BINDINGS = {
+    compute::SampledImage,
+    compute::StorageImage, compute::StorageImage, compute::StorageImage, compute::StorageImage,
+    compute::StorageImage, compute::StorageImage, compute::StorageImage, compute::StorageImage,
+    compute::StorageImage, compute::StorageImage, compute::StorageImage, compute::StorageImage,
+    compute::StorageBuffer
+};
+static const uint32_t COUNTER_BINDING = 1 + MAX_LEVEL_COUNT;
+// destination texels of level 0 per group and direction
+static const uint32_t GROUP_TILE_SIZE = 32;
+
+static uint32_t nextPowerOfTwo(uint32_t value) {
+    uint32_t power = 1;
+    while (power < value) {
+        power *= 2;
+    }
+    return power;
+}
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+VkExtent2D getPyramidExtent(uint32_t width, uint32_t height) {
+    return {std::max(nextPowerOfTwo(width) / 2, 1u), std::max(nextPowerOfTwo(height) / 2, 1u)};
+}
+
+void Downsampler::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    uint32_t maxTargetCount,
+    const char* colorFile,
+    const char* depthFile,
+    const char* multisampledDepthFile
+) {
+    physicalDevice_ = physicalDevice;
+    logicalDevice_ = logicalDevice;
+
+    // the shader maps its threads on a 16x16 tile, no smaller group will do
+    compute::Limits limits = compute::getLimits(physicalDevice);
+    if (compute::chooseGroupSize(limits, GROUP_SIZE) != GROUP_SIZE) {
+        throw std::runtime_error("compute groups of 256 invocations are not supported!");
+    }
+    compute::createKernel(colorFile, logicalDevice_, BINDINGS, sizeof(PushConstants), GROUP_SIZE, color_);
+    compute::createKernel(depthFile, logicalDevice_, BINDINGS, sizeof(PushConstants), GROUP_SIZE, depth_);
+    compute::createKernel(multisampledDepthFile, logicalDevice_, BINDINGS, sizeof(PushConstants), GROUP_SIZE,
+        multisampledDepth_);
+    compute::createDescriptorPool(logicalDevice_, BINDINGS, maxTargetCount, descriptorPool_,
+        VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    if (vkCreateSampler(logicalDevice_, &samplerInfo, nullptr, &sampler_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mipgen sampler!");
+    }
+}
+
+void Downsampler::createMipTarget(
+    VkImage image,
+    VkFormat format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    Target& target
+) {
+    if (format != VK_FORMAT_R8G8B8A8_SRGB && format != VK_FORMAT_R8G8B8A8_UNORM) {
+        throw std::invalid_argument("mipgen only generates R8G8B8A8 mips!");
+    }
+    if (mipLevels < 2 || mipLevels - 1 > MAX_LEVEL_COUNT || mipLevels > getMipLevelCount(width, height)) {
+        throw std::invalid_argument("mipgen generates 1 to 12 levels, within the mip chain!");
+    }
+
+    target.image = image;
+    target.extent = {std::max(width / 2, 1u), std::max(height / 2, 1u)};
+    target.levelCount = mipLevels - 1;
+    target.reduction = Average;
+    target.srgb = format == VK_FORMAT_R8G8B8A8_SRGB;
+    target.depth = false;
+    // the storage views are UNORM (no sRGB storage images): the shader encodes itself
+    target.sourceView = image2::createImageView(logicalDevice_, image, format, VK_IMAGE_ASPECT_COLOR_BIT, 1, 0);
+    for (uint32_t level = 1; level < mipLevels; level++) {
+        target.levelViews.push_back(image2::createImageView(logicalDevice_, image, VK_FORMAT_R8G8B8A8_UNORM,
+            VK_IMAGE_ASPECT_COLOR_BIT, 1, level));
+    }
+    createTarget(target.sourceView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, target);
+}
+
+void Downsampler::createPyramidTarget(
+    VkImageView depthView,
+    VkImage pyramid,
+    uint32_t depthWidth,
+    uint32_t depthHeight,
+    VkSampleCountFlagBits depthSamples,
+    uint32_t levelCount,
+    Reduction reduction,
+    Target& target
+) {
+    VkExtent2D extent = getPyramidExtent(depthWidth, depthHeight);
+    if (levelCount < 1 || levelCount > MAX_LEVEL_COUNT || levelCount > getMipLevelCount(extent.width, extent.height)) {
+        throw std::invalid_argument("mipgen generates 1 to 12 levels, within the pyramid!");
+    }
+
+    target.image = pyramid;
+    target.extent = extent;
+    target.levelCount = levelCount;
+    target.reduction = reduction;
+    target.srgb = false;
+    target.depth = true;
+    target.multisampled = depthSamples != VK_SAMPLE_COUNT_1_BIT;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        target.levelViews.push_back(image2::createImageView(logicalDevice_, pyramid, VK_FORMAT_R32_SFLOAT,
+            VK_IMAGE_ASPECT_COLOR_BIT, 1, level));
+    }
+    createTarget(depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, target);
+}
+
+void Downsampler::createTarget(VkImageView sourceView, VkImageLayout sourceLayout, Target& target) {
+    // the last group reduces level 5 alone, 64x64 at most
+    if (target.levelCount > 6 && std::max(target.extent.width, target.extent.height) > GROUP_TILE_SIZE << 6) {
+        throw std::invalid_argument("mipgen generates more than 6 levels of a 4096x4096 source at most!");
+    }
+    target.descriptorSet = compute::allocateDescriptorSet(logicalDevice_, descriptorPool_,
+        getKernel(target).descriptorSetLayout);
+
+    compute::writeImage(logicalDevice_, target.descriptorSet, 0, compute::SampledImage, sourceView, sourceLayout, sampler_);
+    // the bindings past the last level still need a valid view, never written
+    for (uint32_t level = 0; level < MAX_LEVEL_COUNT; level++) {
+        VkImageView view = target.levelViews[std::min(level, target.levelCount - 1)];
+        compute::writeImage(logicalDevice_, target.descriptorSet, 1 + level, compute::StorageImage, view,
+            VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    buffer2::bindBuffer(physicalDevice_, logicalDevice_, sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly, target.counter, target.counterMemory);
+    compute::writeBuffer(logicalDevice_, target.descriptorSet, COUNTER_BINDING, compute::StorageBuffer, target.counter);
+}
+
+void Downsampler::record(VkCommandBuffer commandBuffer, const Target& target) {
+    PROFILE_SCOPE("mipgen::record");
+    compute::GroupCount groupCount = compute::getGroupCount2D(target.extent.width, target.extent.height,
+        GROUP_TILE_SIZE, GROUP_TILE_SIZE);
+
+    // after the previous dispatch on the target (still counting if in the same command buffer)
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    dispatch::getDeviceTable().vkCmdFillBuffer(commandBuffer, target.counter, 0, sizeof(uint32_t), 0);
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    PushConstants pushConstants{};
+    pushConstants.width = target.extent.width;
+    pushConstants.height = target.extent.height;
+    pushConstants.levelCount = target.levelCount;
+    pushConstants.reduction = target.reduction;
+    pushConstants.srgb = target.srgb ? 1 : 0;
+    pushConstants.groupCount = groupCount.x * groupCount.y;
+    compute::recordDispatch(commandBuffer, getKernel(target), target.descriptorSet, &pushConstants, groupCount);
+}
+
+const compute::Kernel& Downsampler::getKernel(const Target& target) const {
+    if (!target.depth) {
+        return color_;
+    }
+    return target.multisampled ? multisampledDepth_ : depth_;
+}
+
+void Downsampler::destroyTarget(Target& target) {
+    vkFreeDescriptorSets(logicalDevice_, descriptorPool_, 1, &target.descriptorSet);
+    vkDestroyBuffer(logicalDevice_, target.counter, nullptr);
+    memory::freeMemory(logicalDevice_, target.counterMemory);
+    for (VkImageView view : target.levelViews) {
+        vkDestroyImageView(logicalDevice_, view, nullptr);
+    }
+    if (target.sourceView != VK_NULL_HANDLE) {
+        vkDestroyImageView(logicalDevice_, target.sourceView, nullptr);
+    }
+    target = Target{};
+}
+
+void Downsampler::destroy() {
+    vkDestroySampler(logicalDevice_, sampler_, nullptr);
+    vkDestroyDescriptorPool(logicalDevice_, descriptorPool_, nullptr);
+    compute::destroyKernel(logicalDevice_, color_);
+    compute::destroyKernel(logicalDevice_, depth_);
+    compute::destroyKernel(logicalDevice_, multisampledDepth_);
+}
+
+}
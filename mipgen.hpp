@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "compute.hpp"
+
+namespace mipgen {
+
+/**
+ * Mip chains and depth pyramids generated by one compute dispatch (shaders/spd.comp.glsl,
+ * after AMD's single pass downsampler), instead of the blit chain of texture3::generateMipmaps:
+ * one barrier per level and a transfer queue round trip less, and the source is only read once.
+ *
+ * Each group reduces a 64x64 tile of the source to levels 0..5 through shared memory,
+ * the last group to finish (an atomic counter, zeroed by record) reduces level 5 to
+ * levels 6..11: 12 destination levels, a 4096x4096 source at most.
+ *
+ * Every destination level is the 2x2 reduction of the level before (the source for the first one),
+ * with floor sizes: on NPOT sizes the odd last row / column is dropped where the blit chain
+ * stretches it over the others
+ */
+enum Reduction {
+    /** box filter, for the color mips */
+    Average,
+    Min,
+    /** the farthest depth of the 2x2, for occlusion culling with a depth test LESS */
+    Max
+};
+
+const uint32_t MAX_LEVEL_COUNT = 12;
+/** the threads of a group, 16x16 */
+const uint32_t GROUP_SIZE = 256;
+
+const auto DEFAULT_SPD_FILE = "./shaders/spirv/spd.comp.spirv";
+const auto DEFAULT_SPD_DEPTH_FILE = "./shaders/spirv/spd_depth.comp.spirv";
+const auto DEFAULT_SPD_DEPTH_MS_FILE = "./shaders/spirv/spd_depth_ms.comp.spirv";
+
+/** the levels of a full mip chain of width x height */
+uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+/**
+ * The level 0 of the depth pyramid of a width x height depth buffer: half the next powers
+ * of two, so each texel of every level covers a whole power of two block of depth texels,
+ * the parts out of the depth buffer repeating its edges. Levels down to 1x1: getMipLevelCount
+ */
+VkExtent2D getPyramidExtent(uint32_t width, uint32_t height);
+
+/** an image record can reduce: its views, descriptor set and counter */
+struct Target {
+    VkImage image = VK_NULL_HANDLE;
+    /** destination level 0 */
+    VkExtent2D extent{};
+    uint32_t levelCount = 0;
+    Reduction reduction = Average;
+    bool srgb = false;
+    bool depth = false;
+    /** a multisampled depth buffer, its samples reduced like the texels */
+    bool multisampled = false;
+    /** the sampled view of the source, if created by the downsampler */
+    VkImageView sourceView = VK_NULL_HANDLE;
+    std::vector<VkImageView> levelViews;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkBuffer counter = VK_NULL_HANDLE;
+    VkDeviceMemory counterMemory = VK_NULL_HANDLE;
+};
+
+class Downsampler {
+public:
+    /** maxTargetCount: the targets alive at once, sizes the descriptor pools */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        uint32_t maxTargetCount = 16,
+        const char* colorFile = DEFAULT_SPD_FILE,
+        const char* depthFile = DEFAULT_SPD_DEPTH_FILE,
+        const char* multisampledDepthFile = DEFAULT_SPD_DEPTH_MS_FILE
+    );
+
+    /**
+     * The levels 1..mipLevels-1 of image from its level 0.
+     * image: R8G8B8A8_UNORM with VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT if format is R8G8B8A8_SRGB
+     * (texture3::bindImageMemory flags), usage SAMPLED and STORAGE.
+     * format: R8G8B8A8_SRGB or _UNORM, how level 0 is read. With SRGB the average is
+     * computed on linear values and encoded back, like the blit of an sRGB image
+     */
+    void createMipTarget(
+        VkImage image,
+        VkFormat format,
+        uint32_t width,
+        uint32_t height,
+        uint32_t mipLevels,
+        Target& target
+    );
+
+    /**
+     * The depth pyramid of a depth buffer, in the levels of pyramid.
+     * depthView: sampled, DEPTH aspect only, of depthSamples samples.
+     * pyramid: R32_SFLOAT of getPyramidExtent(depthWidth, depthHeight), usage SAMPLED and STORAGE
+     */
+    void createPyramidTarget(
+        VkImageView depthView,
+        VkImage pyramid,
+        uint32_t depthWidth,
+        uint32_t depthHeight,
+        VkSampleCountFlagBits depthSamples,
+        uint32_t levelCount,
+        Reduction reduction,
+        Target& target
+    );
+
+    /**
+     * The whole reduction in one dispatch, outside of a render pass.
+     * Layouts, left to the caller's barriers: the source SHADER_READ_ONLY_OPTIMAL (depth:
+     * DEPTH_STENCIL_READ_ONLY_OPTIMAL), the destination levels GENERAL. The writes are
+     * done at the end of the COMPUTE_SHADER stage
+     */
+    void record(VkCommandBuffer commandBuffer, const Target& target);
+
+    void destroyTarget(Target& target);
+    void destroy();
+
+private:
+    struct PushConstants {
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint32_t reduction;
+        uint32_t srgb;
+        uint32_t groupCount;
+    };
+
+    void createTarget(VkImageView sourceView, VkImageLayout sourceLayout, Target& target);
+    const compute::Kernel& getKernel(const Target& target) const;
+
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    compute::Kernel color_;
+    compute::Kernel depth_;
+    compute::Kernel multisampledDepth_;
+    VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
+    /** nearest, clamped: the shader only texelFetch the source */
+    VkSampler sampler_ = VK_NULL_HANDLE;
+};
+
+}
@@ -0,0 +1,112 @@
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+
+// could be only in one file in the project
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "model.hpp"
+#include "profiler.hpp"
+
+namespace model {
+
+void loadObj(const char* path, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    /**
+     * The attrib container holds all of the positions, normals and texture coordinates
+     * in its attrib.vertices, attrib.normals and attrib.texcoords vectors.
+     * The shapes container contains all of the separate objects and their faces.
+     * Each face consists of an array of vertices, and each vertex contains
+     * the indices of the position, normal and texture coordinate attributes.
+     * OBJ models can also define a material and texture per face, but we will be ignoring those.
+     */
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    {
+        PROFILE_SCOPE("tinyobj::LoadObj");
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path)) {
+            throw std::runtime_error(warn + err);
+        }
+    }
+
+    // We're going to combine all of the faces in the file into a single model, so just iterate over all of the shapes:
+    for (const auto& shape : shapes) {
+        // The triangulation feature has already made sure that there are three vertices per face,
+        // so we can now directly iterate over the vertices and dump them straight into our vertices vector:
+        for (const auto& index : shape.mesh.indices) {
+            vertex3::Vertex vertex{};
+
+            // attrib.vertices array is an array of float values instead of something like glm::vec3
+            vertex.pos = {
+                attrib.vertices[3 * index.vertex_index + 0], // x
+                attrib.vertices[3 * index.vertex_index + 1], // y
+                attrib.vertices[3 * index.vertex_index + 2] // z
+            };
+
+            // Similarly, there are two texture coordinate components per entry.
+            vertex.texCoord = {
+                attrib.texcoords[2 * index.texcoord_index + 0], // u
+                // for OBJ format 0 means the bottom of the image
+                // but we've uploaded the image to Vulkan in a top-bottom orientation
+                // so we flip the vertical axis
+                1.0f - attrib.texcoords[2 * index.texcoord_index + 1] // v
+            };
+
+            vertex.color = {1.0f, 1.0f, 1.0f};
+
+            vertices.push_back(vertex);
+            // every vertex is unique at this point, hence the simple auto-increment indices
+            indices.push_back(static_cast<uint32_t>(indices.size()));
+        }
+    }
+}
+
+// Vertex has no padding (3 + 3 + 2 floats): hashing and comparing its bytes is fine
+static_assert(sizeof(vertex3::Vertex) == 8 * sizeof(float), "vertex3::Vertex has padding");
+
+struct VertexHash {
+    size_t operator()(const vertex3::Vertex& vertex) const {
+        // FNV-1a over the bytes
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(vertex3::Vertex); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+struct VertexEqual {
+    bool operator()(const vertex3::Vertex& a, const vertex3::Vertex& b) const {
+        return memcmp(&a, &b, sizeof(vertex3::Vertex)) == 0;
+    }
+};
+
+void deduplicateVertices(std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    PROFILE_SCOPE("model::deduplicateVertices");
+    std::unordered_map<vertex3::Vertex, uint32_t, VertexHash, VertexEqual> uniqueVertices;
+    uniqueVertices.reserve(vertices.size());
+
+    // compacted in place: a vertex is never written before it has been read
+    uint32_t uniqueCount = 0;
+    std::vector<uint32_t> remap(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        auto inserted = uniqueVertices.emplace(vertices[i], uniqueCount);
+        if (inserted.second) {
+            vertices[uniqueCount] = vertices[i];
+            uniqueCount++;
+        }
+        remap[i] = inserted.first->second;
+    }
+    vertices.resize(uniqueCount);
+
+    for (auto& index : indices) {
+        index = remap[index];
+    }
+}
+
+}
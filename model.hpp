@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "vertex3.hpp"
+
+namespace model {
+
+/**
+ * All the shapes of an OBJ file combined into a single mesh (tinyobjloader triangulates
+ * the faces), one vertex per face corner: see deduplicateVertices.
+ * The v of the texture coordinates is flipped, OBJ puts 0 at the bottom of the image.
+ * Throws with the warnings and errors of tinyobjloader if the file can't be loaded
+ */
+void loadObj(const char* path, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices);
+
+/**
+ * Keeps only the first of identical vertices (bitwise comparison of all the attributes)
+ * and rewrites the indices: a face corner shared by several faces is then transformed
+ * once by the vertex shader, and the post transform cache can do its job.
+ * The order of the first occurrences is kept
+ */
+void deduplicateVertices(std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices);
+
+}
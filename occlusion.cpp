@@ -0,0 +1,365 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "occlusion.hpp"
+#include "device.hpp"
+#include "texture3.hpp"
+#include "image2.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "commandbuffer.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
+
+namespace occlusion {
+
+// objects, visibility, draws, counters and the pyramid
+static const std::vector<compute::BindingType> BINDINGS = {
+    compute::StorageBuffer,
+    compute::StorageBuffer,
+    compute::StorageBuffer,
+    compute::StorageBuffer,
+    compute::SampledImage
+};
+static const uint32_t OBJECT_BINDING = 0;
+static const uint32_t VISIBILITY_BINDING = 1;
+static const uint32_t DRAW_BINDING = 2;
+static const uint32_t COUNTER_BINDING = 3;
+static const uint32_t PYRAMID_BINDING = 4;
+// VkDrawIndexedIndirectCommand, tightly packed
+static const VkDeviceSize DRAW_STRIDE = 5 * sizeof(uint32_t);
+
+glm::vec4 getBoundingSphere(const std::vector<vertex3::Vertex>& vertices) {
+    return getBoundingSphere(vertices.data(), vertices.size());
+}
+
+glm::vec4 getBoundingSphere(const vertex3::Vertex* vertices, size_t count) {
+    if (count == 0) {
+        return glm::vec4(0.0f);
+    }
+    glm::vec3 low = vertices[0].pos;
+    glm::vec3 high = vertices[0].pos;
+    for (size_t i = 0; i < count; i++) {
+        low = glm::min(low, vertices[i].pos);
+        high = glm::max(high, vertices[i].pos);
+    }
+    glm::vec3 center = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        radius = std::max(radius, glm::length(vertices[i].pos - center));
+    }
+    return glm::vec4(center, radius);
+}
+
+glm::vec4 transformSphere(const glm::mat4& model, const glm::vec4& sphere) {
+    glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f));
+    float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])),
+        glm::length(glm::vec3(model[2]))});
+    return glm::vec4(center, sphere.w * scale);
+}
+
+void Culler::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue queue,
+    VkImage depthImage,
+    VkImageView depthView,
+    VkFormat depthFormat,
+    VkExtent2D depthExtent,
+    VkSampleCountFlagBits depthSamples,
+    uint32_t frameSlotCount,
+    const char* cullFile
+) {
+    PROFILE_SCOPE("occlusion::Culler::init");
+    physicalDevice_ = physicalDevice;
+    logicalDevice_ = logicalDevice;
+    commandPool_ = commandPool;
+    queue_ = queue;
+    depthImage_ = depthImage;
+    depthExtent_ = depthExtent;
+    depthAspect_ = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (device::hasStencilComponent(depthFormat)) {
+        // the layout of both aspects changes together
+        depthAspect_ |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    limits_ = compute::getLimits(physicalDevice_);
+    compute::createKernel(cullFile, logicalDevice_, BINDINGS, sizeof(PushConstants),
+        compute::chooseGroupSize(limits_), cull_);
+    compute::createDescriptorPool(logicalDevice_, BINDINGS, 1, descriptorPool_);
+    descriptorSet_ = compute::allocateDescriptorSet(logicalDevice_, descriptorPool_, cull_.descriptorSetLayout);
+
+    // the pyramid, every level kept up to 12
+    VkExtent2D extent = mipgen::getPyramidExtent(depthExtent.width, depthExtent.height);
+    uint32_t levelCount = std::min(mipgen::getMipLevelCount(extent.width, extent.height), mipgen::MAX_LEVEL_COUNT);
+    texture3::bindImageMemory(physicalDevice_, logicalDevice_, extent.width, extent.height, levelCount,
+        VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, memory::GpuOnly, pyramid_, pyramidMemory_);
+    pyramidView_ = image2::createImageView(logicalDevice_, pyramid_, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT,
+        levelCount);
+
+    downsampler_.init(physicalDevice_, logicalDevice_, 1);
+    downsampler_.createPyramidTarget(depthView, pyramid_, depthExtent.width, depthExtent.height, depthSamples,
+        levelCount, mipgen::Max, pyramidTarget_);
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = static_cast<float>(levelCount);
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    if (vkCreateSampler(logicalDevice_, &samplerInfo, nullptr, &pyramidSampler_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create occlusion pyramid sampler!");
+    }
+    // written by the downsampler and read by the cull shader in GENERAL, for good
+    compute::writeImage(logicalDevice_, descriptorSet_, PYRAMID_BINDING, compute::SampledImage, pyramidView_,
+        VK_IMAGE_LAYOUT_GENERAL, pyramidSampler_);
+
+    buffer2::bindBuffer(physicalDevice_, logicalDevice_, COUNTER_COUNT * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly, counterBuffer_, counterMemory_);
+    compute::writeBuffer(logicalDevice_, descriptorSet_, COUNTER_BINDING, compute::StorageBuffer, counterBuffer_);
+
+    slots_.resize(frameSlotCount);
+    for (auto& slot : slots_) {
+        buffer2::bindBuffer(physicalDevice_, logicalDevice_, COUNTER_COUNT * sizeof(uint32_t),
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT, memory::Readback, slot.buffer, slot.memory);
+        vkMapMemory(logicalDevice_, slot.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped);
+    }
+
+    VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice_, commandPool_);
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid_;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1};
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+    commandbuffer::endAndExecuteSingleTimeCommands(logicalDevice_, commandPool_, queue_, commandBuffer);
+}
+
+void Culler::setObjects(const std::vector<Object>& objects) {
+    PROFILE_SCOPE("occlusion::Culler::setObjects");
+    destroyObjectBuffers();
+    objectCount_ = static_cast<uint32_t>(objects.size());
+    // the counters in flight belong to the previous objects
+    for (auto& slot : slots_) {
+        slot.recorded = false;
+    }
+    lastStats_ = Stats{};
+    if (objectCount_ == 0) {
+        return;
+    }
+
+    VkDeviceSize objectSize = objectCount_ * sizeof(Object);
+    VkDeviceSize visibilitySize = objectCount_ * sizeof(uint32_t);
+    buffer2::bindBuffer(physicalDevice_, logicalDevice_, objectSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly, objectBuffer_, objectMemory_);
+    buffer2::bindBuffer(physicalDevice_, logicalDevice_, visibilitySize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::GpuOnly, visibilityBuffer_, visibilityMemory_);
+    buffer2::bindBuffer(physicalDevice_, logicalDevice_, 2 * objectCount_ * DRAW_STRIDE,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        memory::GpuOnly, drawBuffer_, drawMemory_);
+
+    buffer2::StagingBuffer staging;
+    buffer2::reserveStagingBuffer(physicalDevice_, logicalDevice_, objectSize, staging);
+    memcpy(staging.mapped, objects.data(), objectSize);
+    mapped::flush(logicalDevice_, staging.memory, 0, objectSize);
+
+    VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice_, commandPool_);
+    VkBufferCopy region{0, 0, objectSize};
+    vkCmdCopyBuffer(commandBuffer, staging.buffer, objectBuffer_, 1, &region);
+    // nothing visible last frame: the first one draws everything late
+    vkCmdFillBuffer(commandBuffer, visibilityBuffer_, 0, visibilitySize, 0);
+    commandbuffer::endAndExecuteSingleTimeCommands(logicalDevice_, commandPool_, queue_, commandBuffer);
+    buffer2::destroyStagingBuffer(logicalDevice_, staging);
+
+    compute::writeBuffer(logicalDevice_, descriptorSet_, OBJECT_BINDING, compute::StorageBuffer, objectBuffer_);
+    compute::writeBuffer(logicalDevice_, descriptorSet_, VISIBILITY_BINDING, compute::StorageBuffer, visibilityBuffer_);
+    compute::writeBuffer(logicalDevice_, descriptorSet_, DRAW_BINDING, compute::StorageBuffer, drawBuffer_);
+}
+
+void Culler::setOcclusion(bool enabled) {
+    occlusion_ = enabled;
+}
+
+bool Culler::getOcclusion() const {
+    return occlusion_;
+}
+
+void Culler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+    Slot& slot = slots_[frameSlot];
+    if (slot.recorded) {
+        // the fence of the slot has been waited for
+        mapped::invalidate(logicalDevice_, slot.memory, 0, COUNTER_COUNT * sizeof(uint32_t));
+        const uint32_t* counters = static_cast<const uint32_t*>(slot.mapped);
+        lastStats_.objectCount = slot.objectCount;
+        lastStats_.earlyDrawCount = counters[0];
+        lastStats_.lateDrawCount = counters[1];
+        lastStats_.frustumCulledCount = counters[2];
+        lastStats_.occlusionCulledCount = counters[3];
+    }
+    slot.recorded = false;
+
+    // the counters are shared by the frames in flight: after the copy and the atomics of the previous one
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    dispatch::getDeviceTable().vkCmdFillBuffer(commandBuffer, counterBuffer_, 0, COUNTER_COUNT * sizeof(uint32_t), 0);
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void Culler::recordCull(VkCommandBuffer commandBuffer, Phase phase, const glm::mat4& viewProjection) {
+    PROFILE_SCOPE("occlusion::Culler::recordCull");
+    if (objectCount_ == 0) {
+        return;
+    }
+
+    // the draws of the previous pass read, the visibility and the pyramid written
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    PushConstants pushConstants{};
+    pushConstants.viewProjection = viewProjection;
+    pushConstants.objectCount = objectCount_;
+    pushConstants.phase = phase;
+    pushConstants.occlusion = occlusion_ ? 1 : 0;
+    pushConstants.levelCount = pyramidTarget_.levelCount;
+    pushConstants.depthWidth = depthExtent_.width;
+    pushConstants.depthHeight = depthExtent_.height;
+    compute::recordDispatch(commandBuffer, cull_, descriptorSet_, &pushConstants,
+        compute::getGroupCount(limits_, objectCount_, cull_.groupSize));
+
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+}
+
+void Culler::recordPyramid(VkCommandBuffer commandBuffer) {
+    PROFILE_SCOPE("occlusion::Culler::recordPyramid");
+    if (!occlusion_ || objectCount_ == 0) {
+        return;
+    }
+
+    recordDepthLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    // the previous frame is done reading the pyramid
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+    downsampler_.record(commandBuffer, pyramidTarget_);
+
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    recordDepthLayout(commandBuffer, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+}
+
+void Culler::recordDepthLayout(VkCommandBuffer commandBuffer, VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = depthImage_;
+    barrier.subresourceRange = {depthAspect_, 0, 1, 0, 1};
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    dispatch::getDeviceTable().vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Culler::endFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    Slot& slot = slots_[frameSlot];
+
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    VkBufferCopy region{0, 0, COUNTER_COUNT * sizeof(uint32_t)};
+    table.vkCmdCopyBuffer(commandBuffer, counterBuffer_, slot.buffer, 1, &region);
+    compute::recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+    slot.recorded = true;
+    slot.objectCount = objectCount_;
+}
+
+VkBuffer Culler::getDrawBuffer() const {
+    return drawBuffer_;
+}
+
+VkDeviceSize Culler::getDrawOffset(Phase phase, uint32_t object) const {
+    return (static_cast<VkDeviceSize>(phase) * objectCount_ + object) * DRAW_STRIDE;
+}
+
+const Stats& Culler::getLastStats() const {
+    return lastStats_;
+}
+
+void Culler::destroyObjectBuffers() {
+    for (auto buffer : {objectBuffer_, visibilityBuffer_, drawBuffer_}) {
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice_, buffer, nullptr);
+        }
+    }
+    for (auto bufferMemory : {objectMemory_, visibilityMemory_, drawMemory_}) {
+        if (bufferMemory != VK_NULL_HANDLE) {
+            memory::freeMemory(logicalDevice_, bufferMemory);
+        }
+    }
+    objectBuffer_ = VK_NULL_HANDLE;
+    objectMemory_ = VK_NULL_HANDLE;
+    visibilityBuffer_ = VK_NULL_HANDLE;
+    visibilityMemory_ = VK_NULL_HANDLE;
+    drawBuffer_ = VK_NULL_HANDLE;
+    drawMemory_ = VK_NULL_HANDLE;
+    objectCount_ = 0;
+}
+
+void Culler::destroy() {
+    if (logicalDevice_ == VK_NULL_HANDLE) {
+        return;
+    }
+    destroyObjectBuffers();
+    for (auto& slot : slots_) {
+        vkDestroyBuffer(logicalDevice_, slot.buffer, nullptr);
+        memory::freeMemory(logicalDevice_, slot.memory);
+    }
+    slots_.clear();
+    vkDestroyBuffer(logicalDevice_, counterBuffer_, nullptr);
+    memory::freeMemory(logicalDevice_, counterMemory_);
+
+    downsampler_.destroyTarget(pyramidTarget_);
+    downsampler_.destroy();
+    vkDestroySampler(logicalDevice_, pyramidSampler_, nullptr);
+    vkDestroyImageView(logicalDevice_, pyramidView_, nullptr);
+    vkDestroyImage(logicalDevice_, pyramid_, nullptr);
+    memory::freeMemory(logicalDevice_, pyramidMemory_);
+
+    vkDestroyDescriptorPool(logicalDevice_, descriptorPool_, nullptr);
+    compute::destroyKernel(logicalDevice_, cull_);
+    logicalDevice_ = VK_NULL_HANDLE;
+}
+
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "glm/glm.hpp"
+
+#include "vertex3.hpp"
+#include "compute.hpp"
+#include "mipgen.hpp"
+
+namespace occlusion {
+
+/**
+ * Hierarchical-Z occlusion culling on the GPU, in two phases per frame so the objects
+ * which show up again (disocclusion) are drawn the same frame:
+ * 1. early cull: the objects visible last frame, if in the frustum, get their draw
+ * 2. early pass: they are drawn, their depth is stored
+ * 3. the depth is reduced into a max depth pyramid (mipgen::Downsampler): each texel holds
+ *    the farthest depth of the pixels it covers
+ * 4. late cull: every object in the frustum is tested against the pyramid. The visible
+ *    ones not drawn early get their draw, the visibility is kept for the next frame
+ * 5. late pass: they are drawn over the early pass (attachments loaded)
+ *
+ * An object is its bounding sphere, tested through the 8 corners of the box around it:
+ * out of the frustum if they are all out of the same plane, occluded if the nearest corner
+ * is farther than the pyramid texels (2x2 at most, of the level where they cover the box).
+ * Boxes crossing the near plane are never occluded. Conservative: an occluded object can be
+ * drawn, never the other way around. Standard depth (cleared to 1, test LESS, 0..1 clip z).
+ *
+ * The draws are VkDrawIndexedIndirectCommand, one per object and phase, with an
+ * instanceCount of 0 when not drawn: the GPU skips the culled ones. With multiDrawIndirect
+ * (optional Vulkan 1.0 feature) they go in a few vkCmdDrawIndexedIndirect, see
+ * offscreen::Renderer::recordIndirectDraws; without it, the fallback binds and draws every
+ * object with a draw count of 1. The number of draws is still the object count: a draw count
+ * written by the GPU needs Vulkan 1.2 or VK_KHR_draw_indirect_count.
+ * The counters of a frame are read back when its frame slot comes again, like gpustats.
+ */
+enum Phase {
+    Early,
+    Late
+};
+
+/** what the cull shader reads per object (std430) */
+struct Object {
+    /** center and radius, in the space transformed by the viewProjection of recordCull */
+    glm::vec4 sphere;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    /** 0 unless the device has drawIndirectFirstInstance */
+    uint32_t firstInstance;
+};
+
+/** one frame */
+struct Stats {
+    uint32_t objectCount = 0;
+    uint32_t earlyDrawCount = 0;
+    uint32_t lateDrawCount = 0;
+    uint32_t frustumCulledCount = 0;
+    uint32_t occlusionCulledCount = 0;
+};
+
+const auto DEFAULT_CULL_FILE = "./shaders/spirv/cull.comp.spirv";
+
+/** around the box of the vertices */
+glm::vec4 getBoundingSphere(const std::vector<vertex3::Vertex>& vertices);
+/** of a range of vertices, e.g. one mesh of a scene */
+glm::vec4 getBoundingSphere(const vertex3::Vertex* vertices, size_t count);
+
+/** the sphere after model, its radius scaled by the largest scale of model */
+glm::vec4 transformSphere(const glm::mat4& model, const glm::vec4& sphere);
+
+class Culler {
+public:
+    /**
+     * depthImage: the depth attachment, usage SAMPLED too, stored by the early pass and left
+     * in DEPTH_STENCIL_ATTACHMENT_OPTIMAL. depthView: its DEPTH aspect, of depthSamples samples.
+     * commandPool and queue: for the uploads, waited for
+     */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        VkCommandPool commandPool,
+        VkQueue queue,
+        VkImage depthImage,
+        VkImageView depthView,
+        VkFormat depthFormat,
+        VkExtent2D depthExtent,
+        VkSampleCountFlagBits depthSamples,
+        uint32_t frameSlotCount,
+        const char* cullFile = DEFAULT_CULL_FILE
+    );
+
+    /** replaces the objects, all invisible for the first frame: the queue must be idle */
+    void setObjects(const std::vector<Object>& objects);
+
+    /**
+     * false: frustum culling only, no pyramid. The objects in the frustum are drawn late the
+     * first frame, early afterwards
+     */
+    void setOcclusion(bool enabled);
+    bool getOcclusion() const;
+
+    /**
+     * First thing recorded for the culling in the command buffer of frameSlot, once its fence
+     * has been waited: reads the counters of the previous frame of the slot, zeroes them
+     */
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+
+    /** the draws of phase, readable by the DRAW_INDIRECT stage afterwards. Outside of a render pass */
+    void recordCull(VkCommandBuffer commandBuffer, Phase phase, const glm::mat4& viewProjection);
+
+    /**
+     * After the early pass: the depth pyramid, then the depth is back in
+     * DEPTH_STENCIL_ATTACHMENT_OPTIMAL for the late pass. Nothing without occlusion
+     */
+    void recordPyramid(VkCommandBuffer commandBuffer);
+
+    /** after the late pass: the counters to the readback of frameSlot */
+    void endFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+
+    /** the indirect draws of all the objects, for vkCmdDrawIndexedIndirect */
+    VkBuffer getDrawBuffer() const;
+    VkDeviceSize getDrawOffset(Phase phase, uint32_t object) const;
+
+    /** the last frame read back */
+    const Stats& getLastStats() const;
+
+    void destroy();
+
+private:
+    struct PushConstants {
+        glm::mat4 viewProjection;
+        uint32_t objectCount;
+        uint32_t phase;
+        uint32_t occlusion;
+        uint32_t levelCount;
+        uint32_t depthWidth;
+        uint32_t depthHeight;
+    };
+
+    /** the GPU counters, in the order of Stats after objectCount */
+    static const uint32_t COUNTER_COUNT = 4;
+
+    void destroyObjectBuffers();
+    void recordDepthLayout(VkCommandBuffer commandBuffer, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    VkCommandPool commandPool_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    compute::Limits limits_{};
+    compute::Kernel cull_;
+    VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet_ = VK_NULL_HANDLE;
+    bool occlusion_ = true;
+
+    VkImage depthImage_ = VK_NULL_HANDLE;
+    VkImageAspectFlags depthAspect_ = 0;
+    VkExtent2D depthExtent_{};
+
+    mipgen::Downsampler downsampler_;
+    mipgen::Target pyramidTarget_;
+    VkImage pyramid_ = VK_NULL_HANDLE;
+    VkDeviceMemory pyramidMemory_ = VK_NULL_HANDLE;
+    /** all the levels, sampled by the cull shader */
+    VkImageView pyramidView_ = VK_NULL_HANDLE;
+    VkSampler pyramidSampler_ = VK_NULL_HANDLE;
+
+    uint32_t objectCount_ = 0;
+    VkBuffer objectBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory objectMemory_ = VK_NULL_HANDLE;
+    /** 1 per visible object, what the early phase of the next frame draws */
+    VkBuffer visibilityBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory visibilityMemory_ = VK_NULL_HANDLE;
+    /** the early draws of all the objects, then the late ones */
+    VkBuffer drawBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory drawMemory_ = VK_NULL_HANDLE;
+    VkBuffer counterBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory counterMemory_ = VK_NULL_HANDLE;
+
+    struct Slot {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        bool recorded = false;
+        uint32_t objectCount = 0;
+    };
+    std::vector<Slot> slots_;
+    Stats lastStats_;
+};
+
+}
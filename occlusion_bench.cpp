@@ -0,0 +1,325 @@
+/**
+ * Headless bench of the GPU culling of offscreen::Renderer (occlusion::Culler) in a dense
+ * generated scene (scene::generate): the same frames rendered without culling, with
+ * frustum culling, then with the two phase hierarchical-Z occlusion culling.
+ * Per mode: the frame time, the command recording time, and per frame the instances
+ * drawn (early + late pass) and culled by the frustum or by the depth pyramid.
+ *
+ * The camera stands at the edge of the cube of instances, looking at its center while
+ * the scene turns: most instances are hidden behind the nearest ones, and the turning
+ * uncovers new ones every frame (what the late pass catches).
+ *
+ * Correctness: frame --check-frame is read back in every mode and compared with the one
+ * without culling. Culling must not change the image: the bench fails if more than
+ * 0.1% of the pixels differ (by more than a rounding of the MSAA resolve).
+ *
+ * usage: occlusion_bench [--objects N] [--triangles T] [--shape sphere|cube|grid|<obj path>]
+ *                        [--distribution uniform|clustered|lattice] [--extent E] [--seed S]
+ *                        [--frames F] [--warmup W] [--check-frame C] [--width X] [--height Y]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iomanip>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+// the culling expects the 0..1 clip depth of Vulkan
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "headless.hpp"
+#include "offscreen.hpp"
+#include "scene.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "commandbuffer.hpp"
+
+// a channel difference the MSAA resolve can make on its own
+const int PIXEL_TOLERANCE = 2;
+const double MAX_DIFFERENT_PIXELS = 0.001;
+
+struct BenchOptions {
+    uint32_t objectCount = 10000;
+    uint32_t triangleCount = 1000;
+    scene::Shape shape = scene::Sphere;
+    std::string meshPath;
+    scene::Distribution distribution = scene::Uniform;
+    float extent = 20.0f;
+    uint64_t seed = 1;
+    uint32_t frameCount = 200;
+    uint32_t warmupFrameCount = 20;
+    uint32_t checkFrame = 30;
+    uint32_t width = 800;
+    uint32_t height = 600;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        if (name == "--objects") {
+            options.objectCount = number;
+        } else if (name == "--triangles") {
+            options.triangleCount = number;
+        } else if (name == "--shape") {
+            if (value == "sphere") {
+                options.shape = scene::Sphere;
+            } else if (value == "cube") {
+                options.shape = scene::Cube;
+            } else if (value == "grid") {
+                options.shape = scene::Grid;
+            } else {
+                options.shape = scene::Loaded;
+                options.meshPath = value;
+            }
+        } else if (name == "--distribution") {
+            if (value == "uniform") {
+                options.distribution = scene::Uniform;
+            } else if (value == "clustered") {
+                options.distribution = scene::Clustered;
+            } else if (value == "lattice") {
+                options.distribution = scene::Lattice;
+            } else {
+                throw std::invalid_argument("unknown distribution " + value);
+            }
+        } else if (name == "--extent") {
+            options.extent = std::strtof(value.c_str(), nullptr);
+        } else if (name == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "--frames") {
+            options.frameCount = number;
+        } else if (name == "--warmup") {
+            options.warmupFrameCount = number;
+        } else if (name == "--check-frame") {
+            options.checkFrame = number;
+        } else if (name == "--width") {
+            options.width = number;
+        } else if (name == "--height") {
+            options.height = number;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** from the edge of the cube, at its center, turning slowly around z */
+static buffer2::UniformBufferObject makeUniforms(uint32_t frame, VkExtent2D extent, float sceneExtent) {
+    buffer2::UniformBufferObject ubo{};
+    ubo.model = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.view = glm::lookAt(glm::vec3(0.0f, -1.1f * sceneExtent, 0.2f * sceneExtent), glm::vec3(0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(60.0f), extent.width / static_cast<float>(extent.height),
+        0.1f, 4.0f * sceneExtent);
+    ubo.proj[1][1] *= -1;
+    return ubo;
+}
+
+struct Result {
+    const char* name;
+    double frameMs;
+    double recordUs;
+    double drawnCount;
+    double frustumCulledCount;
+    double occlusionCulledCount;
+};
+
+static Result measure(offscreen::Renderer& renderer, const BenchOptions& options, offscreen::Culling culling,
+    const char* name) {
+    renderer.setCulling(culling);
+
+    double recordMs = 0.0;
+    uint64_t drawnCount = 0;
+    uint64_t frustumCulledCount = 0;
+    uint64_t occlusionCulledCount = 0;
+    uint32_t totalFrameCount = options.warmupFrameCount + options.frameCount;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < totalFrameCount; frame++) {
+        if (frame == options.warmupFrameCount) {
+            renderer.waitIdle();
+            start = std::chrono::steady_clock::now();
+        }
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent(), options.extent));
+        if (frame >= options.warmupFrameCount) {
+            recordMs += renderer.getLastRecordMs();
+            // a frame MAX_FRAMES_IN_FLIGHT frames back, of the same warm scene
+            const occlusion::Stats& stats = renderer.getCullingStats();
+            drawnCount += stats.earlyDrawCount + stats.lateDrawCount;
+            frustumCulledCount += stats.frustumCulledCount;
+            occlusionCulledCount += stats.occlusionCulledCount;
+        }
+    }
+    renderer.waitIdle();
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Result result;
+    result.name = name;
+    result.frameMs = elapsedMs / options.frameCount;
+    result.recordUs = recordMs * 1000.0 / options.frameCount;
+    if (culling == offscreen::NoCulling) {
+        result.drawnCount = options.objectCount;
+        result.frustumCulledCount = 0.0;
+        result.occlusionCulledCount = 0.0;
+    } else {
+        result.drawnCount = static_cast<double>(drawnCount) / options.frameCount;
+        result.frustumCulledCount = static_cast<double>(frustumCulledCount) / options.frameCount;
+        result.occlusionCulledCount = static_cast<double>(occlusionCulledCount) / options.frameCount;
+    }
+    return result;
+}
+
+/** frame checkFrame, the frames before it rendered too (what the culling sees), read back as RGBA8 */
+static std::vector<unsigned char> renderCheckFrame(
+    offscreen::Renderer& renderer,
+    const headless::Device& headless,
+    const BenchOptions& options,
+    offscreen::Culling culling
+) {
+    renderer.setCulling(culling);
+    for (uint32_t frame = 0; frame <= options.checkFrame; frame++) {
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent(), options.extent));
+    }
+    renderer.waitIdle();
+
+    VkExtent2D extent = renderer.getExtent();
+    VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+    VkBuffer buffer;
+    VkDeviceMemory bufferMemory;
+    buffer2::bindBuffer(headless.physicalDevice_, headless.device_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::Readback, buffer, bufferMemory);
+
+    VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(headless.device_, renderer.getCommandPool());
+    // the resolve of the last frame, already in TRANSFER_SRC_OPTIMAL
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, renderer.getResolveImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        buffer, 1, &region);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    commandbuffer::endAndExecuteSingleTimeCommands(headless.device_, renderer.getCommandPool(), headless.queue_,
+        commandBuffer);
+
+    std::vector<unsigned char> pixels(size);
+    void* mappedPixels;
+    vkMapMemory(headless.device_, bufferMemory, 0, VK_WHOLE_SIZE, 0, &mappedPixels);
+    mapped::invalidate(headless.device_, bufferMemory, 0, size);
+    memcpy(pixels.data(), mappedPixels, size);
+    vkUnmapMemory(headless.device_, bufferMemory);
+    vkDestroyBuffer(headless.device_, buffer, nullptr);
+    memory::freeMemory(headless.device_, bufferMemory);
+    return pixels;
+}
+
+/** the share of the pixels with a channel further than PIXEL_TOLERANCE */
+static double getDifferentPixels(const std::vector<unsigned char>& expected, const std::vector<unsigned char>& actual) {
+    size_t differentCount = 0;
+    for (size_t pixel = 0; pixel < expected.size(); pixel += 4) {
+        for (size_t channel = 0; channel < 4; channel++) {
+            if (std::abs(expected[pixel + channel] - actual[pixel + channel]) > PIXEL_TOLERANCE) {
+                differentCount++;
+                break;
+            }
+        }
+    }
+    return static_cast<double>(differentCount) / (expected.size() / 4);
+}
+
+static bool run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Occlusion bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+
+    offscreen::Renderer renderer;
+    renderer.init(headless, {options.width, options.height});
+
+    scene::Config config;
+    config.seed = options.seed;
+    config.instanceCount = options.objectCount;
+    config.shape = options.shape;
+    config.triangleCount = options.triangleCount;
+    config.meshPath = options.meshPath.empty() ? nullptr : options.meshPath.c_str();
+    config.distribution = options.distribution;
+    config.extent = options.extent;
+    scene::Scene generated = scene::generate(config);
+    renderer.uploadScene(generated);
+
+    std::cout << "device: " << properties.deviceName << ", " << options.width << "x" << options.height
+        << " " << renderer.getSampleCount() << "x MSAA, seed " << options.seed << ", "
+        << options.objectCount << " objects of " << generated.getTriangleCount() << " triangles\n\n";
+
+    struct Mode {
+        offscreen::Culling culling;
+        const char* name;
+    };
+    const Mode modes[] = {
+        {offscreen::NoCulling, "none"},
+        {offscreen::FrustumCulling, "frustum"},
+        {offscreen::OcclusionCulling, "hzb"}
+    };
+
+    std::cout << std::setw(10) << "culling" << std::setw(12) << "ms/frame" << std::setw(12) << "record us"
+        << std::setw(10) << "drawn" << std::setw(12) << "frustum" << std::setw(12) << "occluded" << '\n';
+    for (const Mode& mode : modes) {
+        Result result = measure(renderer, options, mode.culling, mode.name);
+        std::cout << std::fixed << std::setprecision(2)
+            << std::setw(10) << result.name << std::setw(12) << result.frameMs
+            << std::setw(12) << std::setprecision(1) << result.recordUs
+            << std::setw(10) << result.drawnCount << std::setw(12) << result.frustumCulledCount
+            << std::setw(12) << result.occlusionCulledCount << '\n';
+    }
+    std::cout << '\n';
+    renderer.getGpuStats().printReport();
+
+    bool passed = true;
+    std::vector<unsigned char> expected = renderCheckFrame(renderer, headless, options, offscreen::NoCulling);
+    for (const Mode& mode : modes) {
+        if (mode.culling == offscreen::NoCulling) {
+            continue;
+        }
+        double different = getDifferentPixels(expected, renderCheckFrame(renderer, headless, options, mode.culling));
+        bool modePassed = different <= MAX_DIFFERENT_PIXELS;
+        passed = passed && modePassed;
+        std::cout << "frame " << options.checkFrame << ", " << mode.name << ": " << std::setprecision(3)
+            << different * 100.0 << "% of the pixels differ from no culling "
+            << (modePassed ? "OK" : "FAILED") << '\n';
+    }
+
+    renderer.cleanup();
+    headless.cleanup();
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (!run(parseOptions(argc, argv))) {
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,741 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+
+#include "offscreen.hpp"
+#include "device.hpp"
+#include "pipeline5.hpp"
+#include "compute.hpp"
+#include "swapchain3.hpp"
+#include "texture3.hpp"
+#include "image2.hpp"
+#include "memory.hpp"
+#include "dispatch.hpp"
+#include "heapcount.hpp"
+#include "hitch.hpp"
+#include "profiler.hpp"
+
+namespace offscreen {
+
+/** the frame ubo, the texture, the models of the instances: the set of MultiDrawIndirect */
+static std::vector<compute::BindingType> getIndirectBindings() {
+    return {compute::UniformBuffer, compute::SampledImage, compute::StorageBuffer};
+}
+
+void Renderer::init(
+    const headless::Device& device,
+    VkExtent2D extent,
+    VkSampleCountFlagBits sampleCount,
+    const char* vertFile,
+    const char* fragFile
+) {
+    PROFILE_SCOPE("offscreen::Renderer::init");
+    physicalDevice_ = device.physicalDevice_;
+    device_ = device.device_;
+    queue_ = device.queue_;
+    queueFamilyIndex_ = device.queueFamilyIndex_;
+    extent_ = extent;
+    sampleCount_ = std::min(sampleCount, device::getMaxUsableSampleCount(physicalDevice_));
+    // RGBA rather than the BGRA of the swapchains: the readbacks are in the order of the PNG files
+    colorFormat_ = VK_FORMAT_R8G8B8A8_SRGB;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex_;
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+    VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+    uniformStride_ = (sizeof(buffer2::UniformBufferObject) + alignment - 1) / alignment * alignment;
+    // 1 without multiDrawIndirect, at least 2^16 - 1 with it
+    maxDrawIndirectCount_ = device.features_.multiDrawIndirect == VK_TRUE ? properties.limits.maxDrawIndirectCount : 1;
+    drawIndirectFirstInstance_ = device.features_.drawIndirectFirstInstance == VK_TRUE;
+    geometry_.init(physicalDevice_, device_, commandPool_, queue_);
+
+    samplerCache_.init(physicalDevice_, device_);
+    uniformFlush_.init(device_);
+    gpuStats_.init(physicalDevice_, device_, queueFamilyIndex_, MAX_FRAMES_IN_FLIGHT);
+
+    createTarget();
+    createPipeline(vertFile, fragFile);
+    createTexture();
+    createFrameResources();
+
+    instances_ = {scene::Instance{glm::mat4(1.0f), 0}};
+    createInstanceResources();
+}
+
+void Renderer::createTarget() {
+    depthFormat_ = device::findSupportedDepthImageFormat(
+        physicalDevice_,
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+    );
+
+    texture3::bindImageMemory(physicalDevice_, device_, extent_.width, extent_.height, 1, sampleCount_,
+        colorFormat_, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        memory::GpuOnly, colorImage_, colorImageMemory_);
+    colorImageView_ = image2::createImageView(device_, colorImage_, colorFormat_, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+    // sampled too for the depth pyramid of the occlusion culling, if the format and sample count allow it
+    VkFormatProperties depthProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice_, depthFormat_, &depthProperties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+    depthSampleable_ = (depthProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0
+        && (properties.limits.sampledImageDepthSampleCounts & sampleCount_) != 0;
+    VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (depthSampleable_) {
+        depthUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    }
+    texture3::bindImageMemory(physicalDevice_, device_, extent_.width, extent_.height, 1, sampleCount_,
+        depthFormat_, VK_IMAGE_TILING_OPTIMAL, depthUsage,
+        memory::GpuOnly, depthImage_, depthImageMemory_);
+    depthImageView_ = image2::createImageView(device_, depthImage_, depthFormat_, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+    // what the swapchain image is in the app: the resolve target, then copied from
+    texture3::bindImageMemory(physicalDevice_, device_, extent_.width, extent_.height, 1, VK_SAMPLE_COUNT_1_BIT,
+        colorFormat_, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        memory::GpuOnly, resolveImage_, resolveImageMemory_);
+    resolveImageView_ = image2::createImageView(device_, resolveImage_, colorFormat_, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+    pipeline5::createRenderPass(device_, colorFormat_, sampleCount_, depthFormat_, renderPass_,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    swapchain3::createFramebuffers(device_, {resolveImageView_}, extent_, depthImageView_, colorImageView_,
+        renderPass_, framebuffers_);
+}
+
+void Renderer::createPipeline(const char* vertFile, const char* fragFile) {
+    descriptor::createDescriptorSetLayout(device_, descriptor::WriteDescriptorSet, descriptorSetLayout_);
+
+    pipeline5::createGraphicsPipeline(vertFile, fragFile, device_, extent_, sampleCount_, renderPass_,
+        descriptorSetLayout_, pipelineLayout_, graphicsPipeline_);
+
+    descriptor::createBinder(device_, descriptor::WriteDescriptorSet, descriptorSetLayout_, pipelineLayout_,
+        descriptorBinder_);
+}
+
+void Renderer::createTexture() {
+    // a checkerboard: no file to find, and the mip chain still has something to filter
+    const int TEXTURE_SIZE = 256;
+    const int CELL_SIZE = 32;
+    std::vector<unsigned char> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+    for (int y = 0; y < TEXTURE_SIZE; y++) {
+        for (int x = 0; x < TEXTURE_SIZE; x++) {
+            unsigned char value = ((x / CELL_SIZE + y / CELL_SIZE) % 2) ? 220 : 60;
+            unsigned char* pixel = &pixels[(y * TEXTURE_SIZE + x) * 4];
+            pixel[0] = value;
+            pixel[1] = value;
+            pixel[2] = value;
+            pixel[3] = 255;
+        }
+    }
+
+    uploadTexture(pixels.data(), TEXTURE_SIZE);
+
+    // samplerAnisotropy is not enabled on the headless device
+    sampler::SamplerKey key = sampler::getTextureSamplerKey(1.0f);
+    key.anisotropyEnable = VK_FALSE;
+    textureSampler_ = samplerCache_.acquire(key);
+}
+
+void Renderer::createFrameResources() {
+    commandBuffers_.resize(MAX_FRAMES_IN_FLIGHT);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool_;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers_.size());
+    if (vkAllocateCommandBuffers(device_, &allocInfo, commandBuffers_.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers!");
+    }
+
+    inFlightFences_.resize(MAX_FRAMES_IN_FLIGHT);
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    // the first wait of each slot must not block
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    for (auto& fence : inFlightFences_) {
+        if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create fence!");
+        }
+    }
+
+}
+
+void Renderer::uploadTexture(const unsigned char* pixels, uint32_t size) {
+    Texture texture{};
+    uint32_t mipLevels = texture3::createTextureImageFromPixels(physicalDevice_, device_, commandPool_, queue_,
+        pixels, static_cast<int>(size), static_cast<int>(size), VK_SAMPLE_COUNT_1_BIT, texture.image, texture.memory);
+    texture3::createTextureImageView(device_, texture.image, texture.view, mipLevels);
+    textures_.push_back(texture);
+}
+
+void Renderer::destroyTextures() {
+    for (const auto& texture : textures_) {
+        vkDestroyImageView(device_, texture.view, nullptr);
+        vkDestroyImage(device_, texture.image, nullptr);
+        memory::freeMemory(device_, texture.memory);
+    }
+    textures_.clear();
+}
+
+void Renderer::createInstanceResources() {
+    uint32_t instanceCount = static_cast<uint32_t>(instances_.size());
+    uint32_t textureCount = static_cast<uint32_t>(textures_.size());
+    textureFirstInstance_.assign(textureCount + 1, 0);
+    for (const auto& instance : instances_) {
+        textureFirstInstance_[instance.textureIndex + 1]++;
+    }
+    for (uint32_t i = 0; i < textureCount; i++) {
+        textureFirstInstance_[i + 1] += textureFirstInstance_[i];
+    }
+    if (instanceCount == 0) {
+        return;
+    }
+
+    uniformBuffers_.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformBuffersMemory_.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformBuffersMapped_.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        // written every frame, read in place by the GPU, like buffer2::createUniformBuffers
+        buffer2::bindBuffer(physicalDevice_, device_, (instanceCount + 1) * uniformStride_,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, memory::Dynamic, uniformBuffers_[i], uniformBuffersMemory_[i]);
+        vkMapMemory(device_, uniformBuffersMemory_[i], 0, VK_WHOLE_SIZE, 0, &uniformBuffersMapped_[i]);
+    }
+
+    // the bindings never change: the sets are written once, a frame only binds them
+    buffer2::createDescriptorPool(device_, MAX_FRAMES_IN_FLIGHT * instanceCount, descriptorPool_);
+    descriptor::allocateDescriptorSets(device_, descriptorBinder_, descriptorPool_, descriptorSetLayout_,
+        MAX_FRAMES_IN_FLIGHT * instanceCount, descriptorSets_);
+
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            descriptor::PerDrawBindings bindings{};
+            bindings.uniformBuffer.buffer = uniformBuffers_[frame];
+            bindings.uniformBuffer.offset = i * uniformStride_;
+            bindings.uniformBuffer.range = sizeof(buffer2::UniformBufferObject);
+            bindings.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            bindings.texture.imageView = textures_[instances_[i].textureIndex].view;
+            bindings.texture.sampler = textureSampler_;
+            descriptor::updateDescriptorSet(device_, descriptorBinder_, descriptorSets_[frame * instanceCount + i], bindings);
+        }
+    }
+
+    if (indirectPipeline_ == VK_NULL_HANDLE) {
+        return;
+    }
+    // the models never change either, ubo.model is applied by the shader
+    std::vector<glm::mat4> models(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        models[i] = instances_[i].model;
+    }
+    buffer2::createBuffer(buffer2::Type::Storage, physicalDevice_, device_, commandPool_, queue_,
+        models, instanceBuffer_, instanceBufferMemory_);
+
+    compute::createDescriptorPool(device_, getIndirectBindings(), MAX_FRAMES_IN_FLIGHT * textureCount,
+        indirectDescriptorPool_);
+    indirectDescriptorSets_.resize(MAX_FRAMES_IN_FLIGHT * textureCount);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        for (uint32_t texture = 0; texture < textureCount; texture++) {
+            VkDescriptorSet set = compute::allocateDescriptorSet(device_, indirectDescriptorPool_, indirectSetLayout_);
+            compute::writeBuffer(device_, set, 0, compute::UniformBuffer, uniformBuffers_[frame],
+                instanceCount * uniformStride_, sizeof(buffer2::UniformBufferObject));
+            compute::writeImage(device_, set, 1, compute::SampledImage, textures_[texture].view,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, textureSampler_);
+            compute::writeBuffer(device_, set, 2, compute::StorageBuffer, instanceBuffer_);
+            indirectDescriptorSets_[frame * textureCount + texture] = set;
+        }
+    }
+}
+
+void Renderer::destroyInstanceResources() {
+    for (size_t i = 0; i < uniformBuffers_.size(); i++) {
+        vkDestroyBuffer(device_, uniformBuffers_[i], nullptr);
+        memory::freeMemory(device_, uniformBuffersMemory_[i]);
+    }
+    uniformBuffers_.clear();
+    uniformBuffersMemory_.clear();
+    uniformBuffersMapped_.clear();
+
+    vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
+    descriptorPool_ = VK_NULL_HANDLE;
+    descriptorSets_.clear();
+
+    vkDestroyBuffer(device_, instanceBuffer_, nullptr);
+    memory::freeMemory(device_, instanceBufferMemory_);
+    instanceBuffer_ = VK_NULL_HANDLE;
+    instanceBufferMemory_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorPool(device_, indirectDescriptorPool_, nullptr);
+    indirectDescriptorPool_ = VK_NULL_HANDLE;
+    indirectDescriptorSets_.clear();
+}
+
+void Renderer::uploadScene(const scene::Scene& scene) {
+    PROFILE_SCOPE("offscreen::Renderer::uploadScene");
+    // a scene without meshes is one mesh of all its vertices
+    std::vector<scene::Mesh> sceneMeshes = scene.meshes;
+    if (sceneMeshes.empty()) {
+        sceneMeshes.push_back(scene::Mesh{0, static_cast<uint32_t>(scene.vertices.size()),
+            0, static_cast<uint32_t>(scene.indices.size())});
+    }
+    for (const auto& instance : scene.instances) {
+        if (instance.textureIndex >= scene.textures.size()) {
+            throw std::invalid_argument("scene instance with a texture index out of range!");
+        }
+        if (instance.meshIndex >= sceneMeshes.size()) {
+            throw std::invalid_argument("scene instance with a mesh index out of range!");
+        }
+    }
+
+    waitIdle();
+    destroyInstanceResources();
+    destroyTextures();
+
+    for (const auto& texture : scene.textures) {
+        uploadTexture(texture.pixels.data(), texture.size);
+    }
+    // the instances of a texture next to each other: one draw per texture with MultiDrawIndirect
+    instances_ = scene.instances;
+    std::stable_sort(instances_.begin(), instances_.end(), [](const scene::Instance& a, const scene::Instance& b) {
+        return a.textureIndex < b.textureIndex;
+    });
+    createInstanceResources();
+
+    // the pool wants the indices relative to the first vertex of the mesh
+    std::vector<uint32_t> indices(scene.indices.size());
+    std::vector<geometrypool::MeshData> meshData(sceneMeshes.size());
+    for (size_t i = 0; i < sceneMeshes.size(); i++) {
+        const scene::Mesh& mesh = sceneMeshes[i];
+        for (uint32_t j = mesh.firstIndex; j < mesh.firstIndex + mesh.indexCount; j++) {
+            indices[j] = scene.indices[j] - mesh.firstVertex;
+        }
+        meshData[i].vertices = scene.vertices.data() + mesh.firstVertex;
+        meshData[i].vertexCount = mesh.vertexCount;
+        meshData[i].indices = indices.data() + mesh.firstIndex;
+        meshData[i].indexCount = mesh.indexCount;
+    }
+
+    destroyMeshes();
+    meshes_ = geometry_.load(meshData);
+    for (const auto& mesh : sceneMeshes) {
+        meshSpheres_.push_back(occlusion::getBoundingSphere(scene.vertices.data() + mesh.firstVertex, mesh.vertexCount));
+    }
+    updateCullObjects();
+    updateIndirectDraws();
+}
+
+void Renderer::uploadMesh(const std::vector<vertex3::Vertex>& vertices, const std::vector<uint32_t>& indices) {
+    waitIdle();
+    destroyMeshes();
+
+    meshes_.push_back(geometry_.load(vertices, indices));
+    meshSpheres_.push_back(occlusion::getBoundingSphere(vertices));
+    for (auto& instance : instances_) {
+        instance.meshIndex = 0;
+    }
+    updateCullObjects();
+    updateIndirectDraws();
+}
+
+void Renderer::updateCullObjects() {
+    cullObjects_.resize(instances_.size());
+    for (size_t i = 0; i < instances_.size(); i++) {
+        occlusion::Object& object = cullObjects_[i];
+        geometrypool::Mesh mesh{};
+        glm::vec4 sphere{0.0f};
+        if (!meshes_.empty()) {
+            mesh = meshes_[instances_[i].meshIndex];
+            sphere = meshSpheres_[instances_[i].meshIndex];
+        }
+        object.sphere = occlusion::transformSphere(instances_[i].model, sphere);
+        object.indexCount = mesh.indexCount;
+        object.firstIndex = mesh.firstIndex;
+        object.vertexOffset = static_cast<int32_t>(mesh.firstVertex);
+        // the model of the instance in the storage buffer of shader6
+        object.firstInstance = submission_ == MultiDrawIndirect ? static_cast<uint32_t>(i) : 0;
+    }
+    if (earlyRenderPass_ != VK_NULL_HANDLE) {
+        culler_.setObjects(!meshes_.empty() ? cullObjects_ : std::vector<occlusion::Object>{});
+    }
+}
+
+void Renderer::updateIndirectDraws() {
+    vkDestroyBuffer(device_, drawBuffer_, nullptr);
+    memory::freeMemory(device_, drawBufferMemory_);
+    drawBuffer_ = VK_NULL_HANDLE;
+    drawBufferMemory_ = VK_NULL_HANDLE;
+    if (indirectPipeline_ == VK_NULL_HANDLE || meshes_.empty() || instances_.empty()) {
+        return;
+    }
+
+    std::vector<VkDrawIndexedIndirectCommand> commands(instances_.size());
+    for (size_t i = 0; i < instances_.size(); i++) {
+        commands[i] = geometry_.getDrawCommand(meshes_[instances_[i].meshIndex], static_cast<uint32_t>(i));
+    }
+    buffer2::createBuffer(buffer2::Type::Indirect, physicalDevice_, device_, commandPool_, queue_,
+        commands, drawBuffer_, drawBufferMemory_);
+}
+
+void Renderer::setGeometryPooling(bool pooling) {
+    if (!pooling && submission_ == MultiDrawIndirect) {
+        throw std::runtime_error("multi draw indirect needs the geometry pool!");
+    }
+    waitIdle();
+    destroyMeshes();
+    geometry_.destroy();
+    geometry_.init(physicalDevice_, device_, commandPool_, queue_,
+        pooling ? geometrypool::DEFAULT_BLOCK_VERTEX_COUNT : 0,
+        pooling ? geometrypool::DEFAULT_BLOCK_INDEX_COUNT : 0);
+    updateCullObjects();
+    updateIndirectDraws();
+}
+
+void Renderer::setSubmission(Submission submission, const char* vertFile, const char* fragFile) {
+    if (submission == MultiDrawIndirect) {
+        if (!drawIndirectFirstInstance_) {
+            throw std::runtime_error("multi draw indirect needs drawIndirectFirstInstance!");
+        }
+        if (!geometry_.isPooled()) {
+            throw std::runtime_error("multi draw indirect needs the geometry pool!");
+        }
+    }
+    waitIdle();
+    if (submission == MultiDrawIndirect && indirectPipeline_ == VK_NULL_HANDLE) {
+        compute::createDescriptorSetLayout(device_, getIndirectBindings(), indirectSetLayout_,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        pipeline5::createGraphicsPipeline(vertFile, fragFile, device_, extent_, sampleCount_, renderPass_,
+            indirectSetLayout_, indirectPipelineLayout_, indirectPipeline_);
+        // again, with the models and the descriptor sets per texture this time
+        destroyInstanceResources();
+        createInstanceResources();
+    }
+    submission_ = submission;
+    updateCullObjects();
+    updateIndirectDraws();
+}
+
+void Renderer::setCulling(Culling culling) {
+    waitIdle();
+    if (culling != NoCulling && earlyRenderPass_ == VK_NULL_HANDLE) {
+        if (!depthSampleable_) {
+            throw std::runtime_error("culling needs a depth buffer the device can sample!");
+        }
+        pipeline5::createRenderPass(device_, colorFormat_, sampleCount_, depthFormat_, earlyRenderPass_,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, VK_ATTACHMENT_STORE_OP_STORE);
+        pipeline5::createRenderPass(device_, colorFormat_, sampleCount_, depthFormat_, lateRenderPass_,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, true);
+        culler_.init(physicalDevice_, device_, commandPool_, queue_, depthImage_, depthImageView_, depthFormat_,
+            extent_, sampleCount_, MAX_FRAMES_IN_FLIGHT);
+        updateCullObjects();
+    }
+    if (culling != NoCulling) {
+        culler_.setOcclusion(culling == OcclusionCulling);
+    }
+    culling_ = culling;
+}
+
+void Renderer::destroyMeshes() {
+    for (const auto& mesh : meshes_) {
+        geometry_.unload(mesh);
+    }
+    meshes_.clear();
+    meshSpheres_.clear();
+}
+
+void Renderer::recordCommandBuffer(VkCommandBuffer commandBuffer) {
+    HEAP_SCOPE("offscreen::recordCommandBuffer");
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (table.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+    }
+    gpuStats_.beginFrame(commandBuffer, currentFrame_);
+
+    if (culling_ == NoCulling) {
+        recordPass(commandBuffer, renderPass_, "main pass", false, occlusion::Early);
+    } else {
+        culler_.beginFrame(commandBuffer, currentFrame_);
+        culler_.recordCull(commandBuffer, occlusion::Early, cullMatrix_);
+        recordPass(commandBuffer, earlyRenderPass_, "early pass", true, occlusion::Early);
+
+        gpuStats_.beginPass(commandBuffer, "depth pyramid");
+        culler_.recordPyramid(commandBuffer);
+        culler_.recordCull(commandBuffer, occlusion::Late, cullMatrix_);
+        gpuStats_.endPass(commandBuffer);
+
+        recordPass(commandBuffer, lateRenderPass_, "late pass", true, occlusion::Late);
+        culler_.endFrame(commandBuffer, currentFrame_);
+    }
+
+    if (table.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+void Renderer::recordPass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, const char* passName, bool culled,
+    occlusion::Phase phase) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+
+    // same order as the attachments of pipeline5::createRenderPass: color, depth, (resolve)
+    VkClearValue clearValues[2]{};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = framebuffers_[0];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = extent_;
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+    gpuStats_.beginPass(commandBuffer, passName);
+    table.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    if (!meshes_.empty() && !instances_.empty()) {
+        VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent_.width), static_cast<float>(extent_.height), 0.0f, 1.0f};
+        VkRect2D scissor{{0, 0}, extent_};
+
+        if (submission_ == MultiDrawIndirect) {
+            table.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline_);
+            table.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            table.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            recordIndirectDraws(commandBuffer, culled, phase);
+        } else {
+            table.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
+            table.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            table.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+            uint32_t instanceCount = static_cast<uint32_t>(instances_.size());
+            const VkDescriptorSet* frameSets = &descriptorSets_[currentFrame_ * instanceCount];
+            descriptor::PerDrawBindings unused{};
+            // pooled, every mesh is in the same block: bound once
+            uint32_t boundBlock = geometry_.getBlockCount();
+
+            gpuStats_.beginDraws(commandBuffer, "mesh");
+            for (uint32_t instance = 0; instance < instanceCount; instance++) {
+                const geometrypool::Mesh& mesh = meshes_[instances_[instance].meshIndex];
+                if (mesh.block != boundBlock) {
+                    geometry_.bind(commandBuffer, mesh.block);
+                    boundBlock = mesh.block;
+                }
+                descriptor::bindDescriptors(commandBuffer, descriptorBinder_, pipelineLayout_, frameSets[instance], unused);
+                if (culled) {
+                    // instanceCount 0 when culled: still recorded, skipped by the GPU
+                    table.vkCmdDrawIndexedIndirect(commandBuffer, culler_.getDrawBuffer(),
+                        culler_.getDrawOffset(phase, instance), 1, 0);
+                    continue;
+                }
+                for (uint32_t i = 0; i < drawCount_; i++) {
+                    table.vkCmdDrawIndexed(commandBuffer, mesh.indexCount, 1, mesh.firstIndex,
+                        static_cast<int32_t>(mesh.firstVertex), 0);
+                }
+            }
+            gpuStats_.endDraws(commandBuffer);
+        }
+    }
+
+    table.vkCmdEndRenderPass(commandBuffer);
+    gpuStats_.endPass(commandBuffer);
+}
+
+void Renderer::recordIndirectDraws(VkCommandBuffer commandBuffer, bool culled, occlusion::Phase phase) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    // the meshes of an upload are in one block
+    geometry_.bind(commandBuffer, meshes_[0].block);
+
+    uint32_t textureCount = static_cast<uint32_t>(textures_.size());
+    const VkDescriptorSet* frameSets = &indirectDescriptorSets_[currentFrame_ * textureCount];
+    const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    gpuStats_.beginDraws(commandBuffer, "mesh");
+    for (uint32_t texture = 0; texture < textureCount; texture++) {
+        uint32_t first = textureFirstInstance_[texture];
+        uint32_t count = textureFirstInstance_[texture + 1] - first;
+        if (count == 0) {
+            continue;
+        }
+        table.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout_,
+            0, 1, &frameSets[texture], 0, nullptr);
+
+        // the commands of the culler are in the order of the instances too, instanceCount 0 when culled
+        VkBuffer buffer = culled ? culler_.getDrawBuffer() : drawBuffer_;
+        VkDeviceSize offset = culled ? culler_.getDrawOffset(phase, first) : first * stride;
+        for (uint32_t done = 0; done < count; done += maxDrawIndirectCount_) {
+            uint32_t drawCount = std::min(count - done, maxDrawIndirectCount_);
+            table.vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset + done * stride, drawCount,
+                static_cast<uint32_t>(stride));
+        }
+    }
+    gpuStats_.endDraws(commandBuffer);
+}
+
+void Renderer::updateUniformBuffer(const buffer2::UniformBufferObject& ubo) {
+    HEAP_SCOPE("offscreen::updateUniformBuffer");
+    if (instances_.empty()) {
+        return;
+    }
+    char* mapped = static_cast<char*>(uniformBuffersMapped_[currentFrame_]);
+    if (submission_ == MultiDrawIndirect) {
+        // the slot after the instances, the shader applies the models
+        VkDeviceSize offset = instances_.size() * uniformStride_;
+        memcpy(mapped + offset, &ubo, sizeof(ubo));
+        uniformFlush_.add(uniformBuffersMemory_[currentFrame_], offset, sizeof(ubo));
+        return;
+    }
+    buffer2::UniformBufferObject instanceUbo = ubo;
+    for (size_t i = 0; i < instances_.size(); i++) {
+        instanceUbo.model = ubo.model * instances_[i].model;
+        memcpy(mapped + i * uniformStride_, &instanceUbo, sizeof(instanceUbo));
+    }
+    // one range for all the slots
+    uniformFlush_.add(uniformBuffersMemory_[currentFrame_], 0, instances_.size() * uniformStride_);
+}
+
+void Renderer::drawFrame(const buffer2::UniformBufferObject& ubo) {
+    HEAP_SCOPE("offscreen::drawFrame");
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+
+    {
+        hitch::ScopedEvent hitchEvent(hitch::FENCE_WAIT);
+        table.vkWaitForFences(device_, 1, &inFlightFences_[currentFrame_], VK_TRUE, UINT64_MAX);
+    }
+    table.vkResetFences(device_, 1, &inFlightFences_[currentFrame_]);
+
+    table.vkResetCommandBuffer(commandBuffers_[currentFrame_], 0);
+    // the instances are culled in the space of ubo.model, like the uniforms
+    cullMatrix_ = ubo.proj * ubo.view * ubo.model;
+    auto recordStart = std::chrono::steady_clock::now();
+    recordCommandBuffer(commandBuffers_[currentFrame_]);
+    lastRecordMs_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+    updateUniformBuffer(ubo);
+
+    {
+        HEAP_SCOPE("offscreen::submit");
+        uniformFlush_.flush();
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffers_[currentFrame_];
+        if (table.vkQueueSubmit(queue_, 1, &submitInfo, inFlightFences_[currentFrame_]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
+    }
+
+    currentFrame_ = (currentFrame_ + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+void Renderer::waitIdle() {
+    if (device_ != VK_NULL_HANDLE) {
+        vkQueueWaitIdle(queue_);
+    }
+}
+
+void Renderer::cleanup() {
+    waitIdle();
+    destroyMeshes();
+    geometry_.destroy();
+    vkDestroyBuffer(device_, drawBuffer_, nullptr);
+    memory::freeMemory(device_, drawBufferMemory_);
+
+    destroyInstanceResources();
+    vkDestroyPipeline(device_, indirectPipeline_, nullptr);
+    vkDestroyPipelineLayout(device_, indirectPipelineLayout_, nullptr);
+    vkDestroyDescriptorSetLayout(device_, indirectSetLayout_, nullptr);
+    culler_.destroy();
+    vkDestroyRenderPass(device_, earlyRenderPass_, nullptr);
+    vkDestroyRenderPass(device_, lateRenderPass_, nullptr);
+    descriptor::destroyBinder(device_, descriptorBinder_);
+
+    samplerCache_.release(textureSampler_);
+    samplerCache_.destroy();
+    destroyTextures();
+
+    for (auto fence : inFlightFences_) {
+        vkDestroyFence(device_, fence, nullptr);
+    }
+    vkDestroyCommandPool(device_, commandPool_, nullptr);
+    gpuStats_.destroy();
+
+    vkDestroyPipeline(device_, graphicsPipeline_, nullptr);
+    vkDestroyPipelineLayout(device_, pipelineLayout_, nullptr);
+    vkDestroyDescriptorSetLayout(device_, descriptorSetLayout_, nullptr);
+
+    for (auto framebuffer : framebuffers_) {
+        vkDestroyFramebuffer(device_, framebuffer, nullptr);
+    }
+    vkDestroyRenderPass(device_, renderPass_, nullptr);
+
+    for (VkImageView view : {colorImageView_, depthImageView_, resolveImageView_}) {
+        vkDestroyImageView(device_, view, nullptr);
+    }
+    for (VkImage image : {colorImage_, depthImage_, resolveImage_}) {
+        vkDestroyImage(device_, image, nullptr);
+    }
+    for (VkDeviceMemory imageMemory : {colorImageMemory_, depthImageMemory_, resolveImageMemory_}) {
+        memory::freeMemory(device_, imageMemory);
+    }
+
+    device_ = VK_NULL_HANDLE;
+}
+
+VkExtent2D Renderer::getExtent() const {
+    return extent_;
+}
+
+VkSampleCountFlagBits Renderer::getSampleCount() const {
+    return sampleCount_;
+}
+
+VkFormat Renderer::getColorFormat() const {
+    return colorFormat_;
+}
+
+VkImage Renderer::getResolveImage() const {
+    return resolveImage_;
+}
+
+VkCommandPool Renderer::getCommandPool() const {
+    return commandPool_;
+}
+
+uint32_t Renderer::getCurrentFrame() const {
+    return currentFrame_;
+}
+
+void Renderer::setDrawCount(uint32_t drawCount) {
+    drawCount_ = drawCount;
+}
+
+double Renderer::getLastRecordMs() const {
+    return lastRecordMs_;
+}
+
+const gpustats::Recorder& Renderer::getGpuStats() const {
+    return gpuStats_;
+}
+
+const occlusion::Stats& Renderer::getCullingStats() const {
+    return culler_.getLastStats();
+}
+
+geometrypool::Stats Renderer::getGeometryStats() const {
+    return geometry_.getStats();
+}
+
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "headless.hpp"
+#include "buffer2.hpp"
+#include "descriptor.hpp"
+#include "sampler.hpp"
+#include "mapped.hpp"
+#include "vertex3.hpp"
+#include "gpustats.hpp"
+#include "scene.hpp"
+#include "occlusion.hpp"
+#include "geometrypool.hpp"
+
+namespace offscreen {
+
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
+const auto DEFAULT_VERT_FILE = "./shaders/spirv/shader5.vert.spirv";
+const auto DEFAULT_FRAG_FILE = "./shaders/spirv/shader3.frag.spirv";
+/** shader5 reading the model of the instance from a storage buffer, for MultiDrawIndirect */
+const auto DEFAULT_INDIRECT_VERT_FILE = "./shaders/spirv/shader6.vert.spirv";
+
+/**
+ * The frame loop of hello_model_1 without window: same render pass (MSAA color,
+ * depth, resolve), same pipeline and shaders, same per frame steps (wait for the fence
+ * of the frame slot, record, write the uniforms, submit), but into images instead of a
+ * swapchain, so there is no acquire nor present. For the benchmarks, on lavapipe too.
+ *
+ * The resolved image ends each frame in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL.
+ * The texture is a generated checkerboard, the descriptors use the WriteDescriptorSet
+ * mode (the headless device enables no descriptor extension).
+ *
+ * A scene (scene::generate) replaces the mesh, the textures and the single instance:
+ * each instance has its uniform slot in the buffer of the frame slot and its own
+ * descriptor set per frame slot, written once at upload. A frame then writes the N
+ * uniforms (ubo.model * instance model) and records one bind and draw per instance.
+ *
+ * With culling (setCulling), the draws of the instances are indirect, written by
+ * occlusion::Culler, and the frame is two passes of the same pipeline and framebuffer:
+ * an early one (the instances visible last frame, depth stored) and a late one loading the
+ * attachments (the instances which showed up). The depth image is created SAMPLED too
+ * when the device allows it, for the depth pyramid.
+ *
+ * The meshes are ranges of a geometrypool::Pool (setGeometryPooling), all the meshes of an
+ * upload in one block: one bind of the vertex and index buffers for the whole scene. The
+ * instances are sorted by texture at upload. With MultiDrawIndirect (setSubmission) the
+ * instances of a texture are one vkCmdDrawIndexedIndirect of the static draw commands (or of
+ * the ones of the culler), the models in a storage buffer read at gl_InstanceIndex: a frame
+ * writes one uniform and records a bind and a draw per texture instead of per instance.
+ */
+enum Culling {
+    NoCulling,
+    /** the frustum only, no depth pyramid */
+    FrustumCulling,
+    /** the frustum and the depth pyramid of the early pass */
+    OcclusionCulling
+};
+
+enum Submission {
+    /** a descriptor set and a vkCmdDrawIndexed per instance */
+    DrawPerInstance,
+    /**
+     * a descriptor set and a vkCmdDrawIndexedIndirect per texture. Needs drawIndirectFirstInstance
+     * and the geometry pool; without multiDrawIndirect the draws of a texture are one indirect
+     * draw each (same commands, same descriptor set), and maxDrawIndirectCount at most with it
+     */
+    MultiDrawIndirect
+};
+
+class Renderer {
+public:
+    /** sampleCount is clamped to what the device supports for color and depth */
+    void init(
+        const headless::Device& device,
+        VkExtent2D extent,
+        VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_4_BIT,
+        const char* vertFile = DEFAULT_VERT_FILE,
+        const char* fragFile = DEFAULT_FRAG_FILE
+    );
+
+    /**
+     * replaces the previous meshes, all the instances draw this one. Waits for the device to be
+     * idle first, the ranges of the previous meshes go back to the pool
+     */
+    void uploadMesh(const std::vector<vertex3::Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+    /** replaces the meshes, the textures and the instances, waits for the device to be idle first */
+    void uploadScene(const scene::Scene& scene);
+
+    /**
+     * true by default: the meshes are loaded in the big blocks of a geometry pool. false for a
+     * vertex and an index buffer per mesh, the way it used to be (the baseline of the benchmarks).
+     * Waits for the device to be idle and unloads the meshes: the next upload uses the new mode.
+     * Throws while the submission is MultiDrawIndirect
+     */
+    void setGeometryPooling(bool pooling);
+
+    /**
+     * DrawPerInstance by default. Waits for the device to be idle, the pipeline of
+     * MultiDrawIndirect is created the first time. Throws if the device lacks
+     * drawIndirectFirstInstance or the geometry is not pooled. MultiDrawIndirect ignores setDrawCount
+     */
+    void setSubmission(Submission submission, const char* vertFile = DEFAULT_INDIRECT_VERT_FILE,
+        const char* fragFile = DEFAULT_FRAG_FILE);
+
+    /**
+     * the mesh is drawn drawCount times per frame (1 by default): the cost per object
+     * (draw call, vertex work) without per object data, the copies fail the depth test
+     */
+    void setDrawCount(uint32_t drawCount);
+
+    /**
+     * NoCulling by default. Waits for the device to be idle, the culler is created the first
+     * time. Throws if the depth buffer can't be sampled. Culling ignores setDrawCount
+     */
+    void setCulling(Culling culling);
+
+    /** one frame: waits only if the frame slot is still in flight */
+    void drawFrame(const buffer2::UniformBufferObject& ubo);
+
+    void waitIdle();
+    void cleanup();
+
+    VkExtent2D getExtent() const;
+    VkSampleCountFlagBits getSampleCount() const;
+    VkFormat getColorFormat() const;
+    VkImage getResolveImage() const;
+    VkCommandPool getCommandPool() const;
+    uint32_t getCurrentFrame() const;
+    /** CPU time of the command recording of the last drawFrame */
+    double getLastRecordMs() const;
+    /** "main pass" and its "mesh" draws, read back MAX_FRAMES_IN_FLIGHT frames late */
+    const gpustats::Recorder& getGpuStats() const;
+    /** the draws and culled instances of a frame, MAX_FRAMES_IN_FLIGHT frames late, while culling */
+    const occlusion::Stats& getCullingStats() const;
+    geometrypool::Stats getGeometryStats() const;
+
+private:
+    void createTarget();
+    void createPipeline(const char* vertFile, const char* fragFile);
+    void createTexture();
+    void createFrameResources();
+    void createInstanceResources();
+    void destroyInstanceResources();
+    void uploadTexture(const unsigned char* pixels, uint32_t size);
+    void destroyTextures();
+    void destroyMeshes();
+    void recordCommandBuffer(VkCommandBuffer commandBuffer);
+    /** the render pass and its draws, indirect when culled */
+    void recordPass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, const char* passName, bool culled,
+        occlusion::Phase phase);
+    /** MultiDrawIndirect: one draw per texture, of the static commands or of the ones of the culler */
+    void recordIndirectDraws(VkCommandBuffer commandBuffer, bool culled, occlusion::Phase phase);
+    void updateCullObjects();
+    /** the static draw commands of MultiDrawIndirect, after the meshes or the instances changed */
+    void updateIndirectDraws();
+    void updateUniformBuffer(const buffer2::UniformBufferObject& ubo);
+
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex_ = 0;
+
+    VkExtent2D extent_{};
+    VkSampleCountFlagBits sampleCount_ = VK_SAMPLE_COUNT_1_BIT;
+    VkFormat colorFormat_ = VK_FORMAT_R8G8B8A8_UNORM;
+    VkFormat depthFormat_ = VK_FORMAT_UNDEFINED;
+    /** SAMPLED usage on the depth image: occlusion culling is possible */
+    bool depthSampleable_ = false;
+
+    VkImage colorImage_ = VK_NULL_HANDLE;
+    VkDeviceMemory colorImageMemory_ = VK_NULL_HANDLE;
+    VkImageView colorImageView_ = VK_NULL_HANDLE;
+    VkImage depthImage_ = VK_NULL_HANDLE;
+    VkDeviceMemory depthImageMemory_ = VK_NULL_HANDLE;
+    VkImageView depthImageView_ = VK_NULL_HANDLE;
+    VkImage resolveImage_ = VK_NULL_HANDLE;
+    VkDeviceMemory resolveImageMemory_ = VK_NULL_HANDLE;
+    VkImageView resolveImageView_ = VK_NULL_HANDLE;
+
+    VkRenderPass renderPass_ = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers_;
+    VkDescriptorSetLayout descriptorSetLayout_ = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout_ = VK_NULL_HANDLE;
+    VkPipeline graphicsPipeline_ = VK_NULL_HANDLE;
+
+    VkCommandPool commandPool_ = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers_;
+    std::vector<VkFence> inFlightFences_;
+    uint32_t currentFrame_ = 0;
+    gpustats::Recorder gpuStats_;
+
+    sampler::SamplerCache samplerCache_;
+    struct Texture {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+    };
+    std::vector<Texture> textures_;
+    VkSampler textureSampler_ = VK_NULL_HANDLE;
+
+    /** one identity instance with the first texture until a scene is uploaded, sorted by texture */
+    std::vector<scene::Instance> instances_;
+    /** the instances of texture t are [textureFirstInstance_[t], textureFirstInstance_[t + 1]) */
+    std::vector<uint32_t> textureFirstInstance_;
+    /** sizeof(UniformBufferObject) aligned to minUniformBufferOffsetAlignment */
+    VkDeviceSize uniformStride_ = 0;
+    /** a slot per instance then the ubo of the frame (MultiDrawIndirect), per frame slot */
+    std::vector<VkBuffer> uniformBuffers_;
+    std::vector<VkDeviceMemory> uniformBuffersMemory_;
+    std::vector<void*> uniformBuffersMapped_;
+    mapped::FlushBatcher uniformFlush_;
+
+    descriptor::Binder descriptorBinder_;
+    VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
+    /** frame slot major: descriptorSets_[frame * instance count + instance] */
+    std::vector<VkDescriptorSet> descriptorSets_;
+
+    geometrypool::Pool geometry_;
+    /** the meshes of the last upload, the meshIndex of the instances */
+    std::vector<geometrypool::Mesh> meshes_;
+    /** their bounding spheres, the instances are the objects of the culler */
+    std::vector<glm::vec4> meshSpheres_;
+    uint32_t drawCount_ = 1;
+    double lastRecordMs_ = 0.0;
+
+    Culling culling_ = NoCulling;
+    occlusion::Culler culler_;
+    /** compatible with renderPass_: clears and stores the depth / loads color and depth */
+    VkRenderPass earlyRenderPass_ = VK_NULL_HANDLE;
+    VkRenderPass lateRenderPass_ = VK_NULL_HANDLE;
+    std::vector<occlusion::Object> cullObjects_;
+    /** proj * view * model of the frame being recorded */
+    glm::mat4 cullMatrix_{1.0f};
+
+    Submission submission_ = DrawPerInstance;
+    /** the draws per vkCmdDrawIndexedIndirect: 1 without the multiDrawIndirect feature */
+    uint32_t maxDrawIndirectCount_ = 1;
+    bool drawIndirectFirstInstance_ = false;
+    /** ubo, texture, models: compute::createDescriptorSetLayout with the graphics stages */
+    VkDescriptorSetLayout indirectSetLayout_ = VK_NULL_HANDLE;
+    VkPipelineLayout indirectPipelineLayout_ = VK_NULL_HANDLE;
+    VkPipeline indirectPipeline_ = VK_NULL_HANDLE;
+    VkDescriptorPool indirectDescriptorPool_ = VK_NULL_HANDLE;
+    /** frame slot major: indirectDescriptorSets_[frame * texture count + texture] */
+    std::vector<VkDescriptorSet> indirectDescriptorSets_;
+    /** the model of each instance, in the order of instances_ */
+    VkBuffer instanceBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory instanceBufferMemory_ = VK_NULL_HANDLE;
+    /** a VkDrawIndexedIndirectCommand per instance, firstInstance its index */
+    VkBuffer drawBuffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory drawBufferMemory_ = VK_NULL_HANDLE;
+};
+
+}
@@ -0,0 +1,471 @@
+/**
+ * Performance regression suite: the CPU hot paths and headless GPU scenarios, each
+ * measured --repeats times, written as JSON and compared against a baseline.
+ *
+ * CPU:
+ * * obj_load_ms: model::loadObj of the viking room
+ * * vertex_dedup_ms: model::deduplicateVertices of its vertices
+ * * ubo_update_ns: the matrices of a UniformBufferObject and the copy to mapped memory
+ * GPU (headless::Device, lavapipe is fine), skipped with --gpu 0:
+ * * record_us_<N>_objects, frames_per_s_<N>_objects: offscreen::Renderer drawing the
+ *   viking room N times (setDrawCount), command recording time and frame rate
+ * * mip_generation_ms: texture3::generateMipmaps (blit chain) of a 2048x2048 RGBA8 texture
+ * * upload_mb_per_s: memcpy to the staging buffer, flush, then buffer2::copyBuffer to a GpuOnly buffer
+ *
+ * Each metric keeps its median and its MAD (median absolute deviation, scaled to a
+ * standard deviation). Against the baseline, a metric regresses if its median is worse by
+ * more than --tolerance-pct percent of the baseline median AND by more than --sigmas times
+ * the combined deviation of both runs: a noisy metric needs a bigger change to fail.
+ * The suite exits with a failure if any metric regressed.
+ *
+ * The baseline is the output of a previous run on the reference machine: run with
+ * --update-baseline 1 there and commit it. Only the metrics with the same name are
+ * compared (the object count is in the name). Without a baseline, or with none of the
+ * metrics in it, the suite fails: a regression check that compares nothing must not pass.
+ * The committed perf_baseline.json only holds obj_load_ms and vertex_dedup_ms, measured on a
+ * single core Intel Xeon VM (10 repeats, -g like the build tasks) without a Vulkan SDK:
+ * update it with the GPU metrics on the first machine which has one.
+ *
+ * usage: perf_bench [--repeats R] [--objects N] [--frames F] [--upload-mb M] [--gpu 0|1]
+ *                   [--tolerance-pct P] [--sigmas S] [--output file] [--baseline file]
+ *                   [--update-baseline 0|1]
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "model.hpp"
+#include "headless.hpp"
+#include "offscreen.hpp"
+#include "buffer2.hpp"
+#include "texture3.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+
+const auto MODEL_PATH = "models/viking_room.obj";
+const uint32_t MIP_TEXTURE_SIZE = 2048;
+const uint32_t UBO_UPDATE_COUNT = 100000;
+
+struct BenchOptions {
+    uint32_t repeatCount = 10;
+    uint32_t objectCount = 256;
+    uint32_t frameCount = 200;
+    uint32_t uploadMB = 64;
+    bool gpu = true;
+    double tolerancePct = 10.0;
+    double sigmas = 3.0;
+    std::string outputPath = "perf_results.json";
+    std::string baselinePath = "perf_baseline.json";
+    bool updateBaseline = false;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string text = argv[i + 1];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(text.c_str(), nullptr, 10));
+        if (name == "--repeats") {
+            options.repeatCount = std::max(value, 1u);
+        } else if (name == "--objects") {
+            options.objectCount = std::max(value, 1u);
+        } else if (name == "--frames") {
+            options.frameCount = std::max(value, 1u);
+        } else if (name == "--upload-mb") {
+            options.uploadMB = std::max(value, 1u);
+        } else if (name == "--gpu") {
+            options.gpu = value != 0;
+        } else if (name == "--tolerance-pct") {
+            options.tolerancePct = std::strtod(text.c_str(), nullptr);
+        } else if (name == "--sigmas") {
+            options.sigmas = std::strtod(text.c_str(), nullptr);
+        } else if (name == "--output") {
+            options.outputPath = text;
+        } else if (name == "--baseline") {
+            options.baselinePath = text;
+        } else if (name == "--update-baseline") {
+            options.updateBaseline = value != 0;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+struct Metric {
+    std::string name;
+    std::string unit;
+    bool higherIsBetter = false;
+    std::vector<double> samples;
+    double median = 0.0;
+    double deviation = 0.0;
+};
+
+static double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    double upper = values[middle];
+    if (values.size() % 2 == 1) {
+        return upper;
+    }
+    double lower = *std::max_element(values.begin(), values.begin() + middle);
+    return (lower + upper) / 2.0;
+}
+
+/** median and MAD * 1.4826, the standard deviation of a normal distribution with that MAD */
+static void summarize(Metric& metric) {
+    metric.median = median(metric.samples);
+    std::vector<double> deviations;
+    for (double sample : metric.samples) {
+        deviations.push_back(std::fabs(sample - metric.median));
+    }
+    metric.deviation = 1.4826 * median(deviations);
+}
+
+/** runs sample repeatCount times, sample returns one measurement */
+template <class Sample>
+static Metric measure(const char* name, const char* unit, bool higherIsBetter, uint32_t repeatCount, Sample sample) {
+    Metric metric;
+    metric.name = name;
+    metric.unit = unit;
+    metric.higherIsBetter = higherIsBetter;
+    for (uint32_t i = 0; i < repeatCount; i++) {
+        metric.samples.push_back(sample());
+    }
+    summarize(metric);
+    std::cout << "  " << metric.name << ": " << metric.median << " " << metric.unit
+        << " (+- " << metric.deviation << ")\n";
+    return metric;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static buffer2::UniformBufferObject makeUniforms(uint32_t frame, VkExtent2D extent) {
+    buffer2::UniformBufferObject ubo{};
+    // same transforms as hello_model_1::updateUniformBuffer
+    ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.5f, -3.0f));
+    ubo.model = glm::rotate(ubo.model, frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.model = glm::rotate(ubo.model, glm::radians(90.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.5f, -3.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), extent.width / static_cast<float>(extent.height), 0.1f, 100.0f);
+    ubo.proj[1][1] *= -1;
+    return ubo;
+}
+
+static void measureCpu(const BenchOptions& options, std::vector<Metric>& metrics) {
+    std::cout << "cpu\n";
+    std::vector<vertex3::Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    metrics.push_back(measure("obj_load_ms", "ms", false, options.repeatCount, [&]() {
+        vertices.clear();
+        indices.clear();
+        auto start = std::chrono::steady_clock::now();
+        model::loadObj(MODEL_PATH, vertices, indices);
+        return elapsedMs(start);
+    }));
+
+    metrics.push_back(measure("vertex_dedup_ms", "ms", false, options.repeatCount, [&]() {
+        std::vector<vertex3::Vertex> dedupVertices = vertices;
+        std::vector<uint32_t> dedupIndices = indices;
+        auto start = std::chrono::steady_clock::now();
+        model::deduplicateVertices(dedupVertices, dedupIndices);
+        return elapsedMs(start);
+    }));
+
+    // a few slots like per frame uniforms, so that the copies are not all to the same lines
+    std::vector<buffer2::UniformBufferObject> mapped(offscreen::MAX_FRAMES_IN_FLIGHT);
+    metrics.push_back(measure("ubo_update_ns", "ns", false, options.repeatCount, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < UBO_UPDATE_COUNT; i++) {
+            buffer2::UniformBufferObject ubo = makeUniforms(i, {800, 600});
+            memcpy(&mapped[i % mapped.size()], &ubo, sizeof(ubo));
+        }
+        return elapsedMs(start) * 1e6 / UBO_UPDATE_COUNT;
+    }));
+    // the copies must not be optimized away
+    if (mapped[0].proj[1][1] == 0.0f) {
+        throw std::runtime_error("ubo update check failed: empty projection");
+    }
+}
+
+static void measureFrames(const headless::Device& headless, const BenchOptions& options, std::vector<Metric>& metrics) {
+    offscreen::Renderer renderer;
+    renderer.init(headless, {800, 600});
+
+    std::vector<vertex3::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    model::loadObj(MODEL_PATH, vertices, indices);
+    model::deduplicateVertices(vertices, indices);
+    renderer.uploadMesh(vertices, indices);
+    renderer.setDrawCount(options.objectCount);
+
+    // warm: pipelines, first command buffer allocations
+    for (uint32_t frame = 0; frame < 2 * offscreen::MAX_FRAMES_IN_FLIGHT; frame++) {
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent()));
+    }
+    renderer.waitIdle();
+
+    std::string objects = std::to_string(options.objectCount) + "_objects";
+    Metric record;
+    record.name = "record_us_" + objects;
+    record.unit = "us";
+    Metric frames = measure(("frames_per_s_" + objects).c_str(), "frames/s", true, options.repeatCount, [&]() {
+        double recordMs = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < options.frameCount; frame++) {
+            renderer.drawFrame(makeUniforms(frame, renderer.getExtent()));
+            recordMs += renderer.getLastRecordMs();
+        }
+        renderer.waitIdle();
+        record.samples.push_back(recordMs * 1000.0 / options.frameCount);
+        return options.frameCount / (elapsedMs(start) / 1000.0);
+    });
+    summarize(record);
+    std::cout << "  " << record.name << ": " << record.median << " us (+- " << record.deviation << ")\n";
+    metrics.push_back(record);
+    metrics.push_back(frames);
+
+    renderer.cleanup();
+}
+
+static void measureMipGeneration(const headless::Device& headless, const BenchOptions& options, std::vector<Metric>& metrics) {
+    VkDevice device = headless.device_;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(MIP_TEXTURE_SIZE))) + 1;
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory imageMemory = VK_NULL_HANDLE;
+    texture3::bindImageMemory(headless.physicalDevice_, device, MIP_TEXTURE_SIZE, MIP_TEXTURE_SIZE, mipLevels,
+        VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        memory::GpuOnly, image, imageMemory);
+
+    std::cout << "gpu\n";
+    metrics.push_back(measure("mip_generation_ms", "ms", false, options.repeatCount, [&]() {
+        // the level 0 content doesn't matter for the blits: UNDEFINED discards it
+        texture3::transitionImageLayout(device, commandPool, headless.queue_, image, VK_FORMAT_R8G8B8A8_SRGB,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        auto start = std::chrono::steady_clock::now();
+        // waits for the queue to be idle
+        texture3::generateMipmaps(headless.physicalDevice_, device, commandPool, headless.queue_, image,
+            VK_FORMAT_R8G8B8A8_SRGB, MIP_TEXTURE_SIZE, MIP_TEXTURE_SIZE, mipLevels, 1);
+        return elapsedMs(start);
+    }));
+
+    vkDestroyImage(device, image, nullptr);
+    memory::freeMemory(device, imageMemory);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+static void measureUpload(const headless::Device& headless, const BenchOptions& options, std::vector<Metric>& metrics) {
+    VkDevice device = headless.device_;
+    VkDeviceSize size = static_cast<VkDeviceSize>(options.uploadMB) * 1024 * 1024;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    buffer2::StagingBuffer staging;
+    buffer2::reserveStagingBuffer(headless.physicalDevice_, device, size, staging);
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+    buffer2::bindBuffer(headless.physicalDevice_, device, size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, memory::GpuOnly, buffer, bufferMemory);
+
+    std::vector<unsigned char> source(size);
+    for (size_t i = 0; i < source.size(); i++) {
+        source[i] = static_cast<unsigned char>(i * 31);
+    }
+
+    metrics.push_back(measure("upload_mb_per_s", "MB/s", true, options.repeatCount, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        memcpy(staging.mapped, source.data(), source.size());
+        mapped::flush(device, staging.memory, 0, size);
+        buffer2::copyBuffer(device, commandPool, headless.queue_, staging.buffer, buffer, size);
+        return options.uploadMB / (elapsedMs(start) / 1000.0);
+    }));
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    memory::freeMemory(device, bufferMemory);
+    buffer2::destroyStagingBuffer(device, staging);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+static std::string toJson(const std::string& device, const std::vector<Metric>& metrics) {
+    std::ostringstream json;
+    json.precision(9);
+    json << "{\n  \"device\": \"" << device << "\",\n  \"metrics\": [\n";
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const Metric& metric = metrics[i];
+        json << "    {\"name\": \"" << metric.name << "\", \"unit\": \"" << metric.unit << "\""
+            << ", \"higherIsBetter\": " << (metric.higherIsBetter ? "true" : "false")
+            << ", \"median\": " << metric.median
+            << ", \"deviation\": " << metric.deviation
+            << ", \"samples\": [";
+        for (size_t j = 0; j < metric.samples.size(); j++) {
+            json << (j ? ", " : "") << metric.samples[j];
+        }
+        json << "]}" << (i + 1 < metrics.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+    return json.str();
+}
+
+/** the number after "key": in text, from position */
+static double readNumber(const std::string& text, size_t position, const char* key) {
+    size_t found = text.find(std::string("\"") + key + "\": ", position);
+    if (found == std::string::npos) {
+        throw std::runtime_error(std::string("baseline: no ") + key + " after offset " + std::to_string(position));
+    }
+    return std::strtod(text.c_str() + found + strlen(key) + 4, nullptr);
+}
+
+/**
+ * only what toJson writes: one object per metric, name first, so a plain scan
+ * for the keys is enough. Returns false if there is no baseline file
+ */
+static bool readBaseline(const std::string& path, std::vector<Metric>& baseline) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    std::string text = content.str();
+
+    const std::string NAME_KEY = "{\"name\": \"";
+    for (size_t position = text.find(NAME_KEY); position != std::string::npos; position = text.find(NAME_KEY, position)) {
+        position += NAME_KEY.size();
+        Metric metric;
+        metric.name = text.substr(position, text.find('"', position) - position);
+        metric.higherIsBetter = text.compare(text.find("\"higherIsBetter\": ", position) + 18, 4, "true") == 0;
+        metric.median = readNumber(text, position, "median");
+        metric.deviation = readNumber(text, position, "deviation");
+        baseline.push_back(metric);
+    }
+    return true;
+}
+
+/** returns the number of regressions */
+static uint32_t compare(const std::vector<Metric>& baseline, const std::vector<Metric>& metrics, const BenchOptions& options) {
+    uint32_t regressionCount = 0;
+    uint32_t comparedCount = 0;
+    std::cout << "against the baseline (worse by more than " << options.tolerancePct << "% and "
+        << options.sigmas << " deviations fails):\n";
+    for (const Metric& metric : metrics) {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&metric](const Metric& m) { return m.name == metric.name; });
+        if (base == baseline.end()) {
+            std::cout << "  " << metric.name << ": not in the baseline\n";
+            continue;
+        }
+        comparedCount++;
+        // positive when worse, whatever the direction of the metric
+        double worse = metric.higherIsBetter ? base->median - metric.median : metric.median - base->median;
+        double noise = options.sigmas * std::sqrt(base->deviation * base->deviation + metric.deviation * metric.deviation);
+        double threshold = std::max(options.tolerancePct / 100.0 * std::fabs(base->median), noise);
+        double changePct = base->median != 0.0 ? 100.0 * (metric.median - base->median) / base->median : 0.0;
+
+        const char* verdict = "ok";
+        if (worse > threshold) {
+            verdict = "REGRESSION";
+            regressionCount++;
+        } else if (-worse > threshold) {
+            verdict = "improved";
+        }
+        std::cout << "  " << metric.name << ": " << base->median << " -> " << metric.median << " " << metric.unit
+            << " (" << (changePct >= 0.0 ? "+" : "") << changePct << "%, threshold " << threshold << ") " << verdict << '\n';
+    }
+    if (comparedCount == 0) {
+        throw std::runtime_error("no metric of this run is in " + options.baselinePath
+            + " (other --objects?), --update-baseline 1 to replace it");
+    }
+    return regressionCount;
+}
+
+static void run(const BenchOptions& options) {
+    std::vector<Metric> metrics;
+    std::string deviceName = "cpu only";
+
+    measureCpu(options, metrics);
+
+    if (options.gpu) {
+        headless::Device headless;
+        headless.init("Perf bench");
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+        deviceName = properties.deviceName;
+        std::cout << "device: " << deviceName << '\n';
+
+        measureMipGeneration(headless, options, metrics);
+        measureUpload(headless, options, metrics);
+        measureFrames(headless, options, metrics);
+
+        headless.cleanup();
+    }
+
+    std::string json = toJson(deviceName, metrics);
+    std::ofstream(options.outputPath) << json;
+    std::cout << "results written to " << options.outputPath << '\n';
+
+    if (options.updateBaseline) {
+        std::ofstream(options.baselinePath) << json;
+        std::cout << "baseline " << options.baselinePath << " updated, commit it\n";
+        return;
+    }
+
+    std::vector<Metric> baseline;
+    if (!readBaseline(options.baselinePath, baseline)) {
+        throw std::runtime_error("no baseline " + options.baselinePath
+            + ", run with --update-baseline 1 on the reference machine and commit it");
+    }
+    uint32_t regressionCount = compare(baseline, metrics, options);
+    if (regressionCount > 0) {
+        throw std::runtime_error(std::to_string(regressionCount) + " metrics regressed against " + options.baselinePath);
+    }
+    std::cout << "no regression\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
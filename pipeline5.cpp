@@ -2,11 +2,14 @@
 #include <fstream>
 
 #include "pipeline5.hpp"
+#include "profiler.hpp"
+#include "hitch.hpp"
 #include "vertex3.hpp"
 
 namespace pipeline5 {
 
-static std::vector<char> readFile(const std::string& filename) {
+std::vector<char> readFile(const std::string& filename) {
+    PROFILE_SCOPE("pipeline5::readFile");
     // start reading at the end of the file and no text transformations
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -33,6 +36,7 @@ static std::vector<char> readFile(const std::string& filename) {
 }
 
 VkShaderModule createShaderModule(const std::vector<char>& code, VkDevice logical_device) {
+    PROFILE_SCOPE("pipeline5::createShaderModule");
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize = code.size();
@@ -52,8 +56,12 @@ void createRenderPass(
     VkFormat swapChainImageFormat,
     VkSampleCountFlagBits msaaSampleCount,
     VkFormat depthFormat,
-    VkRenderPass& renderPass
+    VkRenderPass& renderPass,
+    VkImageLayout resolveFinalLayout,
+    bool loadAttachments,
+    VkAttachmentStoreOp depthStoreOp
 ) {
+    PROFILE_SCOPE("pipeline5::createRenderPass");
     /**
      * In our case we'll have just a single color buffer attachment 
      * represented by one of the images from the swap chain.
@@ -86,6 +94,11 @@ void createRenderPass(
     colorAttachment.samples = msaaSampleCount;
     // multisampled images cannot be presented directly. We first need to resolve them to a regular image
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    if (loadAttachments) {
+        // what the previous pass left
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -100,8 +113,8 @@ void createRenderPass(
     colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    // this one will be presented to the swapchain
-    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // this one will be presented to the swapchain (or copied from when offscreen)
+    colorAttachmentResolve.finalLayout = resolveFinalLayout;
 
     /**
      * The render pass now has to be instructed to resolve multisampled color image
@@ -119,12 +132,18 @@ void createRenderPass(
     // This time we don't care about storing the depth data (storeOp), 
     // because it will not be used after drawing has finished. 
     // This may allow the hardware to perform additional optimizations. 
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // Unless it is read afterwards: the occlusion culling builds its depth pyramid from it.
+    depthAttachment.storeOp = depthStoreOp;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     // we don't care about the previous depth contents,
     depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    if (loadAttachments) {
+        // ... unless we continue drawing into it
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    }
 
     VkAttachmentReference depthAttachmentRef{};
     depthAttachmentRef.attachment = 1;
@@ -173,6 +192,11 @@ void createRenderPass(
     dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    if (loadAttachments) {
+        // the loads read what the previous pass wrote, its depth up to the late tests
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
 
     std::array<VkAttachmentDescription, 3> attachments = {colorAttachment, depthAttachment, colorAttachmentResolve};
     VkRenderPassCreateInfo renderPassInfo{};
@@ -200,9 +224,32 @@ void createGraphicsPipeline(
     VkPipelineLayout& pipelineLayout,
     VkPipeline& graphicsPipeline
 ) {
-    auto vertShaderCode = readFile(vert_file);
-    auto fragShaderCode = readFile(frag_file);
+    createGraphicsPipeline(
+        readFile(vert_file),
+        readFile(frag_file),
+        logical_device,
+        swapChainExtent,
+        msaaSampleCount,
+        renderPass,
+        descriptorSetLayout,
+        pipelineLayout,
+        graphicsPipeline
+    );
+}
 
+void createGraphicsPipeline(
+    const std::vector<char>& vertShaderCode,
+    const std::vector<char>& fragShaderCode,
+    VkDevice logical_device,
+    VkExtent2D swapChainExtent,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkRenderPass renderPass,
+    const VkDescriptorSetLayout& descriptorSetLayout,
+    VkPipelineLayout& pipelineLayout,
+    VkPipeline& graphicsPipeline
+) {
+    PROFILE_SCOPE("pipeline5::createGraphicsPipeline");
+    hitch::ScopedEvent hitchEvent(hitch::COMPILE);
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode, logical_device);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode, logical_device);
 
@@ -1,20 +1,39 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 // Let GLFW include by itslef vulkan headers
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 namespace pipeline5 {
 
-/** the attachments referenced by the pipeline stages and their usage */
+/**
+ * the attachments referenced by the pipeline stages and their usage.
+ * resolveFinalLayout: the layout of the resolved image after the pass, e.g.
+ * VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL for an offscreen target without swapchain
+ * loadAttachments: the color and depth attachments are loaded instead of cleared, for a pass
+ * continuing the drawing of an other one (they must be in their ATTACHMENT_OPTIMAL layout)
+ * depthStoreOp: STORE to read the depth after the pass, e.g. for a depth pyramid (occlusion)
+ */
 void createRenderPass(
     VkDevice logical_device,
     VkFormat swapChainImageFormat,
     VkSampleCountFlagBits msaaSampleCount,
     VkFormat depthFormat,
-    VkRenderPass& renderPass
+    VkRenderPass& renderPass,
+    VkImageLayout resolveFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    bool loadAttachments = false,
+    VkAttachmentStoreOp depthStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE
 );
 
+/** the whole file, e.g. SPIR-V read on another thread before createGraphicsPipeline */
+std::vector<char> readFile(const std::string& filename);
+
+/** can be destroyed as soon as the pipelines using it are created */
+VkShaderModule createShaderModule(const std::vector<char>& code, VkDevice logical_device);
+
 void createGraphicsPipeline(
     const char* vert_file,
     const char* frag_file,
@@ -27,4 +46,17 @@ void createGraphicsPipeline(
     VkPipeline& graphicsPipeline
 );
 
+/** same, with the SPIR-V code already read */
+void createGraphicsPipeline(
+    const std::vector<char>& vertShaderCode,
+    const std::vector<char>& fragShaderCode,
+    VkDevice logical_device,
+    VkExtent2D swapChainExtent,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkRenderPass renderPass,
+    const VkDescriptorSetLayout& descriptorSetLayout,
+    VkPipelineLayout& pipelineLayout,
+    VkPipeline& graphicsPipeline
+);
+
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "profiler.hpp"
+
+namespace profiler {
+
+struct Event {
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    uint32_t thread;
+};
+
+// enough for the startup, a scope left in a hot loop by mistake won't eat the memory
+const size_t MAX_EVENT_COUNT = 1 << 20;
+
+static std::mutex mutex;
+static std::vector<Event> events;
+static size_t droppedCount = 0;
+// the first event is the origin of the trace
+static std::chrono::steady_clock::time_point origin;
+
+static uint32_t getThreadIndex() {
+    static std::atomic<uint32_t> threadCount{0};
+    thread_local uint32_t index = threadCount++;
+    return index;
+}
+
+ScopedTimer::ScopedTimer(const char* name) : name_(name), start_(std::chrono::steady_clock::now()) {}
+
+ScopedTimer::~ScopedTimer() {
+    record(name_, start_, std::chrono::steady_clock::now());
+}
+
+void record(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    uint32_t thread = getThreadIndex();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= MAX_EVENT_COUNT) {
+        droppedCount++;
+        return;
+    }
+    if (events.empty() || start < origin) {
+        origin = start;
+    }
+    events.push_back(Event{name, start, end, thread});
+}
+
+static double toUs(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+static std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeChromeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for (size_t i = 0; i < events.size(); i++) {
+        const auto& event = events[i];
+        file << "{\"name\": \"" << escapeJson(event.name) << "\", \"cat\": \"startup\", \"ph\": \"X\""
+            << ", \"ts\": " << toUs(event.start - origin)
+            << ", \"dur\": " << toUs(event.end - event.start)
+            << ", \"pid\": 1, \"tid\": " << event.thread << "}"
+            << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+}
+
+void printSummary() {
+    struct Total {
+        uint32_t count = 0;
+        double totalMs = 0.0;
+        double maxMs = 0.0;
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::map<std::string, Total> totals;
+    for (const auto& event : events) {
+        double ms = toUs(event.end - event.start) / 1000.0;
+        Total& total = totals[event.name];
+        total.count++;
+        total.totalMs += ms;
+        total.maxMs = std::max(total.maxMs, ms);
+    }
+
+    std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.totalMs > b.second.totalMs;
+    });
+
+    // scopes nest: the totals overlap, they don't add up to the startup time
+    std::cout << std::fixed << std::setprecision(2)
+        << "profile (" << events.size() << " scopes, nested ones counted in their parents too)\n"
+        << "    total ms  count      avg ms      max ms  scope\n";
+    for (const auto& entry : sorted) {
+        const Total& total = entry.second;
+        std::cout << std::setw(12) << total.totalMs
+            << std::setw(7) << total.count
+            << std::setw(12) << total.totalMs / total.count
+            << std::setw(12) << total.maxMs
+            << "  " << entry.first << '\n';
+    }
+    if (droppedCount > 0) {
+        std::cout << droppedCount << " scopes dropped, more than " << MAX_EVENT_COUNT << " recorded\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+void dump(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.empty()) {
+            return;
+        }
+    }
+
+    writeChromeTrace(path);
+    printSummary();
+    std::cout << "trace written to " << path << '\n';
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace profiler {
+
+/**
+ * Scoped timers for the startup (and whatever else gets a PROFILE_SCOPE):
+ * each scope is recorded with its thread, dump writes them as a Chrome trace
+ * (chrome://tracing or https://ui.perfetto.dev) and prints a summary sorted by total time.
+ *
+ * Compiled in only with -DPROFILER_ENABLED (the .vscode "with profiler" build task): without it
+ * the macros expand to nothing, not even a clock read.
+ * Recording takes a mutex: fine for the startup steps, not for a per draw scope
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+void record(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+/** {"traceEvents": [...]} with one complete ("X") event per scope */
+void writeChromeTrace(const std::string& path);
+
+/** per name: count, total, average and max, the biggest total first */
+void printSummary();
+
+/** writeChromeTrace then printSummary, nothing if nothing was recorded (profiler compiled out) */
+void dump(const std::string& path);
+
+}
+
+#ifdef PROFILER_ENABLED
+    #define PROFILE_CONCAT_INNER(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+    #define PROFILE_SCOPE(name) profiler::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+    #define PROFILE_SCOPE(name) ((void) 0)
+#endif
@@ -0,0 +1,381 @@
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "readback.hpp"
+#include "buffer2.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
+
+namespace readback {
+
+// the largest stored deflate block
+const size_t MAX_STORED_BLOCK_SIZE = 65535;
+
+static std::array<uint32_t, 256> makeCrcTable() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char* bytes, size_t size) {
+    static const std::array<uint32_t, 256> table = makeCrcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+    out.insert(out.end(), {
+        static_cast<unsigned char>(value >> 24),
+        static_cast<unsigned char>(value >> 16),
+        static_cast<unsigned char>(value >> 8),
+        static_cast<unsigned char>(value)
+    });
+}
+
+/** length, type, data, CRC of type and data */
+static void appendChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+    appendBigEndian(out, static_cast<uint32_t>(data.size()));
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    appendBigEndian(out, crc32(0, &out[typeStart], out.size() - typeStart));
+}
+
+void writePng(const std::string& path, uint32_t width, uint32_t height, const unsigned char* pixels) {
+    // each row starts with its filter type, 0: none
+    size_t rowSize = static_cast<size_t>(width) * 4;
+    std::vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * rowSize, pixels + (y + 1) * rowSize);
+    }
+
+    // zlib header (deflate, 32K window, no preset dictionary), stored blocks, Adler-32
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / MAX_STORED_BLOCK_SIZE * 5 + 16);
+    size_t offset = 0;
+    do {
+        size_t blockSize = std::min(raw.size() - offset, MAX_STORED_BLOCK_SIZE);
+        bool last = offset + blockSize == raw.size();
+        uint16_t length = static_cast<uint16_t>(blockSize);
+        uint16_t complement = static_cast<uint16_t>(~length);
+        // BFINAL and BTYPE 00, then LEN and NLEN little endian
+        zlib.insert(zlib.end(), {
+            static_cast<unsigned char>(last ? 1 : 0),
+            static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+            static_cast<unsigned char>(complement), static_cast<unsigned char>(complement >> 8)
+        });
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < raw.size());
+
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    // 8 bits, RGBA, deflate, no filter method extension, no interlace
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+
+    std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+    if (!file) {
+        throw std::runtime_error("failed to write " + path + "!");
+    }
+}
+
+void Ring::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkQueue queue,
+    uint32_t queueFamilyIndex,
+    VkExtent2D extent,
+    VkFormat format,
+    const std::string& directory,
+    uint32_t slotCount
+) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            swapRedBlue_ = false;
+            break;
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            swapRedBlue_ = true;
+            break;
+        default:
+            throw std::invalid_argument("readback of a format which isn't RGBA8 or BGRA8!");
+    }
+
+    logicalDevice_ = logicalDevice;
+    queue_ = queue;
+    extent_ = extent;
+    directory_ = directory;
+    stats_ = Stats{};
+    stopping_ = false;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    if (vkCreateCommandPool(logicalDevice_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    slots_.resize(std::max(slotCount, 1u));
+    VkDeviceSize size = static_cast<VkDeviceSize>(extent_.width) * extent_.height * 4;
+    for (auto& slot : slots_) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool_;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(logicalDevice_, &allocInfo, &slot.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(logicalDevice_, &fenceInfo, nullptr, &slot.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create fence!");
+        }
+
+        // HOST_CACHED when there is some: the encoder reads every byte
+        buffer2::bindBuffer(physicalDevice, logicalDevice_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            memory::Readback, slot.buffer, slot.memory);
+        vkMapMemory(logicalDevice_, slot.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped);
+    }
+
+    pending_.clear();
+    pending_.reserve(slots_.size());
+    encoder_ = std::thread(&Ring::encode, this);
+}
+
+bool Ring::capture(VkImage image, uint64_t frameIndex) {
+    PROFILE_SCOPE("readback::capture");
+    Slot* slot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& candidate : slots_) {
+            if (candidate.state == FREE) {
+                slot = &candidate;
+                break;
+            }
+        }
+        if (slot == nullptr) {
+            stats_.dropped++;
+            return false;
+        }
+        slot->state = COPYING;
+        slot->frameIndex = frameIndex;
+        stats_.captured++;
+    }
+
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    table.vkResetCommandBuffer(slot->commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (table.vkBeginCommandBuffer(slot->commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+    }
+
+    // after the color attachment writes of the frame, including the final layout transition
+    // of its render pass (the implicit dependency at the end of a pass waits for all commands)
+    VkMemoryBarrier renderedBarrier{};
+    renderedBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    renderedBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    renderedBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    table.vkCmdPipelineBarrier(slot->commandBuffer,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        1, &renderedBarrier, 0, nullptr, 0, nullptr);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    // tightly packed
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {extent_.width, extent_.height, 1};
+    table.vkCmdCopyImageToBuffer(slot->commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        slot->buffer, 1, &region);
+
+    // the copy visible to the host, and done reading before the next frames write the image
+    VkMemoryBarrier copiedBarrier{};
+    copiedBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    copiedBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    copiedBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    table.vkCmdPipelineBarrier(slot->commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        1, &copiedBarrier, 0, nullptr, 0, nullptr);
+
+    if (table.vkEndCommandBuffer(slot->commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot->commandBuffer;
+    if (table.vkQueueSubmit(queue_, 1, &submitInfo, slot->fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit readback command buffer!");
+    }
+    return true;
+}
+
+void Ring::poll() {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (uint32_t i = 0; i < slots_.size(); i++) {
+            Slot& slot = slots_[i];
+            if (slot.state != COPYING || table.vkGetFenceStatus(logicalDevice_, slot.fence) != VK_SUCCESS) {
+                continue;
+            }
+            table.vkResetFences(logicalDevice_, 1, &slot.fence);
+            slot.state = ENCODING;
+            // never grows: a slot is queued at most once
+            pending_.push_back(i);
+            queued = true;
+        }
+    }
+    if (queued) {
+        queued_.notify_one();
+    }
+}
+
+void Ring::flush() {
+    std::vector<VkFence> fences;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& slot : slots_) {
+            if (slot.state == COPYING) {
+                fences.push_back(slot.fence);
+            }
+        }
+    }
+    if (!fences.empty()) {
+        vkWaitForFences(logicalDevice_, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX);
+    }
+    poll();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    encoded_.wait(lock, [this] {
+        return std::all_of(slots_.begin(), slots_.end(), [](const Slot& slot) { return slot.state == FREE; });
+    });
+}
+
+void Ring::encode() {
+    std::vector<unsigned char> pixels;
+    while (true) {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            index = pending_.front();
+            pending_.erase(pending_.begin());
+        }
+
+        // the slot is ENCODING: nobody else touches it
+        const Slot& slot = slots_[index];
+        size_t size = static_cast<size_t>(extent_.width) * extent_.height * 4;
+        bool written = true;
+        try {
+            mapped::invalidate(logicalDevice_, slot.memory, 0, size);
+            const unsigned char* rgba = static_cast<const unsigned char*>(slot.mapped);
+            if (swapRedBlue_) {
+                pixels.assign(rgba, rgba + size);
+                for (size_t i = 0; i < size; i += 4) {
+                    std::swap(pixels[i], pixels[i + 2]);
+                }
+                rgba = pixels.data();
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "frame_%06llu.png", static_cast<unsigned long long>(slot.frameIndex));
+            writePng(directory_ + "/" + name, extent_.width, extent_.height, rgba);
+        } catch (const std::exception& e) {
+            std::cerr << "readback: " << e.what() << std::endl;
+            written = false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_[index].state = FREE;
+            if (written) {
+                stats_.written++;
+            } else {
+                stats_.failed++;
+            }
+        }
+        encoded_.notify_all();
+    }
+}
+
+Stats Ring::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void Ring::destroy() {
+    if (logicalDevice_ == VK_NULL_HANDLE) {
+        return;
+    }
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queued_.notify_one();
+    encoder_.join();
+
+    for (auto& slot : slots_) {
+        vkDestroyFence(logicalDevice_, slot.fence, nullptr);
+        vkDestroyBuffer(logicalDevice_, slot.buffer, nullptr);
+        memory::freeMemory(logicalDevice_, slot.memory);
+    }
+    slots_.clear();
+    vkDestroyCommandPool(logicalDevice_, commandPool_, nullptr);
+    commandPool_ = VK_NULL_HANDLE;
+    logicalDevice_ = VK_NULL_HANDLE;
+}
+
+}
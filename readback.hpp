@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace readback {
+
+/**
+ * PNG file of width x height RGBA8 pixels, rows tightly packed, top row first.
+ * The zlib stream uses stored (uncompressed) deflate blocks: no dependency, and the
+ * encoding is only a CRC and an Adler-32 over the bytes. The files are as big as the pixels.
+ * Throws if the file can't be written
+ */
+void writePng(const std::string& path, uint32_t width, uint32_t height, const unsigned char* pixels);
+
+struct Stats {
+    /** copies submitted */
+    uint64_t captured = 0;
+    /** capture found no free slot: the frame was skipped rather than waited for */
+    uint64_t dropped = 0;
+    uint64_t written = 0;
+    uint64_t failed = 0;
+};
+
+/**
+ * Screenshots and frame dumps without stalling the frame loop.
+ *
+ * capture records the copy of the image into a slot of a ring of HOST_CACHED buffers
+ * (memory::Readback) and submits it with the slot fence, right after the frame which
+ * rendered the image. poll, once a frame, only checks the fences (vkGetFenceStatus):
+ * the finished slots go to a background thread which invalidates, converts to RGBA
+ * and writes frame_<index>.png in the directory, then gives the slot back.
+ * Nothing waits on the frame thread: when the GPU or the disk is too slow, all the
+ * slots are busy and capture drops the frame (counted in Stats::dropped).
+ *
+ * The image must be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, last written as a color
+ * attachment by a submission made earlier on the same queue (offscreen::Renderer's
+ * resolve image). The copy is ordered before the color attachment writes of the next
+ * submissions, the next frame can render into the image right away.
+ * capture and poll are called on the thread which submits to the queue
+ */
+class Ring {
+public:
+    /** format: RGBA8 or BGRA8, UNORM or SRGB (the bytes are written as they are) */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        VkQueue queue,
+        uint32_t queueFamilyIndex,
+        VkExtent2D extent,
+        VkFormat format,
+        const std::string& directory,
+        uint32_t slotCount = 3
+    );
+
+    /** returns false if the frame was dropped */
+    bool capture(VkImage image, uint64_t frameIndex);
+
+    /** non blocking: hands the finished copies to the encoding thread */
+    void poll();
+
+    /** blocks until everything captured is written, not for the frame loop */
+    void flush();
+
+    Stats getStats() const;
+
+    /** flushes first */
+    void destroy();
+
+private:
+    enum State {
+        FREE,
+        COPYING,
+        ENCODING
+    };
+
+    struct Slot {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        uint64_t frameIndex = 0;
+        State state = FREE;
+    };
+
+    void encode();
+
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    VkCommandPool commandPool_ = VK_NULL_HANDLE;
+    VkExtent2D extent_{};
+    bool swapRedBlue_ = false;
+    std::string directory_;
+    std::vector<Slot> slots_;
+
+    // the states, pending_ and the stats are shared with the encoding thread
+    mutable std::mutex mutex_;
+    std::condition_variable queued_;
+    std::condition_variable encoded_;
+    /** slots to encode, oldest first, capacity reserved at init */
+    std::vector<uint32_t> pending_;
+    bool stopping_ = false;
+    Stats stats_;
+    std::thread encoder_;
+};
+
+}
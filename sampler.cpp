@@ -0,0 +1,196 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "sampler.hpp"
+
+namespace sampler {
+
+// FNV-1a, good enough for a handful of small keys
+static void hashCombine(size_t& hash, const void* data, size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+template <class T>
+static void hashField(size_t& hash, const T& field) {
+    hashCombine(hash, &field, sizeof(field));
+}
+
+// -0.0f == 0.0f for operator==, so they must hash the same: + 0.0f turns -0 into +0
+// (NaN never equals itself, acquire rejects it)
+static void hashField(size_t& hash, float field) {
+    float normalized = field + 0.0f;
+    hashCombine(hash, &normalized, sizeof(normalized));
+}
+
+bool SamplerKey::operator==(const SamplerKey& other) const {
+    return magFilter == other.magFilter
+        && minFilter == other.minFilter
+        && mipmapMode == other.mipmapMode
+        && addressModeU == other.addressModeU
+        && addressModeV == other.addressModeV
+        && addressModeW == other.addressModeW
+        && mipLodBias == other.mipLodBias
+        && anisotropyEnable == other.anisotropyEnable
+        && maxAnisotropy == other.maxAnisotropy
+        && compareEnable == other.compareEnable
+        && compareOp == other.compareOp
+        && minLod == other.minLod
+        && maxLod == other.maxLod
+        && borderColor == other.borderColor
+        && unnormalizedCoordinates == other.unnormalizedCoordinates;
+}
+
+size_t SamplerKeyHash::operator()(const SamplerKey& key) const {
+    size_t hash = 14695981039346656037ULL;
+    hashField(hash, key.magFilter);
+    hashField(hash, key.minFilter);
+    hashField(hash, key.mipmapMode);
+    hashField(hash, key.addressModeU);
+    hashField(hash, key.addressModeV);
+    hashField(hash, key.addressModeW);
+    hashField(hash, key.mipLodBias);
+    hashField(hash, key.anisotropyEnable);
+    hashField(hash, key.maxAnisotropy);
+    hashField(hash, key.compareEnable);
+    hashField(hash, key.compareOp);
+    hashField(hash, key.minLod);
+    hashField(hash, key.maxLod);
+    hashField(hash, key.borderColor);
+    hashField(hash, key.unnormalizedCoordinates);
+    return hash;
+}
+
+SamplerKey getTextureSamplerKey(float maxAnisotropy) {
+    SamplerKey key{};
+    key.magFilter = VK_FILTER_LINEAR;
+    key.minFilter = VK_FILTER_LINEAR;
+    // could be used for example for floors and walls
+    key.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    key.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    key.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    // no reason to use something else except for performance reason
+    // be wary that it is actually an optional device feature
+    // so physical device must be checked properly about this
+    key.anisotropyEnable = VK_TRUE;
+    key.maxAnisotropy = maxAnisotropy;
+    // when accessing beyond the image with clamp to border
+    // can be black, white or transparent
+    key.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    // use normalized coordinate 0,1 0,1
+    // instead of 0,texWidth 0,texHeight
+    key.unnormalizedCoordinates = VK_FALSE;
+    // if true used for filter (compare to a value)
+    // this could be used for percentage-colser filtering on shadow maps
+    key.compareEnable = VK_FALSE;
+    key.compareOp = VK_COMPARE_OP_ALWAYS;
+    // mipmaping
+    key.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    key.minLod = 0.0f;
+    key.maxLod = VK_LOD_CLAMP_NONE;
+    key.mipLodBias = 0.0f;
+    return key;
+}
+
+void SamplerCache::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice) {
+    logicalDevice_ = logicalDevice;
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    limits_ = properties.limits;
+}
+
+VkSampler SamplerCache::acquire(const SamplerKey& requestedKey) {
+    // normalize the key so that equivalent requests end up on the same sampler
+    SamplerKey key = requestedKey;
+    if (key.anisotropyEnable) {
+        key.maxAnisotropy = std::min(key.maxAnisotropy, limits_.maxSamplerAnisotropy);
+    } else {
+        // ignored by the driver when anisotropy is disabled
+        key.maxAnisotropy = 1.0f;
+    }
+    if (!key.compareEnable) {
+        key.compareOp = VK_COMPARE_OP_ALWAYS;
+    }
+    // a NaN key equals no other: every acquire would create a sampler
+    for (float value : {key.mipLodBias, key.maxAnisotropy, key.minLod, key.maxLod}) {
+        if (std::isnan(value)) {
+            throw std::invalid_argument("sampler key with a NaN!");
+        }
+    }
+
+    auto found = samplers_.find(key);
+    if (found != samplers_.end()) {
+        found->second.refCount++;
+        return found->second.sampler;
+    }
+
+    if (samplers_.size() >= limits_.maxSamplerAllocationCount) {
+        throw std::runtime_error("maxSamplerAllocationCount reached!");
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = key.magFilter;
+    samplerInfo.minFilter = key.minFilter;
+    samplerInfo.mipmapMode = key.mipmapMode;
+    samplerInfo.addressModeU = key.addressModeU;
+    samplerInfo.addressModeV = key.addressModeV;
+    samplerInfo.addressModeW = key.addressModeW;
+    samplerInfo.mipLodBias = key.mipLodBias;
+    samplerInfo.anisotropyEnable = key.anisotropyEnable;
+    samplerInfo.maxAnisotropy = key.maxAnisotropy;
+    samplerInfo.compareEnable = key.compareEnable;
+    samplerInfo.compareOp = key.compareOp;
+    samplerInfo.minLod = key.minLod;
+    samplerInfo.maxLod = key.maxLod;
+    samplerInfo.borderColor = key.borderColor;
+    samplerInfo.unnormalizedCoordinates = key.unnormalizedCoordinates;
+
+    VkSampler sampler;
+    if (vkCreateSampler(logicalDevice_, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture sampler!");
+    }
+
+    samplers_[key] = Entry{sampler, 1};
+    keys_[sampler] = key;
+
+    return sampler;
+}
+
+void SamplerCache::release(VkSampler sampler) {
+    auto key = keys_.find(sampler);
+    if (key == keys_.end()) {
+        throw std::invalid_argument("sampler not owned by the cache!");
+    }
+
+    auto entry = samplers_.find(key->second);
+    if (--entry->second.refCount == 0) {
+        vkDestroySampler(logicalDevice_, sampler, nullptr);
+        samplers_.erase(entry);
+        keys_.erase(key);
+    }
+}
+
+void SamplerCache::destroy() {
+    for (const auto& entry : samplers_) {
+        vkDestroySampler(logicalDevice_, entry.second.sampler, nullptr);
+    }
+
+    samplers_.clear();
+    keys_.clear();
+}
+
+const VkPhysicalDeviceLimits& SamplerCache::getLimits() const {
+    return limits_;
+}
+
+size_t SamplerCache::size() const {
+    return samplers_.size();
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+namespace sampler {
+
+/**
+ * The part of VkSamplerCreateInfo that makes two samplers different.
+ * sType, pNext and flags are left out as we never chain anything
+ * Hashed field by field: the raw struct bytes would include padding.
+ * The floats are compared as floats: -0 and +0 are the same key, NaN is not a valid one
+ */
+struct SamplerKey {
+    VkFilter magFilter = VK_FILTER_LINEAR;
+    VkFilter minFilter = VK_FILTER_LINEAR;
+    VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    VkSamplerAddressMode addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    float mipLodBias = 0.0f;
+    VkBool32 anisotropyEnable = VK_FALSE;
+    float maxAnisotropy = 1.0f;
+    VkBool32 compareEnable = VK_FALSE;
+    VkCompareOp compareOp = VK_COMPARE_OP_ALWAYS;
+    float minLod = 0.0f;
+    float maxLod = VK_LOD_CLAMP_NONE;
+    VkBorderColor borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    VkBool32 unnormalizedCoordinates = VK_FALSE;
+
+    bool operator==(const SamplerKey& other) const;
+};
+
+struct SamplerKeyHash {
+    size_t operator()(const SamplerKey& key) const;
+};
+
+/**
+ * linear filtering, repeat, anisotropic filtering at the maximum the GPU allows
+ * what texture3::createTextureSampler used to create for every texture
+ */
+SamplerKey getTextureSamplerKey(float maxAnisotropy);
+
+/**
+ * Samplers are independent of the images, so every texture using the same filtering
+ * can share the same VkSampler. Without sharing we would create one per texture and
+ * hit maxSamplerAllocationCount (can be as low as 4000) way before running out of memory.
+ *
+ * acquire/release are refcounted, the VkSampler is destroyed when the last user releases it
+ */
+class SamplerCache {
+public:
+    /** query the device limits once, instead of every sampler creation */
+    void init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice);
+    VkSampler acquire(const SamplerKey& key);
+    void release(VkSampler sampler);
+    /** destroy all the samplers, even the ones still referenced */
+    void destroy();
+    const VkPhysicalDeviceLimits& getLimits() const;
+    size_t size() const;
+
+private:
+    struct Entry {
+        VkSampler sampler;
+        uint32_t refCount;
+    };
+
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    VkPhysicalDeviceLimits limits_{};
+    std::unordered_map<SamplerKey, Entry, SamplerKeyHash> samplers_;
+    // to find the entry back on release
+    std::unordered_map<VkSampler, SamplerKey> keys_;
+};
+
+}
@@ -0,0 +1,280 @@
+/**
+ * Headless bench of the sampler cache (sampler.hpp)
+ *
+ * First checks the keys: equal keys hash the same (-0 and +0 included), a change of any
+ * field makes a different key, then the cache: the requests of the same filtering share one
+ * VkSampler, the keys acquire normalizes too, a NaN key is rejected, releasing everything
+ * destroys everything.
+ *
+ * Then 10k texture bindings (a sampler and a combined image sampler descriptor each):
+ * * cached: SamplerCache::acquire, a handful of distinct samplers
+ * * uncached: a vkCreateSampler per binding, what texture3::createTextureSampler did,
+ *   up to maxSamplerAllocationCount
+ *
+ * usage: sampler_bench [--bindings N] [--distinct D]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "headless.hpp"
+#include "sampler.hpp"
+#include "texture3.hpp"
+#include "compute.hpp"
+#include "memory.hpp"
+
+struct BenchOptions {
+    uint32_t bindingCount = 10000;
+    /** distinct filterings amongst the bindings */
+    uint32_t distinctCount = 4;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--bindings") {
+            options.bindingCount = value;
+        } else if (name == "--distinct") {
+            options.distinctCount = std::max(value, 1u);
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+static void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error("sampler check failed: " + what);
+    }
+}
+
+/** the filterings of the bindings, cycling through distinctCount of them */
+static sampler::SamplerKey makeKey(uint32_t index, uint32_t distinctCount) {
+    sampler::SamplerKey key = sampler::getTextureSamplerKey(1.0f);
+    // samplerAnisotropy is not enabled on the headless device
+    key.anisotropyEnable = VK_FALSE;
+    uint32_t variant = index % distinctCount;
+    key.addressModeU = (variant & 1) ? VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE : VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    key.mipLodBias = static_cast<float>(variant / 2) * 0.25f;
+    return key;
+}
+
+/** the key hashing, no device needed */
+static void checkKeys() {
+    sampler::SamplerKeyHash hash;
+    sampler::SamplerKey base = sampler::getTextureSamplerKey(16.0f);
+    sampler::SamplerKey copy = base;
+    expect(base == copy && hash(base) == hash(copy), "a copy is the same key");
+
+    sampler::SamplerKey negativeZero = base;
+    negativeZero.mipLodBias = -0.0f;
+    negativeZero.minLod = -0.0f;
+    expect(base == negativeZero, "-0 and +0 are the same key");
+    expect(hash(base) == hash(negativeZero), "-0 and +0 hash the same");
+
+    // every field matters
+    std::vector<sampler::SamplerKey> changed(15, base);
+    changed[0].magFilter = VK_FILTER_NEAREST;
+    changed[1].minFilter = VK_FILTER_NEAREST;
+    changed[2].mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    changed[3].addressModeU = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+    changed[4].addressModeV = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+    changed[5].addressModeW = VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+    changed[6].mipLodBias = 0.5f;
+    changed[7].anisotropyEnable = VK_FALSE;
+    changed[8].maxAnisotropy = 4.0f;
+    changed[9].compareEnable = VK_TRUE;
+    changed[10].compareOp = VK_COMPARE_OP_LESS;
+    changed[11].minLod = 1.0f;
+    changed[12].maxLod = 4.0f;
+    changed[13].borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    changed[14].unnormalizedCoordinates = VK_TRUE;
+    for (size_t i = 0; i < changed.size(); i++) {
+        expect(!(changed[i] == base), "field " + std::to_string(i) + " changes the key");
+        expect(hash(changed[i]) != hash(base), "field " + std::to_string(i) + " changes the hash");
+    }
+
+    std::cout << "key checks passed\n";
+}
+
+static void checkCache(sampler::SamplerCache& cache) {
+    // samplerAnisotropy is not enabled on the headless device
+    sampler::SamplerKey key = sampler::getTextureSamplerKey(1.0f);
+    key.anisotropyEnable = VK_FALSE;
+    VkSampler first = cache.acquire(key);
+    VkSampler second = cache.acquire(key);
+    expect(first == second && cache.size() == 1, "the same key shares the sampler");
+
+    // maxAnisotropy is ignored without anisotropy, compareOp without compare
+    sampler::SamplerKey equivalent = key;
+    equivalent.maxAnisotropy = 8.0f;
+    equivalent.compareOp = VK_COMPARE_OP_GREATER;
+    VkSampler third = cache.acquire(equivalent);
+    expect(third == first && cache.size() == 1, "equivalent keys share the sampler");
+
+    sampler::SamplerKey negativeZero = key;
+    negativeZero.mipLodBias = -0.0f;
+    VkSampler fourth = cache.acquire(negativeZero);
+    expect(fourth == first && cache.size() == 1, "-0 finds the sampler of +0");
+
+    sampler::SamplerKey clamped = key;
+    clamped.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    VkSampler fifth = cache.acquire(clamped);
+    expect(fifth != first && cache.size() == 2, "another filtering gets its own sampler");
+
+    sampler::SamplerKey nan = key;
+    nan.maxLod = std::nanf("");
+    bool rejected = false;
+    try {
+        cache.acquire(nan);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    expect(rejected && cache.size() == 2, "a NaN key is rejected");
+
+    for (VkSampler sampler : {first, second, third, fourth, fifth}) {
+        cache.release(sampler);
+    }
+    expect(cache.size() == 0, "the last release destroys the sampler");
+
+    std::cout << "cache checks passed\n";
+}
+
+static void run(const BenchOptions& options) {
+    checkKeys();
+
+    headless::Device headless;
+    headless.init("Sampler bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName
+        << ", maxSamplerAllocationCount " << properties.limits.maxSamplerAllocationCount << '\n';
+
+    sampler::SamplerCache cache;
+    cache.init(headless.physicalDevice_, headless.device_);
+    checkCache(cache);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(headless.device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    // one small texture for all the bindings: the samplers are what is measured
+    const int TEXTURE_SIZE = 4;
+    std::vector<unsigned char> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 4, 128);
+    VkImage image;
+    VkDeviceMemory imageMemory;
+    uint32_t mipLevels = texture3::createTextureImageFromPixels(headless.physicalDevice_, headless.device_,
+        commandPool, headless.queue_, pixels.data(), TEXTURE_SIZE, TEXTURE_SIZE, VK_SAMPLE_COUNT_1_BIT,
+        image, imageMemory);
+    VkImageView imageView;
+    texture3::createTextureImageView(headless.device_, image, imageView, mipLevels);
+
+    std::vector<compute::BindingType> bindings = {compute::SampledImage};
+    VkDescriptorSetLayout setLayout;
+    compute::createDescriptorSetLayout(headless.device_, bindings, setLayout, VK_SHADER_STAGE_FRAGMENT_BIT);
+    VkDescriptorPool descriptorPool;
+    compute::createDescriptorPool(headless.device_, bindings, options.bindingCount, descriptorPool);
+    std::vector<VkDescriptorSet> sets(options.bindingCount);
+    for (auto& set : sets) {
+        set = compute::allocateDescriptorSet(headless.device_, descriptorPool, setLayout);
+    }
+
+    // cached
+    std::vector<VkSampler> samplers(options.bindingCount);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.bindingCount; i++) {
+        samplers[i] = cache.acquire(makeKey(i, options.distinctCount));
+        compute::writeImage(headless.device_, sets[i], 0, compute::SampledImage, imageView,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, samplers[i]);
+    }
+    double cachedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t cachedSamplerCount = cache.size();
+    expect(cachedSamplerCount == std::min(options.distinctCount, options.bindingCount),
+        "the bindings share " + std::to_string(options.distinctCount) + " samplers, got "
+        + std::to_string(cachedSamplerCount));
+    for (VkSampler sampler : samplers) {
+        cache.release(sampler);
+    }
+    expect(cache.size() == 0, "all the bindings released");
+
+    // uncached, within the limit
+    uint32_t uncachedCount = std::min(options.bindingCount, properties.limits.maxSamplerAllocationCount);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < uncachedCount; i++) {
+        sampler::SamplerKey key = makeKey(i, options.distinctCount);
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = key.magFilter;
+        samplerInfo.minFilter = key.minFilter;
+        samplerInfo.mipmapMode = key.mipmapMode;
+        samplerInfo.addressModeU = key.addressModeU;
+        samplerInfo.addressModeV = key.addressModeV;
+        samplerInfo.addressModeW = key.addressModeW;
+        samplerInfo.mipLodBias = key.mipLodBias;
+        samplerInfo.anisotropyEnable = key.anisotropyEnable;
+        samplerInfo.maxAnisotropy = key.maxAnisotropy;
+        samplerInfo.compareEnable = key.compareEnable;
+        samplerInfo.compareOp = key.compareOp;
+        samplerInfo.minLod = key.minLod;
+        samplerInfo.maxLod = key.maxLod;
+        samplerInfo.borderColor = key.borderColor;
+        samplerInfo.unnormalizedCoordinates = key.unnormalizedCoordinates;
+        if (vkCreateSampler(headless.device_, &samplerInfo, nullptr, &samplers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture sampler!");
+        }
+        compute::writeImage(headless.device_, sets[i], 0, compute::SampledImage, imageView,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, samplers[i]);
+    }
+    double uncachedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for (uint32_t i = 0; i < uncachedCount; i++) {
+        vkDestroySampler(headless.device_, samplers[i], nullptr);
+    }
+
+    std::cout << options.bindingCount << " texture bindings, " << options.distinctCount << " distinct filterings\n"
+        << "  cached:   " << cachedMs << " ms, " << cachedMs * 1000.0 / options.bindingCount << " us/binding, "
+        << cachedSamplerCount << " samplers\n"
+        << "  uncached: " << uncachedMs << " ms, " << uncachedMs * 1000.0 / std::max(uncachedCount, 1u)
+        << " us/binding, " << uncachedCount << " samplers";
+    if (uncachedCount < options.bindingCount) {
+        std::cout << " (maxSamplerAllocationCount reached: the other bindings can't exist)";
+    }
+    std::cout << '\n';
+
+    vkDestroyDescriptorPool(headless.device_, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(headless.device_, setLayout, nullptr);
+    vkDestroyImageView(headless.device_, imageView, nullptr);
+    vkDestroyImage(headless.device_, image, nullptr);
+    memory::freeMemory(headless.device_, imageMemory);
+    vkDestroyCommandPool(headless.device_, commandPool, nullptr);
+    cache.destroy();
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
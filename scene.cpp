@@ -0,0 +1,267 @@
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "scene.hpp"
+#include "model.hpp"
+#include "profiler.hpp"
+
+namespace scene {
+
+const float PI = 3.14159265358979f;
+
+uint64_t Random::next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+float Random::nextFloat() {
+    // the 24 high bits: exactly representable, never 1.0
+    return (next() >> 40) * (1.0f / 16777216.0f);
+}
+
+float Random::nextFloat(float min, float max) {
+    return min + (max - min) * nextFloat();
+}
+
+uint32_t Random::nextIndex(uint32_t count) {
+    return static_cast<uint32_t>((next() >> 32) * count >> 32);
+}
+
+/** n x n quads from origin along u and v, counter clockwise seen from u x v */
+static void appendPatch(
+    glm::vec3 origin,
+    glm::vec3 u,
+    glm::vec3 v,
+    uint32_t n,
+    std::vector<vertex3::Vertex>& vertices,
+    std::vector<uint32_t>& indices
+) {
+    uint32_t first = static_cast<uint32_t>(vertices.size());
+    for (uint32_t y = 0; y <= n; y++) {
+        for (uint32_t x = 0; x <= n; x++) {
+            float s = static_cast<float>(x) / n;
+            float t = static_cast<float>(y) / n;
+            vertex3::Vertex vertex{};
+            vertex.pos = origin + s * u + t * v;
+            vertex.color = {1.0f, 1.0f, 1.0f};
+            // the images are top-bottom
+            vertex.texCoord = {s, 1.0f - t};
+            vertices.push_back(vertex);
+        }
+    }
+    uint32_t rowSize = n + 1;
+    for (uint32_t y = 0; y < n; y++) {
+        for (uint32_t x = 0; x < n; x++) {
+            uint32_t corner = first + y * rowSize + x;
+            indices.insert(indices.end(), {corner, corner + 1, corner + rowSize + 1});
+            indices.insert(indices.end(), {corner, corner + rowSize + 1, corner + rowSize});
+        }
+    }
+}
+
+void makeGrid(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    // 2 n^2 triangles
+    uint32_t n = std::max(1u, static_cast<uint32_t>(std::lround(std::sqrt(triangleCount / 2.0))));
+    appendPatch({-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, n, vertices, indices);
+}
+
+void makeCube(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    // 6 faces of 2 n^2 triangles
+    uint32_t n = std::max(1u, static_cast<uint32_t>(std::lround(std::sqrt(triangleCount / 12.0))));
+    const glm::vec3 X{1.0f, 0.0f, 0.0f};
+    const glm::vec3 Y{0.0f, 1.0f, 0.0f};
+    const glm::vec3 Z{0.0f, 0.0f, 1.0f};
+    // u x v is the outward normal of each face
+    const glm::vec3 faces[6][2] = {{Y, Z}, {Z, Y}, {Z, X}, {X, Z}, {X, Y}, {Y, X}};
+    for (const auto& face : faces) {
+        glm::vec3 normal = glm::cross(face[0], face[1]);
+        glm::vec3 origin = 0.5f * normal - 0.5f * face[0] - 0.5f * face[1];
+        appendPatch(origin, face[0], face[1], n, vertices, indices);
+    }
+}
+
+void makeSphere(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices) {
+    // stacks from pole to pole and 2 * stacks slices: 4 stacks (stacks - 1) triangles,
+    // the first and last stacks have one triangle per slice
+    uint32_t stacks = std::max(2u, static_cast<uint32_t>(std::lround(std::sqrt(triangleCount / 4.0) + 0.5)));
+    uint32_t slices = 2 * stacks;
+
+    uint32_t first = static_cast<uint32_t>(vertices.size());
+    for (uint32_t j = 0; j <= stacks; j++) {
+        float theta = PI * j / stacks;
+        for (uint32_t i = 0; i <= slices; i++) {
+            // the seam is duplicated for the texture coordinates
+            float phi = 2.0f * PI * i / slices;
+            vertex3::Vertex vertex{};
+            vertex.pos = 0.5f * glm::vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            vertex.color = {1.0f, 1.0f, 1.0f};
+            vertex.texCoord = {static_cast<float>(i) / slices, static_cast<float>(j) / stacks};
+            vertices.push_back(vertex);
+        }
+    }
+    uint32_t rowSize = slices + 1;
+    for (uint32_t j = 0; j < stacks; j++) {
+        for (uint32_t i = 0; i < slices; i++) {
+            // a b on the ring above (north), c d below, i eastward
+            uint32_t a = first + j * rowSize + i;
+            uint32_t b = a + 1;
+            uint32_t c = a + rowSize;
+            uint32_t d = c + 1;
+            // c and d are the same point at the south pole
+            if (j != stacks - 1) {
+                indices.insert(indices.end(), {a, c, d});
+            }
+            // a and b are the same point at the north pole
+            if (j != 0) {
+                indices.insert(indices.end(), {a, d, b});
+            }
+        }
+    }
+}
+
+Texture makeTexture(uint32_t size, uint32_t index, uint64_t seed) {
+    Random random(seed ^ (0x9e3779b97f4a7c15ull * (index + 1)));
+    const uint32_t CELL_SIZES[] = {4, 8, 16, 32, 64};
+    uint32_t cellSize = std::min(CELL_SIZES[random.nextIndex(5)], std::max(size / 2, 1u));
+    unsigned char colors[2][3];
+    for (auto& color : colors) {
+        for (auto& channel : color) {
+            channel = static_cast<unsigned char>(random.nextIndex(256));
+        }
+    }
+
+    Texture texture;
+    texture.size = size;
+    texture.pixels.resize(static_cast<size_t>(size) * size * 4);
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            const unsigned char* color = colors[(x / cellSize + y / cellSize) % 2];
+            unsigned char* pixel = &texture.pixels[(static_cast<size_t>(y) * size + x) * 4];
+            pixel[0] = color[0];
+            pixel[1] = color[1];
+            pixel[2] = color[2];
+            pixel[3] = 255;
+        }
+    }
+    return texture;
+}
+
+/** a random unit vector, uniform on the sphere */
+static glm::vec3 randomAxis(Random& random) {
+    float z = random.nextFloat(-1.0f, 1.0f);
+    float phi = random.nextFloat(0.0f, 2.0f * PI);
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+Scene generate(const Config& config) {
+    PROFILE_SCOPE("scene::generate");
+    Scene scene;
+    uint32_t meshCount = std::max(config.meshCount, 1u);
+    for (uint32_t i = 0; i < meshCount; i++) {
+        Mesh mesh;
+        mesh.firstVertex = static_cast<uint32_t>(scene.vertices.size());
+        mesh.firstIndex = static_cast<uint32_t>(scene.indices.size());
+        // the first one has triangleCount, like with a single mesh
+        uint32_t triangleCount = config.triangleCount + static_cast<uint32_t>(
+            static_cast<uint64_t>(config.triangleCount) * i / meshCount);
+        switch (config.shape) {
+            case Sphere:
+                makeSphere(triangleCount, scene.vertices, scene.indices);
+                break;
+            case Cube:
+                makeCube(triangleCount, scene.vertices, scene.indices);
+                break;
+            case Grid:
+                makeGrid(triangleCount, scene.vertices, scene.indices);
+                break;
+            case Loaded:
+                if (config.meshPath == nullptr) {
+                    throw std::invalid_argument("scene::Loaded needs a meshPath!");
+                }
+                if (i == 0) {
+                    model::loadObj(config.meshPath, scene.vertices, scene.indices);
+                    model::deduplicateVertices(scene.vertices, scene.indices);
+                } else {
+                    const Mesh& first = scene.meshes[0];
+                    scene.vertices.reserve(scene.vertices.size() + first.vertexCount);
+                    for (uint32_t j = 0; j < first.vertexCount; j++) {
+                        scene.vertices.push_back(scene.vertices[j]);
+                    }
+                    for (uint32_t j = 0; j < first.indexCount; j++) {
+                        scene.indices.push_back(scene.indices[j] + mesh.firstVertex);
+                    }
+                }
+                break;
+        }
+        mesh.vertexCount = static_cast<uint32_t>(scene.vertices.size()) - mesh.firstVertex;
+        mesh.indexCount = static_cast<uint32_t>(scene.indices.size()) - mesh.firstIndex;
+        scene.meshes.push_back(mesh);
+    }
+
+    // separate streams: changing the instance count doesn't change the textures
+    uint32_t textureCount = std::max(config.textureCount, 1u);
+    for (uint32_t i = 0; i < textureCount; i++) {
+        scene.textures.push_back(makeTexture(config.textureSize, i, config.seed));
+    }
+
+    Random random(config.seed);
+    std::vector<glm::vec3> centers;
+    for (uint32_t i = 0; i < std::max(config.clusterCount, 1u); i++) {
+        centers.push_back({random.nextFloat(-config.extent, config.extent),
+            random.nextFloat(-config.extent, config.extent),
+            random.nextFloat(-config.extent, config.extent)});
+    }
+    const float clusterRadius = config.extent / 4.0f;
+    uint32_t latticeSide = std::max(1u, static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(config.instanceCount)))));
+    float latticeSpacing = 2.0f * config.extent / latticeSide;
+
+    scene.instances.reserve(config.instanceCount);
+    for (uint32_t i = 0; i < config.instanceCount; i++) {
+        glm::vec3 position;
+        switch (config.distribution) {
+            case Uniform:
+                position = {random.nextFloat(-config.extent, config.extent),
+                    random.nextFloat(-config.extent, config.extent),
+                    random.nextFloat(-config.extent, config.extent)};
+                break;
+            case Clustered: {
+                glm::vec3 offset;
+                for (uint32_t axis = 0; axis < 3; axis++) {
+                    // the mean of 3 uniforms: denser at the center of the cluster
+                    offset[axis] = (random.nextFloat(-1.0f, 1.0f) + random.nextFloat(-1.0f, 1.0f)
+                        + random.nextFloat(-1.0f, 1.0f)) / 3.0f * clusterRadius;
+                }
+                position = centers[random.nextIndex(static_cast<uint32_t>(centers.size()))] + offset;
+                break;
+            }
+            case Lattice: {
+                uint32_t x = i % latticeSide;
+                uint32_t y = (i / latticeSide) % latticeSide;
+                uint32_t z = i / (latticeSide * latticeSide);
+                position = glm::vec3(-config.extent) + latticeSpacing * (glm::vec3(x, y, z) + 0.5f);
+                break;
+            }
+        }
+
+        glm::vec3 axis = randomAxis(random);
+        float angle = random.nextFloat(0.0f, 2.0f * PI);
+        float scale = random.nextFloat(config.minScale, config.maxScale);
+
+        Instance instance;
+        instance.model = glm::translate(glm::mat4(1.0f), position);
+        instance.model = glm::rotate(instance.model, angle, axis);
+        instance.model = glm::scale(instance.model, glm::vec3(scale));
+        instance.textureIndex = random.nextIndex(textureCount);
+        instance.meshIndex = i % meshCount;
+        scene.instances.push_back(instance);
+    }
+    return scene;
+}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "vertex3.hpp"
+
+namespace scene {
+
+/**
+ * Seeded procedural scenes to stress the renderer beyond the viking room:
+ * N instances of one mesh (generated with about M triangles, or loaded from an OBJ file)
+ * spread in a cube, each with one of K generated textures. With meshCount > 1 the instances
+ * cycle through that many distinct meshes of the shape (their own vertices and indices).
+ *
+ * Deterministic: the same Config gives the same scene on any platform and standard
+ * library, the random numbers come from splitmix64 rather than <random> distributions
+ * (whose results are implementation defined).
+ * The textures are the materials: the shaders only sample them
+ */
+enum Shape {
+    Sphere,
+    Cube,
+    Grid,
+    /** Config::meshPath, the triangle count is the one of the file */
+    Loaded
+};
+
+enum Distribution {
+    /** uniformly in the cube */
+    Uniform,
+    /** around clusterCount centers, uniformly placed */
+    Clustered,
+    /** on a regular 3D lattice filling the cube, no randomness in the positions */
+    Lattice
+};
+
+struct Config {
+    uint64_t seed = 1;
+    uint32_t instanceCount = 100;
+    Shape shape = Sphere;
+    /** a target: the generated meshes round it to their tessellation */
+    uint32_t triangleCount = 1000;
+    const char* meshPath = nullptr;
+    uint32_t textureCount = 4;
+    uint32_t textureSize = 256;
+    Distribution distribution = Uniform;
+    /** the instances are in [-extent, extent]^3, the meshes are about 1 unit wide */
+    float extent = 20.0f;
+    uint32_t clusterCount = 8;
+    float minScale = 0.5f;
+    float maxScale = 1.5f;
+    /**
+     * the generated meshes get 1 to 2 times triangleCount (their tessellation rounds it),
+     * a loaded one is repeated. Changes neither the instances nor the textures
+     */
+    uint32_t meshCount = 1;
+};
+
+/** RGBA8, size x size, sRGB like the other textures */
+struct Texture {
+    uint32_t size = 0;
+    std::vector<unsigned char> pixels;
+};
+
+struct Instance {
+    glm::mat4 model;
+    uint32_t textureIndex;
+    uint32_t meshIndex = 0;
+};
+
+/** a range of Scene::vertices and one of Scene::indices, the indices offset by firstVertex */
+struct Mesh {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+struct Scene {
+    /** the meshes one after the other */
+    std::vector<vertex3::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+    std::vector<Texture> textures;
+
+    /** of all the meshes */
+    uint32_t getTriangleCount() const {
+        return static_cast<uint32_t>(indices.size() / 3);
+    }
+};
+
+/** splitmix64: tiny, fast, and the same sequence everywhere */
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t next();
+    /** in [0, 1) */
+    float nextFloat();
+    float nextFloat(float min, float max);
+    /** in [0, count) */
+    uint32_t nextIndex(uint32_t count);
+
+private:
+    uint64_t state_;
+};
+
+/**
+ * The meshes are centered on 0, radius 0.5, counter clockwise seen from outside (the
+ * pipeline culls the back faces). The vertices are appended, the indices offset by
+ * the vertices already there
+ */
+void makeSphere(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices);
+void makeCube(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices);
+/** in the xy plane, facing +z */
+void makeGrid(uint32_t triangleCount, std::vector<vertex3::Vertex>& vertices, std::vector<uint32_t>& indices);
+
+/** a checkerboard with its own colors and cell size, from index and seed */
+Texture makeTexture(uint32_t size, uint32_t index, uint64_t seed);
+
+Scene generate(const Config& config);
+
+}
@@ -0,0 +1,231 @@
+/**
+ * Headless sweep of generated scenes (scene::generate) through offscreen::Renderer:
+ * every combination of the object, triangle and texture counts is rendered for a few
+ * frames, the throughput curves are printed as a table, one row per combination,
+ * and written as CSV with --csv 1 (scene_results.csv).
+ *
+ * frames/s says how the frame scales, Mtris/s (triangles drawn per second) how much of
+ * the GPU it uses: with many small objects the recording (one descriptor set bind and
+ * one draw per object) limits the frame long before the triangles do.
+ * The same seed gives the same scenes, hence comparable runs.
+ *
+ * usage: scene_bench [--objects 1,10,100,1000] [--triangles 100,1000,10000] [--textures 1,16]
+ *                    [--shape sphere|cube|grid|<obj path>] [--distribution uniform|clustered|lattice]
+ *                    [--seed S] [--frames F] [--warmup W] [--width X] [--height Y] [--csv 0|1]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "headless.hpp"
+#include "offscreen.hpp"
+#include "scene.hpp"
+
+struct BenchOptions {
+    std::vector<uint32_t> objectCounts = {1, 10, 100, 1000};
+    std::vector<uint32_t> triangleCounts = {100, 1000, 10000};
+    std::vector<uint32_t> textureCounts = {1, 16};
+    scene::Shape shape = scene::Sphere;
+    std::string meshPath;
+    scene::Distribution distribution = scene::Uniform;
+    uint64_t seed = 1;
+    uint32_t frameCount = 200;
+    uint32_t warmupFrameCount = 20;
+    uint32_t width = 800;
+    uint32_t height = 600;
+    bool csv = false;
+};
+
+static std::vector<uint32_t> parseList(const std::string& value) {
+    std::vector<uint32_t> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(static_cast<uint32_t>(std::strtoul(item.c_str(), nullptr, 10)));
+    }
+    if (list.empty()) {
+        throw std::invalid_argument("empty list " + value);
+    }
+    return list;
+}
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        if (name == "--objects") {
+            options.objectCounts = parseList(value);
+        } else if (name == "--triangles") {
+            options.triangleCounts = parseList(value);
+        } else if (name == "--textures") {
+            options.textureCounts = parseList(value);
+        } else if (name == "--shape") {
+            if (value == "sphere") {
+                options.shape = scene::Sphere;
+            } else if (value == "cube") {
+                options.shape = scene::Cube;
+            } else if (value == "grid") {
+                options.shape = scene::Grid;
+            } else {
+                options.shape = scene::Loaded;
+                options.meshPath = value;
+            }
+        } else if (name == "--distribution") {
+            if (value == "uniform") {
+                options.distribution = scene::Uniform;
+            } else if (value == "clustered") {
+                options.distribution = scene::Clustered;
+            } else if (value == "lattice") {
+                options.distribution = scene::Lattice;
+            } else {
+                throw std::invalid_argument("unknown distribution " + value);
+            }
+        } else if (name == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "--frames") {
+            options.frameCount = number;
+        } else if (name == "--warmup") {
+            options.warmupFrameCount = number;
+        } else if (name == "--width") {
+            options.width = number;
+        } else if (name == "--height") {
+            options.height = number;
+        } else if (name == "--csv") {
+            options.csv = number != 0;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** the whole cube in view, from outside, turning slowly around z */
+static buffer2::UniformBufferObject makeUniforms(uint32_t frame, VkExtent2D extent, float sceneExtent) {
+    buffer2::UniformBufferObject ubo{};
+    ubo.model = glm::rotate(glm::mat4(1.0f), frame * 0.01f, glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.view = glm::lookAt(glm::vec3(0.0f, -2.5f * sceneExtent, sceneExtent), glm::vec3(0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), extent.width / static_cast<float>(extent.height),
+        0.1f, 6.0f * sceneExtent);
+    ubo.proj[1][1] *= -1;
+    return ubo;
+}
+
+struct Result {
+    uint32_t objectCount;
+    uint32_t meshTriangleCount;
+    uint32_t textureCount;
+    double framesPerS;
+    double trianglesPerS;
+    double recordUs;
+};
+
+static Result measure(offscreen::Renderer& renderer, const BenchOptions& options, const scene::Config& config) {
+    scene::Scene generated = scene::generate(config);
+    renderer.uploadScene(generated);
+
+    double recordMs = 0.0;
+    uint32_t totalFrameCount = options.warmupFrameCount + options.frameCount;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < totalFrameCount; frame++) {
+        if (frame == options.warmupFrameCount) {
+            renderer.waitIdle();
+            start = std::chrono::steady_clock::now();
+        }
+        renderer.drawFrame(makeUniforms(frame, renderer.getExtent(), config.extent));
+        if (frame >= options.warmupFrameCount) {
+            recordMs += renderer.getLastRecordMs();
+        }
+    }
+    renderer.waitIdle();
+    double elapsedS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Result result;
+    result.objectCount = config.instanceCount;
+    result.meshTriangleCount = generated.getTriangleCount();
+    result.textureCount = static_cast<uint32_t>(generated.textures.size());
+    result.framesPerS = options.frameCount / elapsedS;
+    result.trianglesPerS = result.framesPerS * result.meshTriangleCount * result.objectCount;
+    result.recordUs = recordMs * 1000.0 / options.frameCount;
+    return result;
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Scene bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+
+    offscreen::Renderer renderer;
+    renderer.init(headless, {options.width, options.height});
+
+    std::cout << "device: " << properties.deviceName << ", " << options.width << "x" << options.height
+        << " " << renderer.getSampleCount() << "x MSAA, seed " << options.seed << "\n\n";
+    std::cout << std::setw(8) << "objects" << std::setw(12) << "tris/mesh" << std::setw(10) << "textures"
+        << std::setw(12) << "frames/s" << std::setw(12) << "Mtris/s" << std::setw(12) << "record us" << '\n';
+
+    std::vector<Result> results;
+    for (uint32_t textureCount : options.textureCounts) {
+        for (uint32_t triangleCount : options.triangleCounts) {
+            // one curve per mesh: the throughput against the object count
+            for (uint32_t objectCount : options.objectCounts) {
+                scene::Config config;
+                config.seed = options.seed;
+                config.instanceCount = objectCount;
+                config.shape = options.shape;
+                config.triangleCount = triangleCount;
+                config.meshPath = options.meshPath.empty() ? nullptr : options.meshPath.c_str();
+                config.textureCount = textureCount;
+                config.distribution = options.distribution;
+
+                Result result = measure(renderer, options, config);
+                results.push_back(result);
+                std::cout << std::fixed << std::setprecision(1)
+                    << std::setw(8) << result.objectCount << std::setw(12) << result.meshTriangleCount
+                    << std::setw(10) << result.textureCount << std::setw(12) << result.framesPerS
+                    << std::setw(12) << result.trianglesPerS / 1e6 << std::setw(12) << result.recordUs << '\n';
+            }
+            std::cout << '\n';
+        }
+    }
+
+    if (options.csv) {
+        std::ofstream file("scene_results.csv");
+        file << "objects,triangles_per_mesh,textures,frames_per_s,triangles_per_s,record_us\n";
+        for (const auto& result : results) {
+            file << result.objectCount << ',' << result.meshTriangleCount << ',' << result.textureCount << ','
+                << result.framesPerS << ',' << result.trianglesPerS << ',' << result.recordUs << '\n';
+        }
+        std::cout << "results written to scene_results.csv\n";
+    }
+
+    renderer.cleanup();
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
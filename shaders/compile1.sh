@@ -11,6 +11,13 @@ ${GLSLC} -fshader-stage=vert shader2.vert.glsl -o ${OUTPUT_DIR}/shader2.vert.spi
 ${GLSLC} -fshader-stage=vert shader3.vert.glsl -o ${OUTPUT_DIR}/shader3.vert.spirv
 ${GLSLC} -fshader-stage=vert shader4.vert.glsl -o ${OUTPUT_DIR}/shader4.vert.spirv
 ${GLSLC} -fshader-stage=vert shader5.vert.glsl -o ${OUTPUT_DIR}/shader5.vert.spirv
+${GLSLC} -fshader-stage=vert shader6.vert.glsl -o ${OUTPUT_DIR}/shader6.vert.spirv
 ${GLSLC} -fshader-stage=frag shader1.frag.glsl -o ${OUTPUT_DIR}/shader1.frag.spirv
 ${GLSLC} -fshader-stage=frag shader2.frag.glsl -o ${OUTPUT_DIR}/shader2.frag.spirv
-${GLSLC} -fshader-stage=frag shader3.frag.glsl -o ${OUTPUT_DIR}/shader3.frag.spirv
\ No newline at end of file
+${GLSLC} -fshader-stage=frag shader3.frag.glsl -o ${OUTPUT_DIR}/shader3.frag.spirv
+${GLSLC} -fshader-stage=comp fill.comp.glsl -o ${OUTPUT_DIR}/fill.comp.spirv
+${GLSLC} -fshader-stage=comp reduce.comp.glsl -o ${OUTPUT_DIR}/reduce.comp.spirv
+${GLSLC} -fshader-stage=comp spd.comp.glsl -o ${OUTPUT_DIR}/spd.comp.spirv
+${GLSLC} -fshader-stage=comp -DDEPTH_PYRAMID spd.comp.glsl -o ${OUTPUT_DIR}/spd_depth.comp.spirv
+${GLSLC} -fshader-stage=comp -DDEPTH_PYRAMID -DMULTISAMPLED spd.comp.glsl -o ${OUTPUT_DIR}/spd_depth_ms.comp.spirv
+${GLSLC} -fshader-stage=comp cull.comp.glsl -o ${OUTPUT_DIR}/cull.comp.spirv
@@ -0,0 +1,168 @@
+#version 450
+
+// occlusion::Culler: one phase of the two phase culling, one object per invocation.
+// Writes the indirect draw of the object for the phase, instanceCount 0 when culled.
+// early: the objects visible last frame, in the frustum
+// late: the objects in the frustum not occluded by the depth pyramid of the early pass,
+// not drawn early. Keeps their visibility for the early phase of the next frame
+layout(local_size_x_id = 0) in;
+layout(constant_id = 0) const uint GROUP_SIZE = 64;
+
+const uint EARLY = 0;
+const uint LATE = 1;
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+    uint objectCount;
+    uint phase;
+    // 0: frustum culling only
+    uint occlusion;
+    uint levelCount;
+    uvec2 depthSize;
+} pushConstants;
+
+struct Object {
+    vec4 sphere;
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(binding = 0) readonly buffer Objects {
+    Object objects[];
+} objectData;
+
+layout(binding = 1) buffer Visibility {
+    uint visible[];
+} visibilityData;
+
+// the early draws of all the objects, then the late ones
+layout(binding = 2) writeonly buffer Draws {
+    DrawCommand draws[];
+} drawData;
+
+// zeroed each frame, in the order of occlusion::Stats
+layout(binding = 3) buffer Counters {
+    uint earlyDrawCount;
+    uint lateDrawCount;
+    uint frustumCulledCount;
+    uint occlusionCulledCount;
+} counters;
+
+// level 0 is half the next power of two of the depth size: a texel of level L covers
+// 2^(L+1) x 2^(L+1) pixels and holds their farthest depth
+layout(binding = 4) uniform sampler2D pyramid;
+
+// the box around the sphere, projected: out of the frustum or its NDC bounds
+bool projectBox(vec4 sphere, out vec3 ndcMin, out vec3 ndcMax, out bool crossesNear) {
+    ndcMin = vec3(1.0);
+    ndcMax = vec3(-1.0);
+    crossesNear = false;
+    // a bit per plane the corners are all out of: x < -w, x > w, y < -w, y > w, z < 0, z > w
+    uint outside = 63;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0,
+            (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = pushConstants.viewProjection * vec4(corner, 1.0);
+        uint planes = 0;
+        planes |= clip.x < -clip.w ? 1 : 0;
+        planes |= clip.x > clip.w ? 2 : 0;
+        planes |= clip.y < -clip.w ? 4 : 0;
+        planes |= clip.y > clip.w ? 8 : 0;
+        planes |= clip.z < 0.0 ? 16 : 0;
+        planes |= clip.z > clip.w ? 32 : 0;
+        outside &= planes;
+        if (clip.w <= 0.0) {
+            crossesNear = true;
+        } else {
+            vec3 ndc = clip.xyz / clip.w;
+            ndcMin = min(ndcMin, ndc);
+            ndcMax = max(ndcMax, ndc);
+        }
+    }
+    return outside == 0;
+}
+
+bool isOccluded(vec3 ndcMin, vec3 ndcMax) {
+    ivec2 size = ivec2(pushConstants.depthSize);
+    ivec2 pixelMin = clamp(ivec2((ndcMin.xy * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+    ivec2 pixelMax = clamp(ivec2((ndcMax.xy * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+
+    // the first level where the rectangle spans 2x2 texels at most
+    int level = 0;
+    ivec2 texelMin = pixelMin >> 1;
+    ivec2 texelMax = pixelMax >> 1;
+    while (any(greaterThan(texelMax - texelMin, ivec2(1)))) {
+        level++;
+        if (level >= int(pushConstants.levelCount)) {
+            // covers most of the screen, not worth it
+            return false;
+        }
+        texelMin = pixelMin >> (level + 1);
+        texelMax = pixelMax >> (level + 1);
+    }
+
+    ivec2 levelMax = textureSize(pyramid, level) - 1;
+    texelMax = min(texelMax, levelMax);
+    float farthest = max(
+        max(texelFetch(pyramid, texelMin, level).x, texelFetch(pyramid, ivec2(texelMax.x, texelMin.y), level).x),
+        max(texelFetch(pyramid, ivec2(texelMin.x, texelMax.y), level).x, texelFetch(pyramid, texelMax, level).x));
+    // the nearest point of the box behind everything drawn there
+    return ndcMin.z > farthest;
+}
+
+void main() {
+    uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint index = group * GROUP_SIZE + gl_LocalInvocationID.x;
+    if (index >= pushConstants.objectCount) {
+        return;
+    }
+
+    Object object = objectData.objects[index];
+    vec3 ndcMin;
+    vec3 ndcMax;
+    bool crossesNear;
+    bool inFrustum = projectBox(object.sphere, ndcMin, ndcMax, crossesNear);
+    bool drawnEarly = visibilityData.visible[index] != 0 && inFrustum;
+
+    bool draw;
+    if (pushConstants.phase == EARLY) {
+        draw = drawnEarly;
+        if (draw) {
+            atomicAdd(counters.earlyDrawCount, 1);
+        }
+    } else {
+        bool occluded = pushConstants.occlusion != 0 && inFrustum && !crossesNear && ndcMin.z >= 0.0
+            && isOccluded(ndcMin, ndcMax);
+        bool visible = inFrustum && !occluded;
+        draw = visible && !drawnEarly;
+        if (!drawnEarly) {
+            if (!inFrustum) {
+                atomicAdd(counters.frustumCulledCount, 1);
+            } else if (occluded) {
+                atomicAdd(counters.occlusionCulledCount, 1);
+            } else {
+                atomicAdd(counters.lateDrawCount, 1);
+            }
+        }
+        visibilityData.visible[index] = visible ? 1 : 0;
+    }
+
+    DrawCommand command;
+    command.indexCount = object.indexCount;
+    command.instanceCount = draw ? 1 : 0;
+    command.firstIndex = object.firstIndex;
+    command.vertexOffset = object.vertexOffset;
+    command.firstInstance = object.firstInstance;
+    drawData.draws[pushConstants.phase * pushConstants.objectCount + index] = command;
+}
@@ -0,0 +1,23 @@
+#version 450
+
+// the group size is chosen from the device limits at pipeline creation (compute::createKernel)
+layout(local_size_x_id = 0) in;
+layout(constant_id = 0) const uint GROUP_SIZE = 64;
+
+layout(push_constant) uniform PushConstants {
+    uint count;
+    uint value;
+} pushConstants;
+
+layout(binding = 0) writeonly buffer Data {
+    uint values[];
+} data;
+
+void main() {
+    // big dispatches spill into y, see compute::getGroupCount
+    uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint index = group * GROUP_SIZE + gl_LocalInvocationID.x;
+    if (index < pushConstants.count) {
+        data.values[index] = pushConstants.value;
+    }
+}
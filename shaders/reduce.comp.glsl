@@ -0,0 +1,43 @@
+#version 450
+
+// one pass of compute::BufferOps::recordSum: each group sums GROUP_SIZE values
+// into one, the next pass sums the partial sums
+layout(local_size_x_id = 0) in;
+layout(constant_id = 0) const uint GROUP_SIZE = 64;
+
+layout(push_constant) uniform PushConstants {
+    uint count;
+    uint unused;
+} pushConstants;
+
+layout(binding = 0) readonly buffer Input {
+    uint values[];
+} inputData;
+
+layout(binding = 1) writeonly buffer Output {
+    uint sums[];
+} outputData;
+
+shared uint partialSums[GROUP_SIZE];
+
+void main() {
+    uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint local = gl_LocalInvocationID.x;
+    uint index = group * GROUP_SIZE + local;
+    partialSums[local] = index < pushConstants.count ? inputData.values[index] : 0;
+    barrier();
+
+    // GROUP_SIZE is a power of two, halved each step
+    for (uint stride = GROUP_SIZE / 2; stride > 0; stride /= 2) {
+        if (local < stride) {
+            partialSums[local] += partialSums[local + stride];
+        }
+        barrier();
+    }
+
+    // a dispatch spilling into y has x * y groups, a few more than the count needs:
+    // the output only has room for the groups with values
+    if (local == 0 && group * GROUP_SIZE < pushConstants.count) {
+        outputData.sums[group] = partialSums[0];
+    }
+}
@@ -0,0 +1,29 @@
+#version 450
+
+/**
+* shader5 for the multi draw indirect of offscreen::Renderer: the draws of all the
+* instances share one descriptor set, the model of an instance is read from a storage
+* buffer at gl_InstanceIndex, the firstInstance of its draw command
+*/
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(std430, binding = 2) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexColor;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * ubo.model * instances.models[gl_InstanceIndex] * vec4(inPosition, 1.0);
+    fragColor = inColor;
+    fragTexColor = inTexCoord;
+}
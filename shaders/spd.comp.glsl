@@ -0,0 +1,215 @@
+#version 450
+
+// mipgen::Downsampler: up to 12 levels of a mip chain (or of a depth pyramid, compiled
+// with DEPTH_PYRAMID, and MULTISAMPLED for an MSAA depth buffer whose samples are reduced
+// too) in one dispatch, after AMD's single pass downsampler.
+// Each group reduces a 64x64 tile of the source to 32x32 texels of level 0 down to 1 texel
+// of level 5. The last group to finish (atomic counter) reduces the whole level 5, 64x64 at
+// most, to levels 6..11.
+//
+// Level sizes are max(size >> level, 1). A texel is the reduction of the 2x2 texels of the
+// level before, clamped to that level: an odd last row or column is dropped.
+layout(local_size_x_id = 0) in;
+// 256: the 16x16 threads of a tile
+layout(constant_id = 0) const uint GROUP_SIZE = 256;
+
+#ifdef DEPTH_PYRAMID
+#define LEVEL_FORMAT r32f
+#else
+#define LEVEL_FORMAT rgba8
+#endif
+
+const uint AVERAGE = 0;
+const uint MIN = 1;
+const uint MAX = 2;
+// levels written per tile
+const uint TILE_LEVEL_COUNT = 6;
+
+layout(push_constant) uniform PushConstants {
+    // level 0
+    uvec2 size;
+    uint levelCount;
+    uint reduction;
+    // the source is sampled through an sRGB view, the levels are UNORM views
+    uint srgb;
+    uint groupCount;
+} pushConstants;
+
+#ifdef MULTISAMPLED
+layout(binding = 0) uniform sampler2DMS source;
+#else
+layout(binding = 0) uniform sampler2D source;
+#endif
+layout(binding = 1, LEVEL_FORMAT) uniform writeonly image2D level0;
+layout(binding = 2, LEVEL_FORMAT) uniform writeonly image2D level1;
+layout(binding = 3, LEVEL_FORMAT) uniform writeonly image2D level2;
+layout(binding = 4, LEVEL_FORMAT) uniform writeonly image2D level3;
+layout(binding = 5, LEVEL_FORMAT) uniform writeonly image2D level4;
+// read back by the last group
+layout(binding = 6, LEVEL_FORMAT) uniform coherent image2D level5;
+layout(binding = 7, LEVEL_FORMAT) uniform writeonly image2D level6;
+layout(binding = 8, LEVEL_FORMAT) uniform writeonly image2D level7;
+layout(binding = 9, LEVEL_FORMAT) uniform writeonly image2D level8;
+layout(binding = 10, LEVEL_FORMAT) uniform writeonly image2D level9;
+layout(binding = 11, LEVEL_FORMAT) uniform writeonly image2D level10;
+layout(binding = 12, LEVEL_FORMAT) uniform writeonly image2D level11;
+
+// zeroed before the dispatch
+layout(binding = 13) coherent buffer Counter {
+    uint finishedGroups;
+} counter;
+
+shared vec4 tile[16][16];
+shared bool lastGroup;
+
+vec4 reduce4(vec4 a, vec4 b, vec4 c, vec4 d) {
+    if (pushConstants.reduction == MIN) {
+        return min(min(a, b), min(c, d));
+    }
+    if (pushConstants.reduction == MAX) {
+        return max(max(a, b), max(c, d));
+    }
+    return (a + b + c + d) * 0.25;
+}
+
+// the samples are summed for an average
+vec4 reduce2(vec4 a, vec4 b) {
+    if (pushConstants.reduction == MIN) {
+        return min(a, b);
+    }
+    if (pushConstants.reduction == MAX) {
+        return max(a, b);
+    }
+    return a + b;
+}
+
+vec3 toLinear(vec3 color) {
+    return mix(color / 12.92, pow((color + 0.055) / 1.055, vec3(2.4)), greaterThan(color, vec3(0.04045)));
+}
+
+vec3 toSrgb(vec3 color) {
+    return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055, greaterThan(color, vec3(0.0031308)));
+}
+
+ivec2 levelSize(uint level) {
+    return ivec2(max(pushConstants.size >> level, uvec2(1)));
+}
+
+void store(uint level, ivec2 coord, vec4 value) {
+    ivec2 size = levelSize(level);
+    if (level >= pushConstants.levelCount || coord.x >= size.x || coord.y >= size.y) {
+        return;
+    }
+#ifndef DEPTH_PYRAMID
+    if (pushConstants.srgb != 0) {
+        value.rgb = toSrgb(value.rgb);
+    }
+#endif
+    switch (level) {
+        case 0: imageStore(level0, coord, value); break;
+        case 1: imageStore(level1, coord, value); break;
+        case 2: imageStore(level2, coord, value); break;
+        case 3: imageStore(level3, coord, value); break;
+        case 4: imageStore(level4, coord, value); break;
+        case 5: imageStore(level5, coord, value); break;
+        case 6: imageStore(level6, coord, value); break;
+        case 7: imageStore(level7, coord, value); break;
+        case 8: imageStore(level8, coord, value); break;
+        case 9: imageStore(level9, coord, value); break;
+        case 10: imageStore(level10, coord, value); break;
+        case 11: imageStore(level11, coord, value); break;
+    }
+}
+
+// a texel of the level before firstLevel (the source or level 5), clamped to its size
+vec4 fetch(uint firstLevel, ivec2 coord) {
+    if (firstLevel == 0) {
+#ifdef MULTISAMPLED
+        ivec2 clamped = min(coord, textureSize(source) - 1);
+        int sampleCount = textureSamples(source);
+        vec4 samples = texelFetch(source, clamped, 0);
+        for (int i = 1; i < sampleCount; i++) {
+            samples = reduce2(samples, texelFetch(source, clamped, i));
+        }
+        return pushConstants.reduction == AVERAGE ? samples / float(sampleCount) : samples;
+#else
+        return texelFetch(source, min(coord, textureSize(source, 0) - 1), 0);
+#endif
+    }
+    vec4 value = imageLoad(level5, min(coord, levelSize(firstLevel - 1) - 1));
+#ifndef DEPTH_PYRAMID
+    if (pushConstants.srgb != 0) {
+        value.rgb = toLinear(value.rgb);
+    }
+#endif
+    return value;
+}
+
+// levels firstLevel..firstLevel+5 of the 32x32 texels of firstLevel at origin
+void downsampleTile(uint firstLevel, ivec2 origin) {
+    ivec2 local = ivec2(gl_LocalInvocationIndex % 16, gl_LocalInvocationIndex / 16);
+
+    // 2x2 texels of firstLevel per thread, from 4x4 of the level before
+    ivec2 base = origin + local * 2;
+    vec4 texels[2][2];
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            ivec2 coord = base + ivec2(x, y);
+            ivec2 from = coord * 2;
+            vec4 value = reduce4(fetch(firstLevel, from), fetch(firstLevel, from + ivec2(1, 0)),
+                fetch(firstLevel, from + ivec2(0, 1)), fetch(firstLevel, from + ivec2(1, 1)));
+            store(firstLevel, coord, value);
+            texels[y][x] = value;
+        }
+    }
+
+    // then 1 texel of the next level, the second column / row clamped to firstLevel
+    ivec2 second = clamp(levelSize(firstLevel) - 1 - base, ivec2(0), ivec2(1));
+    vec4 value = reduce4(texels[0][0], texels[0][second.x], texels[second.y][0], texels[second.y][second.x]);
+    ivec2 tileOrigin = origin / 2;
+    store(firstLevel + 1, tileOrigin + local, value);
+    tile[local.y][local.x] = value;
+
+    // the rest from shared memory, a quarter of the threads each level
+    for (uint step = 2; step < TILE_LEVEL_COUNT; step++) {
+        uint level = firstLevel + step;
+        if (level >= pushConstants.levelCount) {
+            break;
+        }
+        int width = 32 >> step;
+        bool active = local.x < width && local.y < width;
+        barrier();
+        if (active) {
+            ivec2 last = clamp(levelSize(level - 1) - 1 - tileOrigin, ivec2(0), ivec2(2 * width - 1));
+            ivec2 first = min(local * 2, last);
+            ivec2 second = min(local * 2 + 1, last);
+            value = reduce4(tile[first.y][first.x], tile[first.y][second.x],
+                tile[second.y][first.x], tile[second.y][second.x]);
+        }
+        // everybody has read the level before
+        barrier();
+        tileOrigin /= 2;
+        if (active) {
+            store(level, tileOrigin + local, value);
+            tile[local.y][local.x] = value;
+        }
+    }
+}
+
+void main() {
+    downsampleTile(0, ivec2(gl_WorkGroupID.xy) * 32);
+    if (pushConstants.levelCount <= TILE_LEVEL_COUNT) {
+        return;
+    }
+
+    // the level 5 texel of the group was stored by the thread 0
+    if (gl_LocalInvocationIndex == 0) {
+        memoryBarrierImage();
+        lastGroup = atomicAdd(counter.finishedGroups, 1) == pushConstants.groupCount - 1;
+    }
+    barrier();
+    if (lastGroup) {
+        memoryBarrierImage();
+        downsampleTile(TILE_LEVEL_COUNT, ivec2(0));
+    }
+}
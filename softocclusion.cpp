@@ -0,0 +1,669 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "softocclusion.hpp"
+#include "profiler.hpp"
+
+namespace softocclusion {
+
+// what the plane of a triangle may be off by, added to its depth in a tile
+static const float DEPTH_BIAS = 1e-6f;
+static const float FAR_AWAY = 1e30f;
+static const uint32_t FULL_ROW = 0xFFFFFFFFu;
+static const uint32_t BOXES_PER_TASK = 256;
+
+// right shifts of 32 and more give 0, like _mm256_srlv_epi32
+static uint32_t shiftRight(uint32_t value, int count) {
+    return count >= 32 ? 0 : value >> count;
+}
+
+// the pixels [start, end) of a row
+static uint32_t getRowMask(int start, int end) {
+    return shiftRight(FULL_ROW, start) & ~shiftRight(FULL_ROW, end);
+}
+
+bool isAvx2Supported() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+Implementation getBestImplementation() {
+    return isAvx2Supported() ? Avx2 : Scalar;
+}
+
+/**
+ * The x bounds of the triangle on the 8 rows of the tile row at y0: pixel centers in
+ * [left, right) are inside, the rows in [minY, maxY) (the top left rule of the GPU).
+ * Rows out of the triangle get left > right
+ */
+static void getRowBoundsScalar(const Rasterizer::Triangle& triangle, uint32_t y0, float* left, float* right) {
+    float top = static_cast<float>(y0) + 0.5f;
+    for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+        float y = top + static_cast<float>(row);
+        float rowLeft = -FAR_AWAY;
+        float rowRight = FAR_AWAY;
+        for (int edge = 0; edge < 3; edge++) {
+            if (triangle.sides[edge] == 0) {
+                continue;
+            }
+            const glm::vec2& origin = triangle.origins[edge];
+            float x = origin.x + (y - origin.y) * triangle.slopes[edge];
+            if (triangle.sides[edge] > 0) {
+                rowRight = std::min(rowRight, x);
+            } else {
+                rowLeft = std::max(rowLeft, x);
+            }
+        }
+        bool inside = y >= triangle.minY && y < triangle.maxY;
+        left[row] = inside ? rowLeft : FAR_AWAY;
+        right[row] = inside ? rowRight : -FAR_AWAY;
+    }
+}
+
+/** the coverage masks of the tileCount tiles from x0 of a tile row, 8 uint32 per tile */
+static void coverTilesScalar(const float* left, const float* right, uint32_t x0, uint32_t tileCount, uint32_t* coverage) {
+    for (uint32_t tile = 0; tile < tileCount; tile++) {
+        float tileX = static_cast<float>(x0 + tile * TILE_WIDTH);
+        float center = tileX + 0.5f;
+        for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+            // the first pixel with its center at left or after, the first one at right or after:
+            // the two triangles of an edge get the same pixel, no gap, no overlap
+            float start = std::min(std::max(std::ceil(left[row] - center), 0.0f), 32.0f);
+            float end = std::min(std::max(std::ceil(right[row] - center), 0.0f), 32.0f);
+            coverage[tile * TILE_HEIGHT + row] = getRowMask(static_cast<int>(start), static_cast<int>(end));
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/** getRowBoundsScalar, the 8 rows in the lanes: the same operations, the same bits */
+__attribute__((target("avx2")))
+static void getRowBoundsAvx2(const Rasterizer::Triangle& triangle, uint32_t y0, float* left, float* right) {
+    __m256 y = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(y0) + 0.5f),
+        _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    __m256 rowLeft = _mm256_set1_ps(-FAR_AWAY);
+    __m256 rowRight = _mm256_set1_ps(FAR_AWAY);
+    for (int edge = 0; edge < 3; edge++) {
+        if (triangle.sides[edge] == 0) {
+            continue;
+        }
+        const glm::vec2& origin = triangle.origins[edge];
+        __m256 x = _mm256_add_ps(_mm256_set1_ps(origin.x),
+            _mm256_mul_ps(_mm256_sub_ps(y, _mm256_set1_ps(origin.y)), _mm256_set1_ps(triangle.slopes[edge])));
+        if (triangle.sides[edge] > 0) {
+            rowRight = _mm256_min_ps(rowRight, x);
+        } else {
+            rowLeft = _mm256_max_ps(rowLeft, x);
+        }
+    }
+    __m256 inside = _mm256_and_ps(
+        _mm256_cmp_ps(y, _mm256_set1_ps(triangle.minY), _CMP_GE_OQ),
+        _mm256_cmp_ps(y, _mm256_set1_ps(triangle.maxY), _CMP_LT_OQ));
+    _mm256_storeu_ps(left, _mm256_blendv_ps(_mm256_set1_ps(FAR_AWAY), rowLeft, inside));
+    _mm256_storeu_ps(right, _mm256_blendv_ps(_mm256_set1_ps(-FAR_AWAY), rowRight, inside));
+}
+
+/** coverTilesScalar, the 8 rows of a tile at once */
+__attribute__((target("avx2")))
+static void coverTilesAvx2(const float* left, const float* right, uint32_t x0, uint32_t tileCount, uint32_t* coverage) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 width = _mm256_set1_ps(32.0f);
+    const __m256i full = _mm256_set1_epi32(-1);
+    __m256 rowLeft = _mm256_loadu_ps(left);
+    __m256 rowRight = _mm256_loadu_ps(right);
+    for (uint32_t tile = 0; tile < tileCount; tile++) {
+        float tileX = static_cast<float>(x0 + tile * TILE_WIDTH);
+        __m256 center = _mm256_set1_ps(tileX + 0.5f);
+        __m256 start = _mm256_ceil_ps(_mm256_sub_ps(rowLeft, center));
+        __m256 end = _mm256_ceil_ps(_mm256_sub_ps(rowRight, center));
+        start = _mm256_min_ps(_mm256_max_ps(start, zero), width);
+        end = _mm256_min_ps(_mm256_max_ps(end, zero), width);
+        // the variable shifts give 0 past 31
+        __m256i mask = _mm256_andnot_si256(_mm256_srlv_epi32(full, _mm256_cvttps_epi32(end)),
+            _mm256_srlv_epi32(full, _mm256_cvttps_epi32(start)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(coverage + tile * TILE_HEIGHT), mask);
+    }
+}
+
+/** true if the rows of rect not in the mask of the tile are all 0 */
+__attribute__((target("avx2")))
+static bool isRectInMaskAvx2(const Tile& tile, const uint32_t* rect) {
+    __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile.mask));
+    __m256i rows = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rect));
+    return _mm256_testc_si256(mask, rows) != 0;
+}
+#endif
+
+static bool isRectInMaskScalar(const Tile& tile, const uint32_t* rect) {
+    for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+        if ((rect[row] & ~tile.mask[row]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Rasterizer::~Rasterizer() {
+    destroy();
+}
+
+void Rasterizer::init(uint32_t width, uint32_t height, uint32_t threadCount, Implementation implementation) {
+    if (width == 0 || height == 0) {
+        throw std::invalid_argument("software occlusion buffer of size 0!");
+    }
+    destroy();
+    setImplementation(implementation);
+    width_ = width;
+    height_ = height;
+    tilesX_ = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    tilesY_ = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    tiles_.resize(tilesX_ * tilesY_);
+    clear();
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    chunks_.resize(threadCount);
+    for (auto& chunk : chunks_) {
+        chunk.bins.resize(tilesY_);
+    }
+    stopping_ = false;
+    // the calling thread is the first worker
+    for (uint32_t i = 1; i < threadCount; i++) {
+        threads_.emplace_back(&Rasterizer::workerLoop, this);
+    }
+}
+
+void Rasterizer::setImplementation(Implementation implementation) {
+    if (implementation == Avx2 && !isAvx2Supported()) {
+        throw std::invalid_argument("the CPU has no AVX2!");
+    }
+    implementation_ = implementation;
+}
+
+Implementation Rasterizer::getImplementation() const {
+    return implementation_;
+}
+
+void Rasterizer::clear() {
+    for (auto& tile : tiles_) {
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+        tile.zMax0 = 1.0f;
+        tile.zMax1 = 0.0f;
+    }
+}
+
+void Rasterizer::render(const std::vector<Occluder>& occluders, const glm::mat4& viewProjection) {
+    PROFILE_SCOPE("softocclusion::Rasterizer::render");
+    viewProjection_ = viewProjection;
+    uint32_t chunkCount = static_cast<uint32_t>(std::min<size_t>(chunks_.size(), std::max<size_t>(occluders.size(), 1)));
+    for (auto& chunk : chunks_) {
+        chunk.triangles.clear();
+        for (auto& bin : chunk.bins) {
+            bin.clear();
+        }
+        chunk.rejectedCount = 0;
+    }
+
+    // setup then rasterization: a bin needs the triangles of every chunk
+    parallelFor(chunkCount, [&](uint32_t chunk) {
+        setupChunk(occluders, chunk, chunkCount);
+    });
+    std::vector<uint64_t> tileCounts(tilesY_);
+    parallelFor(tilesY_, [&](uint32_t bin) {
+        tileCounts[bin] = rasterizeBin(bin);
+    });
+
+    stats_ = Stats{};
+    stats_.occluderCount = static_cast<uint32_t>(occluders.size());
+    for (const auto& chunk : chunks_) {
+        stats_.triangleCount += static_cast<uint32_t>(chunk.triangles.size());
+        stats_.rejectedTriangleCount += chunk.rejectedCount;
+    }
+    for (uint64_t count : tileCounts) {
+        stats_.tileCount += count;
+    }
+}
+
+void Rasterizer::setupChunk(const std::vector<Occluder>& occluders, uint32_t chunkIndex, uint32_t chunkCount) {
+    Chunk& chunk = chunks_[chunkIndex];
+    size_t first = occluders.size() * chunkIndex / chunkCount;
+    size_t last = occluders.size() * (chunkIndex + 1) / chunkCount;
+    for (size_t o = first; o < last; o++) {
+        const Occluder& occluder = occluders[o];
+        glm::mat4 matrix = viewProjection_ * occluder.model;
+        chunk.clipPositions.resize(occluder.positions.size());
+        for (size_t i = 0; i < occluder.positions.size(); i++) {
+            chunk.clipPositions[i] = matrix * glm::vec4(occluder.positions[i], 1.0f);
+        }
+        for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+            glm::vec4 clip[3] = {
+                chunk.clipPositions[occluder.indices[i]],
+                chunk.clipPositions[occluder.indices[i + 1]],
+                chunk.clipPositions[occluder.indices[i + 2]]
+            };
+            addClippedTriangle(chunk, clip);
+        }
+    }
+}
+
+// signed distances to the clip planes, inside if >= 0: near, left, right, top, bottom
+static float getPlaneDistance(const glm::vec4& clip, int plane) {
+    switch (plane) {
+        case 0: return clip.z;
+        case 1: return clip.x + clip.w;
+        case 2: return clip.w - clip.x;
+        case 3: return clip.y + clip.w;
+        default: return clip.w - clip.y;
+    }
+}
+static const int PLANE_COUNT = 5;
+
+void Rasterizer::addClippedTriangle(Chunk& chunk, const glm::vec4 clip[3]) {
+    uint32_t outsideAll = 0x1F;
+    uint32_t outsideAny = 0;
+    for (int v = 0; v < 3; v++) {
+        uint32_t outside = 0;
+        for (int plane = 0; plane < PLANE_COUNT; plane++) {
+            if (getPlaneDistance(clip[v], plane) < 0.0f) {
+                outside |= 1u << plane;
+            }
+        }
+        outsideAll &= outside;
+        outsideAny |= outside;
+    }
+    if (outsideAll != 0) {
+        chunk.rejectedCount++;
+        return;
+    }
+    if (outsideAny == 0) {
+        addTriangle(chunk, clip);
+        return;
+    }
+
+    // Sutherland-Hodgman against the planes crossed, then a fan
+    glm::vec4 polygon[3 + PLANE_COUNT];
+    glm::vec4 clipped[3 + PLANE_COUNT];
+    int count = 3;
+    std::copy(clip, clip + 3, polygon);
+    for (int plane = 0; plane < PLANE_COUNT && count > 0; plane++) {
+        if ((outsideAny & (1u << plane)) == 0) {
+            continue;
+        }
+        int clippedCount = 0;
+        for (int v = 0; v < count; v++) {
+            const glm::vec4& a = polygon[v];
+            const glm::vec4& b = polygon[(v + 1) % count];
+            float da = getPlaneDistance(a, plane);
+            float db = getPlaneDistance(b, plane);
+            if (da >= 0.0f) {
+                clipped[clippedCount++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                clipped[clippedCount++] = a + (b - a) * (da / (da - db));
+            }
+        }
+        count = clippedCount;
+        std::copy(clipped, clipped + count, polygon);
+    }
+    if (count < 3) {
+        chunk.rejectedCount++;
+        return;
+    }
+    for (int v = 1; v + 1 < count; v++) {
+        glm::vec4 triangle[3] = {polygon[0], polygon[v], polygon[v + 1]};
+        addTriangle(chunk, triangle);
+    }
+}
+
+void Rasterizer::addTriangle(Chunk& chunk, const glm::vec4 clip[3]) {
+    Triangle triangle;
+    for (int v = 0; v < 3; v++) {
+        float inverseW = 1.0f / clip[v].w;
+        triangle.vertices[v] = glm::vec3(
+            (clip[v].x * inverseW * 0.5f + 0.5f) * static_cast<float>(width_),
+            (clip[v].y * inverseW * 0.5f + 0.5f) * static_cast<float>(height_),
+            clip[v].z * inverseW);
+    }
+
+    glm::vec3 e1 = triangle.vertices[1] - triangle.vertices[0];
+    glm::vec3 e2 = triangle.vertices[2] - triangle.vertices[0];
+    float area = e1.x * e2.y - e2.x * e1.y;
+    if (!(std::abs(area) > 1e-8f)) {
+        chunk.rejectedCount++;
+        return;
+    }
+    // one winding: the edges going down bound the right side
+    if (area < 0.0f) {
+        std::swap(triangle.vertices[1], triangle.vertices[2]);
+        std::swap(e1, e2);
+        area = -area;
+    }
+    triangle.dzdx = (e1.z * e2.y - e2.z * e1.y) / area;
+    triangle.dzdy = (e2.z * e1.x - e1.z * e2.x) / area;
+
+    for (int edge = 0; edge < 3; edge++) {
+        glm::vec2 from(triangle.vertices[edge]);
+        glm::vec2 to(triangle.vertices[(edge + 1) % 3]);
+        triangle.sides[edge] = to.y > from.y ? 1 : -1;
+        // from the top: the triangle on the other side of the edge computes the same x
+        if (to.y < from.y) {
+            std::swap(from, to);
+        }
+        triangle.origins[edge] = from;
+        triangle.slopes[edge] = (to.x - from.x) / (to.y - from.y);
+        // horizontal: minY and maxY bound the rows
+        if (!(std::abs(triangle.slopes[edge]) < FAR_AWAY)) {
+            triangle.sides[edge] = 0;
+            triangle.slopes[edge] = 0.0f;
+        }
+    }
+
+    triangle.minX = std::min({triangle.vertices[0].x, triangle.vertices[1].x, triangle.vertices[2].x});
+    triangle.maxX = std::max({triangle.vertices[0].x, triangle.vertices[1].x, triangle.vertices[2].x});
+    triangle.minY = std::min({triangle.vertices[0].y, triangle.vertices[1].y, triangle.vertices[2].y});
+    triangle.maxY = std::max({triangle.vertices[0].y, triangle.vertices[1].y, triangle.vertices[2].y});
+    triangle.minZ = std::min({triangle.vertices[0].z, triangle.vertices[1].z, triangle.vertices[2].z});
+    triangle.maxZ = std::max({triangle.vertices[0].z, triangle.vertices[1].z, triangle.vertices[2].z});
+
+    // the bins of the rows with a pixel center in the triangle
+    int firstRow = static_cast<int>(std::ceil(triangle.minY - 0.5f));
+    int lastRow = static_cast<int>(std::ceil(triangle.maxY - 0.5f)) - 1;
+    firstRow = std::max(firstRow, 0);
+    lastRow = std::min(lastRow, static_cast<int>(height_) - 1);
+    if (firstRow > lastRow || triangle.minZ > 1.0f) {
+        chunk.rejectedCount++;
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>(chunk.triangles.size());
+    chunk.triangles.push_back(triangle);
+    for (int bin = firstRow / static_cast<int>(TILE_HEIGHT); bin <= lastRow / static_cast<int>(TILE_HEIGHT); bin++) {
+        chunk.bins[bin].push_back(index);
+    }
+}
+
+uint64_t Rasterizer::rasterizeBin(uint32_t bin) {
+    uint32_t y0 = bin * TILE_HEIGHT;
+    // the pixels of the tiles on the screen, for the full masks of the last column and row
+    uint32_t lastColumnMask = getRowMask(0, static_cast<int>(width_ - (tilesX_ - 1) * TILE_WIDTH));
+    uint32_t rowCount = std::min(TILE_HEIGHT, height_ - y0);
+    std::vector<uint32_t> coverage(tilesX_ * TILE_HEIGHT);
+    alignas(32) float left[TILE_HEIGHT];
+    alignas(32) float right[TILE_HEIGHT];
+    uint64_t tileCount = 0;
+
+    for (const Chunk& chunk : chunks_) {
+        for (uint32_t index : chunk.bins[bin]) {
+            const Triangle& triangle = chunk.triangles[index];
+            uint32_t firstTile = static_cast<uint32_t>(std::max(triangle.minX, 0.0f)) / TILE_WIDTH;
+            uint32_t lastTile = std::min(static_cast<uint32_t>(std::max(triangle.maxX, 0.0f)) / TILE_WIDTH, tilesX_ - 1);
+            uint32_t tileSpan = lastTile - firstTile + 1;
+
+#if defined(__x86_64__) || defined(__i386__)
+            if (implementation_ == Avx2) {
+                getRowBoundsAvx2(triangle, y0, left, right);
+                coverTilesAvx2(left, right, firstTile * TILE_WIDTH, tileSpan, coverage.data());
+            } else
+#endif
+            {
+                getRowBoundsScalar(triangle, y0, left, right);
+                coverTilesScalar(left, right, firstTile * TILE_WIDTH, tileSpan, coverage.data());
+            }
+
+            // the depth of the triangle over the part of its bounding box in the tile row: a plane
+            // is farthest and nearest at corners of a rectangle
+            float top = std::max(triangle.minY, static_cast<float>(y0));
+            float bottom = std::min(triangle.maxY, static_cast<float>(y0 + TILE_HEIGHT));
+            const glm::vec3& origin = triangle.vertices[0];
+            for (uint32_t i = 0; i < tileSpan; i++) {
+                uint32_t tx = firstTile + i;
+                float tileLeft = std::max(triangle.minX, static_cast<float>(tx * TILE_WIDTH));
+                float tileRight = std::min(triangle.maxX, static_cast<float>((tx + 1) * TILE_WIDTH));
+                float zFar = origin.z + triangle.dzdx * ((triangle.dzdx > 0.0f ? tileRight : tileLeft) - origin.x)
+                    + triangle.dzdy * ((triangle.dzdy > 0.0f ? bottom : top) - origin.y);
+                float zNear = origin.z + triangle.dzdx * ((triangle.dzdx > 0.0f ? tileLeft : tileRight) - origin.x)
+                    + triangle.dzdy * ((triangle.dzdy > 0.0f ? top : bottom) - origin.y);
+                zFar = std::min(std::max(zFar + DEPTH_BIAS, triangle.minZ), triangle.maxZ);
+                zNear = std::min(std::max(zNear, triangle.minZ), triangle.maxZ);
+
+                uint32_t columnMask = tx == tilesX_ - 1 ? lastColumnMask : FULL_ROW;
+                updateTile(tiles_[bin * tilesX_ + tx], &coverage[i * TILE_HEIGHT], zNear, zFar, columnMask, rowCount);
+                tileCount++;
+            }
+        }
+    }
+    return tileCount;
+}
+
+void Rasterizer::updateTile(Tile& tile, const uint32_t coverage[TILE_HEIGHT], float zNear, float zFar,
+    uint32_t columnMask, uint32_t rowCount) const {
+    uint32_t covered = 0;
+    for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+        covered |= coverage[row];
+    }
+    // nothing covered, or behind everything already
+    if (covered == 0 || zNear >= tile.zMax0) {
+        return;
+    }
+
+    // much nearer than the mask: a fresh start is a better bet than merging far and near
+    float distanceToMask = tile.zMax1 - zFar;
+    float maskToFar = tile.zMax0 - tile.zMax1;
+    if (distanceToMask > maskToFar) {
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+        tile.zMax1 = 0.0f;
+    }
+    tile.zMax1 = std::max(tile.zMax1, zFar);
+    bool full = true;
+    for (uint32_t row = 0; row < TILE_HEIGHT; row++) {
+        tile.mask[row] |= coverage[row];
+        if (row < rowCount && (tile.mask[row] & columnMask) != columnMask) {
+            full = false;
+        }
+    }
+    // every pixel behind zMax1: it bounds the whole tile
+    if (full) {
+        tile.zMax0 = std::min(tile.zMax0, tile.zMax1);
+        tile.zMax1 = 0.0f;
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+    }
+}
+
+ScreenBounds Rasterizer::getScreenBounds(const Box& box) const {
+    ScreenBounds bounds;
+    // a bit per plane all the corners are out of: left, right, top, bottom, near, far
+    uint32_t outside = 0x3F;
+    glm::vec2 ndcMin(FAR_AWAY);
+    glm::vec2 ndcMax(-FAR_AWAY);
+    bounds.minZ = FAR_AWAY;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+            (i & 4) ? box.max.z : box.min.z);
+        glm::vec4 clip = viewProjection_ * glm::vec4(corner, 1.0f);
+        uint32_t planes = 0;
+        planes |= clip.x < -clip.w ? 1 : 0;
+        planes |= clip.x > clip.w ? 2 : 0;
+        planes |= clip.y < -clip.w ? 4 : 0;
+        planes |= clip.y > clip.w ? 8 : 0;
+        planes |= clip.z < 0.0f ? 16 : 0;
+        planes |= clip.z > clip.w ? 32 : 0;
+        outside &= planes;
+        if (clip.z < 0.0f) {
+            bounds.crossesNear = true;
+            continue;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        ndcMin = glm::min(ndcMin, glm::vec2(ndc));
+        ndcMax = glm::max(ndcMax, glm::vec2(ndc));
+        bounds.minZ = std::min(bounds.minZ, ndc.z);
+    }
+    bounds.outOfFrustum = outside != 0;
+    if (bounds.outOfFrustum || bounds.crossesNear) {
+        return bounds;
+    }
+
+    // every pixel the rectangle touches
+    auto toPixel = [](float ndc, uint32_t size) {
+        float pixel = std::floor((ndc * 0.5f + 0.5f) * static_cast<float>(size));
+        return static_cast<int>(std::min(std::max(pixel, 0.0f), static_cast<float>(size - 1)));
+    };
+    bounds.minX = toPixel(ndcMin.x, width_);
+    bounds.maxX = toPixel(ndcMax.x, width_);
+    bounds.minY = toPixel(ndcMin.y, height_);
+    bounds.maxY = toPixel(ndcMax.y, height_);
+    return bounds;
+}
+
+Visibility Rasterizer::testBox(const Box& box) const {
+    ScreenBounds bounds = getScreenBounds(box);
+    if (bounds.outOfFrustum) {
+        return OutOfFrustum;
+    }
+    if (bounds.crossesNear) {
+        return Visible;
+    }
+
+    uint32_t rect[TILE_HEIGHT];
+    for (int ty = bounds.minY / static_cast<int>(TILE_HEIGHT); ty <= bounds.maxY / static_cast<int>(TILE_HEIGHT); ty++) {
+        int y0 = ty * static_cast<int>(TILE_HEIGHT);
+        for (int tx = bounds.minX / static_cast<int>(TILE_WIDTH); tx <= bounds.maxX / static_cast<int>(TILE_WIDTH); tx++) {
+            const Tile& tile = tiles_[ty * tilesX_ + tx];
+            // in front of the farthest pixel of the tile: visible unless masked by a nearer layer
+            if (bounds.minZ <= tile.zMax0) {
+                if (bounds.minZ <= tile.zMax1) {
+                    return Visible;
+                }
+                int x0 = tx * static_cast<int>(TILE_WIDTH);
+                uint32_t rowMask = getRowMask(std::max(bounds.minX - x0, 0), std::min(bounds.maxX - x0 + 1, 32));
+                for (int row = 0; row < static_cast<int>(TILE_HEIGHT); row++) {
+                    bool inside = y0 + row >= bounds.minY && y0 + row <= bounds.maxY;
+                    rect[row] = inside ? rowMask : 0u;
+                }
+                bool inMask;
+#if defined(__x86_64__) || defined(__i386__)
+                if (implementation_ == Avx2) {
+                    inMask = isRectInMaskAvx2(tile, rect);
+                } else
+#endif
+                {
+                    inMask = isRectInMaskScalar(tile, rect);
+                }
+                if (!inMask) {
+                    return Visible;
+                }
+            }
+        }
+    }
+    return Occluded;
+}
+
+void Rasterizer::testBoxes(const std::vector<Box>& boxes, std::vector<Visibility>& visibilities) {
+    PROFILE_SCOPE("softocclusion::Rasterizer::testBoxes");
+    visibilities.resize(boxes.size());
+    uint32_t taskCount = static_cast<uint32_t>((boxes.size() + BOXES_PER_TASK - 1) / BOXES_PER_TASK);
+    parallelFor(taskCount, [&](uint32_t task) {
+        size_t last = std::min<size_t>(boxes.size(), (task + 1) * BOXES_PER_TASK);
+        for (size_t i = task * BOXES_PER_TASK; i < last; i++) {
+            visibilities[i] = testBox(boxes[i]);
+        }
+    });
+}
+
+float Rasterizer::getPixelDepth(uint32_t x, uint32_t y) const {
+    const Tile& tile = tiles_[(y / TILE_HEIGHT) * tilesX_ + x / TILE_WIDTH];
+    bool masked = (tile.mask[y % TILE_HEIGHT] >> (31 - x % TILE_WIDTH)) & 1;
+    return masked ? std::min(tile.zMax0, tile.zMax1) : tile.zMax0;
+}
+
+void Rasterizer::parallelFor(uint32_t count, const std::function<void(uint32_t)>& work) {
+    if (threads_.empty() || count <= 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            work(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work_ = &work;
+        workCount_ = count;
+        nextWork_ = 0;
+        busyCount_ = static_cast<uint32_t>(threads_.size());
+        generation_++;
+    }
+    started_.notify_all();
+
+    for (uint32_t i = nextWork_++; i < count; i = nextWork_++) {
+        work(i);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [this]() { return busyCount_ == 0; });
+    work_ = nullptr;
+}
+
+void Rasterizer::workerLoop() {
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        started_.wait(lock, [&]() { return stopping_ || generation_ != seenGeneration; });
+        if (stopping_) {
+            return;
+        }
+        seenGeneration = generation_;
+        const std::function<void(uint32_t)>* work = work_;
+        uint32_t count = workCount_;
+        lock.unlock();
+
+        for (uint32_t i = nextWork_++; i < count; i = nextWork_++) {
+            (*work)(i);
+        }
+
+        lock.lock();
+        if (--busyCount_ == 0) {
+            finished_.notify_one();
+        }
+    }
+}
+
+uint32_t Rasterizer::getWidth() const {
+    return width_;
+}
+
+uint32_t Rasterizer::getHeight() const {
+    return height_;
+}
+
+uint32_t Rasterizer::getThreadCount() const {
+    return static_cast<uint32_t>(threads_.size()) + 1;
+}
+
+const std::vector<Tile>& Rasterizer::getTiles() const {
+    return tiles_;
+}
+
+const Stats& Rasterizer::getLastStats() const {
+    return stats_;
+}
+
+void Rasterizer::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    started_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+}
+
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "glm/glm.hpp"
+
+namespace softocclusion {
+
+/**
+ * Occlusion culling on the CPU, after Intel's masked software occlusion culling: a few
+ * occluder meshes (walls, big buildings: tagged by the caller) are rasterized into a small
+ * conservative depth buffer, then the bounding boxes of all the objects are tested against it.
+ * No GPU pass competing with the frame, no frame of latency: for lavapipe and small GPUs,
+ * where occlusion::Culler costs more than it saves.
+ *
+ * The buffer is made of 32x8 pixel tiles. A tile keeps no depth per pixel but two layers:
+ * zMax0, the farthest depth of the whole tile, and zMax1, the farthest depth of the pixels
+ * of its coverage mask (a bit per pixel, a uint32 per row). A triangle adds its coverage
+ * to the mask and its farthest depth in the tile to zMax1; once the mask is full zMax1
+ * becomes zMax0. A triangle much nearer than the mask discards it. Every depth is an upper
+ * bound of the depth of the pixels: an object is occluded only if its nearest point is behind
+ * every pixel of its screen rectangle.
+ *
+ * Conservative: the pixels a triangle covers are the ones whose center is inside it (the top
+ * left rule, watertight: the two triangles of a quad leave no gap on the diagonal), an object
+ * covers every pixel its rectangle touches. An occluded object may be reported visible, never
+ * the other way around (up to the float rounding of the edges, a fraction of a pixel).
+ *
+ * Screen space is the one of the Vulkan viewport: the matrices are ubo.proj * ubo.view of
+ * updateUniformBuffer (y flipped by proj[1][1] *= -1, 0..1 depth of GLM_FORCE_DEPTH_ZERO_TO_ONE,
+ * depth test LESS). Triangles are clipped against the near plane and the sides of the screen,
+ * both windings are rasterized (occluders need not be closed).
+ *
+ * Binned and parallel: the triangles are transformed, clipped and set up per chunk of
+ * occluders, each listed in the bins (rows of tiles) it overlaps. Each bin is then rasterized
+ * by one thread, the triangles in the order of the occluders: the result does not depend on
+ * the thread count. The rows of a tile are rasterized together, 8 lanes of AVX2 when the CPU
+ * has it, one at a time by the scalar reference otherwise. Both give the same bits.
+ * The threads are started once by init and wait between the calls
+ */
+const uint32_t TILE_WIDTH = 32;
+const uint32_t TILE_HEIGHT = 8;
+
+enum Implementation {
+    /** one row at a time: the reference */
+    Scalar,
+    /** the 8 rows of a tile at once */
+    Avx2
+};
+
+bool isAvx2Supported();
+
+/** Avx2 if supported */
+Implementation getBestImplementation();
+
+struct Occluder {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    /** model to world, the viewProjection of render does the rest */
+    glm::mat4 model{1.0f};
+};
+
+/** a world space bounding box */
+struct Box {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+enum Visibility {
+    Visible,
+    OutOfFrustum,
+    Occluded
+};
+
+/** the screen rectangle of a box and its nearest depth, as testBox sees it */
+struct ScreenBounds {
+    /** pixels, inclusive, clamped to the buffer */
+    int minX = 0;
+    int minY = 0;
+    int maxX = 0;
+    int maxY = 0;
+    float minZ = 0.0f;
+    /** a corner is in front of the near plane: never occluded */
+    bool crossesNear = false;
+    bool outOfFrustum = false;
+};
+
+struct Tile {
+    /** a row of pixels per uint32, the leftmost pixel in the highest bit */
+    uint32_t mask[TILE_HEIGHT];
+    /** the farthest depth of every pixel of the tile */
+    float zMax0;
+    /** the farthest depth of the pixels of mask */
+    float zMax1;
+};
+
+/** the last render */
+struct Stats {
+    uint32_t occluderCount = 0;
+    /** after clipping, the ones set up for rasterization */
+    uint32_t triangleCount = 0;
+    /** out of the screen or behind the near plane, degenerate */
+    uint32_t rejectedTriangleCount = 0;
+    /** triangle and tile pairs rasterized */
+    uint64_t tileCount = 0;
+};
+
+class Rasterizer {
+public:
+    Rasterizer() = default;
+    Rasterizer(const Rasterizer&) = delete;
+    Rasterizer& operator=(const Rasterizer&) = delete;
+    ~Rasterizer();
+
+    /**
+     * width x height pixels, rounded up to whole tiles (320x192 is plenty, the tests are
+     * conservative anyway). threadCount: the calling thread included, 0 for
+     * std::thread::hardware_concurrency
+     */
+    void init(uint32_t width, uint32_t height, uint32_t threadCount = 0,
+        Implementation implementation = getBestImplementation());
+
+    /** throws std::invalid_argument for Avx2 on a CPU without it */
+    void setImplementation(Implementation implementation);
+    Implementation getImplementation() const;
+
+    /** every tile empty: nothing occluded */
+    void clear();
+
+    /** the occluders over what is already there, seen through viewProjection (proj * view) */
+    void render(const std::vector<Occluder>& occluders, const glm::mat4& viewProjection);
+
+    /** through the viewProjection of the last render */
+    Visibility testBox(const Box& box) const;
+    /** testBox of each box, in parallel */
+    void testBoxes(const std::vector<Box>& boxes, std::vector<Visibility>& visibilities);
+
+    ScreenBounds getScreenBounds(const Box& box) const;
+
+    /** the conservative depth of a pixel: what the tests compare against */
+    float getPixelDepth(uint32_t x, uint32_t y) const;
+
+    uint32_t getWidth() const;
+    uint32_t getHeight() const;
+    uint32_t getThreadCount() const;
+    const std::vector<Tile>& getTiles() const;
+    const Stats& getLastStats() const;
+
+    /** joins the threads */
+    void destroy();
+
+    /** a triangle set up in screen space, counterclockwise (y down) */
+    struct Triangle {
+        /** x, y in pixels, z the depth */
+        glm::vec3 vertices[3];
+        /**
+         * per edge: x at the row y, origins[e].x + (y - origins[e].y) * slopes[e]. The origin
+         * is the top vertex of the edge, whatever the winding: bit exact on shared edges
+         */
+        glm::vec2 origins[3];
+        float slopes[3];
+        /** per edge: 1 the edge bounds the right side, -1 the left one, 0 horizontal */
+        int sides[3];
+        float minX;
+        float maxX;
+        float minY;
+        float maxY;
+        float minZ;
+        float maxZ;
+        /** the plane of the depth: z = vertices[0].z + dzdx * (x - x0) + dzdy * (y - y0) */
+        float dzdx;
+        float dzdy;
+    };
+
+private:
+    /** the triangles of a chunk of occluders, and their indices per bin */
+    struct Chunk {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<uint32_t>> bins;
+        /** the vertices of the occluder being set up */
+        std::vector<glm::vec4> clipPositions;
+        uint32_t rejectedCount = 0;
+    };
+
+    void setupChunk(const std::vector<Occluder>& occluders, uint32_t chunkIndex, uint32_t chunkCount);
+    void addTriangle(Chunk& chunk, const glm::vec4 clip[3]);
+    void addClippedTriangle(Chunk& chunk, const glm::vec4 clip[3]);
+    uint64_t rasterizeBin(uint32_t bin);
+    /** columnMask, rowCount: the pixels of the tile on the screen, for the tiles of the edges */
+    void updateTile(Tile& tile, const uint32_t coverage[TILE_HEIGHT], float zNear, float zFar,
+        uint32_t columnMask, uint32_t rowCount) const;
+
+    /** work(i) for i in [0, count), on all the threads */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& work);
+    void workerLoop();
+
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t tilesX_ = 0;
+    uint32_t tilesY_ = 0;
+    Implementation implementation_ = Scalar;
+    std::vector<Tile> tiles_;
+    glm::mat4 viewProjection_{1.0f};
+    std::vector<Chunk> chunks_;
+    Stats stats_;
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable started_;
+    std::condition_variable finished_;
+    const std::function<void(uint32_t)>* work_ = nullptr;
+    uint32_t workCount_ = 0;
+    std::atomic<uint32_t> nextWork_{0};
+    /** bumped by each parallelFor, the workers run once per value */
+    uint64_t generation_ = 0;
+    uint32_t busyCount_ = 0;
+    bool stopping_ = false;
+};
+
+}
@@ -0,0 +1,405 @@
+/**
+ * Bench and checks of the CPU masked occlusion culling (softocclusion::Rasterizer) in a
+ * generated city: --occluders buildings (boxes of 12 triangles) and a ground, the occluders,
+ * then --boxes small bounding boxes spread among them, the queries. The camera stands in
+ * the street like the one of hello_model_1's updateUniformBuffer (45 degrees, 0.1 to 100
+ * scaled to the city, y flipped), the matrices given to the rasterizer are proj * view.
+ *
+ * Microbenchmarks, per implementation (scalar, AVX2 when the CPU has it) with 1 and
+ * --threads threads: clear + render in occluders/ms, testBoxes in queries/ms.
+ *
+ * Checks, the bench fails if one does not hold:
+ * - every implementation and thread count gives the bits of the scalar one on 1 thread,
+ *   tiles and visibilities
+ * - conservative: against a reference rasterizer (double precision, a depth per pixel, the
+ *   pixels whose center is in a triangle or within the float rounding of its edges), no
+ *   pixel is nearer than the reference, and every box reported occluded is behind the
+ *   reference depth of all the pixels of its rectangle.
+ *   Also printed: the share of the boxes the reference culls that the masked buffer culls
+ * - simple cases: a wall in front of the camera, boxes behind, in front, across the near
+ *   plane and out of the frustum
+ *
+ * usage: softocclusion_bench [--occluders N] [--boxes B] [--extent E] [--width X] [--height Y]
+ *                            [--threads T] [--repeats R] [--seed S]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// the culling expects the 0..1 clip depth of Vulkan
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "softocclusion.hpp"
+#include "scene.hpp"
+
+// what float depths may be off by compared to the double precision reference
+const double DEPTH_TOLERANCE = 1e-5;
+// and the edges, in pixels
+const double EDGE_TOLERANCE = 1e-3;
+
+struct BenchOptions {
+    uint32_t occluderCount = 256;
+    uint32_t boxCount = 10000;
+    float extent = 50.0f;
+    uint32_t width = 320;
+    uint32_t height = 192;
+    uint32_t threadCount = 0;
+    uint32_t repeatCount = 50;
+    uint64_t seed = 1;
+};
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        if (name == "--occluders") {
+            options.occluderCount = number;
+        } else if (name == "--boxes") {
+            options.boxCount = number;
+        } else if (name == "--extent") {
+            options.extent = std::strtof(value.c_str(), nullptr);
+        } else if (name == "--width") {
+            options.width = number;
+        } else if (name == "--height") {
+            options.height = number;
+        } else if (name == "--threads") {
+            options.threadCount = number;
+        } else if (name == "--repeats") {
+            options.repeatCount = number;
+        } else if (name == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    if (options.threadCount == 0) {
+        options.threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return options;
+}
+
+/** a unit cube centered on 0, placed by model */
+static softocclusion::Occluder makeBox(const glm::mat4& model) {
+    std::vector<vertex3::Vertex> vertices;
+    softocclusion::Occluder occluder;
+    scene::makeCube(12, vertices, occluder.indices);
+    for (const auto& vertex : vertices) {
+        occluder.positions.push_back(vertex.pos);
+    }
+    occluder.model = model;
+    return occluder;
+}
+
+struct City {
+    std::vector<softocclusion::Occluder> occluders;
+    std::vector<softocclusion::Box> boxes;
+    glm::mat4 viewProjection;
+};
+
+/** z up, the buildings and the boxes in [-extent, extent]^2, the camera at the south edge */
+static City makeCity(const BenchOptions& options) {
+    City city;
+    scene::Random random(options.seed);
+    float extent = options.extent;
+    // the ground, under the boxes
+    city.occluders.push_back(makeBox(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.5f)),
+        glm::vec3(2.0f * extent, 2.0f * extent, 1.0f))));
+    for (uint32_t i = 1; i < options.occluderCount; i++) {
+        glm::vec3 size(random.nextFloat(2.0f, 8.0f), random.nextFloat(2.0f, 8.0f), random.nextFloat(4.0f, 20.0f));
+        glm::vec3 center(random.nextFloat(-extent, extent), random.nextFloat(-0.8f * extent, extent), 0.5f * size.z);
+        city.occluders.push_back(makeBox(glm::scale(glm::translate(glm::mat4(1.0f), center), size)));
+    }
+    for (uint32_t i = 0; i < options.boxCount; i++) {
+        glm::vec3 size(random.nextFloat(0.3f, 2.0f), random.nextFloat(0.3f, 2.0f), random.nextFloat(0.3f, 2.0f));
+        glm::vec3 corner(random.nextFloat(-extent, extent), random.nextFloat(-extent, extent), random.nextFloat(0.0f, 6.0f));
+        city.boxes.push_back({corner, corner + size});
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, -1.1f * extent, 2.0f), glm::vec3(0.0f, 0.0f, 2.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), options.width / static_cast<float>(options.height),
+        0.1f, 4.0f * extent);
+    proj[1][1] *= -1;
+    city.viewProjection = proj * view;
+    return city;
+}
+
+/** the depth of every pixel: the nearest triangle covering the pixel center, EDGE_TOLERANCE included */
+static std::vector<double> renderReference(const std::vector<softocclusion::Occluder>& occluders,
+    const glm::mat4& viewProjection, uint32_t width, uint32_t height) {
+    std::vector<double> depths(width * height, 1.0);
+    for (const auto& occluder : occluders) {
+        glm::mat4 matrix = viewProjection * occluder.model;
+        for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+            // clipped against the near plane only, the screen bounds the pixels
+            glm::dvec4 polygon[4];
+            int count = 0;
+            for (int v = 0; v < 3; v++) {
+                glm::vec4 a = matrix * glm::vec4(occluder.positions[occluder.indices[i + v]], 1.0f);
+                glm::vec4 b = matrix * glm::vec4(occluder.positions[occluder.indices[i + (v + 1) % 3]], 1.0f);
+                glm::dvec4 da(a.x, a.y, a.z, a.w);
+                glm::dvec4 db(b.x, b.y, b.z, b.w);
+                if (da.z >= 0.0) {
+                    polygon[count++] = da;
+                }
+                if ((da.z >= 0.0) != (db.z >= 0.0)) {
+                    polygon[count++] = da + (db - da) * (da.z / (da.z - db.z));
+                }
+            }
+            for (int t = 1; t + 1 < count; t++) {
+                glm::dvec3 screen[3];
+                int corners[3] = {0, t, t + 1};
+                for (int v = 0; v < 3; v++) {
+                    const glm::dvec4& clip = polygon[corners[v]];
+                    screen[v] = glm::dvec3((clip.x / clip.w * 0.5 + 0.5) * width, (clip.y / clip.w * 0.5 + 0.5) * height,
+                        clip.z / clip.w);
+                }
+                double area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y)
+                    - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+                if (area == 0.0) {
+                    continue;
+                }
+                double minX = std::min({screen[0].x, screen[1].x, screen[2].x});
+                double maxX = std::max({screen[0].x, screen[1].x, screen[2].x});
+                double minY = std::min({screen[0].y, screen[1].y, screen[2].y});
+                double maxY = std::max({screen[0].y, screen[1].y, screen[2].y});
+                int x0 = std::max(static_cast<int>(std::floor(minX)), 0);
+                int x1 = std::min(static_cast<int>(std::ceil(maxX)), static_cast<int>(width) - 1);
+                int y0 = std::max(static_cast<int>(std::floor(minY)), 0);
+                int y1 = std::min(static_cast<int>(std::ceil(maxY)), static_cast<int>(height) - 1);
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        double px = x + 0.5;
+                        double py = y + 0.5;
+                        // the barycentric coordinates, the signed distances to the edges
+                        double weights[3];
+                        bool inside = true;
+                        for (int v = 0; v < 3; v++) {
+                            const glm::dvec3& a = screen[(v + 1) % 3];
+                            const glm::dvec3& b = screen[(v + 2) % 3];
+                            double edge = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+                            weights[v] = edge / area;
+                            double length = std::sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y));
+                            inside = inside && edge * (area > 0.0 ? 1.0 : -1.0) >= -EDGE_TOLERANCE * length;
+                        }
+                        if (!inside) {
+                            continue;
+                        }
+                        double z = weights[0] * screen[0].z + weights[1] * screen[1].z + weights[2] * screen[2].z;
+                        double& depth = depths[y * width + x];
+                        depth = std::min(depth, z);
+                    }
+                }
+            }
+        }
+    }
+    return depths;
+}
+
+/** every pixel of the rectangle of the box is nearer than the box */
+static bool isOccludedByReference(const std::vector<double>& depths, uint32_t width,
+    const softocclusion::ScreenBounds& bounds) {
+    if (bounds.outOfFrustum || bounds.crossesNear) {
+        return false;
+    }
+    for (int y = bounds.minY; y <= bounds.maxY; y++) {
+        for (int x = bounds.minX; x <= bounds.maxX; x++) {
+            if (bounds.minZ <= depths[y * width + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool checkSameBits(const softocclusion::Rasterizer& rasterizer, const std::vector<softocclusion::Visibility>& visibilities,
+    const softocclusion::Rasterizer& expected, const std::vector<softocclusion::Visibility>& expectedVisibilities) {
+    const auto& tiles = rasterizer.getTiles();
+    const auto& expectedTiles = expected.getTiles();
+    return tiles.size() == expectedTiles.size()
+        && std::memcmp(tiles.data(), expectedTiles.data(), tiles.size() * sizeof(softocclusion::Tile)) == 0
+        && visibilities == expectedVisibilities;
+}
+
+static bool checkConservative(const softocclusion::Rasterizer& rasterizer, const City& city,
+    const std::vector<softocclusion::Visibility>& visibilities) {
+    uint32_t width = rasterizer.getWidth();
+    uint32_t height = rasterizer.getHeight();
+    std::vector<double> depths = renderReference(city.occluders, city.viewProjection, width, height);
+
+    uint32_t nearerPixelCount = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            if (rasterizer.getPixelDepth(x, y) < depths[y * width + x] - DEPTH_TOLERANCE) {
+                nearerPixelCount++;
+            }
+        }
+    }
+
+    uint32_t wrongCount = 0;
+    uint32_t referenceCount = 0;
+    uint32_t culledCount = 0;
+    for (size_t i = 0; i < city.boxes.size(); i++) {
+        softocclusion::ScreenBounds bounds = rasterizer.getScreenBounds(city.boxes[i]);
+        bool occluded = isOccludedByReference(depths, width, bounds);
+        referenceCount += occluded ? 1 : 0;
+        if (visibilities[i] == softocclusion::Occluded) {
+            culledCount++;
+            // the reference is exact: a box it sees is seen, whatever the tolerance
+            bounds.minZ += static_cast<float>(DEPTH_TOLERANCE);
+            if (!isOccludedByReference(depths, width, bounds)) {
+                wrongCount++;
+            }
+        }
+    }
+
+    bool passed = nearerPixelCount == 0 && wrongCount == 0;
+    std::cout << "reference: " << nearerPixelCount << " pixels nearer than the reference, " << wrongCount
+        << " boxes wrongly occluded, " << culledCount << " of the " << referenceCount
+        << " boxes the reference occludes culled (" << std::setprecision(3)
+        << (referenceCount > 0 ? 100.0 * culledCount / referenceCount : 100.0) << "%) "
+        << (passed ? "OK" : "FAILED") << '\n';
+    return passed;
+}
+
+/** a wall filling the screen at 10 units, the camera at 0 looking along -z */
+static bool checkSimpleCases(const BenchOptions& options, softocclusion::Implementation implementation) {
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), options.width / static_cast<float>(options.height), 0.1f, 100.0f);
+    proj[1][1] *= -1;
+    std::vector<softocclusion::Occluder> occluders = {
+        makeBox(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -10.5f)), glm::vec3(100.0f, 100.0f, 1.0f)))
+    };
+    softocclusion::Rasterizer rasterizer;
+    rasterizer.init(options.width, options.height, options.threadCount, implementation);
+    rasterizer.render(occluders, proj);
+
+    struct Case {
+        const char* name;
+        softocclusion::Box box;
+        softocclusion::Visibility expected;
+    };
+    const Case cases[] = {
+        {"behind the wall", {{-1.0f, -1.0f, -13.0f}, {1.0f, 1.0f, -12.0f}}, softocclusion::Occluded},
+        {"in front of the wall", {{-1.0f, -1.0f, -6.0f}, {1.0f, 1.0f, -5.0f}}, softocclusion::Visible},
+        {"through the wall", {{-1.0f, -1.0f, -12.0f}, {1.0f, 1.0f, -9.0f}}, softocclusion::Visible},
+        {"across the near plane", {{-1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, 1.0f}}, softocclusion::Visible},
+        {"behind the camera", {{-1.0f, -1.0f, 2.0f}, {1.0f, 1.0f, 3.0f}}, softocclusion::OutOfFrustum},
+        {"beyond the far plane", {{-1.0f, -1.0f, -300.0f}, {1.0f, 1.0f, -200.0f}}, softocclusion::OutOfFrustum},
+    };
+    bool passed = true;
+    for (const Case& c : cases) {
+        if (rasterizer.testBox(c.box) != c.expected) {
+            std::cout << "simple case " << c.name << " FAILED\n";
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+struct Result {
+    std::string name;
+    double occludersPerMs;
+    double trianglesPerMs;
+    double queriesPerMs;
+    uint32_t occludedCount;
+};
+
+static bool run(const BenchOptions& options) {
+    City city = makeCity(options);
+    std::vector<softocclusion::Implementation> implementations = {softocclusion::Scalar};
+    if (softocclusion::isAvx2Supported()) {
+        implementations.push_back(softocclusion::Avx2);
+    }
+    std::vector<uint32_t> threadCounts = {1};
+    if (options.threadCount > 1) {
+        threadCounts.push_back(options.threadCount);
+    }
+
+    std::cout << options.occluderCount << " occluders, " << options.boxCount << " boxes, " << options.width
+        << "x" << options.height << " pixels, AVX2 " << (softocclusion::isAvx2Supported() ? "yes" : "no") << "\n\n";
+
+    bool passed = true;
+    softocclusion::Rasterizer reference;
+    reference.init(options.width, options.height, 1, softocclusion::Scalar);
+    reference.render(city.occluders, city.viewProjection);
+    std::vector<softocclusion::Visibility> referenceVisibilities;
+    reference.testBoxes(city.boxes, referenceVisibilities);
+    const softocclusion::Stats& stats = reference.getLastStats();
+    std::cout << stats.triangleCount << " triangles set up, " << stats.rejectedTriangleCount << " rejected, "
+        << stats.tileCount << " tiles rasterized\n";
+    passed = checkConservative(reference, city, referenceVisibilities) && passed;
+
+    std::vector<Result> results;
+    for (softocclusion::Implementation implementation : implementations) {
+        if (!checkSimpleCases(options, implementation)) {
+            passed = false;
+        }
+        for (uint32_t threadCount : threadCounts) {
+            softocclusion::Rasterizer rasterizer;
+            rasterizer.init(options.width, options.height, threadCount, implementation);
+            std::vector<softocclusion::Visibility> visibilities;
+
+            double renderMs = 0.0;
+            double testMs = 0.0;
+            for (uint32_t repeat = 0; repeat < options.repeatCount; repeat++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                rasterizer.clear();
+                rasterizer.render(city.occluders, city.viewProjection);
+                auto rendered = std::chrono::high_resolution_clock::now();
+                rasterizer.testBoxes(city.boxes, visibilities);
+                auto tested = std::chrono::high_resolution_clock::now();
+                renderMs += std::chrono::duration<double, std::milli>(rendered - start).count();
+                testMs += std::chrono::duration<double, std::milli>(tested - rendered).count();
+            }
+
+            Result result;
+            result.name = std::string(implementation == softocclusion::Avx2 ? "avx2" : "scalar")
+                + ", " + std::to_string(threadCount) + (threadCount == 1 ? " thread" : " threads");
+            result.occludersPerMs = options.repeatCount * city.occluders.size() / renderMs;
+            result.trianglesPerMs = options.repeatCount * static_cast<double>(rasterizer.getLastStats().triangleCount) / renderMs;
+            result.queriesPerMs = options.repeatCount * city.boxes.size() / testMs;
+            result.occludedCount = static_cast<uint32_t>(std::count(visibilities.begin(), visibilities.end(), softocclusion::Occluded));
+            results.push_back(result);
+
+            if (!checkSameBits(rasterizer, visibilities, reference, referenceVisibilities)) {
+                std::cout << result.name << ": not the bits of the scalar reference FAILED\n";
+                passed = false;
+            }
+        }
+    }
+
+    std::cout << '\n' << std::left << std::setw(20) << "implementation" << std::right << std::setw(14) << "occluders/ms"
+        << std::setw(14) << "triangles/ms" << std::setw(14) << "queries/ms" << std::setw(10) << "occluded" << '\n';
+    for (const Result& result : results) {
+        std::cout << std::left << std::setw(20) << result.name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << result.occludersPerMs << std::setw(14) << result.trianglesPerMs
+            << std::setw(14) << result.queriesPerMs << std::setw(10) << result.occludedCount << '\n';
+    }
+    std::cout << '\n' << (passed ? "all checks OK" : "checks FAILED") << '\n';
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (!run(parseOptions(argc, argv))) {
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
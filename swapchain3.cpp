@@ -7,6 +7,7 @@
 #include <array>
 
 #include "swapchain3.hpp"
+#include "profiler.hpp"
 #include "device.hpp"
 #include "image2.hpp"
 
@@ -101,18 +102,13 @@ VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& avai
     * So if Vulkan doesn't fix the swap extent for us, we can't just use the original {WIDTH, HEIGHT}. 
     * Instead, we must use glfwGetFramebufferSize to query the resolution of the window in pixel before 
     * matching it against the minimum and maximum image extent.
+    * That is getFramebufferExtent, on the main thread: framebufferExtent is what it returned
 */
-VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* window) {
+VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D framebufferExtent) {
     if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
         return capabilities.currentExtent;
     } else {
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-
-        VkExtent2D actualExtent = {
-            static_cast<uint32_t>(width),
-            static_cast<uint32_t>(height)
-        };
+        VkExtent2D actualExtent = framebufferExtent;
 
         actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
         actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
@@ -121,8 +117,14 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwi
     }
 }
 
+VkExtent2D getFramebufferExtent(GLFWwindow* window) {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    return {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+}
+
 void createSwapChain(
-    GLFWwindow* window,
+    VkExtent2D framebufferExtent,
     VkPhysicalDevice physicalDevice,
     VkSurfaceKHR surface,
     VkDevice logicalDevice,
@@ -131,10 +133,11 @@ void createSwapChain(
     VkFormat* pSwapChainImageFormat,
     VkExtent2D* pSwapChainExtent 
 ) {
+    PROFILE_SCOPE("swapchain3::createSwapChain");
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice, surface);
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
     VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentationModes);
-    VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, window);
+    VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, framebufferExtent);
 
     // recommended: min image + 1
     uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
@@ -207,6 +210,7 @@ void createImageViews(
     std::vector<VkImageView>& swapChainImageViews,
     uint32_t mipLevels
 ) {
+    PROFILE_SCOPE("swapchain3::createImageViews");
     auto swapChainImageSize = swapChainImages.size();
     swapChainImageViews.resize(swapChainImageSize);
 
@@ -226,6 +230,7 @@ void createFramebuffers(
     std::vector<VkFramebuffer>& swapChainFramebuffers
     
 ) {
+    PROFILE_SCOPE("swapchain3::createFramebuffers");
     auto swapChainImageViewsSize = swapChainImageViews.size();
     swapChainFramebuffers.resize(swapChainImageViewsSize);
 
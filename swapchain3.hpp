@@ -63,8 +63,15 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>
  */
 VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentationModes);
 
+/** glfwGetFramebufferSize: GLFW allows it on the main thread only */
+VkExtent2D getFramebufferExtent(GLFWwindow* window);
+
+/**
+ * framebufferExtent: getFramebufferExtent of the window, queried beforehand on the main thread,
+ * so the swapchain can be created on any thread (the startup task graph)
+ */
 void createSwapChain(
-    GLFWwindow* window,
+    VkExtent2D framebufferExtent,
     VkPhysicalDevice physicalDevice,
     VkSurfaceKHR surface,
     VkDevice logicalDevice,
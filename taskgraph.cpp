@@ -0,0 +1,202 @@
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+
+#include "taskgraph.hpp"
+#include "profiler.hpp"
+
+namespace taskgraph {
+
+TaskId TaskGraph::add(const std::string& name, std::function<void()> work, const std::vector<TaskId>& dependencies) {
+    TaskId id = static_cast<TaskId>(tasks_.size());
+
+    Task task;
+    task.name = name;
+    task.work = std::move(work);
+    task.dependencies = dependencies;
+    task.remaining = static_cast<uint32_t>(dependencies.size());
+
+    for (TaskId dependency : dependencies) {
+        if (dependency >= id) {
+            throw std::invalid_argument("task " + name + " depends on a task added after it!");
+        }
+        tasks_[dependency].dependents.push_back(id);
+    }
+
+    tasks_.push_back(std::move(task));
+    return id;
+}
+
+double TaskGraph::getElapsedMs() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+}
+
+void TaskGraph::run(uint32_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threadCount_ = threadCount;
+
+    traces_.assign(tasks_.size(), TaskTrace{});
+    finishedCount_ = 0;
+    runningCount_ = 0;
+    error_ = nullptr;
+    ready_ = decltype(ready_)();
+    for (TaskId id = 0; id < tasks_.size(); id++) {
+        traces_[id].name = tasks_[id].name;
+        if (tasks_[id].remaining == 0) {
+            ready_.push(id);
+        }
+    }
+
+    start_ = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 1; thread < threadCount; thread++) {
+        threads.emplace_back(&TaskGraph::work, this, thread);
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    totalMs_ = getElapsedMs();
+
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void TaskGraph::work(uint32_t thread) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        changed_.wait(lock, [this]() {
+            return (!ready_.empty() && !error_)
+                || finishedCount_ == tasks_.size()
+                || (error_ && runningCount_ == 0);
+        });
+
+        if (error_ || ready_.empty()) {
+            // everything is done, or nothing will ever be ready again
+            changed_.notify_all();
+            return;
+        }
+
+        TaskId id = ready_.top();
+        ready_.pop();
+        runningCount_++;
+        traces_[id].thread = thread;
+        traces_[id].started = true;
+        traces_[id].startMs = getElapsedMs();
+
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            // every step of the graph shows up in the profiler trace
+            PROFILE_SCOPE(tasks_[id].name.c_str());
+            tasks_[id].work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+
+        traces_[id].endMs = getElapsedMs();
+        runningCount_--;
+
+        if (error) {
+            if (!error_) {
+                error_ = error;
+            }
+        } else {
+            traces_[id].done = true;
+            finishedCount_++;
+            for (TaskId dependent : tasks_[id].dependents) {
+                if (--tasks_[dependent].remaining == 0) {
+                    ready_.push(dependent);
+                }
+            }
+        }
+
+        changed_.notify_all();
+    }
+}
+
+const std::vector<TaskTrace>& TaskGraph::getTraces() const {
+    return traces_;
+}
+
+std::vector<TaskId> TaskGraph::getCriticalPath() const {
+    std::vector<TaskId> path;
+    if (traces_.empty()) {
+        return path;
+    }
+
+    TaskId last = 0;
+    for (TaskId id = 1; id < traces_.size(); id++) {
+        if (traces_[id].endMs > traces_[last].endMs) {
+            last = id;
+        }
+    }
+
+    TaskId current = last;
+    while (true) {
+        path.push_back(current);
+        const auto& dependencies = tasks_[current].dependencies;
+        if (dependencies.empty()) {
+            break;
+        }
+        current = *std::max_element(dependencies.begin(), dependencies.end(), [this](TaskId a, TaskId b) {
+            return traces_[a].endMs < traces_[b].endMs;
+        });
+    }
+
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+void TaskGraph::printTrace() const {
+    std::vector<TaskId> order(traces_.size());
+    for (TaskId id = 0; id < order.size(); id++) {
+        order[id] = id;
+    }
+    std::sort(order.begin(), order.end(), [this](TaskId a, TaskId b) {
+        return traces_[a].startMs < traces_[b].startMs;
+    });
+
+    double sumMs = 0.0;
+    for (const auto& trace : traces_) {
+        sumMs += trace.endMs - trace.startMs;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+        << "startup " << totalMs_ << " ms on " << threadCount_ << " threads"
+        << " (" << sumMs << " ms if run in sequence)\n"
+        << "  thread    start      end  task\n";
+    for (TaskId id : order) {
+        const auto& trace = traces_[id];
+        if (!trace.started) {
+            std::cout << "                            " << trace.name << " (skipped)\n";
+            continue;
+        }
+        std::cout << "  " << std::setw(6) << trace.thread
+            << std::setw(9) << trace.startMs
+            << std::setw(9) << trace.endMs
+            << "  " << trace.name << (trace.done ? "" : " (failed)") << '\n';
+    }
+
+    std::cout << "critical path:";
+    double pathMs = 0.0;
+    for (TaskId id : getCriticalPath()) {
+        double durationMs = traces_[id].endMs - traces_[id].startMs;
+        pathMs += durationMs;
+        std::cout << "\n  " << std::setw(8) << durationMs << " ms  " << traces_[id].name;
+    }
+    // the rest is time spent waiting for a free thread
+    std::cout << "\n  " << std::setw(8) << pathMs << " ms  total, " << totalMs_ - pathMs << " ms waiting for a thread\n";
+    std::cout << std::defaultfloat;
+}
+
+}
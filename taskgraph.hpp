@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace taskgraph {
+
+using TaskId = uint32_t;
+
+/** when a task ran, in ms since the start of TaskGraph::run */
+struct TaskTrace {
+    std::string name;
+    double startMs = 0.0;
+    double endMs = 0.0;
+    /** worker index, 0 is the thread which called run */
+    uint32_t thread = 0;
+    bool started = false;
+    bool done = false;
+};
+
+/**
+ * Tasks with dependencies, run on a few threads as soon as all their dependencies are done.
+ * A dependency has to be added before the task depending on it, so the graph can't have cycles.
+ * Amongst the ready tasks the first added runs first: add the long chains early.
+ *
+ * Nothing is shared between the tasks by the graph itself. Two tasks touching
+ * the same externally synchronized Vulkan object (a command pool, a queue...)
+ * must depend on each other
+ */
+class TaskGraph {
+public:
+    TaskId add(const std::string& name, std::function<void()> work, const std::vector<TaskId>& dependencies = {});
+
+    /**
+     * Run all the tasks, the calling thread is one of the threadCount workers
+     * (0: std::thread::hardware_concurrency).
+     * If a task throws no new task starts, run waits for the running ones and rethrows the exception.
+     * A graph runs only once
+     */
+    void run(uint32_t threadCount = 0);
+
+    const std::vector<TaskTrace>& getTraces() const;
+
+    /**
+     * From the task ending last back to the start, through the dependency each task
+     * waited for the longest: shortening anything else doesn't make run faster
+     */
+    std::vector<TaskId> getCriticalPath() const;
+
+    /** every task by start time, then the critical path */
+    void printTrace() const;
+
+private:
+    struct Task {
+        std::string name;
+        std::function<void()> work;
+        std::vector<TaskId> dependencies;
+        std::vector<TaskId> dependents;
+        uint32_t remaining = 0;
+    };
+
+    void work(uint32_t thread);
+    double getElapsedMs() const;
+
+    std::vector<Task> tasks_;
+    std::vector<TaskTrace> traces_;
+    double totalMs_ = 0.0;
+    uint32_t threadCount_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    // smallest id first
+    std::priority_queue<TaskId, std::vector<TaskId>, std::greater<TaskId>> ready_;
+    size_t finishedCount_ = 0;
+    uint32_t runningCount_ = 0;
+    std::exception_ptr error_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}
@@ -1,13 +1,17 @@
 #include <stdexcept>
+#include <vector>
 
 // this has to be in one (and only ?) one file in the project
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #include "texture3.hpp"
+#include "dispatch.hpp"
+#include "profiler.hpp"
 #include "buffer2.hpp"
 #include "commandbuffer.hpp"
 #include "image2.hpp"
+#include "imageloader.hpp"
 
 namespace texture3 {
 
@@ -25,6 +29,8 @@ void transitionImageLayout(
     VkImageLayout newLayout,
     uint32_t mipLevels
 ) {
+    PROFILE_SCOPE("texture3::transitionImageLayout");
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
     VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice, commandPool);
 
     // A pipeline barrier is used to synchronize access to resources
@@ -85,7 +91,7 @@ void transitionImageLayout(
     }
 
     // All types of pipeline barriers are submitted using the same function.
-    vkCmdPipelineBarrier(
+    table.vkCmdPipelineBarrier(
         commandBuffer,
         sourceStage,
         destinationStage,
@@ -121,6 +127,8 @@ void copyBufferToImage(
     uint32_t width,
     uint32_t height
     ) {
+    PROFILE_SCOPE("texture3::copyBufferToImage");
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
     VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice, commandPool);
 
     VkBufferImageCopy region{};
@@ -142,7 +150,7 @@ void copyBufferToImage(
         1
     };
 
-    vkCmdCopyBufferToImage(
+    table.vkCmdCopyBufferToImage(
         commandBuffer,
         buffer,
         image,
@@ -169,9 +177,10 @@ void bindImageMemory(
     VkFormat format,
     VkImageTiling tiling,
     VkImageUsageFlags usage,
-    VkMemoryPropertyFlags properties,
+    memory::Usage memoryUsage,
     VkImage& image,
-    VkDeviceMemory& imageMemory
+    VkDeviceMemory& imageMemory,
+    VkImageCreateFlags flags
 ) {
     /**
      * Although we could set up the shader to access the pixel values in the buffer, 
@@ -230,7 +239,8 @@ void bindImageMemory(
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     // for multisampling
     imageInfo.samples = msaaSampleCount;
-    imageInfo.flags = 0; // Optional
+    // e.g. VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT for views in an other format (mipgen)
+    imageInfo.flags = flags;
 
     if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &image) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
@@ -240,18 +250,7 @@ void bindImageMemory(
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = buffer2::findMemoryType(
-        physicalDevice,
-        memRequirements.memoryTypeBits,
-        properties
-    );
-
-    if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
+    memory::allocateMemory(physicalDevice, logicalDevice, memRequirements, memoryUsage, imageMemory);
 
     // Same for binding image memory and buffer memory
     vkBindImageMemory(logicalDevice, image, imageMemory, 0);
@@ -266,8 +265,10 @@ void generateMipmaps(
     VkFormat imageFormat,
     int32_t texWidth,
     int32_t texHeight,
-    uint32_t mipLevels
+    uint32_t mipLevels,
+    uint32_t layerCount
 ) {
+    PROFILE_SCOPE("texture3::generateMipmaps");
     // Check if image format supports linear blitting
     VkFormatProperties formatProperties;
     vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
@@ -277,6 +278,19 @@ void generateMipmaps(
     }
 
     VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice, commandPool);
+    recordGenerateMipmaps(commandBuffer, image, texWidth, texHeight, mipLevels, layerCount);
+    commandbuffer::endAndExecuteSingleTimeCommands(logicalDevice, commandPool, graphicsQueue, commandBuffer);
+}
+
+void recordGenerateMipmaps(
+    VkCommandBuffer commandBuffer,
+    VkImage image,
+    int32_t texWidth,
+    int32_t texHeight,
+    uint32_t mipLevels,
+    uint32_t layerCount
+) {
+    const dispatch::DeviceTable& table = dispatch::getDeviceTable();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -285,7 +299,8 @@ void generateMipmaps(
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    // all the layers of an array go down the mip chain together
+    barrier.subresourceRange.layerCount = layerCount;
     barrier.subresourceRange.levelCount = 1;
 
     int32_t mipWidth = texWidth;
@@ -305,7 +320,7 @@ void generateMipmaps(
 
 
 
-        vkCmdPipelineBarrier(commandBuffer,
+        table.vkCmdPipelineBarrier(commandBuffer,
             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
             0, nullptr,
             0, nullptr,
@@ -317,13 +332,13 @@ void generateMipmaps(
         blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         blit.srcSubresource.mipLevel = i - 1;
         blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
+        blit.srcSubresource.layerCount = layerCount;
         blit.dstOffsets[0] = { 0, 0, 0 };
         blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
         blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         blit.dstSubresource.mipLevel = i;
         blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
+        blit.dstSubresource.layerCount = layerCount;
 
         /**
          * Note that textureImage is used for both the srcImage and dstImage parameter. 
@@ -331,7 +346,7 @@ void generateMipmaps(
          * The source mip level was just transitioned to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL 
          * and the destination level is still in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL from createTextureImage.
          */
-        vkCmdBlitImage(commandBuffer,
+        table.vkCmdBlitImage(commandBuffer,
             image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
             image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
             1, &blit,
@@ -347,7 +362,7 @@ void generateMipmaps(
         barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-        vkCmdPipelineBarrier(commandBuffer,
+        table.vkCmdPipelineBarrier(commandBuffer,
             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
             0, nullptr,
             0, nullptr,
@@ -367,14 +382,11 @@ void generateMipmaps(
     barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    vkCmdPipelineBarrier(commandBuffer,
+    table.vkCmdPipelineBarrier(commandBuffer,
         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
         0, nullptr,
         0, nullptr,
         1, &barrier);
-
-
-    commandbuffer::endAndExecuteSingleTimeCommands(logicalDevice, commandPool, graphicsQueue, commandBuffer);
 }
 
 uint32_t createTextureImage(
@@ -387,47 +399,60 @@ uint32_t createTextureImage(
     VkImage& textureImage,
     VkDeviceMemory& textureImageMemory
 ) {
+    PROFILE_SCOPE("texture3::createTextureImage");
     int texWidth;
     int texHeight;
     int texChannels;
 
     stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    // The pixels are laid out row by row with 4 bytes per pixel in the case of STBI_rgb_alpha
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-
-    /**
-     * This calculates the number of levels in the mip chain. The max function selects the largest dimension. 
-     * The log2 function calculates how many times that dimension can be divided by 2. 
-     * The floor function handles cases where the largest dimension is not a power of 2. 
-     * 1 is added so that the original image has a mip level.
-     */
-    auto mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
     if (!pixels) {
         throw std::runtime_error("failed to load texture image!");
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    buffer2::bindBuffer(
+    uint32_t mipLevels = createTextureImageFromPixels(
         physicalDevice,
         logicalDevice,
-        imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer,
-        stagingBufferMemory
+        commandPool,
+        graphicsQueue,
+        pixels,
+        texWidth,
+        texHeight,
+        msaaSampleCount,
+        textureImage,
+        textureImageMemory
     );
 
-    void* data;
-    vkMapMemory(logicalDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(logicalDevice, stagingBufferMemory);
-
     stbi_image_free(pixels);
 
+    return mipLevels;
+}
+
+/**
+ * from the staging buffer (texels at offset 0) to a device local image with its full mip chain
+ * returns the mipLevels
+ */
+static uint32_t uploadTextureImage(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    VkBuffer stagingBuffer,
+    int texWidth,
+    int texHeight,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+) {
+    PROFILE_SCOPE("texture3::uploadTextureImage");
+    /**
+     * This calculates the number of levels in the mip chain. The max function selects the largest dimension. 
+     * The log2 function calculates how many times that dimension can be divided by 2. 
+     * The floor function handles cases where the largest dimension is not a power of 2. 
+     * 1 is added so that the original image has a mip level.
+     */
+    auto mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+
     bindImageMemory(
         physicalDevice,
         logicalDevice,
@@ -439,7 +464,7 @@ uint32_t createTextureImage(
         VK_IMAGE_TILING_OPTIMAL,
         // SRC bit added for the mipmaps generation
         VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        memory::GpuOnly,
         textureImage,
         textureImageMemory
     );
@@ -485,63 +510,167 @@ uint32_t createTextureImage(
     //     mipLevels
     // );
 
-    generateMipmaps(physicalDevice,logicalDevice, commandPool, graphicsQueue, textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+    generateMipmaps(physicalDevice,logicalDevice, commandPool, graphicsQueue, textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels, 1);
+
+    return mipLevels;
+}
+
+uint32_t createTextureImageFromPixels(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const unsigned char* pixels,
+    int texWidth,
+    int texHeight,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+) {
+    PROFILE_SCOPE("texture3::createTextureImageFromPixels");
+    // The pixels are laid out row by row with 4 bytes per pixel in the case of STBI_rgb_alpha
+    VkDeviceSize imageSize = texWidth * texHeight * 4;
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+
+    buffer2::bindBuffer(
+        physicalDevice,
+        logicalDevice,
+        imageSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        memory::Upload,
+        stagingBuffer,
+        stagingBufferMemory
+    );
+
+    void* data;
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    memcpy(data, pixels, static_cast<size_t>(imageSize));
+    mapped::flush(logicalDevice, stagingBufferMemory, 0, imageSize);
+    vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+    uint32_t mipLevels = uploadTextureImage(
+        physicalDevice,
+        logicalDevice,
+        commandPool,
+        graphicsQueue,
+        stagingBuffer,
+        texWidth,
+        texHeight,
+        msaaSampleCount,
+        textureImage,
+        textureImageMemory
+    );
 
     // clean up the stagin buffer
     vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    memory::freeMemory(logicalDevice, stagingBufferMemory);
 
     return mipLevels;
 }
 
 
+uint32_t createTextureImageFromFile(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const char* path,
+    buffer2::StagingBuffer& stagingBuffer,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+) {
+    std::vector<unsigned char> content;
+    if (!imageloader::readFileContent(path, content)) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    int texWidth;
+    int texHeight;
+    decodeToStagingBuffer(physicalDevice, logicalDevice, content, stagingBuffer, texWidth, texHeight);
+
+    return createTextureImageFromStagingBuffer(
+        physicalDevice,
+        logicalDevice,
+        commandPool,
+        graphicsQueue,
+        stagingBuffer,
+        texWidth,
+        texHeight,
+        msaaSampleCount,
+        textureImage,
+        textureImageMemory
+    );
+}
+
+void decodeToStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    std::vector<unsigned char>& content,
+    buffer2::StagingBuffer& stagingBuffer,
+    int& texWidth,
+    int& texHeight
+) {
+    PROFILE_SCOPE("texture3::decodeToStagingBuffer");
+    int texChannels;
+
+    // only the header is read to size the staging memory
+    if (!imageloader::probeImage(content, texWidth, texHeight, texChannels)) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(texWidth) * texHeight * 4;
+    buffer2::reserveStagingBuffer(physicalDevice, logicalDevice, imageSize, stagingBuffer);
+
+    // the texels are written once, straight in the mapped memory
+    if (!imageloader::decodeToRGBA(content, static_cast<unsigned char*>(stagingBuffer.mapped), static_cast<size_t>(stagingBuffer.size))) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+    mapped::flush(logicalDevice, stagingBuffer.memory, 0, imageSize);
+
+    // the encoded file is not needed anymore, don't keep it during the upload
+    std::vector<unsigned char>().swap(content);
+}
+
+uint32_t createTextureImageFromStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const buffer2::StagingBuffer& stagingBuffer,
+    int texWidth,
+    int texHeight,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+) {
+    return uploadTextureImage(
+        physicalDevice,
+        logicalDevice,
+        commandPool,
+        graphicsQueue,
+        stagingBuffer.buffer,
+        texWidth,
+        texHeight,
+        msaaSampleCount,
+        textureImage,
+        textureImageMemory
+    );
+}
+
 void createTextureImageView(VkDevice logicalDevice, VkImage textureImage, VkImageView& textureImageView, uint32_t mipLevels) {
     textureImageView = image2::createImageView(logicalDevice, textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 }
 
-void createTextureSampler(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSampler& textureSampler) {
-
-    VkSamplerCreateInfo samplerInfo{};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    // could be used for example for floors and walls
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    // no reason to use something else except for performance reason
-    // be wary that it is actually an optional device feature
-    // so physical device must be checked properly about this
-    samplerInfo.anisotropyEnable = VK_TRUE;
-
-    // retriev the maximum quality of the GPU
-    VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
-
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-
-    // when accessing beyond the image with clamp to border
-    // can be black, white or transparent
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-
-    // use normalized coordinate 0,1 0,1
-    // instead of 0,texWidth 0,texHeight
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-
-    // if true used for filter (compare to a value)
-    // this could be used for percentage-colser filtering on shadow maps
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-
-    // mipmaping
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.minLod = 0.0f; // Optional
-    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
-    samplerInfo.mipLodBias = 0.0f; // Optional
-
-    if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create texture sampler!");
-    }
+void createTextureSampler(sampler::SamplerCache& samplerCache, VkSampler& textureSampler) {
+    // the maximum quality of the GPU, the limits are queried once by the cache
+    float maxAnisotropy = samplerCache.getLimits().maxSamplerAnisotropy;
+
+    // every texture with the same filtering shares the same VkSampler
+    // release it with samplerCache.release instead of vkDestroySampler
+    textureSampler = samplerCache.acquire(sampler::getTextureSamplerKey(maxAnisotropy));
 }
 
 }
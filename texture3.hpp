@@ -4,6 +4,9 @@
 #define GLFW_INCLUDE_VULKAN
 #include "GLFW/glfw3.h"
 
+#include "sampler.hpp"
+#include "buffer2.hpp"
+
 namespace texture3 {
 
 /**
@@ -24,9 +27,55 @@ void bindImageMemory(
     VkFormat format,
     VkImageTiling tiling,
     VkImageUsageFlags usage,
-    VkMemoryPropertyFlags properties,
+    memory::Usage memoryUsage,
     VkImage& image,
-    VkDeviceMemory& imageMemory
+    VkDeviceMemory& imageMemory,
+    VkImageCreateFlags flags = 0
+);
+
+/**
+ * Layout transition of all the mip levels in a single time command buffer, only
+ * UNDEFINED -> TRANSFER_DST_OPTIMAL and TRANSFER_DST_OPTIMAL -> SHADER_READ_ONLY_OPTIMAL
+ */
+void transitionImageLayout(
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    VkImage image,
+    VkFormat format,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    uint32_t mipLevels
+);
+
+/**
+ * Fill the mip levels 1..mipLevels-1 from the level 0 with a chain of blits.
+ * All the levels must be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, they end up in
+ * VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. layerCount is 1 unless the image is an array.
+ * Throws if the format can't be blitted with a linear filter: see mipgen for a compute
+ * alternative which only needs storage images
+ */
+void generateMipmaps(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    VkImage image,
+    VkFormat imageFormat,
+    int32_t texWidth,
+    int32_t texHeight,
+    uint32_t mipLevels,
+    uint32_t layerCount
+);
+
+/** the blits and barriers of generateMipmaps, recorded into commandBuffer, nothing checked */
+void recordGenerateMipmaps(
+    VkCommandBuffer commandBuffer,
+    VkImage image,
+    int32_t texWidth,
+    int32_t texHeight,
+    uint32_t mipLevels,
+    uint32_t layerCount
 );
 
 /** returns the mipLevel of the image, calculated from its size */
@@ -41,6 +90,68 @@ uint32_t createTextureImage(
     VkDeviceMemory& textureImageMemory
 );
 
+/**
+ * same as createTextureImage, from pixels already decoded (4 bytes per texel, e.g. by imageloader)
+ * the pixels are not freed
+ */
+uint32_t createTextureImageFromPixels(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const unsigned char* pixels,
+    int texWidth,
+    int texHeight,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+);
+
+/**
+ * Same as createTextureImage, but the image is decoded straight into stagingBuffer
+ * (grown if needed, kept mapped and reused by the next uploads):
+ * no intermediate 4 channels copy of the image on the heap
+ */
+uint32_t createTextureImageFromFile(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const char* path,
+    buffer2::StagingBuffer& stagingBuffer,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+);
+
+/**
+ * The two halves of createTextureImageFromFile, to decode while the command pool
+ * and the queue are busy with something else (see the startup task graph).
+ * decodeToStagingBuffer records no command and frees content (the encoded file)
+ */
+void decodeToStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    std::vector<unsigned char>& content,
+    buffer2::StagingBuffer& stagingBuffer,
+    int& texWidth,
+    int& texHeight
+);
+
+/** upload of the texels decodeToStagingBuffer wrote, returns the mipLevels */
+uint32_t createTextureImageFromStagingBuffer(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const buffer2::StagingBuffer& stagingBuffer,
+    int texWidth,
+    int texHeight,
+    VkSampleCountFlagBits msaaSampleCount,
+    VkImage& textureImage,
+    VkDeviceMemory& textureImageMemory
+);
+
 // images are used through imageView rather than directly
 void createTextureImageView(VkDevice logicalDevice, VkImage textureImage, VkImageView& textureImageView, uint32_t mipLevels);
 
@@ -63,7 +174,9 @@ void createTextureImageView(VkDevice logicalDevice, VkImage textureImage, VkImag
  * Note the sampler does not reference a VkImage anywhere. The sampler is a distinct object that provides an
  * interface to extract colors from a texture. It can be applied to any image you want, whether it is 1D, 2D or 3D.
  * This is different from many older APIs, which combined texture images and filtering into a single state.
+ *
+ * Samplers are shared through the cache, see sampler::getTextureSamplerKey for the settings
  */
-void createTextureSampler(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkSampler& textureSampler);
+void createTextureSampler(sampler::SamplerCache& samplerCache, VkSampler& textureSampler);
 
 }
\ No newline at end of file
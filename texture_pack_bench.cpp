@@ -0,0 +1,410 @@
+/**
+ * Headless bench of texturepack: one image by texture against the packed plan
+ *
+ * Generates --textures odd sized small textures (packed in atlases) and --layers
+ * textures sharing a size (array pages, split every --max-layers layers), then:
+ * * checks the plan: the atlas cells (gutter included) don't overlap and stay in the page,
+ *   they are aligned for the atlas mips, the array pages only hold one size in layer order
+ * * uploads one image by texture, then the plan, and prints the measured image count,
+ *   memory and time of both
+ * * reads the level 0 of the packed images back and checks every texel, gutters included:
+ *   a gutter texel is the nearest border texel of its texture
+ * Each texel stores its own x, y and texture index, so a misplaced one can't go unnoticed.
+ *
+ * usage: texture_pack_bench [--textures N] [--layers L] [--max-layers M] [--atlas-size A]
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "texturepack.hpp"
+#include "texture3.hpp"
+#include "buffer2.hpp"
+#include "commandbuffer.hpp"
+#include "memory.hpp"
+#include "mapped.hpp"
+#include "headless.hpp"
+
+struct BenchOptions {
+    uint32_t textureCount = 200;
+    uint32_t layerCount = 40;
+    uint32_t maxLayers = 16;
+    uint32_t atlasSize = 1024;
+};
+
+// the odd sizes stay below 256 so that a texel can store its coordinates in a byte
+const uint32_t MIN_SIZE = 4;
+const uint32_t MAX_SIZE = 120;
+const uint32_t LAYER_SIZE = 64;
+const VkFormat FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--textures") {
+            options.textureCount = value;
+        } else if (name == "--layers") {
+            options.layerCount = value;
+        } else if (name == "--max-layers") {
+            options.maxLayers = std::max(value, 1u);
+        } else if (name == "--atlas-size") {
+            options.atlasSize = std::max(value, 2 * MAX_SIZE);
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+static void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error("texture pack check failed: " + what);
+    }
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** the texel (x, y) of texture index: x, y, low and high bytes of the index */
+static uint32_t getTexel(uint32_t index, uint32_t x, uint32_t y) {
+    return x | y << 8 | (index & 0xff) << 16 | (index >> 8 & 0xff) << 24;
+}
+
+static std::vector<uint32_t> generatePixels(uint32_t index, uint32_t width, uint32_t height) {
+    std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            pixels[y * width + x] = getTexel(index, x, y);
+        }
+    }
+    return pixels;
+}
+
+static bool overlaps(const texturepack::Rect& a, const texturepack::Rect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static void checkPlan(
+    const std::vector<texturepack::TextureDesc>& textures,
+    const texturepack::PackPlan& plan,
+    const texturepack::PackOptions& options
+) {
+    expect(plan.locations.size() == textures.size(), "one location by texture");
+    uint32_t alignment = 1u << (options.atlasMipLevels - 1);
+
+    std::vector<uint32_t> placed(textures.size(), 0);
+    for (uint32_t p = 0; p < plan.pages.size(); p++) {
+        const texturepack::Page& page = plan.pages[p];
+        expect(page.format == FORMAT, "the pages have the format of their textures");
+        std::string name = "page " + std::to_string(p);
+
+        if (page.kind == texturepack::Page::Array) {
+            expect(page.layerCount == page.textures.size() && page.layerCount <= options.maxArrayLayers,
+                name + " has one layer by texture, at most maxArrayLayers");
+            for (uint32_t layer = 0; layer < page.layerCount; layer++) {
+                uint32_t index = page.textures[layer];
+                const texturepack::TextureLocation& location = plan.locations[index];
+                expect(textures[index].width == page.width && textures[index].height == page.height,
+                    name + " only holds textures of its size");
+                expect(location.page == p && location.layer == layer && location.uvOffset == glm::vec2(0.0f)
+                    && location.uvScale == glm::vec2(1.0f), name + " locations are the layers");
+                placed[index]++;
+            }
+            continue;
+        }
+
+        expect(page.layerCount == 1 && page.rects.size() == page.textures.size(), name + " is a single layer atlas");
+        std::vector<texturepack::Rect> cells;
+        for (size_t i = 0; i < page.rects.size(); i++) {
+            const texturepack::Rect& rect = page.rects[i];
+            uint32_t index = page.textures[i];
+            expect(rect.width == textures[index].width && rect.height == textures[index].height,
+                name + " rects have the size of their texture");
+            expect(rect.x >= page.gutter && rect.y >= page.gutter
+                && rect.x + rect.width + page.gutter <= page.width && rect.y + rect.height + page.gutter <= page.height,
+                name + " rects and their gutter stay in the page");
+            expect((rect.x - page.gutter) % alignment == 0 && (rect.y - page.gutter) % alignment == 0,
+                name + " cells are aligned for the atlas mips");
+            expect(plan.locations[index].page == p && plan.locations[index].layer == 0, name + " locations point to it");
+
+            texturepack::Rect cell{rect.x - page.gutter, rect.y - page.gutter,
+                rect.width + 2 * page.gutter, rect.height + 2 * page.gutter};
+            for (const auto& other : cells) {
+                expect(!overlaps(cell, other), name + " cells don't overlap");
+            }
+            cells.push_back(cell);
+            placed[index]++;
+        }
+    }
+
+    for (uint32_t index = 0; index < textures.size(); index++) {
+        expect(placed[index] == 1, "texture " + std::to_string(index) + " is placed once");
+    }
+
+    // a size shared by enough textures never goes to an atlas
+    for (uint32_t index = 0; index < textures.size(); index++) {
+        size_t sharing = static_cast<size_t>(std::count_if(textures.begin(), textures.end(), [&](const texturepack::TextureDesc& other) {
+            return other.width == textures[index].width && other.height == textures[index].height;
+        }));
+        bool inArray = plan.pages[plan.locations[index].page].kind == texturepack::Page::Array;
+        expect(inArray == (sharing >= options.minArrayLayers),
+            "texture " + std::to_string(index) + " is in an array page only if its size is shared");
+    }
+}
+
+/** level 0 of every layer, the image is back in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL after */
+static std::vector<uint32_t> readLevel0(
+    headless::Device& headless,
+    VkCommandPool commandPool,
+    const texturepack::Page& page,
+    VkImage image
+) {
+    VkDevice device = headless.device_;
+    VkDeviceSize size = static_cast<VkDeviceSize>(page.width) * page.height * page.layerCount * sizeof(uint32_t);
+    VkBuffer buffer;
+    VkDeviceMemory bufferMemory;
+    buffer2::bindBuffer(headless.physicalDevice_, device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        memory::Readback, buffer, bufferMemory);
+
+    VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(device, commandPool);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = page.layerCount;
+    // uploadPlan waited for the queue to be idle, nothing to wait for
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = page.layerCount;
+    region.imageExtent = {page.width, page.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = buffer;
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        0, nullptr,
+        1, &hostBarrier,
+        0, nullptr);
+
+    commandbuffer::endAndExecuteSingleTimeCommands(device, commandPool, headless.queue_, commandBuffer);
+
+    std::vector<uint32_t> texels(static_cast<size_t>(size / sizeof(uint32_t)));
+    void* data;
+    vkMapMemory(device, bufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    mapped::invalidate(device, bufferMemory, 0, size);
+    memcpy(texels.data(), data, static_cast<size_t>(size));
+    vkUnmapMemory(device, bufferMemory);
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    memory::freeMemory(device, bufferMemory);
+    return texels;
+}
+
+/** every texel of every texture where the plan put it, and the atlas gutters clamp to the borders */
+static void checkImages(
+    headless::Device& headless,
+    VkCommandPool commandPool,
+    const texturepack::PackPlan& plan,
+    const std::vector<texturepack::PackedImage>& images
+) {
+    for (uint32_t p = 0; p < plan.pages.size(); p++) {
+        const texturepack::Page& page = plan.pages[p];
+        std::vector<uint32_t> texels = readLevel0(headless, commandPool, page, images[p].image);
+        std::string name = "page " + std::to_string(p);
+
+        if (page.kind == texturepack::Page::Array) {
+            for (uint32_t layer = 0; layer < page.layerCount; layer++) {
+                const uint32_t* layerTexels = texels.data() + static_cast<size_t>(layer) * page.width * page.height;
+                for (uint32_t y = 0; y < page.height; y++) {
+                    for (uint32_t x = 0; x < page.width; x++) {
+                        expect(layerTexels[y * page.width + x] == getTexel(page.textures[layer], x, y),
+                            name + " layer " + std::to_string(layer) + " holds its texture");
+                    }
+                }
+            }
+            continue;
+        }
+
+        int64_t gutter = page.gutter;
+        for (size_t i = 0; i < page.rects.size(); i++) {
+            const texturepack::Rect& rect = page.rects[i];
+            int64_t width = rect.width;
+            int64_t height = rect.height;
+            std::string texture = name + " texture " + std::to_string(page.textures[i]);
+            for (int64_t y = -gutter; y < height + gutter; y++) {
+                for (int64_t x = -gutter; x < width + gutter; x++) {
+                    // the gutter replicates the nearest border texel, like CLAMP_TO_EDGE
+                    uint32_t srcX = static_cast<uint32_t>(std::min(std::max<int64_t>(x, 0), width - 1));
+                    uint32_t srcY = static_cast<uint32_t>(std::min(std::max<int64_t>(y, 0), height - 1));
+                    size_t texel = static_cast<size_t>(rect.y + y) * page.width + static_cast<size_t>(rect.x + x);
+                    bool inGutter = x < 0 || y < 0 || x >= width || y >= height;
+                    expect(texels[texel] == getTexel(page.textures[i], srcX, srcY),
+                        texture + (inGutter ? " gutter replicates the border" : " texels are in its rect"));
+                }
+            }
+        }
+    }
+}
+
+/** the way it is done without packing: one image (and allocation) by texture */
+static void measureUnpacked(
+    headless::Device& headless,
+    VkCommandPool commandPool,
+    const std::vector<texturepack::TextureDesc>& textures
+) {
+    VkDevice device = headless.device_;
+    std::vector<VkImage> images(textures.size());
+    std::vector<VkDeviceMemory> imageMemories(textures.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < textures.size(); i++) {
+        texture3::createTextureImageFromPixels(headless.physicalDevice_, device, commandPool, headless.queue_,
+            textures[i].pixels, static_cast<int>(textures[i].width), static_cast<int>(textures[i].height),
+            VK_SAMPLE_COUNT_1_BIT, images[i], imageMemories[i]);
+    }
+    double uploadMs = elapsedMs(start);
+
+    VkDeviceSize bytes = 0;
+    for (VkImage image : images) {
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+        bytes += memRequirements.size;
+    }
+    std::cout << "  one image by texture: " << images.size() << " images, " << bytes / 1024 << " KiB, "
+        << uploadMs << " ms\n";
+
+    for (size_t i = 0; i < images.size(); i++) {
+        vkDestroyImage(device, images[i], nullptr);
+        memory::freeMemory(device, imageMemories[i]);
+    }
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Texture pack bench");
+    VkDevice device = headless.device_;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName << '\n';
+
+    texturepack::PackOptions packOptions;
+    packOptions.atlasSize = options.atlasSize;
+    packOptions.maxArrayLayers = std::min(options.maxLayers, properties.limits.maxImageArrayLayers);
+
+    // fixed seed: the same textures, so the same plan, at every run
+    std::mt19937 random(42);
+    std::uniform_int_distribution<uint32_t> size(MIN_SIZE, MAX_SIZE);
+    std::vector<std::vector<uint32_t>> pixels;
+    std::vector<texturepack::TextureDesc> textures;
+    for (uint32_t i = 0; i < options.textureCount + options.layerCount; i++) {
+        uint32_t width = i < options.textureCount ? size(random) : LAYER_SIZE;
+        uint32_t height = i < options.textureCount ? size(random) : LAYER_SIZE;
+        pixels.push_back(generatePixels(i, width, height));
+        textures.push_back(texturepack::TextureDesc{width, height, FORMAT,
+            reinterpret_cast<const unsigned char*>(pixels.back().data())});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    texturepack::PackPlan plan = texturepack::buildPlan(textures, packOptions);
+    double planMs = elapsedMs(start);
+    checkPlan(textures, plan, packOptions);
+
+    uint32_t atlasCount = 0;
+    for (const auto& page : plan.pages) {
+        atlasCount += page.kind == texturepack::Page::Atlas;
+    }
+    std::cout << textures.size() << " textures: " << plan.pages.size() << " pages (" << atlasCount << " atlases of "
+        << options.atlasSize << "x" << options.atlasSize << ", " << plan.pages.size() - atlasCount
+        << " arrays), planned in " << planMs << " ms\n";
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = headless.queueFamilyIndex_;
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    measureUnpacked(headless, commandPool, textures);
+
+    std::vector<texturepack::PackedImage> images;
+    start = std::chrono::steady_clock::now();
+    texturepack::uploadPlan(headless.physicalDevice_, device, commandPool, headless.queue_, textures, plan, images);
+    double uploadMs = elapsedMs(start);
+
+    VkDeviceSize bytes = 0;
+    for (const auto& image : images) {
+        bytes += image.memorySize;
+    }
+    std::cout << "  packed: " << images.size() << " images, " << bytes / 1024 << " KiB, " << uploadMs << " ms\n";
+    texturepack::printStats(textures, images);
+
+    checkImages(headless, commandPool, plan, images);
+    std::cout << "checks passed: no overlap, gutters replicate the borders, arrays grouped by size\n";
+
+    texturepack::destroyImages(device, images);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
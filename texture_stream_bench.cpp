@@ -0,0 +1,180 @@
+/**
+ * Headless benchmark of texturestream::TextureStreamer
+ *
+ * A camera flies down a corridor of textured quads, each one with its own texture.
+ * Every frame the visible quads request the mip level matching their projected size,
+ * then the streamer runs. Nothing is drawn: no window, no swapchain, it runs anywhere
+ * there is a Vulkan device.
+ *
+ * usage: texture_stream_bench [--textures N] [--size S] [--budget-mb M] [--frames F] [--frame-ms T]
+ * --budget-mb 0 uses VK_EXT_memory_budget (or the heap size)
+ */
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+
+#include "texturestream.hpp"
+#include "memory.hpp"
+#include "headless.hpp"
+
+struct BenchOptions {
+    uint32_t textureCount = 64;
+    uint32_t textureSize = 1024;
+    uint32_t budgetMB = 128;
+    uint32_t frameCount = 600;
+    uint32_t frameMs = 16;
+};
+
+// the scene: quads every SPACING units, QUAD_SIZE wide, seen by a 1080p camera
+const float SPACING = 4.0f;
+const float QUAD_SIZE = 2.0f;
+const float FAR_PLANE = 60.0f;
+const float FOV_Y = glm::radians(45.0f);
+const float VIEWPORT_HEIGHT = 1080.0f;
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        uint32_t value = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+        if (name == "--textures") {
+            options.textureCount = value;
+        } else if (name == "--size") {
+            options.textureSize = value;
+        } else if (name == "--budget-mb") {
+            options.budgetMB = value;
+        } else if (name == "--frames") {
+            options.frameCount = value;
+        } else if (name == "--frame-ms") {
+            options.frameMs = value;
+        } else {
+            throw std::invalid_argument("unknown option " + name);
+        }
+    }
+    return options;
+}
+
+/** a checker board with its own colors, so that every texture has different content */
+static std::vector<unsigned char> makeTexture(uint32_t size, uint32_t seed) {
+    std::vector<unsigned char> pixels(static_cast<size_t>(size) * size * 4);
+    unsigned char r = static_cast<unsigned char>(seed * 67);
+    unsigned char g = static_cast<unsigned char>(seed * 131);
+    unsigned char b = static_cast<unsigned char>(seed * 199);
+
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            bool odd = ((x / 32) + (y / 32)) % 2;
+            unsigned char* texel = &pixels[(static_cast<size_t>(y) * size + x) * 4];
+            texel[0] = odd ? r : static_cast<unsigned char>(255 - r);
+            texel[1] = odd ? g : static_cast<unsigned char>(255 - g);
+            texel[2] = odd ? b : static_cast<unsigned char>(255 - b);
+            texel[3] = 255;
+        }
+    }
+    return pixels;
+}
+
+static double toMB(VkDeviceSize bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+static void run(const BenchOptions& options) {
+    headless::Device headless;
+    headless.init("Texture stream bench");
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(headless.physicalDevice_, &properties);
+    std::cout << "device: " << properties.deviceName
+        << (headless.memoryBudget_ ? " (VK_EXT_memory_budget)" : "") << '\n';
+
+    texturestream::StreamOptions streamOptions;
+    streamOptions.budget = static_cast<VkDeviceSize>(options.budgetMB) * 1024 * 1024;
+
+    texturestream::TextureStreamer streamer;
+    streamer.init(
+        headless.physicalDevice_,
+        headless.device_,
+        headless.queue_,
+        headless.queueFamilyIndex_,
+        streamOptions
+    );
+
+    auto addStart = std::chrono::steady_clock::now();
+    std::vector<uint32_t> textures;
+    for (uint32_t i = 0; i < options.textureCount; i++) {
+        auto pixels = makeTexture(options.textureSize, i + 1);
+        textures.push_back(streamer.addTexture(pixels.data(), options.textureSize, options.textureSize));
+    }
+    double addMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - addStart).count();
+    std::cout << options.textureCount << " textures " << options.textureSize << "x" << options.textureSize
+        << " added in " << addMs << " ms (CPU mip chains + tails)\n";
+
+    // the camera goes through the whole corridor during the run
+    float corridorLength = options.textureCount * SPACING;
+    float focal = VIEWPORT_HEIGHT / (2.0f * std::tan(FOV_Y / 2.0f));
+    VkDeviceSize peakResident = 0;
+    double residentSum = 0.0;
+
+    for (uint32_t frame = 0; frame < options.frameCount; frame++) {
+        float cameraZ = corridorLength * frame / std::max(options.frameCount, 1u);
+
+        for (uint32_t i = 0; i < textures.size(); i++) {
+            float distance = i * SPACING - cameraZ;
+            if (distance <= 0.0f || distance > FAR_PLANE) {
+                continue;
+            }
+            streamer.request(textures[i], QUAD_SIZE * focal / distance);
+        }
+
+        streamer.update();
+
+        auto stats = streamer.getStats();
+        peakResident = std::max(peakResident, stats.residentBytes + stats.pendingBytes);
+        residentSum += toMB(stats.residentBytes);
+
+        if (frame % 60 == 0) {
+            std::cout << "frame " << frame
+                << " resident " << toMB(stats.residentBytes) << " MB"
+                << " pending " << toMB(stats.pendingBytes) << " MB"
+                << " uploads " << stats.uploads
+                << " evictions " << stats.evictions << '\n';
+        }
+
+        // stands for the rendering of the frame
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.frameMs));
+    }
+
+    auto stats = streamer.getStats();
+    std::cout << "budget " << toMB(stats.budget) << " MB, full chains would use " << toMB(stats.fullBytes) << " MB\n"
+        << "resident average " << residentSum / std::max(options.frameCount, 1u) << " MB, peak (with pending) " << toMB(peakResident) << " MB\n"
+        << "uploads " << stats.uploads << " (" << toMB(stats.uploadedBytes) << " MB), evictions " << stats.evictions << '\n'
+        << "streaming latency average " << stats.averageLatencyMs << " ms, max " << stats.maxLatencyMs << " ms\n";
+
+    memory::printHeapStats();
+
+    vkDeviceWaitIdle(headless.device_);
+    streamer.destroy();
+    headless.cleanup();
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
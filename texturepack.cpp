@@ -0,0 +1,439 @@
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <tuple>
+
+#include "texturepack.hpp"
+#include "texture3.hpp"
+#include "buffer2.hpp"
+#include "commandbuffer.hpp"
+
+namespace texturepack {
+
+// only 4 bytes texels for now, like the rest of the texture code
+const uint32_t TEXEL_SIZE = 4;
+
+static uint32_t alignUp(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t getMipLevels(uint32_t width, uint32_t height) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height) : width_(width), height_(height) {
+    // at first the skyline is the floor
+    skyline_.push_back(Segment{0, 0, width});
+}
+
+bool SkylinePacker::fits(size_t index, uint32_t width, uint32_t height, uint32_t& y) const {
+    uint32_t x = skyline_[index].x;
+    if (x + width > width_) {
+        return false;
+    }
+
+    // the rect lies on the highest segment it spans
+    int64_t widthLeft = width;
+    y = skyline_[index].y;
+    size_t i = index;
+    while (widthLeft > 0) {
+        if (i == skyline_.size()) {
+            return false;
+        }
+        y = std::max(y, skyline_[i].y);
+        if (y + height > height_) {
+            return false;
+        }
+        widthLeft -= skyline_[i].width;
+        i++;
+    }
+
+    return true;
+}
+
+void SkylinePacker::addLevel(size_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    skyline_.insert(skyline_.begin() + index, Segment{x, y + height, width});
+
+    // the segments now below the new one are shrinked or removed
+    for (size_t i = index + 1; i < skyline_.size();) {
+        const Segment& previous = skyline_[i - 1];
+        Segment& current = skyline_[i];
+        uint32_t previousEnd = previous.x + previous.width;
+        if (current.x >= previousEnd) {
+            break;
+        }
+
+        uint32_t shrink = previousEnd - current.x;
+        if (current.width <= shrink) {
+            skyline_.erase(skyline_.begin() + i);
+            continue;
+        }
+
+        current.x += shrink;
+        current.width -= shrink;
+        break;
+    }
+
+    // merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline_.size();) {
+        if (skyline_[i].y == skyline_[i + 1].y) {
+            skyline_[i].width += skyline_[i + 1].width;
+            skyline_.erase(skyline_.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+}
+
+bool SkylinePacker::insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) {
+    size_t bestIndex = skyline_.size();
+    uint32_t bestTop = UINT32_MAX;
+    uint32_t bestWidth = UINT32_MAX;
+
+    for (size_t i = 0; i < skyline_.size(); i++) {
+        uint32_t top;
+        if (!fits(i, width, height, top)) {
+            continue;
+        }
+        // lowest top edge first, then the narrowest segment to limit waste
+        if (top + height < bestTop || (top + height == bestTop && skyline_[i].width < bestWidth)) {
+            bestIndex = i;
+            bestTop = top + height;
+            bestWidth = skyline_[i].width;
+            x = skyline_[i].x;
+            y = top;
+        }
+    }
+
+    if (bestIndex == skyline_.size()) {
+        return false;
+    }
+
+    addLevel(bestIndex, x, y, width, height);
+    return true;
+}
+
+PackPlan buildPlan(const std::vector<TextureDesc>& textures, const PackOptions& options) {
+    PackPlan plan;
+    plan.locations.resize(textures.size());
+
+    uint32_t alignment = 1u << (std::max(options.atlasMipLevels, 1u) - 1);
+
+    // group by format and size, std::map to get the same plan at every run
+    std::map<std::tuple<VkFormat, uint32_t, uint32_t>, std::vector<uint32_t>> groups;
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        groups[std::make_tuple(textures[i].format, textures[i].width, textures[i].height)].push_back(i);
+    }
+
+    std::vector<uint32_t> atlasCandidates;
+
+    for (const auto& group : groups) {
+        VkFormat format = std::get<0>(group.first);
+        uint32_t width = std::get<1>(group.first);
+        uint32_t height = std::get<2>(group.first);
+        const std::vector<uint32_t>& indices = group.second;
+
+        bool fitsAtlas = alignUp(width + 2 * options.gutter, alignment) <= options.atlasSize
+            && alignUp(height + 2 * options.gutter, alignment) <= options.atlasSize;
+
+        if (indices.size() < options.minArrayLayers && fitsAtlas) {
+            atlasCandidates.insert(atlasCandidates.end(), indices.begin(), indices.end());
+            continue;
+        }
+
+        // shared size (or too big for an atlas): array pages, split at maxArrayLayers
+        for (size_t first = 0; first < indices.size(); first += options.maxArrayLayers) {
+            Page page{};
+            page.kind = Page::Array;
+            page.width = width;
+            page.height = height;
+            page.format = format;
+            page.mipLevels = getMipLevels(width, height);
+            size_t last = std::min(indices.size(), first + options.maxArrayLayers);
+            for (size_t i = first; i < last; i++) {
+                TextureLocation& location = plan.locations[indices[i]];
+                location.uvOffset = glm::vec2(0.0f);
+                location.uvScale = glm::vec2(1.0f);
+                location.page = static_cast<uint32_t>(plan.pages.size());
+                location.layer = static_cast<uint32_t>(page.textures.size());
+                page.textures.push_back(indices[i]);
+            }
+            page.layerCount = static_cast<uint32_t>(page.textures.size());
+            plan.pages.push_back(page);
+        }
+    }
+
+    // tallest first packs better with a skyline
+    std::stable_sort(atlasCandidates.begin(), atlasCandidates.end(), [&textures](uint32_t a, uint32_t b) {
+        return textures[a].height > textures[b].height;
+    });
+
+    // page index in plan.pages, and its packer
+    std::vector<std::pair<size_t, SkylinePacker>> atlases;
+
+    for (uint32_t index : atlasCandidates) {
+        const TextureDesc& texture = textures[index];
+        uint32_t cellWidth = alignUp(texture.width + 2 * options.gutter, alignment);
+        uint32_t cellHeight = alignUp(texture.height + 2 * options.gutter, alignment);
+
+        uint32_t x = 0;
+        uint32_t y = 0;
+        size_t pageIndex = plan.pages.size();
+        for (auto& atlas : atlases) {
+            if (plan.pages[atlas.first].format == texture.format && atlas.second.insert(cellWidth, cellHeight, x, y)) {
+                pageIndex = atlas.first;
+                break;
+            }
+        }
+
+        if (pageIndex == plan.pages.size()) {
+            Page page{};
+            page.kind = Page::Atlas;
+            page.width = options.atlasSize;
+            page.height = options.atlasSize;
+            page.format = texture.format;
+            page.layerCount = 1;
+            page.gutter = options.gutter;
+            page.mipLevels = std::min(std::max(options.atlasMipLevels, 1u), getMipLevels(options.atlasSize, options.atlasSize));
+            plan.pages.push_back(page);
+
+            atlases.emplace_back(pageIndex, SkylinePacker(options.atlasSize, options.atlasSize));
+            atlases.back().second.insert(cellWidth, cellHeight, x, y);
+        }
+
+        Page& page = plan.pages[pageIndex];
+        Rect rect{x + options.gutter, y + options.gutter, texture.width, texture.height};
+        page.textures.push_back(index);
+        page.rects.push_back(rect);
+
+        TextureLocation& location = plan.locations[index];
+        location.uvOffset = glm::vec2(rect.x / static_cast<float>(page.width), rect.y / static_cast<float>(page.height));
+        location.uvScale = glm::vec2(rect.width / static_cast<float>(page.width), rect.height / static_cast<float>(page.height));
+        location.page = static_cast<uint32_t>(pageIndex);
+        location.layer = 0;
+    }
+
+    return plan;
+}
+
+/**
+ * copy a texture in the atlas and replicate its border texels in the gutter
+ * like VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE would
+ */
+static void writeWithGutter(unsigned char* atlas, uint32_t atlasWidth, const Rect& rect, uint32_t gutter, const unsigned char* pixels) {
+    size_t rowSize = static_cast<size_t>(rect.width) * TEXEL_SIZE;
+
+    for (int64_t row = -static_cast<int64_t>(gutter); row < static_cast<int64_t>(rect.height + gutter); row++) {
+        int64_t srcRow = std::min(std::max<int64_t>(row, 0), static_cast<int64_t>(rect.height) - 1);
+        const unsigned char* src = pixels + srcRow * rowSize;
+        unsigned char* dst = atlas + ((rect.y + row) * atlasWidth + rect.x) * TEXEL_SIZE;
+
+        const unsigned char* firstTexel = src;
+        const unsigned char* lastTexel = src + rowSize - TEXEL_SIZE;
+        for (uint32_t g = 1; g <= gutter; g++) {
+            memcpy(dst - g * TEXEL_SIZE, firstTexel, TEXEL_SIZE);
+            memcpy(dst + rowSize + (g - 1) * TEXEL_SIZE, lastTexel, TEXEL_SIZE);
+        }
+        memcpy(dst, src, rowSize);
+    }
+}
+
+static void createArrayImage(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    const Page& page,
+    PackedImage& packedImage
+) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = page.width;
+    imageInfo.extent.height = page.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = page.mipLevels;
+    imageInfo.arrayLayers = page.layerCount;
+    imageInfo.format = page.format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // SRC bit for the mipmaps generation
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.flags = 0;
+
+    if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &packedImage.image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, packedImage.image, &memRequirements);
+
+    memory::allocateMemory(physicalDevice, logicalDevice, memRequirements, memory::GpuOnly, packedImage.memory);
+
+    vkBindImageMemory(logicalDevice, packedImage.image, packedImage.memory, 0);
+    packedImage.memorySize = memRequirements.size;
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = packedImage.image;
+    // always an array view, even for atlases, so the shaders only deal with sampler2DArray
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = page.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = page.mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = page.layerCount;
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &packedImage.view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image view!");
+    }
+}
+
+void uploadPlan(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const std::vector<TextureDesc>& textures,
+    const PackPlan& plan,
+    std::vector<PackedImage>& images
+) {
+    images.resize(plan.pages.size());
+
+    for (size_t p = 0; p < plan.pages.size(); p++) {
+        const Page& page = plan.pages[p];
+        VkDeviceSize layerSize = static_cast<VkDeviceSize>(page.width) * page.height * TEXEL_SIZE;
+        VkDeviceSize stagingSize = layerSize * page.layerCount;
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        buffer2::bindBuffer(
+            physicalDevice,
+            logicalDevice,
+            stagingSize,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            memory::Upload,
+            stagingBuffer,
+            stagingBufferMemory
+        );
+
+        void* data;
+        vkMapMemory(logicalDevice, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+        auto staging = static_cast<unsigned char*>(data);
+
+        if (page.kind == Page::Array) {
+            for (uint32_t layer = 0; layer < page.layerCount; layer++) {
+                memcpy(staging + layer * layerSize, textures[page.textures[layer]].pixels, static_cast<size_t>(layerSize));
+            }
+        } else {
+            // the unused space is sampled by the lowest mips, keep it deterministic
+            memset(staging, 0, static_cast<size_t>(stagingSize));
+            for (size_t i = 0; i < page.textures.size(); i++) {
+                writeWithGutter(staging, page.width, page.rects[i], page.gutter, textures[page.textures[i]].pixels);
+            }
+        }
+
+        mapped::flush(logicalDevice, stagingBufferMemory, 0, stagingSize);
+        vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+        createArrayImage(physicalDevice, logicalDevice, page, images[p]);
+
+        VkCommandBuffer commandBuffer = commandbuffer::beginSingleTimeCommands(logicalDevice, commandPool);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = images[p].image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = page.mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = page.layerCount;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
+
+        // one region by layer, all recorded in the same command buffer
+        std::vector<VkBufferImageCopy> regions(page.layerCount);
+        for (uint32_t layer = 0; layer < page.layerCount; layer++) {
+            VkBufferImageCopy& region = regions[layer];
+            region.bufferOffset = layer * layerSize;
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = layer;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {page.width, page.height, 1};
+        }
+
+        vkCmdCopyBufferToImage(
+            commandBuffer,
+            stagingBuffer,
+            images[p].image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()),
+            regions.data()
+        );
+
+        commandbuffer::endAndExecuteSingleTimeCommands(logicalDevice, commandPool, graphicsQueue, commandBuffer);
+
+        texture3::generateMipmaps(
+            physicalDevice,
+            logicalDevice,
+            commandPool,
+            graphicsQueue,
+            images[p].image,
+            page.format,
+            static_cast<int32_t>(page.width),
+            static_cast<int32_t>(page.height),
+            page.mipLevels,
+            page.layerCount
+        );
+
+        vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
+        memory::freeMemory(logicalDevice, stagingBufferMemory);
+    }
+}
+
+void destroyImages(VkDevice logicalDevice, std::vector<PackedImage>& images) {
+    for (const auto& packedImage : images) {
+        vkDestroyImageView(logicalDevice, packedImage.view, nullptr);
+        vkDestroyImage(logicalDevice, packedImage.image, nullptr);
+        memory::freeMemory(logicalDevice, packedImage.memory);
+    }
+
+    images.clear();
+}
+
+void printStats(const std::vector<TextureDesc>& textures, const std::vector<PackedImage>& images) {
+    // a full mip chain adds a third of the base level
+    VkDeviceSize bytesBefore = 0;
+    for (const auto& texture : textures) {
+        bytesBefore += static_cast<VkDeviceSize>(texture.width) * texture.height * TEXEL_SIZE * 4 / 3;
+    }
+
+    VkDeviceSize bytesAfter = 0;
+    for (const auto& packedImage : images) {
+        bytesAfter += packedImage.memorySize;
+    }
+
+    std::cout << "texture packing:\n";
+    std::cout << "\tone image by texture: " << textures.size() << " allocations, ~" << bytesBefore / 1024 << " KiB\n";
+    std::cout << "\tpacked: " << images.size() << " allocations, " << bytesAfter / 1024 << " KiB\n";
+}
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+#include "glm/glm.hpp"
+
+namespace texturepack {
+
+/**
+ * A decoded texture waiting to be packed.
+ * pixels are tightly packed 4 bytes texels (what stbi_load gives with STBI_rgb_alpha)
+ * and must stay alive until uploadPlan returns
+ */
+struct TextureDesc {
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    const unsigned char* pixels;
+};
+
+/**
+ * Where a texture ended up, to hand to the shaders (e.g. in a storage buffer).
+ * The texel is sampled from page at (layer, uvOffset + uv * uvScale)
+ * 24 bytes with std430 layout rules, no padding needed
+ */
+struct TextureLocation {
+    glm::vec2 uvOffset;
+    glm::vec2 uvScale;
+    uint32_t page;
+    uint32_t layer;
+};
+
+struct Rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+/**
+ * One VkImage of the plan:
+ * * Array: same format, same size textures, one per layer
+ * * Atlas: odd sized textures packed together on a single layer
+ */
+struct Page {
+    enum Kind {
+        Array,
+        Atlas
+    };
+
+    Kind kind;
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    uint32_t layerCount;
+    uint32_t mipLevels;
+    /** atlases only, texels replicated around each rect */
+    uint32_t gutter;
+    /** indices in the TextureDesc list, in layer order for arrays */
+    std::vector<uint32_t> textures;
+    /** for atlases, the rectangle (gutter excluded) of each texture */
+    std::vector<Rect> rects;
+};
+
+struct PackOptions {
+    uint32_t atlasSize = 2048;
+    /**
+     * texels replicated around each texture in an atlas, so that bilinear
+     * filtering does not fetch the neighbour
+     */
+    uint32_t gutter = 4;
+    /**
+     * number of mip levels generated for atlases. Rects are aligned on
+     * 1 << (atlasMipLevels - 1) texels so that no texture bleeds into another
+     * one down to the last level
+     */
+    uint32_t atlasMipLevels = 4;
+    /** a size shared by less textures than this goes to an atlas instead of an array */
+    uint32_t minArrayLayers = 2;
+    /** must not exceed the maxImageArrayLayers device limit */
+    uint32_t maxArrayLayers = 256;
+};
+
+struct PackPlan {
+    std::vector<Page> pages;
+    /** same order as the TextureDesc list */
+    std::vector<TextureLocation> locations;
+};
+
+/**
+ * Bottom-left skyline packer: the packed area is described by its top outline
+ * a new rectangle goes where it leaves the lowest top edge
+ * Fast and dense enough for textures, which are rarely very thin
+ */
+class SkylinePacker {
+public:
+    SkylinePacker(uint32_t width, uint32_t height);
+    /** returns false if the rectangle does not fit anymore */
+    bool insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+
+private:
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    uint32_t width_;
+    uint32_t height_;
+    std::vector<Segment> skyline_;
+
+    /** returns false if it does not fit at segment index, else y is the top of the rect */
+    bool fits(size_t index, uint32_t width, uint32_t height, uint32_t& y) const;
+    void addLevel(size_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+};
+
+/** CPU only, decides which texture goes where */
+PackPlan buildPlan(const std::vector<TextureDesc>& textures, const PackOptions& options);
+
+struct PackedImage {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkDeviceSize memorySize;
+};
+
+/**
+ * one image, one allocation, one view (2D array) by page
+ * the layers/atlases are filled from a single staging buffer by page
+ */
+void uploadPlan(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkCommandPool commandPool,
+    VkQueue graphicsQueue,
+    const std::vector<TextureDesc>& textures,
+    const PackPlan& plan,
+    std::vector<PackedImage>& images
+);
+
+void destroyImages(VkDevice logicalDevice, std::vector<PackedImage>& images);
+
+/**
+ * prints the allocation count and memory used with one image by texture
+ * (estimated, full mip chain) against the packed images
+ */
+void printStats(const std::vector<TextureDesc>& textures, const std::vector<PackedImage>& images);
+
+}
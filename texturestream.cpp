@@ -0,0 +1,565 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "texturestream.hpp"
+#include "texture3.hpp"
+#include "image2.hpp"
+
+namespace texturestream {
+
+// only 4 bytes texels, like the rest of the texture code
+const uint32_t TEXEL_SIZE = 4;
+// uploads in flight at the same time
+const size_t UPLOAD_COUNT = 4;
+// VK_EXT_memory_budget values change with the other processes, they are read again this often
+const uint64_t BUDGET_REFRESH_FRAMES = 64;
+
+static uint32_t getMipLevels(uint32_t width, uint32_t height) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+static uint32_t getLevelExtent(uint32_t extent, uint32_t level) {
+    return std::max(extent >> level, 1u);
+}
+
+/** 2x2 box filter, the last row/column is reused for odd sizes */
+static void downsample(const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight, unsigned char* dst) {
+    uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+    uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+
+    for (uint32_t y = 0; y < dstHeight; y++) {
+        uint32_t y0 = std::min(2 * y, srcHeight - 1);
+        uint32_t y1 = std::min(2 * y + 1, srcHeight - 1);
+        for (uint32_t x = 0; x < dstWidth; x++) {
+            uint32_t x0 = std::min(2 * x, srcWidth - 1);
+            uint32_t x1 = std::min(2 * x + 1, srcWidth - 1);
+            for (uint32_t c = 0; c < TEXEL_SIZE; c++) {
+                uint32_t sum = src[(y0 * srcWidth + x0) * TEXEL_SIZE + c]
+                    + src[(y0 * srcWidth + x1) * TEXEL_SIZE + c]
+                    + src[(y1 * srcWidth + x0) * TEXEL_SIZE + c]
+                    + src[(y1 * srcWidth + x1) * TEXEL_SIZE + c];
+                dst[(y * dstWidth + x) * TEXEL_SIZE + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+uint32_t getWantedLevel(uint32_t width, uint32_t height, float projectedSize) {
+    uint32_t mipLevels = getMipLevels(width, height);
+    if (projectedSize < 1.0f) {
+        return mipLevels - 1;
+    }
+
+    float ratio = std::max(width, height) / projectedSize;
+    if (ratio <= 1.0f) {
+        return 0;
+    }
+
+    // rounded down: rather a bit more texels than pixels
+    return std::min(static_cast<uint32_t>(std::floor(std::log2(ratio))), mipLevels - 1);
+}
+
+void TextureStreamer::init(
+    VkPhysicalDevice physicalDevice,
+    VkDevice logicalDevice,
+    VkQueue queue,
+    uint32_t queueFamilyIndex,
+    const StreamOptions& options
+) {
+    physicalDevice_ = physicalDevice;
+    logicalDevice_ = logicalDevice;
+    queue_ = queue;
+    options_ = options;
+
+    budget_ = queryBudget();
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    // each upload resets and records its own command buffer again
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    if (vkCreateCommandPool(logicalDevice_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    uploads_.resize(UPLOAD_COUNT);
+    for (auto& upload : uploads_) {
+        createUpload(upload);
+    }
+    createUpload(tailUpload_);
+}
+
+void TextureStreamer::createUpload(Upload& upload) {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool_;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(logicalDevice_, &allocInfo, &upload.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers!");
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateFence(logicalDevice_, &fenceInfo, nullptr, &upload.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create fence!");
+    }
+}
+
+void TextureStreamer::destroyUpload(Upload& upload) {
+    if (upload.busy) {
+        vkWaitForFences(logicalDevice_, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+    }
+    destroyResidency(upload.residency);
+    buffer2::destroyStagingBuffer(logicalDevice_, upload.staging);
+    vkDestroyFence(logicalDevice_, upload.fence, nullptr);
+    upload = Upload{};
+}
+
+VkDeviceSize TextureStreamer::queryBudget() const {
+    if (options_.budget != 0) {
+        return options_.budget;
+    }
+
+    // the biggest device local heap is where the textures end up
+    VkDeviceSize heapBudget = 0;
+    VkDeviceSize heapSize = 0;
+    for (const auto& heap : memory::getHeapStats()) {
+        if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > heapSize) {
+            heapSize = heap.size;
+            heapBudget = heap.budget;
+        }
+    }
+
+    return static_cast<VkDeviceSize>(heapBudget * options_.budgetFraction);
+}
+
+VkDeviceSize TextureStreamer::getLevelsSize(const Texture& texture, uint32_t level) const {
+    VkDeviceSize size = 0;
+    for (uint32_t l = level; l < texture.mipLevels; l++) {
+        size += texture.levels[l].size();
+    }
+    return size;
+}
+
+void TextureStreamer::createResidency(const Texture& texture, uint32_t level, Residency& residency) {
+    uint32_t levelCount = texture.mipLevels - level;
+
+    texture3::bindImageMemory(
+        physicalDevice_,
+        logicalDevice_,
+        getLevelExtent(texture.width, level),
+        getLevelExtent(texture.height, level),
+        levelCount,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_FORMAT_R8G8B8A8_SRGB,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        memory::GpuOnly,
+        residency.image,
+        residency.memory
+    );
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice_, residency.image, &memRequirements);
+    residency.memorySize = memRequirements.size;
+    residency.level = level;
+    residency.view = image2::createImageView(logicalDevice_, residency.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+
+    usedBytes_ += residency.memorySize;
+}
+
+void TextureStreamer::destroyResidency(Residency& residency) {
+    if (residency.image == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkDestroyImageView(logicalDevice_, residency.view, nullptr);
+    vkDestroyImage(logicalDevice_, residency.image, nullptr);
+    memory::freeMemory(logicalDevice_, residency.memory);
+    residency = Residency{};
+}
+
+VkDeviceSize TextureStreamer::recordUpload(Upload& upload, const Texture& texture, uint32_t level) {
+    VkDeviceSize size = getLevelsSize(texture, level);
+    uint32_t levelCount = texture.mipLevels - level;
+
+    // the fence of the previous upload has been waited, the staging memory is free again
+    buffer2::reserveStagingBuffer(physicalDevice_, logicalDevice_, size, upload.staging);
+
+    std::vector<VkBufferImageCopy> regions(levelCount);
+    VkDeviceSize offset = 0;
+    for (uint32_t l = level; l < texture.mipLevels; l++) {
+        const auto& pixels = texture.levels[l];
+        memcpy(static_cast<unsigned char*>(upload.staging.mapped) + offset, pixels.data(), pixels.size());
+
+        VkBufferImageCopy& region = regions[l - level];
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = l - level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {getLevelExtent(texture.width, l), getLevelExtent(texture.height, l), 1};
+
+        offset += pixels.size();
+    }
+    mapped::flush(logicalDevice_, upload.staging.memory, 0, size);
+
+    vkResetCommandBuffer(upload.commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(upload.commandBuffer, &beginInfo);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload.residency.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(upload.commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    // all the levels come from the CPU chain, no blit: the GPU never reads the image being replaced
+    vkCmdCopyBufferToImage(
+        upload.commandBuffer,
+        upload.staging.buffer,
+        upload.residency.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.data()
+    );
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(upload.commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+    vkEndCommandBuffer(upload.commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &upload.commandBuffer;
+
+    if (vkQueueSubmit(queue_, 1, &submitInfo, upload.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit texture upload!");
+    }
+
+    return size;
+}
+
+uint32_t TextureStreamer::addTexture(const unsigned char* pixels, uint32_t width, uint32_t height) {
+    Texture texture{};
+    texture.width = width;
+    texture.height = height;
+    texture.mipLevels = getMipLevels(width, height);
+    texture.wantedLevel = texture.mipLevels;
+
+    texture.levels.resize(texture.mipLevels);
+    texture.levels[0].assign(pixels, pixels + static_cast<size_t>(width) * height * TEXEL_SIZE);
+    for (uint32_t l = 1; l < texture.mipLevels; l++) {
+        texture.levels[l].resize(static_cast<size_t>(getLevelExtent(width, l)) * getLevelExtent(height, l) * TEXEL_SIZE);
+        downsample(texture.levels[l - 1].data(), getLevelExtent(width, l - 1), getLevelExtent(height, l - 1), texture.levels[l].data());
+    }
+
+    texture.tailLevel = 0;
+    while (texture.tailLevel + 1 < texture.mipLevels
+        && std::max(getLevelExtent(width, texture.tailLevel), getLevelExtent(height, texture.tailLevel)) > options_.tailSize) {
+        texture.tailLevel++;
+    }
+
+    // the tail upload is small, waiting for it keeps addTexture simple
+    createResidency(texture, texture.tailLevel, tailUpload_.residency);
+    uploadedBytes_ += recordUpload(tailUpload_, texture, texture.tailLevel);
+    vkWaitForFences(logicalDevice_, 1, &tailUpload_.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(logicalDevice_, 1, &tailUpload_.fence);
+
+    texture.tail = tailUpload_.residency;
+    tailUpload_.residency = Residency{};
+
+    textures_.push_back(std::move(texture));
+    return static_cast<uint32_t>(textures_.size() - 1);
+}
+
+void TextureStreamer::request(uint32_t texture, float projectedSize) {
+    Texture& streamed = textures_[texture];
+    streamed.wantedLevel = std::min(streamed.wantedLevel, getWantedLevel(streamed.width, streamed.height, projectedSize));
+    streamed.lastRequestFrame = frame_;
+
+    uint32_t current = streamed.resident.image != VK_NULL_HANDLE ? streamed.resident.level : streamed.tailLevel;
+    if (streamed.wantedLevel < current && !streamed.waiting) {
+        streamed.waiting = true;
+        streamed.waitStart = std::chrono::steady_clock::now();
+    }
+}
+
+TextureStreamer::Upload* TextureStreamer::getFreeUpload() {
+    for (auto& upload : uploads_) {
+        if (!upload.busy) {
+            return &upload;
+        }
+    }
+    return nullptr;
+}
+
+void TextureStreamer::startUpload(Upload& upload, uint32_t textureIndex, uint32_t level) {
+    Texture& texture = textures_[textureIndex];
+
+    createResidency(texture, level, upload.residency);
+    uploadedBytes_ += recordUpload(upload, texture, level);
+    uploadCount_++;
+
+    upload.busy = true;
+    upload.texture = textureIndex;
+    texture.uploading = true;
+}
+
+bool TextureStreamer::isEvictable(const Texture& texture) const {
+    // textures requested this frame are kept, they are on screen
+    return !texture.uploading && texture.resident.image != VK_NULL_HANDLE && texture.lastRequestFrame < frame_;
+}
+
+VkDeviceSize TextureStreamer::getEvictableBytes(uint32_t keep) const {
+    VkDeviceSize bytes = 0;
+    for (uint32_t i = 0; i < textures_.size(); i++) {
+        if (i != keep && isEvictable(textures_[i])) {
+            bytes += textures_[i].resident.memorySize;
+        }
+    }
+    return bytes;
+}
+
+bool TextureStreamer::evictLeastRecentlyUsed(uint32_t keep) {
+    uint32_t victim = std::numeric_limits<uint32_t>::max();
+    uint64_t oldestFrame = frame_;
+
+    for (uint32_t i = 0; i < textures_.size(); i++) {
+        const Texture& texture = textures_[i];
+        if (i == keep || !isEvictable(texture)) {
+            continue;
+        }
+        if (texture.lastRequestFrame < oldestFrame) {
+            oldestFrame = texture.lastRequestFrame;
+            victim = i;
+        }
+    }
+
+    if (victim == std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    // back to the tail, the image may still be used by the frames in flight
+    Texture& texture = textures_[victim];
+    usedBytes_ -= texture.resident.memorySize;
+    retired_.push_back(Retired{texture.resident, frame_});
+    texture.resident = Residency{};
+    changed_.push_back(victim);
+    evictionCount_++;
+
+    return true;
+}
+
+void TextureStreamer::retireUploads() {
+    for (auto& upload : uploads_) {
+        if (!upload.busy || vkGetFenceStatus(logicalDevice_, upload.fence) != VK_SUCCESS) {
+            continue;
+        }
+
+        vkResetFences(logicalDevice_, 1, &upload.fence);
+        upload.busy = false;
+
+        Texture& texture = textures_[upload.texture];
+        if (texture.resident.image != VK_NULL_HANDLE) {
+            usedBytes_ -= texture.resident.memorySize;
+            retired_.push_back(Retired{texture.resident, frame_});
+        }
+        texture.resident = upload.residency;
+        upload.residency = Residency{};
+        texture.uploading = false;
+        changed_.push_back(upload.texture);
+
+        if (texture.waiting) {
+            double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - texture.waitStart).count();
+            latencySumMs_ += latencyMs;
+            latencyCount_++;
+            maxLatencyMs_ = std::max(maxLatencyMs_, latencyMs);
+            texture.waiting = false;
+        }
+    }
+}
+
+const std::vector<uint32_t>& TextureStreamer::update() {
+    changed_.clear();
+
+    retireUploads();
+
+    // the frames which could sample the retired images are done
+    auto destroyed = std::remove_if(retired_.begin(), retired_.end(), [this](Retired& retired) {
+        if (retired.frame + options_.framesInFlight > frame_) {
+            return false;
+        }
+        destroyResidency(retired.residency);
+        return true;
+    });
+    retired_.erase(destroyed, retired_.end());
+
+    if (memory::isBudgetAvailable() && options_.budget == 0 && frame_ % BUDGET_REFRESH_FRAMES == 0) {
+        budget_ = queryBudget();
+    }
+
+    auto getCurrentLevel = [](const Texture& texture) {
+        return texture.resident.image != VK_NULL_HANDLE ? texture.resident.level : texture.tailLevel;
+    };
+
+    candidates_.clear();
+    for (uint32_t i = 0; i < textures_.size(); i++) {
+        const Texture& texture = textures_[i];
+        if (!texture.uploading && texture.wantedLevel < getCurrentLevel(texture)) {
+            candidates_.push_back(i);
+        }
+    }
+
+    // the most blurry first
+    std::sort(candidates_.begin(), candidates_.end(), [&](uint32_t a, uint32_t b) {
+        return getCurrentLevel(textures_[a]) - textures_[a].wantedLevel > getCurrentLevel(textures_[b]) - textures_[b].wantedLevel;
+    });
+
+    VkDeviceSize frameBytes = 0;
+    for (uint32_t index : candidates_) {
+        Upload* upload = getFreeUpload();
+        if (!upload) {
+            break;
+        }
+
+        const Texture& texture = textures_[index];
+        uint32_t current = getCurrentLevel(texture);
+
+        // a coarser level than wanted if the frame uploads or the budget don't allow it,
+        // the rest comes in the next frames. The level is chosen before evicting anything:
+        // what stays resident whatever we evict must leave room for it
+        VkDeviceSize unevictableBytes = usedBytes_ - getEvictableBytes(index);
+        uint32_t level = texture.wantedLevel;
+        for (; level < current; level++) {
+            VkDeviceSize size = getLevelsSize(texture, level);
+            // at least one upload by frame, whatever its size
+            if (frameBytes > 0 && frameBytes + size > options_.uploadBytesPerFrame) {
+                continue;
+            }
+            if (unevictableBytes + size <= budget_) {
+                break;
+            }
+        }
+
+        if (level >= current) {
+            continue;
+        }
+
+        VkDeviceSize size = getLevelsSize(texture, level);
+        while (usedBytes_ + size > budget_ && evictLeastRecentlyUsed(index)) {
+        }
+
+        frameBytes += size;
+        startUpload(*upload, index, level);
+    }
+
+    // the budget may also have shrunk
+    while (usedBytes_ > budget_ && evictLeastRecentlyUsed(std::numeric_limits<uint32_t>::max())) {
+    }
+
+    for (auto& texture : textures_) {
+        texture.wantedLevel = texture.mipLevels;
+    }
+    frame_++;
+
+    return changed_;
+}
+
+VkImageView TextureStreamer::getView(uint32_t texture) const {
+    const Texture& streamed = textures_[texture];
+    return streamed.resident.image != VK_NULL_HANDLE ? streamed.resident.view : streamed.tail.view;
+}
+
+uint32_t TextureStreamer::getResidentLevel(uint32_t texture) const {
+    const Texture& streamed = textures_[texture];
+    return streamed.resident.image != VK_NULL_HANDLE ? streamed.resident.level : streamed.tailLevel;
+}
+
+StreamStats TextureStreamer::getStats() const {
+    StreamStats stats{};
+    stats.textureCount = static_cast<uint32_t>(textures_.size());
+    stats.budget = budget_;
+
+    for (const auto& texture : textures_) {
+        stats.residentBytes += texture.tail.memorySize + texture.resident.memorySize;
+        stats.fullBytes += getLevelsSize(texture, 0);
+    }
+    for (const auto& upload : uploads_) {
+        stats.pendingBytes += upload.residency.memorySize;
+    }
+    for (const auto& retired : retired_) {
+        stats.pendingBytes += retired.residency.memorySize;
+    }
+
+    stats.uploadedBytes = uploadedBytes_;
+    stats.uploads = uploadCount_;
+    stats.evictions = evictionCount_;
+    stats.averageLatencyMs = latencyCount_ > 0 ? latencySumMs_ / latencyCount_ : 0.0;
+    stats.maxLatencyMs = maxLatencyMs_;
+
+    return stats;
+}
+
+void TextureStreamer::destroy() {
+    for (auto& upload : uploads_) {
+        destroyUpload(upload);
+    }
+    uploads_.clear();
+    destroyUpload(tailUpload_);
+
+    for (auto& retired : retired_) {
+        destroyResidency(retired.residency);
+    }
+    retired_.clear();
+
+    for (auto& texture : textures_) {
+        destroyResidency(texture.resident);
+        destroyResidency(texture.tail);
+    }
+    textures_.clear();
+    usedBytes_ = 0;
+
+    // frees the command buffers too
+    vkDestroyCommandPool(logicalDevice_, commandPool_, nullptr);
+    commandPool_ = VK_NULL_HANDLE;
+}
+
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Let GLFW include by itslef vulkan headers
+#define GLFW_INCLUDE_VULKAN
+#include "GLFW/glfw3.h"
+
+#include "buffer2.hpp"
+
+namespace texturestream {
+
+struct StreamOptions {
+    /**
+     * bytes of VRAM the streamed textures may use
+     * 0: budgetFraction of the device local heap budget (see memory::HeapStats)
+     */
+    VkDeviceSize budget = 0;
+    float budgetFraction = 0.5f;
+    /**
+     * the levels up to this size (the "mip tail") are uploaded by addTexture and never evicted,
+     * there is always something to sample
+     */
+    uint32_t tailSize = 64;
+    /** upper bound of the bytes copied to the GPU by update, spreads the big uploads over several frames */
+    VkDeviceSize uploadBytesPerFrame = 32 * 1024 * 1024;
+    /** an image replaced by an other residency is destroyed this many updates later */
+    uint32_t framesInFlight = 2;
+};
+
+struct StreamStats {
+    uint32_t textureCount = 0;
+    VkDeviceSize budget = 0;
+    VkDeviceSize residentBytes = 0;
+    /** memory of the images being uploaded or waiting for destruction */
+    VkDeviceSize pendingBytes = 0;
+    /** what the textures would use with their full mip chain resident */
+    VkDeviceSize fullBytes = 0;
+    uint64_t uploadedBytes = 0;
+    uint32_t uploads = 0;
+    uint32_t evictions = 0;
+    /** from the first request needing a finer level to the level being sampled */
+    double averageLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
+/**
+ * Which first mip level gives about one texel per pixel for a texture of size width x height
+ * covering projectedSize pixels on screen (along its largest dimension)
+ */
+uint32_t getWantedLevel(uint32_t width, uint32_t height, float projectedSize);
+
+/**
+ * Textures whose mip levels are resident on demand.
+ *
+ * Each texture keeps its full mip chain in host memory (our "disk") and only the levels
+ * [residentLevel, mipLevels) on the GPU, in an image sized for residentLevel. Going to an other
+ * residency builds a new image in the background (own command pool, fence polled by update),
+ * the view is swapped once the copy completed. Until then the shaders sample the old view, which is
+ * how the sampled LOD is clamped to the resident levels: Vulkan 1.0 has no minLod on image views
+ * (VK_EXT_image_view_min_lod) and allocating the whole chain would defeat the budget.
+ *
+ * Under budget pressure the least recently requested textures go back to their mip tail.
+ *
+ * Usage, once a frame: request() every visible texture, then update(), then rewrite the
+ * descriptors of the textures update() reports as changed
+ */
+class TextureStreamer {
+public:
+    /**
+     * queue is used for the uploads, queueFamilyIndex must be its family
+     * memory::init must have been called for the budget to come from VK_EXT_memory_budget
+     */
+    void init(
+        VkPhysicalDevice physicalDevice,
+        VkDevice logicalDevice,
+        VkQueue queue,
+        uint32_t queueFamilyIndex,
+        const StreamOptions& options
+    );
+
+    /**
+     * pixels: width * height * 4 bytes, copied. The mip chain is built on the CPU and
+     * the tail uploaded right away (blocking). Returns the texture id
+     */
+    uint32_t addTexture(const unsigned char* pixels, uint32_t width, uint32_t height);
+
+    /** the texture covers projectedSize pixels on screen this frame, can be called several times */
+    void request(uint32_t texture, float projectedSize);
+
+    /**
+     * Retire the finished uploads, evict over budget and start the new uploads.
+     * Returns the textures whose view changed, valid until the next call
+     */
+    const std::vector<uint32_t>& update();
+
+    VkImageView getView(uint32_t texture) const;
+    /** first level of the full chain currently sampled, i.e. the minLod the view is clamped to */
+    uint32_t getResidentLevel(uint32_t texture) const;
+    StreamStats getStats() const;
+
+    /** waits for the uploads in flight */
+    void destroy();
+
+private:
+    struct Residency {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkDeviceSize memorySize = 0;
+        uint32_t level = 0;
+    };
+
+    struct Texture {
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        uint32_t tailLevel;
+        /** the full chain, level 0 first, 4 bytes texels */
+        std::vector<std::vector<unsigned char>> levels;
+        /** [tailLevel, mipLevels), always resident */
+        Residency tail;
+        /** finer levels, image is VK_NULL_HANDLE when only the tail is resident */
+        Residency resident;
+        /** finest level requested this frame, mipLevels if none */
+        uint32_t wantedLevel;
+        uint64_t lastRequestFrame = 0;
+        bool uploading = false;
+        /** when a finer level than the resident one was first wanted */
+        bool waiting = false;
+        std::chrono::steady_clock::time_point waitStart;
+    };
+
+    struct Upload {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        buffer2::StagingBuffer staging;
+        bool busy = false;
+        uint32_t texture = 0;
+        Residency residency;
+    };
+
+    struct Retired {
+        Residency residency;
+        uint64_t frame;
+    };
+
+    VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
+    VkDevice logicalDevice_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    VkCommandPool commandPool_ = VK_NULL_HANDLE;
+    StreamOptions options_;
+    VkDeviceSize budget_ = 0;
+    uint64_t frame_ = 1;
+    /** tails, resident and uploading images. The retired ones are counted as free already */
+    VkDeviceSize usedBytes_ = 0;
+
+    std::vector<Texture> textures_;
+    std::vector<Upload> uploads_;
+    /** used by addTexture only, so that it never touches the streaming uploads */
+    Upload tailUpload_;
+    std::vector<Retired> retired_;
+    std::vector<uint32_t> changed_;
+    std::vector<uint32_t> candidates_;
+
+    uint64_t uploadedBytes_ = 0;
+    uint32_t uploadCount_ = 0;
+    uint32_t evictionCount_ = 0;
+    double latencySumMs_ = 0.0;
+    uint32_t latencyCount_ = 0;
+    double maxLatencyMs_ = 0.0;
+
+    VkDeviceSize queryBudget() const;
+    VkDeviceSize getLevelsSize(const Texture& texture, uint32_t level) const;
+    void createResidency(const Texture& texture, uint32_t level, Residency& residency);
+    void destroyResidency(Residency& residency);
+    /** records the copy of the levels [level, mipLevels) in upload.commandBuffer, returns the bytes copied */
+    VkDeviceSize recordUpload(Upload& upload, const Texture& texture, uint32_t level);
+    void createUpload(Upload& upload);
+    void destroyUpload(Upload& upload);
+    Upload* getFreeUpload();
+    void startUpload(Upload& upload, uint32_t textureIndex, uint32_t level);
+    /** resident, not being replaced and not requested this frame */
+    bool isEvictable(const Texture& texture) const;
+    /** the bytes evictLeastRecentlyUsed(keep) could free, repeated until it returns false */
+    VkDeviceSize getEvictableBytes(uint32_t keep) const;
+    bool evictLeastRecentlyUsed(uint32_t keep);
+    void retireUploads();
+};
+
+}